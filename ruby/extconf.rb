@@ -50,5 +50,8 @@ EOF
 end
 
 
+# Ruby 1.9.3 and later wait for fds with rb_thread_fd_select().
+have_func "rb_thread_fd_select"
+
 create_makefile "trema", "trema"
 
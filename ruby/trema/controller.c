@@ -29,6 +29,11 @@
 VALUE mTrema;
 VALUE cController;
 
+static ID id_match;
+static ID id_buffer_id;
+static ID id_actions;
+static ID id_port;
+
 
 static VALUE
 controller_send_message( VALUE self, VALUE message, VALUE datapath_id ) {
@@ -77,7 +82,7 @@ controller_send_flow_mod_add( int argc, VALUE *argv, VALUE self ) {
 
   rb_scan_args( argc, argv, "11", &datapath_id, &options );
 
-  struct ofp_match *match = malloc( sizeof( struct ofp_match ) );
+  struct ofp_match match;
   uint32_t buffer_id;
   openflow_actions *actions = create_actions();
 
@@ -86,17 +91,19 @@ controller_send_flow_mod_add( int argc, VALUE *argv, VALUE self ) {
   VALUE raction = Qnil;
 
   if ( options != Qnil ) {
-    rmatch = rb_hash_aref( options, ID2SYM( rb_intern( "match" ) ) );
-    rbuffer_id = rb_hash_aref( options, ID2SYM( rb_intern( "buffer_id" ) ) );
-    raction = rb_hash_aref( options, ID2SYM( rb_intern( "actions" ) ) );
+    rmatch = rb_hash_aref( options, ID2SYM( id_match ) );
+    rbuffer_id = rb_hash_aref( options, ID2SYM( id_buffer_id ) );
+    raction = rb_hash_aref( options, ID2SYM( id_actions ) );
   }
 
   if ( rmatch != Qnil ) {
-    Data_Get_Struct( rmatch, struct ofp_match, match );
+    struct ofp_match *cmatch;
+    Data_Get_Struct( rmatch, struct ofp_match, cmatch );
+    match = *cmatch;
   }
   else {
-    memset( match, 0, sizeof( struct ofp_match ) );
-    match->wildcards = OFPFW_ALL;
+    memset( &match, 0, sizeof( struct ofp_match ) );
+    match.wildcards = OFPFW_ALL;
   }
 
   if ( rbuffer_id == Qnil ) {
@@ -107,12 +114,12 @@ controller_send_flow_mod_add( int argc, VALUE *argv, VALUE self ) {
   }
 
   if ( raction != Qnil ) {
-    append_action_output( actions, rb_funcall( raction, rb_intern( "port" ), 0 ), UINT16_MAX );
+    append_action_output( actions, rb_funcall( raction, id_port, 0 ), UINT16_MAX );
   }
 
   buffer *flow_mod = create_flow_mod(
     get_transaction_id(),
-    *match,
+    match,
     get_cookie(),
     OFPFC_ADD,
     60,
@@ -132,13 +139,30 @@ controller_send_flow_mod_add( int argc, VALUE *argv, VALUE self ) {
 }
 
 
+/*
+ * call-seq:
+ *   send_packet_out(datapath_id, buffer_id, in_port, action, data)
+ *
+ * Sends a packet_out message. <code>data</code> is the packet data as
+ * a String (e.g. PacketIn#data) or a Buffer, or nil for a buffered
+ * packet.
+ */
 static VALUE
 controller_send_packet_out( VALUE self, VALUE datapath_id, VALUE buffer_id, VALUE in_port, VALUE action, VALUE data ) {
   openflow_actions *actions = create_actions();
-  append_action_output( actions, rb_funcall( action, rb_intern( "port" ), 0 ), UINT16_MAX );
-
-  buffer *cbuffer;
-  Data_Get_Struct( data, buffer, cbuffer );
+  append_action_output( actions, rb_funcall( action, id_port, 0 ), UINT16_MAX );
+
+  buffer *cbuffer = NULL;
+  buffer *wrapped = NULL;
+  if ( TYPE( data ) == T_STRING ) {
+    if ( RSTRING_LEN( data ) > 0 ) {
+      // create_packet_out() copies the data, so no copy is made here.
+      cbuffer = wrapped = wrap_buffer( RSTRING_PTR( data ), ( size_t ) RSTRING_LEN( data ) );
+    }
+  }
+  else if ( data != Qnil ) {
+    Data_Get_Struct( data, buffer, cbuffer );
+  }
 
   buffer *packet_out = create_packet_out(
     get_transaction_id(),
@@ -149,9 +173,12 @@ controller_send_packet_out( VALUE self, VALUE datapath_id, VALUE buffer_id, VALU
   );
   send_openflow_message( NUM2ULL( datapath_id ), packet_out );
   free_buffer( packet_out );
+  if ( wrapped != NULL ) {
+    free_buffer( wrapped );
+  }
 
   delete_actions( actions );
-  
+
   return self;
 }
 
@@ -198,20 +225,40 @@ controller_shutdown( VALUE self ) {
 }
 
 
+/*
+ * Waits for events of the event handler through Ruby, so that other Ruby
+ * threads run ( and the GVL is released ) while this controller is idle.
+ * Handlers are called back on the Ruby thread once this returns.
+ */
 static void
-thread_pass( void *user_data ) {
-  rb_funcall( rb_cThread, rb_intern( "pass" ), 0 );
+wait_for_events( int fd, int timeout_msec ) {
+  struct timeval timeout;
+  struct timeval *tv = NULL;
+
+  if ( timeout_msec >= 0 ) {
+    timeout.tv_sec = timeout_msec / 1000;
+    timeout.tv_usec = ( timeout_msec % 1000 ) * 1000;
+    tv = &timeout;
+  }
+
+#ifdef HAVE_RB_THREAD_FD_SELECT
+  rb_fdset_t fds;
+  rb_fd_init( &fds );
+  rb_fd_set( fd, &fds );
+  rb_thread_fd_select( fd + 1, &fds, NULL, NULL, tv );
+  rb_fd_term( &fds );
+#else
+  fd_set fds;
+  FD_ZERO( &fds );
+  FD_SET( fd, &fds );
+  rb_thread_select( fd + 1, &fds, NULL, NULL, tv );
+#endif
 }
 
 
 static VALUE
 controller_start_trema( VALUE self ) {
-  struct itimerspec interval;
-  interval.it_interval.tv_sec = 0;
-  interval.it_interval.tv_nsec = 1000000;
-  interval.it_value.tv_sec = 0;
-  interval.it_value.tv_nsec = 0;
-  add_timer_event_callback( &interval, thread_pass, NULL );
+  set_event_wait_function( wait_for_events );
 
   start_trema();
 
@@ -420,6 +467,11 @@ Init_controller() {
 
   // Private
   rb_define_private_method( cController, "start_trema", controller_start_trema, 0 );
+
+  id_match = rb_intern( "match" );
+  id_buffer_id = rb_intern( "buffer_id" );
+  id_actions = rb_intern( "actions" );
+  id_port = rb_intern( "port" );
 }
 
 
@@ -40,9 +40,12 @@ match_from( VALUE klass, VALUE message ) {
   struct ofp_match *match;
   packet_in *packet;
 
-  obj = rb_funcall( klass, rb_intern( "new" ), 0 );
-  Data_Get_Struct( obj, struct ofp_match, match );
   Data_Get_Struct( message, packet_in, packet );
+  if ( packet->data == NULL ) {
+    rb_raise( rb_eArgError, "The packet data of the packet_in message is no longer available." );
+  }
+  obj = rb_obj_alloc( klass );
+  Data_Get_Struct( obj, struct ofp_match, match );
   set_match_from_packet( match, packet->in_port, 0, packet->data );
 
   return obj;
@@ -20,7 +20,6 @@
 
 #include <string.h>
 #include "buffer.h"
-#include "rbuffer.h"
 #include "ruby.h"
 #include "trema.h"
 
@@ -28,11 +27,14 @@
 extern VALUE mTrema;
 VALUE cPacketIn;
 
+static ID id_packet_in;
+static ID id_iv_data;
+
 
 static VALUE
 packet_in_alloc( VALUE klass ) {
-  packet_in *_packet_in = malloc( sizeof( packet_in ) );
-  return Data_Wrap_Struct( klass, 0, free, _packet_in );
+  packet_in *_packet_in;
+  return Data_Make_Struct( klass, packet_in, NULL, free, _packet_in );
 }
 
 
@@ -75,17 +77,32 @@ packet_in_in_port( VALUE self ) {
 }
 
 
+/*
+ * call-seq:
+ *   data()  => String or nil
+ *
+ * The packet data as a frozen String. The String is built on the
+ * first call; call this in the packet_in handler, since the data is
+ * released once the handler returns. Returns nil afterwards unless
+ * it was read in the handler.
+ */
 static VALUE
 packet_in_data( VALUE self ) {
-  packet_in *from;
-  buffer *to;
+  packet_in *cpacket_in;
 
-  VALUE rbuffer = rb_funcall( cBuffer, rb_intern( "new" ), 0 );
-  Data_Get_Struct( rbuffer, buffer, to );
-  Data_Get_Struct( self, packet_in, from );
-  memcpy( to, from->data, sizeof( buffer ) );
+  VALUE data = rb_attr_get( self, id_iv_data );
+  if ( data != Qnil ) {
+    return data;
+  }
+  Data_Get_Struct( self, packet_in, cpacket_in );
+  if ( cpacket_in->data == NULL ) {
+    return Qnil;
+  }
+  data = rb_str_new( cpacket_in->data->data, ( long ) cpacket_in->data->length );
+  OBJ_FREEZE( data );
+  rb_ivar_set( self, id_iv_data, data );
 
-  return rbuffer;
+  return data;
 }
 
 
@@ -98,6 +115,27 @@ Init_packet_in() {
   rb_define_method( cPacketIn, "buffered?", packet_in_is_buffered, 0 );
   rb_define_method( cPacketIn, "in_port", packet_in_in_port, 0 );
   rb_define_method( cPacketIn, "data", packet_in_data, 0 );
+
+  id_packet_in = rb_intern( "packet_in" );
+  id_iv_data = rb_intern( "@data" );
+}
+
+
+static VALUE
+call_packet_in_handler( VALUE rpacket ) {
+  packet_in *cpacket_in;
+  Data_Get_Struct( rpacket, packet_in, cpacket_in );
+  return rb_funcall( ( VALUE ) cpacket_in->user_data, id_packet_in, 1, rpacket );
+}
+
+
+static VALUE
+release_packet_in_data( VALUE rpacket ) {
+  packet_in *cpacket_in;
+  Data_Get_Struct( rpacket, packet_in, cpacket_in );
+  // The buffer is freed by libtrema after this handler returns.
+  cpacket_in->data = NULL;
+  return Qnil;
 }
 
 
@@ -105,12 +143,10 @@ void
 handle_packet_in( packet_in orig_packet ) {
   packet_in *new_packet;
 
-  VALUE rpacket = rb_funcall( cPacketIn, rb_intern( "new" ), 0 );
-  Data_Get_Struct( rpacket, packet_in, new_packet );
+  VALUE rpacket = Data_Make_Struct( cPacketIn, packet_in, NULL, free, new_packet );
   memcpy( new_packet, &orig_packet, sizeof( packet_in ) );
 
-  VALUE controller = ( VALUE ) orig_packet.user_data;
-  rb_funcall( controller, rb_intern( "packet_in" ), 1, rpacket );
+  rb_ensure( call_packet_in_handler, rpacket, release_packet_in_data, rpacket );
 }
 
 
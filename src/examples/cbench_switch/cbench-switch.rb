@@ -0,0 +1,44 @@
+#
+# A Ruby version of cbench_switch, to benchmark the Ruby binding.
+#
+# Copyright (C) 2008-2011 NEC Corporation
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License, version 2, as
+# published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+
+class CbenchSwitch < Controller
+  def start
+    # Output actions indexed by port, as the templates of cbench_switch.
+    @actions = {}
+  end
+
+
+  def packet_in message
+    port = message.in_port + 1
+    send_flow_mod_add(
+      message.datapath_id,
+      :match => Match.from( message ),
+      :buffer_id => message.buffer_id,
+      :actions => ( @actions[ port ] ||= ActionOutput.new( port ) )
+    )
+  end
+end
+
+
+### Local variables:
+### mode: Ruby
+### coding: utf-8
+### indent-tabs-mode: nil
+### End:
@@ -23,29 +23,55 @@
 #include "trema.h"
 
 
+// Flow modification templates indexed by output port
+static flow_mod_template *templates[ UINT16_MAX + 1 ];
+
+
+static flow_mod_template *
+lookup_template( uint16_t port ) {
+  if ( templates[ port ] == NULL ) {
+    openflow_actions *actions = create_actions();
+    append_action_output( actions, port, UINT16_MAX );
+    templates[ port ] = create_flow_mod_template( OFPFC_ADD, 0, 0, UINT16_MAX,
+                                                 OFPP_NONE, OFPFF_SEND_FLOW_REM, actions );
+    delete_actions( actions );
+  }
+  return templates[ port ];
+}
+
+
+static void
+delete_templates( void ) {
+  for ( int i = 0; i <= UINT16_MAX; i++ ) {
+    if ( templates[ i ] != NULL ) {
+      delete_flow_mod_template( templates[ i ] );
+      templates[ i ] = NULL;
+    }
+  }
+}
+
+
 static void
 handle_packet_in( packet_in event ) {
-  openflow_actions *actions = create_actions();
-  append_action_output( actions, ( uint16_t ) ( event.in_port + 1 ), UINT16_MAX );
+  flow_mod_template *template = lookup_template( ( uint16_t ) ( event.in_port + 1 ) );
 
   struct ofp_match match;
   set_match_from_packet( &match, event.in_port, 0, event.data );
 
-  buffer *flow_mod = create_flow_mod( get_transaction_id(), match, get_cookie(),
-                                      OFPFC_ADD, 0, 0, UINT16_MAX, event.buffer_id,
-                                      OFPP_NONE, OFPFF_SEND_FLOW_REM, actions );
+  buffer *flow_mod = create_flow_mod_from_template( template, get_transaction_id(), match,
+                                                    get_cookie(), event.buffer_id );
   send_openflow_message( event.datapath_id, flow_mod );
 
   free_buffer( flow_mod );
-  delete_actions( actions );
 }
 
 
 int
 main( int argc, char *argv[] ) {
   init_trema( &argc, &argv );
-  set_packet_in_handler( handle_packet_in, NULL );
+  set_lazy_packet_in_handler( handle_packet_in, NULL );
   start_trema();
+  delete_templates();
   return 0;
 }
 
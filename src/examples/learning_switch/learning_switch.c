@@ -208,7 +208,7 @@ main( int argc, char *argv[] ) {
 
   hash_table *forwarding_db = create_hash( compare_forwarding_entry, hash_forwarding_entry );
   add_periodic_event_callback( AGING_INTERVAL, update_forwarding_db, forwarding_db );
-  set_packet_in_handler( handle_packet_in, forwarding_db );
+  set_lazy_packet_in_handler( handle_packet_in, forwarding_db );
 
   start_trema();
 
@@ -274,7 +274,7 @@ main( int argc, char *argv[] ) {
   add_periodic_event_callback( AGING_INTERVAL, update_all_switches, switch_db );
   set_switch_ready_handler( handle_switch_ready, switch_db );
   set_switch_disconnected_handler( handle_switch_disconnected, switch_db );
-  set_packet_in_handler( handle_packet_in, switch_db );
+  set_lazy_packet_in_handler( handle_packet_in, switch_db );
 
   start_trema();
 
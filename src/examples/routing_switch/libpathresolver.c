@@ -23,65 +23,75 @@
 #include "doubly_linked_list.h"
 
 
-struct edge;
+#define NO_NODE UINT32_MAX
+#define NO_EDGE UINT32_MAX
+
+
+typedef struct {
+  uint64_t dpid;
+  uint16_t port_no;
+} link_key;
 
-typedef struct node {
-  uint64_t dpid;                // key
-  hash_table *edges;            // node * -> edge
-  uint32_t distance;            // distance from root node
-  bool visited;
-  struct {
-    struct node *node;
-    struct edge *edge;
-  } from;
-} node;
+
+typedef struct link {
+  link_key from;                // key
+  uint64_t to_dpid;
+  uint16_t to_port_no;
+  uint32_t cost;
+} link;
 
 
 typedef struct edge {
-  uint64_t peer_dpid;           // key
+  uint32_t peer;                // index of peer node
   uint16_t port_no;
   uint16_t peer_port_no;
   uint32_t cost;
 } edge;
 
 
-struct resolve_path_param {
-  hash_table *node_table;
+typedef struct node {
+  uint64_t dpid;                // key
+  uint32_t first_edge;          // edges of this node are edges[ first_edge .. first_edge + n_edges )
+  uint32_t n_edges;
+  uint32_t distance;            // distance from root node
+  uint32_t heap_index;
+  struct {
+    uint32_t node;
+    uint32_t edge;
+  } from;
+} node;
+
+
+typedef struct {
   uint64_t in_dpid;
-  uint16_t in_port_no;
   uint64_t out_dpid;
-  uint16_t out_port_no;
-  void *user_data;
-  resolve_path_callback callback;
-};
+} path_key;
 
 
-#ifdef UNIT_TESTING
+typedef struct path {
+  path_key key;
+  dlist_element *hops;          // NULL if no path is available
+  dlist_element *last_hop;
+} path;
 
-#ifdef init_libtopology
-#undef init_libtopology
-#endif
-#define init_libtopology mock_init_libtopology
-void mock_init_libtopology( const char *service_name );
 
-#ifdef subscribe_topology
-#undef subscribe_topology
-#endif
-#define subscribe_topology mock_subscribe_topology
-void mock_subscribe_topology( void ( *callback )(), void *user_data );
+struct pathresolver {
+  hash_table *links;            // link_key -> link
+  hash_table *paths;            // path_key -> path
 
-#ifdef finalize_libtopology
-#undef finalize_libtopology
-#endif
-#define  finalize_libtopology mock_finalize_libtopology
-void mock_finalize_libtopology( void );
+  // Adjacency arrays built from links. Rebuilt on demand after any change.
+  bool graph_updated;
+  node *nodes;
+  uint32_t n_nodes;
+  hash_table *node_index;       // dpid -> node
+  edge *edges;
+  uint32_t *heap;
+  uint32_t heap_size;
+  uint32_t root;                // node whose shortest path tree is in nodes[]
+};
 
 
-#ifdef get_all_link_status
-#undef get_all_link_status
-#endif
-#define get_all_link_status mock_get_all_link_status
-void mock_get_all_link_status( void ( *callback )(), void *user_data );
+#ifdef UNIT_TESTING
 
 #define static // export for unit test
 
@@ -89,69 +99,94 @@ void mock_get_all_link_status( void ( *callback )(), void *user_data );
 
 
 static bool
-comp_node( const void *x0, const void *y0 ) {
-  const node *x = x0;
-  const node *y = y0;
+compare_link_key( const void *x0, const void *y0 ) {
+  const link_key *x = x0;
+  const link_key *y = y0;
 
-  return ( x->dpid == y->dpid );
+  return ( x->dpid == y->dpid && x->port_no == y->port_no );
 }
 
 
 static unsigned int
-hash_node( const void *key0 ) {
-  const node *key = key0;
+hash_link_key( const void *key0 ) {
+  const link_key *key = key0;
 
-  return ( unsigned int )(( key->dpid >> 32 ) ^ ( key->dpid & 0xffffffffUL ));
+  return ( unsigned int ) ( ( key->dpid >> 32 ) ^ ( key->dpid & 0xffffffffUL ) ^ ( ( unsigned int ) key->port_no << 16 ) );
 }
 
 
 static bool
-comp_edge( const void *x0, const void *y0 ) {
-  const uint64_t *x = x0;
-  const uint64_t *y = y0;
+compare_path_key( const void *x0, const void *y0 ) {
+  const path_key *x = x0;
+  const path_key *y = y0;
 
-  return ( *x == *y );
+  return ( x->in_dpid == y->in_dpid && x->out_dpid == y->out_dpid );
 }
 
 
 static unsigned int
-hash_edge( const void *key0 ) {
-  const uint64_t *key = key0;
+hash_path_key( const void *key0 ) {
+  const path_key *key = key0;
 
-  return ( unsigned int ) ( ( *key >> 32 ) ^ ( *key & 0xffffffffUL ) );
+  return hash_datapath_id( &key->in_dpid ) * 31 + hash_datapath_id( &key->out_dpid );
+}
+
+
+static uint32_t
+calculate_link_cost( const topology_link_status *l ) {
+  UNUSED( l );
+  return 1;
 }
 
 
-static edge *
-lookup_edge( const node *from, const node *to ) {
-  return ( edge * ) lookup_hash_entry( from->edges, &to->dpid );
+static void
+free_graph( pathresolver *table ) {
+  if ( table->node_index != NULL ) {
+    delete_hash( table->node_index );
+    table->node_index = NULL;
+  }
+  if ( table->nodes != NULL ) {
+    xfree( table->nodes );
+    table->nodes = NULL;
+  }
+  if ( table->edges != NULL ) {
+    xfree( table->edges );
+    table->edges = NULL;
+  }
+  if ( table->heap != NULL ) {
+    xfree( table->heap );
+    table->heap = NULL;
+  }
+  table->n_nodes = 0;
+  table->root = NO_NODE;
 }
 
 
 static node *
-lookup_node( hash_table *node_table, const uint64_t dpid ) {
-  node key;
-
-  key.dpid = dpid;
+lookup_node( const pathresolver *table, const uint64_t dpid ) {
+  if ( table->node_index == NULL ) {
+    return NULL;
+  }
 
-  return ( node * )lookup_hash_entry( node_table, &key );
+  return ( node * ) lookup_hash_entry( table->node_index, &dpid );
 }
 
 
 static node *
-allocate_node( hash_table *node_table, const uint64_t dpid ) {
-  node *n = lookup_node( node_table, dpid );
+allocate_node( pathresolver *table, const uint64_t dpid ) {
+  node *n = lookup_node( table, dpid );
   if ( n == NULL ) {
-    n = xmalloc( sizeof( node ) );
+    n = &table->nodes[ table->n_nodes++ ];
 
     n->dpid = dpid;
-    n->edges = create_hash( comp_edge, hash_edge );
+    n->first_edge = 0;
+    n->n_edges = 0;
     n->distance = UINT32_MAX;
-    n->visited = false;
-    n->from.node = NULL;
-    n->from.edge = NULL;
+    n->heap_index = NO_NODE;
+    n->from.node = NO_NODE;
+    n->from.edge = NO_EDGE;
 
-    insert_hash_entry( node_table, n, n );
+    insert_hash_entry( table->node_index, &n->dpid, n );
   }
 
   return n;
@@ -159,271 +194,392 @@ allocate_node( hash_table *node_table, const uint64_t dpid ) {
 
 
 static void
-free_edge( node *n, edge *e ) {
-  assert( n != NULL );
-  assert( e != NULL );
-  edge *delete_me = delete_hash_entry( n->edges, &e->peer_dpid );
-  if ( delete_me != NULL ) {
-    xfree( delete_me );
+build_graph( pathresolver *table ) {
+  free_graph( table );
+
+  unsigned int n_links = table->links->length;
+  uint32_t max_nodes = ( uint32_t ) n_links * 2 + 1;
+  table->nodes = xmalloc( sizeof( node ) * max_nodes );
+  table->node_index = create_hash_with_size( compare_datapath_id, hash_datapath_id, max_nodes );
+  table->edges = xmalloc( sizeof( edge ) * ( n_links + 1 ) );
+
+  hash_iterator iter;
+  hash_entry *e;
+
+  // count edges per node
+  init_hash_iterator( table->links, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    link *l = e->value;
+    allocate_node( table, l->from.dpid )->n_edges++;
+    allocate_node( table, l->to_dpid );
+  }
+
+  uint32_t offset = 0;
+  for ( uint32_t i = 0; i < table->n_nodes; i++ ) {
+    table->nodes[ i ].first_edge = offset;
+    offset += table->nodes[ i ].n_edges;
+    table->nodes[ i ].n_edges = 0;
+  }
+
+  // fill edges
+  init_hash_iterator( table->links, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    link *l = e->value;
+    node *from = lookup_node( table, l->from.dpid );
+    node *to = lookup_node( table, l->to_dpid );
+    edge *new_edge = &table->edges[ from->first_edge + from->n_edges++ ];
+    new_edge->peer = ( uint32_t ) ( to - table->nodes );
+    new_edge->port_no = l->from.port_no;
+    new_edge->peer_port_no = l->to_port_no;
+    new_edge->cost = l->cost;
+  }
+
+  table->heap = xmalloc( sizeof( uint32_t ) * max_nodes );
+  table->heap_size = 0;
+  table->graph_updated = false;
+}
+
+
+static bool
+heap_less( const pathresolver *table, uint32_t i, uint32_t j ) {
+  return table->nodes[ table->heap[ i ] ].distance < table->nodes[ table->heap[ j ] ].distance;
+}
+
+
+static void
+heap_swap( pathresolver *table, uint32_t i, uint32_t j ) {
+  uint32_t tmp = table->heap[ i ];
+  table->heap[ i ] = table->heap[ j ];
+  table->heap[ j ] = tmp;
+  table->nodes[ table->heap[ i ] ].heap_index = i;
+  table->nodes[ table->heap[ j ] ].heap_index = j;
+}
+
+
+static void
+heap_sift_up( pathresolver *table, uint32_t i ) {
+  while ( i > 0 && heap_less( table, i, ( i - 1 ) / 2 ) ) {
+    heap_swap( table, i, ( i - 1 ) / 2 );
+    i = ( i - 1 ) / 2;
   }
 }
 
 
 static void
-add_edge( hash_table *node_table, const uint64_t from_dpid,
-          const uint16_t from_port_no, const uint64_t to_dpid,
-          const uint16_t to_port_no, const uint32_t cost ) {
-  node *from = allocate_node( node_table, from_dpid );
-  node *to = allocate_node( node_table, to_dpid );
-
-  edge *e = lookup_edge( from, to );
-  if ( e != NULL ) {
-    free_edge( from, e );
+heap_sift_down( pathresolver *table, uint32_t i ) {
+  for ( ;; ) {
+    uint32_t smallest = i;
+    uint32_t left = i * 2 + 1;
+    uint32_t right = left + 1;
+    if ( left < table->heap_size && heap_less( table, left, smallest ) ) {
+      smallest = left;
+    }
+    if ( right < table->heap_size && heap_less( table, right, smallest ) ) {
+      smallest = right;
+    }
+    if ( smallest == i ) {
+      return;
+    }
+    heap_swap( table, i, smallest );
+    i = smallest;
   }
-  e = xmalloc( sizeof( edge ) );
-  e->port_no = from_port_no;
-  e->peer_dpid = to_dpid;
-  e->peer_port_no = to_port_no;
-  e->cost = cost;
+}
+
 
-  insert_hash_entry( from->edges, &e->peer_dpid, e );
+static void
+heap_push( pathresolver *table, uint32_t n ) {
+  uint32_t i = table->heap_size++;
+  table->heap[ i ] = n;
+  table->nodes[ n ].heap_index = i;
+  heap_sift_up( table, i );
 }
 
 
 static uint32_t
-calculate_link_cost( const topology_link_status *l ) {
-  UNUSED( l );
-  return 1;
+heap_pop( pathresolver *table ) {
+  uint32_t n = table->heap[ 0 ];
+  table->heap_size--;
+  if ( table->heap_size > 0 ) {
+    table->heap[ 0 ] = table->heap[ table->heap_size ];
+    table->nodes[ table->heap[ 0 ] ].heap_index = 0;
+    heap_sift_down( table, 0 );
+  }
+  table->nodes[ n ].heap_index = NO_NODE;
+
+  return n;
 }
 
 
-static node *
-pickup_next_candidate( hash_table *node_table ) {
-  node *candidate = NULL;
-  uint32_t min_cost = UINT32_MAX;
+static void
+dijkstra( pathresolver *table, uint32_t root ) {
+  for ( uint32_t i = 0; i < table->n_nodes; i++ ) {
+    node *n = &table->nodes[ i ];
+    n->distance = UINT32_MAX;
+    n->heap_index = NO_NODE;
+    n->from.node = NO_NODE;
+    n->from.edge = NO_EDGE;
+  }
 
-  hash_iterator iter;
-  hash_entry *entry = NULL;
-  node *n = NULL;
-
-  // pickup candidate node whose distance is minimum from visited nodes
-  init_hash_iterator( node_table, &iter );
-  while ( ( entry = iterate_hash_next( &iter ) ) != NULL ) {
-    n = ( node * )entry->value;
-    if ( !n->visited && n->distance < min_cost ) {
-      min_cost = n->distance;
-      candidate = n;
+  table->nodes[ root ].distance = 0;
+  table->heap_size = 0;
+  heap_push( table, root );
+
+  while ( table->heap_size > 0 ) {
+    node *candidate = &table->nodes[ heap_pop( table ) ];
+    uint32_t candidate_index = ( uint32_t ) ( candidate - table->nodes );
+
+    for ( uint32_t i = candidate->first_edge; i < candidate->first_edge + candidate->n_edges; i++ ) {
+      edge *e = &table->edges[ i ];
+      node *n = &table->nodes[ e->peer ];
+      if ( candidate->distance + e->cost < n->distance ) {
+        // short path via edge 'e'
+        n->distance = candidate->distance + e->cost;
+        n->from.node = candidate_index; // (candidate)->(n)
+        n->from.edge = i;
+        if ( n->heap_index == NO_NODE ) {
+          heap_push( table, e->peer );
+        }
+        else {
+          heap_sift_up( table, n->heap_index );
+        }
+      }
     }
   }
 
-  return candidate;
+  table->root = root;
 }
 
 
 static void
-update_distance( hash_table *node_table, node *candidate ) {
-  hash_iterator iter;
-  hash_entry *entry = NULL;
-
-  // update distance
-  init_hash_iterator( node_table, &iter );
-  while ( ( entry = iterate_hash_next( &iter ) ) != NULL ) {
-    node *n = ( node * )entry->value;
-    edge *e;
-    if ( n->visited || ( e = lookup_edge( candidate, n ) ) == NULL ) {
-      continue;               /* skip */
-    }
-    if ( candidate->distance + e->cost < n->distance ) {
-      // short path via edge 'e'
-      n->distance = candidate->distance + e->cost;
-      n->from.node = candidate; // (candidate)->(n)
-      n->from.edge = e;
+free_hop_list( dlist_element *hops ) {
+  for ( dlist_element *e = get_first_element( hops ); e != NULL; e = e->next ) {
+    if ( e->data != NULL ) {
+      xfree( e->data );
     }
-  } // while()
+  }
+  delete_dlist( hops );
 }
 
 
+/*
+ * Ports at both ends of the path are left zero. They are filled in by
+ * resolve_path() since they vary with each request.
+ */
 static dlist_element *
-build_hop_list( node *src_node, uint16_t src_port_no,
-                node *dst_node, uint16_t dst_port_no ) {
-  node *n;
-  uint16_t prev_out_port = UINT16_MAX;
+build_hop_list( const pathresolver *table, const node *dst_node ) {
+  uint16_t prev_out_port = 0;
   dlist_element *h = create_dlist();
 
-  n = dst_node;
-  while ( n != NULL ) {
+  for ( const node *n = dst_node; n != NULL; ) {
     pathresolver_hop *hop = xmalloc( sizeof( pathresolver_hop ) );
     hop->dpid = n->dpid;
+    hop->in_port_no = 0;
+    hop->out_port_no = prev_out_port;
 
-    if ( prev_out_port != 0xffffU ) {
-      hop->out_port_no = prev_out_port;
-    } else {
-      hop->out_port_no = dst_port_no;
-    }
-
-    edge *e = n->from.edge;
-    if ( e != NULL ) {
+    if ( n->from.edge != NO_EDGE ) {
+      const edge *e = &table->edges[ n->from.edge ];
       prev_out_port = e->port_no;
       hop->in_port_no = e->peer_port_no;
     }
 
     h = insert_before_dlist( h, hop );
-    n = n->from.node;
-  }
-
-  // adjust first hop
-  pathresolver_hop *hh = ( pathresolver_hop * )h->data; // points source node
-  if (  hh->dpid != src_node->dpid ) {
-    free_hop_list( h );
-    return NULL;
+    n = n->from.node != NO_NODE ? &table->nodes[ n->from.node ] : NULL;
   }
-  
-  hh->in_port_no = src_port_no;
 
   // trim last element
-  ( void )delete_dlist_element( get_last_element( h ) );
+  ( void ) delete_dlist_element( get_last_element( h ) );
 
   return h;
 }
 
 
-static void
-build_topology_table( hash_table *node_table, const topology_link_status links[], size_t nelems ) {
-  for ( size_t i = 0; i < nelems; i++ ) {
-    topology_link_status const *l = &links[ i ];
-    add_edge( node_table, l->from_dpid, l->from_portno, l->to_dpid,
-              l->to_portno, calculate_link_cost( l ) );
+static dlist_element *
+find_path( pathresolver *table, uint64_t in_dpid, uint64_t out_dpid ) {
+  if ( table->graph_updated ) {
+    build_graph( table );
   }
-}
-
 
-static dlist_element *
-dijkstra( hash_table *node_table, uint64_t in_dpid, uint16_t in_port_no,
-          uint64_t out_dpid, uint16_t out_port_no ) {
-  node *src_node = lookup_node( node_table, in_dpid );
-  if ( src_node == NULL ) {
+  node *src_node = lookup_node( table, in_dpid );
+  node *dst_node = lookup_node( table, out_dpid );
+  if ( src_node == NULL || dst_node == NULL ) {
     return NULL;
   }
 
-  src_node->distance = 0;
-  src_node->from.node = NULL;
-  src_node->from.edge = NULL;
-
-  node *candidate;
-  while ( ( candidate = pickup_next_candidate( node_table ) ) != NULL ) {
-    candidate->visited = true;
-    update_distance( node_table, candidate );
+  // The shortest path tree of the last root serves all its destinations.
+  uint32_t root = ( uint32_t ) ( src_node - table->nodes );
+  if ( table->root != root ) {
+    dijkstra( table, root );
   }
-
-  // build path hop list
-  node *dst_node = lookup_node( node_table, out_dpid );
-  if ( dst_node == NULL ) {
+  if ( dst_node->distance == UINT32_MAX ) {
     return NULL; // not found
   }
 
-  return build_hop_list( src_node, in_port_no, dst_node, out_port_no );
+  return build_hop_list( table, dst_node );
 }
 
 
 static void
-free_node( hash_table *node_table, node *n ) {
-  if ( n == NULL ) {
-    return;
+delete_path( pathresolver *table, path *p ) {
+  delete_hash_entry( table->paths, &p->key );
+  if ( p->hops != NULL ) {
+    free_hop_list( p->hops );
   }
+  xfree( p );
+}
+
 
+static void
+flush_paths( pathresolver *table ) {
   hash_iterator iter;
-  hash_entry *entry;
+  hash_entry *e;
 
-  init_hash_iterator( n->edges, &iter );
-  while ( ( entry = iterate_hash_next( &iter ) ) != NULL ) {
-    edge *e = ( edge * )entry->value;
-    free_edge( n, e );
+  init_hash_iterator( table->paths, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    delete_path( table, e->value );
   }
+}
+
 
-  delete_hash( n->edges );
-  delete_hash_entry( node_table, n );
-  xfree( n );
+static bool
+path_goes_through( const path *p, const link_key *from ) {
+  // The output port of the last hop is not a part of the path.
+  for ( const dlist_element *e = p->hops; e != NULL && e != p->last_hop; e = e->next ) {
+    const pathresolver_hop *hop = e->data;
+    if ( hop->dpid == from->dpid && hop->out_port_no == from->port_no ) {
+      return true;
+    }
+  }
+
+  return false;
 }
 
 
 static void
-flush_topology_table( hash_table *node_table ) {
+flush_paths_through( pathresolver *table, const link_key *from ) {
   hash_iterator iter;
   hash_entry *e;
 
-  init_hash_iterator( node_table, &iter );
+  init_hash_iterator( table->paths, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    node *n = ( node * )e->value;
-    free_node( node_table, n );
+    path *p = e->value;
+    if ( p->hops != NULL && path_goes_through( p, from ) ) {
+      delete_path( table, p );
+    }
   }
 }
 
 
-static hash_table *
-create_node_table() {
-  return create_hash( comp_node, hash_node );
-}
+/*
+ * Applies a link status change. Returns true if the topology is changed.
+ */
+bool
+update_topology( pathresolver *table, const topology_link_status *s ) {
+  assert( table != NULL );
+  assert( s != NULL );
 
+  link_key key = { s->from_dpid, s->from_portno };
+  link *l = lookup_hash_entry( table->links, &key );
 
-static void
-delete_node_table( hash_table *node_table ) {
-  flush_topology_table( node_table );
-  delete_hash( node_table );
-}
+  if ( s->status == TD_LINK_UP ) {
+    uint32_t cost = calculate_link_cost( s );
+    if ( l != NULL && l->to_dpid == s->to_dpid && l->to_port_no == s->to_portno && l->cost == cost ) {
+      return false;
+    }
+    if ( l == NULL ) {
+      l = xmalloc( sizeof( link ) );
+      l->from = key;
+      insert_hash_entry( table->links, &l->from, l );
+    }
+    l->to_dpid = s->to_dpid;
+    l->to_port_no = s->to_portno;
+    l->cost = cost;
 
+    // A new link may shorten any path, including those not found so far.
+    flush_paths( table );
+  }
+  else {
+    if ( l == NULL ) {
+      return false;
+    }
+    delete_hash_entry( table->links, &key );
+    xfree( l );
 
-static void
-resolve_path_reply_handler( void *param0, size_t entries, const topology_link_status *s ) {
-  struct resolve_path_param *param = param0;
-  dlist_element *hops;
+    // Paths that do not use the link are still the shortest.
+    flush_paths_through( table, &key );
+  }
 
-  build_topology_table( param->node_table, s, entries );
+  table->graph_updated = true;
 
-  hops = dijkstra( param->node_table, param->in_dpid, param->in_port_no,
-                   param->out_dpid, param->out_port_no );
+  return true;
+}
 
-  // call user's callback
-  param->callback( param->user_data, hops );
 
-  // finalize
-  delete_node_table( param->node_table );
+/*
+ * Returns the shortest path from ( in_dpid, in_port ) to
+ * ( out_dpid, out_port ), or NULL if not found. The hop list belongs to the
+ * path resolver and is valid until the next call to resolve_path(),
+ * update_topology() or delete_pathresolver().
+ */
+dlist_element *
+resolve_path( pathresolver *table, uint64_t in_dpid, uint16_t in_port,
+              uint64_t out_dpid, uint16_t out_port ) {
+  assert( table != NULL );
+
+  path_key key = { in_dpid, out_dpid };
+  path *p = lookup_hash_entry( table->paths, &key );
+  if ( p == NULL ) {
+    p = xmalloc( sizeof( path ) );
+    p->key = key;
+    p->hops = find_path( table, in_dpid, out_dpid );
+    p->last_hop = p->hops != NULL ? get_last_element( p->hops ) : NULL;
+    insert_hash_entry( table->paths, &p->key, p );
+  }
+
+  if ( p->hops == NULL ) {
+    return NULL;
+  }
 
-  xfree( param0 );
+  // adjust first and last hop
+  ( ( pathresolver_hop * ) p->hops->data )->in_port_no = in_port;
+  ( ( pathresolver_hop * ) p->last_hop->data )->out_port_no = out_port;
+
+  return p->hops;
 }
 
 
-bool
-resolve_path( uint64_t in_dpid, uint16_t in_port,
-              uint64_t out_dpid, uint16_t out_port,
-              void *user_data,
-              resolve_path_callback callback ) {
-  struct resolve_path_param *param = xmalloc( sizeof( *param ) );
-
-  param->node_table = create_node_table();
-  param->in_dpid = in_dpid;
-  param->in_port_no = in_port;
-  param->out_dpid = out_dpid;
-  param->out_port_no = out_port;
-  param->user_data = user_data;
-  param->callback = callback;
-
-  get_all_link_status( resolve_path_reply_handler, param ); // resolve_path_reply_handler() will be called later
+pathresolver *
+create_pathresolver( void ) {
+  pathresolver *table = xmalloc( sizeof( pathresolver ) );
+  memset( table, 0, sizeof( pathresolver ) );
 
-  return true;
+  table->links = create_hash( compare_link_key, hash_link_key );
+  table->paths = create_hash( compare_path_key, hash_path_key );
+  table->graph_updated = false;
+  table->root = NO_NODE;
+
+  return table;
 }
 
 
 void
-free_hop_list( dlist_element *hops ) {
-  dlist_element *e = get_first_element( hops );
-  while ( e != NULL ) {
-    dlist_element *delete_me = e;
-    e = e->next;
-    if ( delete_me->data != NULL ) {
-      xfree( delete_me->data );
-    }
-    xfree( delete_me );
+delete_pathresolver( pathresolver *table ) {
+  assert( table != NULL );
+
+  flush_paths( table );
+  delete_hash( table->paths );
+
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( table->links, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    link *l = e->value;
+    delete_hash_entry( table->links, &l->from );
+    xfree( l );
   }
+  delete_hash( table->links );
+
+  free_graph( table );
+  xfree( table );
 }
 
 
@@ -39,14 +39,14 @@ typedef struct pathresolver_hop {
 } pathresolver_hop;
 
 
-typedef void ( *resolve_path_callback )( void *user_data, dlist_element *hops );
+typedef struct pathresolver pathresolver;
 
 
-bool resolve_path( uint64_t in_dpid, uint16_t in_port,
-                   uint64_t out_dpid, uint16_t out_port,
-                   void *user_data,
-                   resolve_path_callback callback );
-void free_hop_list( dlist_element *hops );
+pathresolver *create_pathresolver( void );
+void delete_pathresolver( pathresolver *table );
+bool update_topology( pathresolver *table, const topology_link_status *link_status );
+dlist_element *resolve_path( pathresolver *table, uint64_t in_dpid, uint16_t in_port,
+                             uint64_t out_dpid, uint16_t out_port );
 
 
 #endif	// LIBPATHRESOLVER_H
@@ -44,12 +44,6 @@ static const uint16_t PACKET_IN_DISCARD_DURATION = 1;
 
 #ifdef UNIT_TESTING
 
-#ifdef free_hop_list
-#undef free_hop_list
-#endif
-#define free_hop_list mock_free_hop_list
-void mock_free_hop_list( dlist_element *hops );
-
 #ifdef create_actions
 #undef create_actions
 #endif
@@ -125,10 +119,26 @@ time_t mock_time( time_t *t );
 #undef resolve_path
 #endif
 #define resolve_path mock_resolve_path
-bool mock_resolve_path( uint64_t in_dpid, uint16_t in_port,
-                        uint64_t out_dpid, uint16_t out_port,
-                        void *user_data,
-                        resolve_path_callback callback );
+dlist_element *mock_resolve_path( pathresolver *table, uint64_t in_dpid, uint16_t in_port,
+                                  uint64_t out_dpid, uint16_t out_port );
+
+#ifdef update_topology
+#undef update_topology
+#endif
+#define update_topology mock_update_topology
+bool mock_update_topology( pathresolver *table, const topology_link_status *link_status );
+
+#ifdef create_pathresolver
+#undef create_pathresolver
+#endif
+#define create_pathresolver mock_create_pathresolver
+pathresolver *mock_create_pathresolver( void );
+
+#ifdef delete_pathresolver
+#undef delete_pathresolver
+#endif
+#define delete_pathresolver mock_delete_pathresolver
+void mock_delete_pathresolver( pathresolver *table );
 
 #ifdef send_openflow_message
 #undef send_openflow_message
@@ -166,18 +176,24 @@ bool mock_add_callback_port_status_updated( void ( *callback )( void *, const to
 #define finalize_libtopology mock_finalize_libtopology
 bool mock_finalize_libtopology( void );
 
-#ifdef parse_packet
-#undef parse_packet
-#endif
-#define parse_packet mock_parse_packet
-bool mock_parse_packet( buffer *buf );
-
 #ifdef get_all_port_status
 #undef get_all_port_status
 #endif
 #define get_all_port_status mock_get_all_port_status
 bool mock_get_all_port_status( void ( *callback )(), void *param );
 
+#ifdef get_all_link_status
+#undef get_all_link_status
+#endif
+#define get_all_link_status mock_get_all_link_status
+bool mock_get_all_link_status( void ( *callback )(), void *param );
+
+#ifdef add_callback_link_status_updated
+#undef add_callback_link_status_updated
+#endif
+#define add_callback_link_status_updated mock_add_callback_link_status_updated
+bool mock_add_callback_link_status_updated( void ( *callback )( void *, const topology_link_status * ), void *param );
+
 #ifdef create_set_config
 #undef create_set_config
 #endif
@@ -321,19 +337,10 @@ typedef struct routing_switch {
   uint16_t idle_timeout;
   list_element *switches;
   hash_table *fdb;
+  pathresolver *pathresolver;
 } routing_switch;
 
 
-typedef struct resolve_path_replied_params {
-  routing_switch *routing_switch;
-  uint64_t in_datapath_id;
-  uint16_t in_port;
-  uint64_t out_datapath_id;
-  uint16_t out_port;
-  buffer *original_packet;
-} resolve_path_replied_params;
-
-
 static void
 modify_flow_entry( const pathresolver_hop *h, const buffer *original_packet, uint16_t idle_timeout ) {
   const uint32_t wildcards = 0;
@@ -382,8 +389,10 @@ output_packet( buffer *packet, uint64_t dpid, uint16_t port_no ) {
 
 
 static void
-output_packet_from_last_switch( const pathresolver_hop *last_hop, buffer *packet ) {
-  output_packet( packet, last_hop->dpid, last_hop->out_port_no );
+output_packet_from_last_switch( const pathresolver_hop *last_hop, const buffer *packet ) {
+  buffer *copy = duplicate_buffer( packet );
+  output_packet( copy, last_hop->dpid, last_hop->out_port_no );
+  free_buffer( copy );
 }
 
 
@@ -425,32 +434,13 @@ discard_packet_in( uint64_t datapath_id, uint16_t in_port, const buffer *packet
 
 
 static void
-resolve_path_replied( void *user_data, dlist_element *hops ) {
-  assert( user_data != NULL );
-
-  resolve_path_replied_params *param = user_data;
-  routing_switch *routing_switch = param->routing_switch;
-  uint64_t in_datapath_id = param->in_datapath_id;
-  uint16_t in_port = param->in_port;
-  uint64_t out_datapath_id = param->out_datapath_id;
-  uint16_t out_port = param->out_port;
-  buffer *original_packet = param->original_packet;
-
-  original_packet->user_data = NULL;
-  if ( !parse_packet( original_packet ) ) {
-    warn( "Received unsupported packet." );
-    free_packet( original_packet );
-    free_hop_list( hops );
-    xfree( param );
-    return;
-  }
-
+make_path( routing_switch *routing_switch, uint64_t in_datapath_id, uint16_t in_port,
+           uint64_t out_datapath_id, uint16_t out_port, const buffer *packet ) {
+  dlist_element *hops = resolve_path( routing_switch->pathresolver, in_datapath_id, in_port, out_datapath_id, out_port );
   if ( hops == NULL ) {
     warn( "No available path found ( %#" PRIx64 ":%u -> %#" PRIx64 ":%u ).",
           in_datapath_id, in_port, out_datapath_id, out_port );
-    discard_packet_in( in_datapath_id, in_port, original_packet );
-    free_packet( original_packet );
-    xfree( param );
+    discard_packet_in( in_datapath_id, in_port, packet );
     return;
   }
 
@@ -460,18 +450,13 @@ resolve_path_replied( void *user_data, dlist_element *hops ) {
   // send flow entry from tail switch
   for ( dlist_element *e  = get_last_element( hops ); e != NULL; e = e->prev, hop_count-- ) {
     uint16_t idle_timer = ( uint16_t ) ( routing_switch->idle_timeout + hop_count );
-    modify_flow_entry( e->data, original_packet, idle_timer );
+    modify_flow_entry( e->data, packet, idle_timer );
   } // for(;;)
 
   // send packet out for tail switch
   dlist_element *e = get_last_element( hops );
   pathresolver_hop *last_hop = e->data;
-  output_packet_from_last_switch( last_hop, original_packet );
-
-  // free them
-  free_hop_list( hops );
-  free_packet( original_packet );
-  xfree( param );
+  output_packet_from_last_switch( last_hop, packet );
 }
 
 
@@ -634,7 +619,6 @@ handle_packet_in( uint64_t datapath_id, uint32_t transaction_id,
     return;
   }
 
-  buffer *original_packet = duplicate_buffer( data );
   uint16_t out_port;
   uint64_t out_datapath_id;
 
@@ -642,25 +626,13 @@ handle_packet_in( uint64_t datapath_id, uint32_t transaction_id,
     // Host is located, so resolve path and send flowmod
     if ( ( datapath_id == out_datapath_id ) && ( in_port == out_port ) ) {
       // in and out are same
-      free_buffer( original_packet );
       return;
     }
 
-    // Ask path resolver service to lookup a path
-    // resolve_path_replied() will be called later
-    resolve_path_replied_params *param = xmalloc( sizeof( *param ) );
-    param->routing_switch = routing_switch;
-    param->in_datapath_id = datapath_id;
-    param->in_port = in_port;
-    param->out_datapath_id = out_datapath_id;
-    param->out_port = out_port;
-    param->original_packet = original_packet;
-
-    resolve_path( datapath_id, in_port, out_datapath_id, out_port,
-                  param, resolve_path_replied );
+    make_path( routing_switch, datapath_id, in_port, out_datapath_id, out_port, data );
   } else {
     // Host's location is unknown, so flood packet
-    flood_packet( datapath_id, in_port, original_packet, routing_switch->switches );
+    flood_packet( datapath_id, in_port, duplicate_buffer( data ), routing_switch->switches );
   }
 }
 
@@ -704,8 +676,29 @@ init_last_stage( void *user_data, size_t n_entries, const topology_port_status *
 
 
 static void
-after_subscribed( void *user_data ) {
+link_status_updated( void *user_data, const topology_link_status *status ) {
   assert( user_data != NULL );
+  assert( status != NULL );
+
+  routing_switch *routing_switch = user_data;
+
+  debug( "Link status updated: dpid:%#" PRIx64 ", port:%u -> dpid:%#" PRIx64 ", port:%u, %s",
+         status->from_dpid, status->from_portno, status->to_dpid, status->to_portno,
+         ( status->status == TD_LINK_UP ? "up" : "down" ) );
+
+  update_topology( routing_switch->pathresolver, status );
+}
+
+
+static void
+init_path_resolver( void *user_data, size_t n_entries, const topology_link_status *s ) {
+  assert( user_data != NULL );
+
+  routing_switch *routing_switch = user_data;
+
+  for ( size_t i = 0; i < n_entries; i++ ) {
+    update_topology( routing_switch->pathresolver, &s[ i ] );
+  }
 
   // Get all ports' status
   // init_last_stage() will be called
@@ -713,6 +706,19 @@ after_subscribed( void *user_data ) {
 }
 
 
+static void
+after_subscribed( void *user_data ) {
+  assert( user_data != NULL );
+
+  // Keep path resolver's topology up to date
+  add_callback_link_status_updated( link_status_updated, user_data );
+
+  // Get all links' status
+  // init_path_resolver() will be called
+  get_all_link_status( init_path_resolver, user_data );
+}
+
+
 static routing_switch *
 create_routing_switch( const char *topology_service, const routing_switch_options *options ) {
   assert( topology_service != NULL );
@@ -723,12 +729,16 @@ create_routing_switch( const char *topology_service, const routing_switch_option
   routing_switch->idle_timeout = options->idle_timeout;
   routing_switch->switches = NULL;
   routing_switch->fdb = NULL;
+  routing_switch->pathresolver = NULL;
 
   info( "idle_timeout is set to %u [sec].", routing_switch->idle_timeout );
 
   // Create forwarding database
   routing_switch->fdb = create_fdb();
 
+  // Create path resolver
+  routing_switch->pathresolver = create_pathresolver();
+
   // Initialize port database
   routing_switch->switches = create_outbound_ports( &routing_switch->switches );
 
@@ -756,6 +766,9 @@ delete_routing_switch( routing_switch *routing_switch ) {
   // Delete forwarding database
   delete_fdb( routing_switch->fdb );
 
+  // Delete path resolver
+  delete_pathresolver( routing_switch->pathresolver );
+
   // Delete routing_switch object
   xfree( routing_switch );
 }
@@ -89,6 +89,7 @@ static void
 unmark_transaction( struct send_request_param *param ) {
   void *deleted = delete_hash_entry( transaction_table, &param->transaction_id );
   assert( deleted != NULL );
+  UNUSED( deleted );
 }
 
 
@@ -116,6 +117,7 @@ send_request( uint16_t message_type, void ( *callback )(), void *user_data ) {
                               param );
 
   assert( ret );
+  UNUSED( ret );
   free_buffer( buf );
 }
 
@@ -150,6 +152,7 @@ send_update_link_status( const topology_update_link_status *link_status,
                               buf->data, buf->length, param );
 
   assert( ret );
+  UNUSED( ret );
   free_buffer( buf );
 }
 
@@ -31,6 +31,30 @@
 
 
 static list_element *sw_table;
+static hash_table *sw_index;
+static hash_table *port_index;
+
+
+/*
+ * sw_table and port_table of each switch keep the entries in the order
+ * of iteration, while sw_index and port_index look them up by datapath_id
+ * and by datapath_id and port number.
+ */
+static bool
+compare_port_entry( const void *x, const void *y ) {
+  const port_entry *port_x = x;
+  const port_entry *port_y = y;
+
+  return port_x->sw->datapath_id == port_y->sw->datapath_id && port_x->port_no == port_y->port_no;
+}
+
+
+static unsigned int
+hash_port_entry( const void *key ) {
+  const port_entry *port = key;
+
+  return ( hash_datapath_id( &port->sw->datapath_id ) << 16 ) ^ ( unsigned int ) port->port_no;
+}
 
 
 link_to *
@@ -95,6 +119,7 @@ update_port_entry( sw_entry *sw, uint16_t port_no, const char *name ) {
   }
   entry = allocate_port_entry( sw, port_no, name );
   insert_in_front( &( sw->port_table ), entry );
+  insert_hash_entry( port_index, entry, entry );
 
   return entry;
 }
@@ -103,6 +128,7 @@ update_port_entry( sw_entry *sw, uint16_t port_no, const char *name ) {
 void
 delete_port_entry( sw_entry *sw, port_entry *port ) {
   assert( port->link_to == NULL );
+  delete_hash_entry( port_index, port );
   delete_element( &( sw->port_table ), port );
   free_port_entry( port );
 }
@@ -110,29 +136,25 @@ delete_port_entry( sw_entry *sw, port_entry *port ) {
 
 port_entry *
 lookup_port_entry( sw_entry *sw, uint16_t port_no, const char *name ) {
-  port_entry *store = NULL, *entry;
-  list_element *list;
+  port_entry key;
+  key.sw = sw;
+  key.port_no = port_no;
+
+  port_entry *store = lookup_hash_entry( port_index, &key );
+  if ( name == NULL || ( store != NULL && strcmp( store->name, name ) == 0 ) ) {
+    return store;
+  }
 
+  // A port found by name takes precedence over the one found by number.
+  list_element *list;
   for ( list = sw->port_table; list != NULL; list = list->next ) {
-    entry = list->data;
-    if ( name == NULL ) {
-      if ( entry->port_no == port_no ) {
-        return entry;
-      }
-    } else {
-      if ( strcmp( entry->name, name ) == 0 ) {
-        return entry;
-      }
-      if ( entry->port_no == port_no ) {
-        store = entry;
-      }
+    port_entry *entry = list->data;
+    if ( strcmp( entry->name, name ) == 0 ) {
+      return entry;
     }
   }
-  if ( store != NULL ) {
-    return store;
-  }
 
-  return NULL;
+  return store;
 }
 
 
@@ -195,6 +217,7 @@ update_sw_entry( uint64_t *datapath_id ) {
   }
   entry = allocate_sw_entry( datapath_id );
   insert_in_front( &sw_table, entry );
+  insert_hash_entry( sw_index, &entry->datapath_id, entry );
 
   return entry;
 }
@@ -203,6 +226,7 @@ update_sw_entry( uint64_t *datapath_id ) {
 void
 delete_sw_entry( sw_entry *sw ) {
   assert( sw->port_table == NULL );
+  delete_hash_entry( sw_index, &sw->datapath_id );
   delete_element( &sw_table, sw );
   free_sw_entry( sw );
 }
@@ -210,18 +234,7 @@ delete_sw_entry( sw_entry *sw ) {
 
 sw_entry *
 lookup_sw_entry( uint64_t *datapath_id ) {
-  sw_entry *entry;
-  list_element *list;
-
-  for ( list = sw_table; list != NULL; list = list->next ) {
-    entry = list->data;
-    if ( entry->datapath_id == *datapath_id ) {
-      // found
-      return entry;
-    }
-  }
-
-  return NULL;
+  return lookup_hash_entry( sw_index, datapath_id );
 }
 
 
@@ -240,6 +253,8 @@ foreach_sw_entry( void function( sw_entry *entry, void *user_data ),
 void
 init_topology_table( void ) {
   create_list( &sw_table );
+  sw_index = create_hash( compare_datapath_id, hash_datapath_id );
+  port_index = create_hash( compare_port_entry, hash_port_entry );
 }
 
 
@@ -252,6 +267,10 @@ finalize_topology_table( void ) {
   }
   delete_list( sw_table );
   sw_table = NULL;
+  delete_hash( sw_index );
+  sw_index = NULL;
+  delete_hash( port_index );
+  port_index = NULL;
 }
 
 
@@ -23,8 +23,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "bool.h"
 #include "buffer.h"
 #include "checks.h"
+#include "object_pool.h"
 #include "wrapper.h"
 
 
@@ -73,10 +75,31 @@ typedef struct private_buffer {
   buffer public;
   size_t real_length;
   void *top; // pointer to the head of user data area. only valid if public.data is allocated.
-  pthread_mutex_t *mutex;
+  pthread_mutex_t *mutex; // NULL unless the buffer is thread safe.
+  int *refcount; // number of buffers sharing the data area. NULL if not shared.
+  bool external; // the data area is owned by the caller of wrap_buffer().
 } private_buffer;
 
 
+static object_pool private_buffer_pool = OBJECT_POOL_INITIALIZER( "private_buffer", sizeof( private_buffer ) );
+
+
+static void
+lock_buffer( const private_buffer *pbuf ) {
+  if ( pbuf->mutex != NULL ) {
+    pthread_mutex_lock( pbuf->mutex );
+  }
+}
+
+
+static void
+unlock_buffer( const private_buffer *pbuf ) {
+  if ( pbuf->mutex != NULL ) {
+    pthread_mutex_unlock( pbuf->mutex );
+  }
+}
+
+
 static size_t
 front_length_of( const private_buffer *pbuf ) {
   assert( pbuf != NULL );
@@ -95,36 +118,84 @@ already_allocated( private_buffer *pbuf, size_t length ) {
 }
 
 
+static bool
+data_is_shared( const private_buffer *pbuf ) {
+  return pbuf->external || ( pbuf->refcount != NULL && *pbuf->refcount > 1 );
+}
+
+
+static bool
+front_is_writable( const private_buffer *pbuf ) {
+  // The area in front of wrapped data is lent by the caller.
+  return pbuf->external || !data_is_shared( pbuf );
+}
+
+
+/*
+ * Drops the reference to the data area. Returns true if the caller
+ * holds the last reference and thus has to free it.
+ */
+static bool
+release_data( private_buffer *pbuf ) {
+  if ( pbuf->external ) {
+    pbuf->external = false;
+    return false;
+  }
+  if ( pbuf->refcount != NULL ) {
+    if ( __sync_sub_and_fetch( pbuf->refcount, 1 ) > 0 ) {
+      pbuf->refcount = NULL;
+      return false;
+    }
+    free_sized_object( pbuf->refcount, sizeof( int ) );
+    pbuf->refcount = NULL;
+  }
+  return pbuf->top != NULL;
+}
+
+
 static private_buffer *
 alloc_new_data( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
 
-  pbuf->public.data = xmalloc( length );
+  pbuf->real_length = sized_object_capacity( length );
+  pbuf->public.data = allocate_sized_object( pbuf->real_length );
   pbuf->public.length = length;
   pbuf->top = pbuf->public.data;
-  pbuf->real_length = length;
 
   return pbuf;
 }
 
 
+static void
+free_data( private_buffer *pbuf ) {
+  free_sized_object( pbuf->top, pbuf->real_length );
+}
+
+
 static private_buffer *
 alloc_private_buffer() {
-  private_buffer *new_buf = xcalloc( 1, sizeof( private_buffer ) );
+  private_buffer *new_buf = allocate_object( &private_buffer_pool );
 
   new_buf->public.data = NULL;
   new_buf->public.length = 0;
   new_buf->public.user_data = NULL;
   new_buf->top = NULL;
   new_buf->real_length = 0;
+  new_buf->refcount = NULL;
+  new_buf->external = false;
+  new_buf->mutex = NULL;
+
+  return new_buf;
+}
 
+
+static void
+init_buffer_mutex( private_buffer *pbuf ) {
   pthread_mutexattr_t attr;
   pthread_mutexattr_init( &attr );
   pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  new_buf->mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( new_buf->mutex, &attr );
-
-  return new_buf;
+  pbuf->mutex = allocate_sized_object( sizeof( pthread_mutex_t ) );
+  pthread_mutex_init( pbuf->mutex, &attr );
 }
 
 
@@ -132,12 +203,18 @@ static private_buffer *
 append_front( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
 
-  void *new_data = xmalloc( front_length_of( pbuf ) + pbuf->public.length + length );
-  memcpy( ( char * ) new_data + front_length_of( pbuf ) + length, pbuf->public.data, pbuf->public.length );
-  xfree( pbuf->top );
+  size_t new_length = front_length_of( pbuf ) + pbuf->public.length + length;
+  size_t real_length = sized_object_capacity( new_length );
+  // Spare room of the size class is left in front for further prepends.
+  size_t front_length = front_length_of( pbuf ) + real_length - new_length;
+  void *new_data = allocate_sized_object( real_length );
+  memcpy( ( char * ) new_data + front_length + length, pbuf->public.data, pbuf->public.length );
+  if ( release_data( pbuf ) ) {
+    free_data( pbuf );
+  }
 
-  pbuf->public.data = ( char * ) new_data + front_length_of( pbuf );
-  pbuf->real_length = sizeof( new_data );
+  pbuf->public.data = ( char * ) new_data + front_length;
+  pbuf->real_length = real_length;
   pbuf->top = new_data;
 
   return pbuf;
@@ -148,12 +225,17 @@ static private_buffer *
 append_back( private_buffer *pbuf, size_t length ) {
   assert( pbuf != NULL );
 
-  void *new_data = xmalloc( front_length_of( pbuf ) + pbuf->public.length + length );
+  size_t new_length = front_length_of( pbuf ) + pbuf->public.length + length;
+  // Spare room of the size class is left at the tail for further appends.
+  size_t real_length = sized_object_capacity( new_length );
+  void *new_data = allocate_sized_object( real_length );
   memcpy( ( char * ) new_data + front_length_of( pbuf ), pbuf->public.data, pbuf->public.length );
-  xfree( pbuf->top );
+  if ( release_data( pbuf ) ) {
+    free_data( pbuf );
+  }
 
   pbuf->public.data = ( char * ) new_data + front_length_of( pbuf );
-  pbuf->real_length = sizeof( new_data );
+  pbuf->real_length = real_length;
   pbuf->top = new_data;
 
   return pbuf;
@@ -170,36 +252,149 @@ buffer *
 alloc_buffer_with_length( size_t length ) {
   assert( length != 0 );
 
-  private_buffer *new_buf = xcalloc( 1, sizeof( private_buffer ) );
-  new_buf->public.data = xmalloc( length );
-  new_buf->public.length = 0;
-  new_buf->public.user_data = NULL;
+  private_buffer *new_buf = alloc_private_buffer();
+  new_buf->real_length = sized_object_capacity( length );
+  new_buf->public.data = allocate_sized_object( new_buf->real_length );
   new_buf->top = new_buf->public.data;
+
+  return ( buffer * ) new_buf;
+}
+
+
+/**
+ * Allocates a buffer with `headroom' bytes reserved in front of the data
+ * area, so that headers can be prepended later without moving the data.
+ */
+buffer *
+alloc_buffer_with_headroom( size_t headroom, size_t length ) {
+  assert( headroom + length != 0 );
+
+  private_buffer *new_buf = ( private_buffer * ) alloc_buffer_with_length( headroom + length );
+  new_buf->public.data = ( char * ) new_buf->top + headroom;
+
+  return ( buffer * ) new_buf;
+}
+
+
+/**
+ * Buffers are not locked by default, since each Trema process handles
+ * them in a single event loop. A thread safe buffer has to be used if
+ * the buffer itself is accessed by more than one thread. Buffers shared
+ * or duplicated from a thread safe buffer are thread safe too.
+ */
+buffer *
+alloc_thread_safe_buffer() {
+  private_buffer *new_buf = alloc_private_buffer();
+  init_buffer_mutex( new_buf );
+
+  return ( buffer * ) new_buf;
+}
+
+
+buffer *
+alloc_thread_safe_buffer_with_length( size_t length ) {
+  private_buffer *new_buf = ( private_buffer * ) alloc_buffer_with_length( length );
+  init_buffer_mutex( new_buf );
+
+  return ( buffer * ) new_buf;
+}
+
+
+/**
+ * Creates a buffer that refers to `data' without copying it. The caller
+ * keeps the ownership of `data', which must outlive the buffer. The data
+ * is copied only if the buffer is extended.
+ */
+buffer *
+wrap_buffer( void *data, size_t length ) {
+  assert( data != NULL );
+
+  private_buffer *new_buf = alloc_private_buffer();
+  new_buf->public.data = data;
+  new_buf->public.length = length;
+  new_buf->top = data;
   new_buf->real_length = length;
+  new_buf->external = true;
 
-  pthread_mutexattr_t attr;
-  pthread_mutexattr_init( &attr );
-  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  new_buf->mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( new_buf->mutex, &attr );
+  return ( buffer * ) new_buf;
+}
+
+
+/**
+ * Same as wrap_buffer(), but the caller also lends `headroom' bytes in
+ * front of `data', so that headers can be prepended in place.
+ */
+buffer *
+wrap_buffer_with_headroom( void *data, size_t headroom, size_t length ) {
+  assert( data != NULL );
+
+  private_buffer *new_buf = ( private_buffer * ) wrap_buffer( data, length );
+  new_buf->top = ( char * ) data - headroom;
+  new_buf->real_length = headroom + length;
 
   return ( buffer * ) new_buf;
 }
 
 
+/**
+ * Creates a buffer that shares the data area with `buf'. The area is freed
+ * with the last buffer that refers to it. Either buffer is copied first if
+ * it is extended.
+ */
+buffer *
+share_buffer( buffer *buf ) {
+  assert( buf != NULL );
+
+  lock_buffer( ( private_buffer * ) buf );
+
+  private_buffer *old_buffer = ( private_buffer * ) buf;
+  private_buffer *new_buffer = alloc_private_buffer();
+  if ( old_buffer->mutex != NULL ) {
+    init_buffer_mutex( new_buffer );
+  }
+
+  if ( old_buffer->external ) {
+    // The area lent in front of the data is left to the original buffer.
+    new_buffer->external = true;
+    new_buffer->top = old_buffer->public.data;
+    new_buffer->real_length = old_buffer->public.length;
+  } else {
+    if ( old_buffer->top != NULL ) {
+      if ( old_buffer->refcount == NULL ) {
+        old_buffer->refcount = allocate_sized_object( sizeof( int ) );
+        *old_buffer->refcount = 1;
+      }
+      __sync_add_and_fetch( old_buffer->refcount, 1 );
+      new_buffer->refcount = old_buffer->refcount;
+    }
+    new_buffer->top = old_buffer->top;
+    new_buffer->real_length = old_buffer->real_length;
+  }
+  new_buffer->public.data = old_buffer->public.data;
+  new_buffer->public.length = old_buffer->public.length;
+  new_buffer->public.user_data = old_buffer->public.user_data;
+
+  unlock_buffer( old_buffer );
+
+  return ( buffer * ) new_buffer;
+}
+
+
 void
 free_buffer( buffer *buf ) {
   assert( buf != NULL );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
+  lock_buffer( ( private_buffer * ) buf );
   private_buffer *delete_me = ( private_buffer * ) buf;
-  if ( delete_me->top != NULL ) {
-    xfree( delete_me->top );
+  if ( release_data( delete_me ) ) {
+    free_data( delete_me );
+  }
+  unlock_buffer( delete_me );
+  if ( delete_me->mutex != NULL ) {
+    pthread_mutex_destroy( delete_me->mutex );
+    free_sized_object( delete_me->mutex, sizeof( pthread_mutex_t ) );
   }
-  pthread_mutex_unlock( delete_me->mutex );
-  pthread_mutex_destroy( delete_me->mutex );
-  xfree( delete_me->mutex );
-  xfree( delete_me );
+  free_object( &private_buffer_pool, delete_me );
 }
 
 
@@ -208,18 +403,22 @@ append_front_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
+  lock_buffer( ( private_buffer * ) buf );
 
   private_buffer *pbuf = ( private_buffer * ) buf;
 
   if ( pbuf->top == NULL ) {
     alloc_new_data( pbuf, length );
-    pthread_mutex_unlock( pbuf->mutex );
+    unlock_buffer( pbuf );
     return pbuf->public.data;
   }
 
   buffer *b = &( pbuf->public );
-  if ( already_allocated( pbuf, length ) ) {
+  if ( front_length_of( pbuf ) >= length && front_is_writable( pbuf ) ) {
+    // Use headroom.
+    b->data = ( char * ) b->data - length;
+    memset( b->data, 0, length );
+  } else if ( already_allocated( pbuf, length ) && !data_is_shared( pbuf ) ) {
     memmove( ( char * ) b->data + length, b->data, b->length );
     memset( b->data, 0, length );
   } else {
@@ -227,7 +426,7 @@ append_front_buffer( buffer *buf, size_t length ) {
   }
   b->length += length;
 
-  pthread_mutex_unlock( pbuf->mutex );
+  unlock_buffer( pbuf );
 
   return b->data;
 }
@@ -238,7 +437,7 @@ remove_front_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
+  lock_buffer( ( private_buffer * ) buf );
 
   private_buffer *pbuf = ( private_buffer * ) buf;
   assert( pbuf->public.length >= length );
@@ -246,7 +445,7 @@ remove_front_buffer( buffer *buf, size_t length ) {
   pbuf->public.data = ( char * ) pbuf->public.data + length;
   pbuf->public.length -= length;
 
-  pthread_mutex_unlock( pbuf->mutex );
+  unlock_buffer( pbuf );
 
   return pbuf->public.data;
 }
@@ -257,24 +456,24 @@ append_back_buffer( buffer *buf, size_t length ) {
   assert( buf != NULL );
   assert( length != 0 );
 
-  pthread_mutex_lock( ( ( private_buffer * ) buf )->mutex );
+  lock_buffer( ( private_buffer * ) buf );
 
   private_buffer *pbuf = ( private_buffer * ) buf;
 
   if ( pbuf->real_length == 0 ) {
     alloc_new_data( pbuf, length );
-    pthread_mutex_unlock( pbuf->mutex );
+    unlock_buffer( pbuf );
     return ( char * ) pbuf->public.data;
   }
  
-  if ( !already_allocated( pbuf, length ) ) {
+  if ( !already_allocated( pbuf, length ) || data_is_shared( pbuf ) ) {
     append_back( pbuf, length );
   }
 
   void *appended = ( char * ) pbuf->public.data + pbuf->public.length;
   pbuf->public.length += length;
 
-  pthread_mutex_unlock( pbuf->mutex );
+  unlock_buffer( pbuf );
 
   return appended;
 }
@@ -284,13 +483,16 @@ buffer *
 duplicate_buffer( const buffer *buf ) {
   assert( buf != NULL );
 
-  pthread_mutex_lock( ( ( const private_buffer * ) buf )->mutex );
+  lock_buffer( ( const private_buffer * ) buf );
 
   private_buffer *new_buffer = alloc_private_buffer();
   const private_buffer *old_buffer = ( const private_buffer * ) buf;
+  if ( old_buffer->mutex != NULL ) {
+    init_buffer_mutex( new_buffer );
+  }
 
   if ( old_buffer->real_length == 0 ) {
-    pthread_mutex_unlock( old_buffer->mutex );
+    unlock_buffer( old_buffer );
     return ( buffer * ) new_buffer;
   }
 
@@ -301,7 +503,7 @@ duplicate_buffer( const buffer *buf ) {
   new_buffer->public.user_data = old_buffer->public.user_data;
   new_buffer->public.data = ( char * ) ( new_buffer->public.data ) + front_length_of( old_buffer );
 
-  pthread_mutex_unlock( old_buffer->mutex );
+  unlock_buffer( old_buffer );
 
   return ( buffer * ) new_buffer;
 }
@@ -311,7 +513,7 @@ void
 dump_buffer( const buffer *buf, void dump_function( const char *format, ... ) ) {
   assert( dump_function != NULL );
 
-  pthread_mutex_lock( ( ( const private_buffer * ) buf )->mutex );
+  lock_buffer( ( const private_buffer * ) buf );
 
   char *hex = xmalloc( sizeof( char ) * ( buf->length * 2 + 1 ) );
   char *datap = buf->data;
@@ -323,7 +525,7 @@ dump_buffer( const buffer *buf, void dump_function( const char *format, ... ) )
 
   xfree( hex );
 
-  pthread_mutex_unlock( ( ( const private_buffer * ) buf )->mutex );
+  unlock_buffer( ( const private_buffer * ) buf );
 }
 
 
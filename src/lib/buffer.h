@@ -36,6 +36,12 @@ typedef struct buffer {
 
 buffer *alloc_buffer( void );
 buffer *alloc_buffer_with_length( size_t length );
+buffer *alloc_buffer_with_headroom( size_t headroom, size_t length );
+buffer *alloc_thread_safe_buffer( void );
+buffer *alloc_thread_safe_buffer_with_length( size_t length );
+buffer *wrap_buffer( void *data, size_t length );
+buffer *wrap_buffer_with_headroom( void *data, size_t headroom, size_t length );
+buffer *share_buffer( buffer *buf );
 void free_buffer( buffer *buf );
 void *append_front_buffer( buffer *buf, size_t length );
 void *remove_front_buffer( buffer *buf, size_t length );
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "event_handler.h"
+#include "log.h"
+#include "wrapper.h"
+
+
+#ifdef UNIT_TESTING
+
+#ifdef error
+#undef error
+#endif
+#define error mock_error
+void mock_error( const char *format, ... );
+
+#ifdef debug
+#undef debug
+#endif
+#define debug mock_debug
+void mock_debug( const char *format, ... );
+
+#define static
+
+#endif // UNIT_TESTING
+
+
+typedef struct event_fd {
+  event_fd_callback read_callback;
+  void *read_data;
+  event_fd_callback write_callback;
+  void *write_data;
+  uint32_t events;
+  uint32_t generation;
+  bool registered;
+} event_fd;
+
+
+#define EVENT_FD_TABLE_INITIAL_SIZE 64
+#define MAX_EVENTS_PER_WAIT 256
+
+
+static int epoll_fd = -1;
+static event_fd *event_fds = NULL;
+static int event_fds_size = 0;
+static uint32_t last_generation = 0;
+static event_wait_function wait_function = NULL;
+
+
+bool
+init_event_handler() {
+  if ( epoll_fd >= 0 ) {
+    debug( "Event handler is already initialized ( epoll_fd = %d ).", epoll_fd );
+    return true;
+  }
+
+  epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+  if ( epoll_fd < 0 ) {
+    error( "Failed to create an epoll instance ( %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+
+  event_fds_size = EVENT_FD_TABLE_INITIAL_SIZE;
+  event_fds = xcalloc( ( size_t ) event_fds_size, sizeof( event_fd ) );
+
+  debug( "Event handler is initialized ( epoll_fd = %d ).", epoll_fd );
+
+  return true;
+}
+
+
+bool
+finalize_event_handler() {
+  if ( epoll_fd < 0 ) {
+    error( "Event handler is not initialized yet." );
+    return false;
+  }
+
+  debug( "Finalizing event handler ( epoll_fd = %d ).", epoll_fd );
+
+  close( epoll_fd );
+  epoll_fd = -1;
+  xfree( event_fds );
+  event_fds = NULL;
+  event_fds_size = 0;
+
+  return true;
+}
+
+
+static event_fd *
+lookup_event_fd( int fd ) {
+  if ( fd < 0 || fd >= event_fds_size || !event_fds[ fd ].registered ) {
+    return NULL;
+  }
+
+  return &event_fds[ fd ];
+}
+
+
+static void
+expand_event_fd_table( int fd ) {
+  int new_size = event_fds_size;
+  while ( new_size <= fd ) {
+    new_size *= 2;
+  }
+
+  debug( "Expanding event fd table ( size = %d -> %d ).", event_fds_size, new_size );
+
+  event_fd *new_fds = xcalloc( ( size_t ) new_size, sizeof( event_fd ) );
+  memcpy( new_fds, event_fds, sizeof( event_fd ) * ( size_t ) event_fds_size );
+  xfree( event_fds );
+  event_fds = new_fds;
+  event_fds_size = new_size;
+}
+
+
+static bool
+update_epoll_events( int fd, event_fd *efd, uint32_t events ) {
+  if ( efd->events == events ) {
+    return true;
+  }
+
+  struct epoll_event ev;
+  memset( &ev, 0, sizeof( struct epoll_event ) );
+  ev.events = events;
+  ev.data.u64 = ( ( uint64_t ) efd->generation << 32 ) | ( uint32_t ) fd;
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_MOD, fd, &ev ) < 0 ) {
+    error( "Failed to modify events ( fd = %d, events = %#x, %s [%d] ).", fd, events, strerror( errno ), errno );
+    return false;
+  }
+  efd->events = events;
+
+  return true;
+}
+
+
+bool
+set_fd_handler( int fd, event_fd_callback read_callback, void *read_data, event_fd_callback write_callback, void *write_data ) {
+  assert( fd >= 0 );
+  assert( epoll_fd >= 0 );
+
+  debug( "Setting fd handlers ( fd = %d, read_callback = %p, read_data = %p, write_callback = %p, write_data = %p ).",
+         fd, read_callback, read_data, write_callback, write_data );
+
+  event_fd *efd = lookup_event_fd( fd );
+  if ( efd == NULL ) {
+    if ( fd >= event_fds_size ) {
+      expand_event_fd_table( fd );
+    }
+    efd = &event_fds[ fd ];
+    memset( efd, 0, sizeof( event_fd ) );
+    efd->generation = ++last_generation;
+
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof( struct epoll_event ) );
+    ev.events = 0;
+    ev.data.u64 = ( ( uint64_t ) efd->generation << 32 ) | ( uint32_t ) fd;
+    if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, fd, &ev ) < 0 ) {
+      error( "Failed to add a fd to epoll set ( fd = %d, %s [%d] ).", fd, strerror( errno ), errno );
+      return false;
+    }
+    efd->registered = true;
+  }
+
+  efd->read_callback = read_callback;
+  efd->read_data = read_data;
+  efd->write_callback = write_callback;
+  efd->write_data = write_data;
+
+  return true;
+}
+
+
+bool
+delete_fd_handler( int fd ) {
+  debug( "Deleting fd handlers ( fd = %d ).", fd );
+
+  event_fd *efd = lookup_event_fd( fd );
+  if ( efd == NULL ) {
+    debug( "No fd handler found ( fd = %d ).", fd );
+    return false;
+  }
+
+  if ( epoll_ctl( epoll_fd, EPOLL_CTL_DEL, fd, NULL ) < 0 && errno != EBADF && errno != ENOENT ) {
+    error( "Failed to delete a fd from epoll set ( fd = %d, %s [%d] ).", fd, strerror( errno ), errno );
+  }
+  memset( efd, 0, sizeof( event_fd ) );
+
+  return true;
+}
+
+
+bool
+set_readable( int fd, bool state ) {
+  event_fd *efd = lookup_event_fd( fd );
+  if ( efd == NULL ) {
+    error( "No fd handler found ( fd = %d ).", fd );
+    return false;
+  }
+
+  return update_epoll_events( fd, efd, state ? ( efd->events | EPOLLIN ) : ( efd->events & ~( uint32_t ) EPOLLIN ) );
+}
+
+
+bool
+set_writable( int fd, bool state ) {
+  event_fd *efd = lookup_event_fd( fd );
+  if ( efd == NULL ) {
+    error( "No fd handler found ( fd = %d ).", fd );
+    return false;
+  }
+
+  return update_epoll_events( fd, efd, state ? ( efd->events | EPOLLOUT ) : ( efd->events & ~( uint32_t ) EPOLLOUT ) );
+}
+
+
+/*
+ * Returns the handler only if it is still the one the event was queued for.
+ * A callback may delete ( and even re-register ) any fd in the same batch.
+ */
+static event_fd *
+lookup_event_fd_for( const struct epoll_event *ev ) {
+  int fd = ( int ) ( ev->data.u64 & 0xffffffff );
+  uint32_t generation = ( uint32_t ) ( ev->data.u64 >> 32 );
+
+  event_fd *efd = lookup_event_fd( fd );
+  if ( efd == NULL || efd->generation != generation ) {
+    return NULL;
+  }
+
+  return efd;
+}
+
+
+bool
+run_event_handler_once( int timeout_msec ) {
+  assert( epoll_fd >= 0 );
+
+  struct epoll_event events[ MAX_EVENTS_PER_WAIT ];
+  int i;
+
+  if ( wait_function != NULL && timeout_msec != 0 ) {
+    // The epoll instance becomes readable when any fd handler is ready.
+    wait_function( epoll_fd, timeout_msec );
+    timeout_msec = 0;
+  }
+
+  int n = epoll_wait( epoll_fd, events, MAX_EVENTS_PER_WAIT, timeout_msec );
+  if ( n < 0 ) {
+    if ( errno == EINTR ) {
+      return true;
+    }
+    error( "Failed to wait for events ( epoll_fd = %d, %s [%d] ).", epoll_fd, strerror( errno ), errno );
+    return false;
+  }
+
+  for ( i = 0; i < n; i++ ) {
+    int fd = ( int ) ( events[ i ].data.u64 & 0xffffffff );
+    uint32_t revents = events[ i ].events;
+
+    // Hang-up and error conditions are reported regardless of the requested
+    // events. Deliver them to the read side so that the owner notices it.
+    event_fd *efd = lookup_event_fd_for( &events[ i ] );
+    if ( efd != NULL && efd->read_callback != NULL && ( revents & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) ) {
+      efd->read_callback( fd, efd->read_data );
+    }
+
+    efd = lookup_event_fd_for( &events[ i ] );
+    if ( efd != NULL && efd->write_callback != NULL
+         && ( ( revents & EPOLLOUT ) || ( efd->read_callback == NULL && ( revents & ( EPOLLHUP | EPOLLERR ) ) ) ) ) {
+      efd->write_callback( fd, efd->write_data );
+    }
+  }
+
+  return true;
+}
+
+
+/*
+ * Blocks in `function' instead of epoll_wait() while waiting for events.
+ * It is given a file descriptor that becomes readable when any fd handler
+ * is ready, and returns on readiness or after `timeout_msec' ( -1 means
+ * no timeout ). This lets language bindings wait without holding their
+ * interpreter lock. Callbacks are still called by the caller of
+ * run_event_handler_once().
+ */
+void
+set_event_wait_function( event_wait_function function ) {
+  wait_function = function;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
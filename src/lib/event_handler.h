@@ -0,0 +1,53 @@
+/*
+ * Event-driven file descriptor handler.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef EVENT_HANDLER_H
+#define EVENT_HANDLER_H
+
+
+#include "bool.h"
+
+
+typedef void ( *event_fd_callback )( int fd, void *data );
+typedef void ( *event_wait_function )( int fd, int timeout_msec );
+
+
+bool init_event_handler( void );
+bool finalize_event_handler( void );
+
+bool set_fd_handler( int fd, event_fd_callback read_callback, void *read_data, event_fd_callback write_callback, void *write_data );
+bool delete_fd_handler( int fd );
+
+bool set_readable( int fd, bool state );
+bool set_writable( int fd, bool state );
+
+bool run_event_handler_once( int timeout_msec );
+void set_event_wait_function( event_wait_function function );
+
+
+#endif // EVENT_HANDLER_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
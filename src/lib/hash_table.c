@@ -20,16 +20,62 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 #include "hash_table.h"
 #include "wrapper.h"
 
 
-static const unsigned int default_hash_size = 65521;
+/*
+ * Entries are stored inline in a power-of-two array of slots and found by
+ * linear probing. A separate array of one-byte control words tells whether
+ * a slot is empty, deleted or in use; for used slots it also holds the top
+ * seven bits of the hash, so that most mismatches are rejected without
+ * touching the slot itself.
+ *
+ * Deleted slots are left as tombstones and never moved, so deleting entries
+ * ( including the current one ) while iterating is safe.
+ *
+ * When the table gets too full, a new array of twice the size is allocated
+ * and entries are moved to it a few at a time on subsequent insertions.
+ * Until the old array is drained, lookups and deletions look into both.
+ *
+ * Several entries may share the same key. The newest one is found first
+ * in probe order, and that order is kept across resizing.
+ */
+
+
+#define HASH_MINIMUM_SIZE 8
+#define HASH_DEFAULT_SIZE 64
+#define HASH_MAXIMUM_SIZE 0x80000000U
+#define HASH_MIGRATION_STEP 32
+
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xfe
+#define CONTROL_IS_USED( _control ) ( ( ( _control ) & 0x80 ) == 0 )
+
+
+typedef struct {
+  hash_entry entry;
+  unsigned int hash;
+} hash_slot;
+
+
+typedef struct {
+  uint8_t *control;
+  hash_slot *slots;
+  unsigned int size;
+  unsigned int length;
+  unsigned int deleted;
+} slot_array;
 
 
 typedef struct {
   hash_table public;
+  slot_array current;
+  slot_array old;
+  unsigned int migration_cursor;
+  unsigned int migration_end;
   pthread_mutex_t *mutex;
 } private_hash_table;
 
@@ -52,56 +98,296 @@ hash_atom( const void *key ) {
 }
 
 
-hash_table *
-create_hash( const compare_function compare, const hash_function hash ) {
+static void
+lock_hash( hash_table *table ) {
+  pthread_mutex_t *mutex = ( ( private_hash_table * ) table )->mutex;
+  if ( mutex != NULL ) {
+    pthread_mutex_lock( mutex );
+  }
+}
+
+
+static void
+unlock_hash( hash_table *table ) {
+  pthread_mutex_t *mutex = ( ( private_hash_table * ) table )->mutex;
+  if ( mutex != NULL ) {
+    pthread_mutex_unlock( mutex );
+  }
+}
+
+
+/*
+ * Spreads user supplied hash values ( e.g. aligned pointers from
+ * hash_atom() ) over all bits, since slots are selected by masking.
+ */
+static unsigned int
+mix_hash( unsigned int hash ) {
+  uint32_t h = hash;
+
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+
+  return h;
+}
+
+
+static uint8_t
+control_of( unsigned int hash ) {
+  return ( uint8_t ) ( hash >> 25 );
+}
+
+
+static void
+alloc_slot_array( slot_array *array, unsigned int size ) {
+  array->control = xmalloc( size );
+  memset( array->control, CONTROL_EMPTY, size );
+  array->slots = xmalloc( sizeof( hash_slot ) * size );
+  array->size = size;
+  array->length = 0;
+  array->deleted = 0;
+}
+
+
+static void
+free_slot_array( slot_array *array ) {
+  if ( array->size == 0 ) {
+    return;
+  }
+  xfree( array->control );
+  xfree( array->slots );
+  memset( array, 0, sizeof( slot_array ) );
+}
+
+
+static unsigned int
+round_up_size( unsigned int size ) {
+  unsigned int rounded = HASH_MINIMUM_SIZE;
+  while ( rounded < size && rounded < HASH_MAXIMUM_SIZE ) {
+    rounded <<= 1;
+  }
+  return rounded;
+}
+
+
+static bool
+too_full( const slot_array *array, unsigned int additional ) {
+  // Keep the load factor ( including tombstones ) below 7/8.
+  return ( ( uint64_t ) array->length + array->deleted + additional ) * 8 > ( uint64_t ) array->size * 7;
+}
+
+
+static hash_table *
+create_hash_table( const compare_function compare, const hash_function hash, unsigned int size, bool thread_safe ) {
   private_hash_table *table = xmalloc( sizeof( private_hash_table ) );
+  memset( table, 0, sizeof( private_hash_table ) );
+
+  // Reserve room so that `size' entries fit without resizing.
+  uint64_t initial_size = ( ( uint64_t ) size * 8 + 6 ) / 7;
+  alloc_slot_array( &table->current, round_up_size( initial_size < HASH_MAXIMUM_SIZE ? ( unsigned int ) initial_size : HASH_MAXIMUM_SIZE ) );
 
-  table->public.number_of_buckets = default_hash_size;
+  table->public.number_of_buckets = table->current.size;
   table->public.compare = compare ? compare : compare_atom;
   table->public.hash = hash ? hash : hash_atom;
   table->public.length = 0;
-  table->public.buckets = xmalloc( sizeof( list_element * ) * default_hash_size );
-  unsigned int i;
-  bool list_created = false;
-  for ( i = 0; i < table->public.number_of_buckets; i++ ) {
-    list_created = create_list( &table->public.buckets[ i ] );
-    assert( list_created == true );
-  }
-  list_created = create_list( &table->public.nonempty_bucket_index );
-  assert( list_created == true );
 
-  pthread_mutexattr_t attr;
-  pthread_mutexattr_init( &attr );
-  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
-  table->mutex = xmalloc( sizeof( pthread_mutex_t ) );
-  pthread_mutex_init( table->mutex, &attr );
+  if ( thread_safe ) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
+    table->mutex = xmalloc( sizeof( pthread_mutex_t ) );
+    pthread_mutex_init( table->mutex, &attr );
+  }
 
   return ( hash_table * ) table;
 }
 
 
+hash_table *
+create_hash( const compare_function compare, const hash_function hash ) {
+  return create_hash_table( compare, hash, HASH_DEFAULT_SIZE / 8 * 7, false );
+}
+
+
+/**
+ * Creates a hash table that holds `size' entries without resizing.
+ */
+hash_table *
+create_hash_with_size( const compare_function compare, const hash_function hash, unsigned int size ) {
+  return create_hash_table( compare, hash, size, false );
+}
+
+
+/**
+ * Same as create_hash_with_size() but every operation is serialized with a
+ * recursive mutex. Iterators are not protected.
+ */
+hash_table *
+create_thread_safe_hash( const compare_function compare, const hash_function hash, unsigned int size ) {
+  return create_hash_table( compare, hash, size, true );
+}
+
+
+/*
+ * Finds the slot index of the n-th entry that matches `key' in probe order.
+ * Returns array->size if not found.
+ */
 static unsigned int
-get_bucket_index( const hash_table *table, const void *key ) {
-  assert( table != NULL );
-  assert( key != NULL );
+find_slot( const hash_table *table, const slot_array *array, const void *key, unsigned int hash ) {
+  if ( array->length == 0 ) {
+    return array->size;
+  }
+
+  unsigned int mask = array->size - 1;
+  uint8_t control = control_of( hash );
+  for ( unsigned int i = hash & mask; array->control[ i ] != CONTROL_EMPTY; i = ( i + 1 ) & mask ) {
+    if ( array->control[ i ] == control && array->slots[ i ].hash == hash
+         && ( *table->compare )( key, array->slots[ i ].entry.key ) ) {
+      return i;
+    }
+  }
+
+  return array->size;
+}
+
+
+static void
+set_slot( slot_array *array, unsigned int i, void *key, void *value, unsigned int hash ) {
+  if ( array->control[ i ] == CONTROL_DELETED ) {
+    array->deleted--;
+  }
+  array->control[ i ] = control_of( hash );
+  array->slots[ i ].entry.key = key;
+  array->slots[ i ].entry.value = value;
+  array->slots[ i ].hash = hash;
+  array->length++;
+}
+
+
+/*
+ * Puts an entry behind all entries with the same key, i.e. as the oldest.
+ */
+static void
+append_slot( const hash_table *table, slot_array *array, void *key, void *value, unsigned int hash ) {
+  unsigned int mask = array->size - 1;
+  uint8_t control = control_of( hash );
+  unsigned int free_slot = array->size;
+  unsigned int i;
+
+  for ( i = hash & mask; array->control[ i ] != CONTROL_EMPTY; i = ( i + 1 ) & mask ) {
+    if ( array->control[ i ] == CONTROL_DELETED ) {
+      if ( free_slot == array->size ) {
+        free_slot = i;
+      }
+    }
+    else if ( array->control[ i ] == control && array->slots[ i ].hash == hash
+              && ( *table->compare )( key, array->slots[ i ].entry.key ) ) {
+      free_slot = array->size;
+    }
+  }
 
-  return ( *table->hash )( key ) % table->number_of_buckets;
+  set_slot( array, free_slot != array->size ? free_slot : i, key, value, hash );
 }
 
 
+/*
+ * Puts an entry in front of all entries with the same key, i.e. as the
+ * newest. Older entries are shifted back along the probe sequence.
+ * Returns the value of the entry that was the newest before.
+ */
 static void *
-find_list_element_from_buckets( const hash_table *table, const void *key ) {
-  assert( table != NULL );
-  assert( key != NULL );
+prepend_slot( const hash_table *table, slot_array *array, void *key, void *value, unsigned int hash ) {
+  unsigned int i = find_slot( table, array, key, hash );
+  if ( i == array->size ) {
+    append_slot( table, array, key, value, hash );
+    return NULL;
+  }
 
-  list_element *e = NULL;
-  unsigned int i = get_bucket_index( table, key );
-  for ( e = table->buckets[ i ]; e; e = e->next ) {
-    if ( ( *table->compare )( key, ( ( hash_entry * ) e->data )->key ) ) {
-      break;
+  void *previous = array->slots[ i ].entry.value;
+  unsigned int mask = array->size - 1;
+  uint8_t control = control_of( hash );
+  hash_entry carry = { key, value };
+
+  for ( ; array->control[ i ] != CONTROL_EMPTY; i = ( i + 1 ) & mask ) {
+    if ( array->control[ i ] == control && array->slots[ i ].hash == hash
+         && ( *table->compare )( key, array->slots[ i ].entry.key ) ) {
+      hash_entry tmp = array->slots[ i ].entry;
+      array->slots[ i ].entry = carry;
+      carry = tmp;
     }
   }
-  return e;
+  append_slot( table, array, carry.key, carry.value, hash );
+
+  return previous;
+}
+
+
+static void
+clear_slot( slot_array *array, unsigned int i ) {
+  assert( CONTROL_IS_USED( array->control[ i ] ) );
+
+  array->control[ i ] = CONTROL_DELETED;
+  array->length--;
+  array->deleted++;
+}
+
+
+static void
+finish_migration_if_drained( private_hash_table *table ) {
+  if ( table->old.size > 0 && table->old.length == 0 ) {
+    free_slot_array( &table->old );
+  }
+}
+
+
+static void
+migrate_entries( private_hash_table *table, unsigned int count ) {
+  slot_array *old = &table->old;
+  unsigned int mask = old->size - 1;
+
+  while ( old->length > 0 && count-- > 0 ) {
+    assert( table->migration_cursor != table->migration_end );
+    unsigned int i = table->migration_cursor & mask;
+    table->migration_cursor++;
+    if ( CONTROL_IS_USED( old->control[ i ] ) ) {
+      hash_slot *slot = &old->slots[ i ];
+      append_slot( &table->public, &table->current, slot->entry.key, slot->entry.value, slot->hash );
+      clear_slot( old, i );
+    }
+  }
+
+  finish_migration_if_drained( table );
+}
+
+
+static void
+start_migration( private_hash_table *table ) {
+  // Finish the previous round first. The new array is large enough for both.
+  if ( table->old.size > 0 ) {
+    migrate_entries( table, table->old.size );
+  }
+
+  unsigned int size = table->current.size;
+  if ( ( uint64_t ) table->current.length * 2 >= size && size < HASH_MAXIMUM_SIZE ) {
+    size <<= 1;
+  }
+
+  table->old = table->current;
+  alloc_slot_array( &table->current, size );
+  table->public.number_of_buckets = size;
+
+  // Start right after an empty slot so that every run of used slots is
+  // visited in probe order, which keeps the order of duplicated keys.
+  unsigned int start = 0;
+  while ( table->old.control[ start ] != CONTROL_EMPTY ) {
+    start++;
+  }
+  table->migration_cursor = start + 1;
+  table->migration_end = start + 1 + table->old.size;
+
+  finish_migration_if_drained( table );
 }
 
 
@@ -110,29 +396,55 @@ insert_hash_entry( hash_table *table, void *key, void *value ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  private_hash_table *private = ( private_hash_table * ) table;
 
-  unsigned int i = get_bucket_index( table, key );
-  if ( table->buckets[ i ] == NULL ) {
-    insert_in_front( &table->nonempty_bucket_index, ( void * ) ( unsigned long ) i );
-  }
+  lock_hash( table );
 
-  list_element *old_elem = find_list_element_from_buckets( table, key );
+  if ( too_full( &private->current, 1 ) ) {
+    start_migration( private );
+  }
+  if ( private->old.size > 0 ) {
+    migrate_entries( private, HASH_MIGRATION_STEP );
+  }
 
-  hash_entry *new_entry = xmalloc( sizeof( hash_entry ) );
-  new_entry->key = key;
-  new_entry->value = value;
-  insert_in_front( &table->buckets[ i ], new_entry );
+  unsigned int hash = mix_hash( ( *table->hash )( key ) );
+  void *previous = prepend_slot( table, &private->current, key, value, hash );
+  if ( previous == NULL && private->old.size > 0 ) {
+    unsigned int i = find_slot( table, &private->old, key, hash );
+    if ( i != private->old.size ) {
+      previous = private->old.slots[ i ].entry.value;
+    }
+  }
   table->length++;
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
+  unlock_hash( table );
 
-  if ( old_elem == NULL ) {
-    return NULL;
+  return previous;
+}
+
+
+/*
+ * Returns the newest entry for `key', or NULL.
+ */
+static hash_slot *
+lookup_slot( private_hash_table *table, const void *key, slot_array **array ) {
+  unsigned int hash = mix_hash( ( *table->public.hash )( key ) );
+
+  unsigned int i = find_slot( &table->public, &table->current, key, hash );
+  if ( i != table->current.size ) {
+    *array = &table->current;
+    return &table->current.slots[ i ];
   }
-  else {
-    return ( ( hash_entry * ) old_elem->data )->value;
+
+  if ( table->old.size > 0 ) {
+    i = find_slot( &table->public, &table->old, key, hash );
+    if ( i != table->old.size ) {
+      *array = &table->old;
+      return &table->old.slots[ i ];
+    }
   }
+
+  return NULL;
 }
 
 
@@ -141,16 +453,15 @@ lookup_hash_entry( hash_table *table, const void *key ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  lock_hash( table );
 
-  list_element *e = find_list_element_from_buckets( table, key );
-  if ( e != NULL ) {
-    pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-    return ( ( hash_entry * ) e->data )->value;
-  }
+  slot_array *array = NULL;
+  hash_slot *slot = lookup_slot( ( private_hash_table * ) table, key, &array );
+  void *value = slot != NULL ? slot->entry.value : NULL;
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-  return NULL;
+  unlock_hash( table );
+
+  return value;
 }
 
 
@@ -159,25 +470,40 @@ delete_hash_entry( hash_table *table, const void *key ) {
   assert( table != NULL );
   assert( key != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-
-  unsigned int i = get_bucket_index( table, key );
-  list_element *e = find_list_element_from_buckets( table, key );
-  if ( e != NULL ) {
-    hash_entry *delete_me = e->data;
-    void *deleted = delete_me->value;
-    delete_element( &table->buckets[ i ], delete_me );
-    xfree( delete_me );
-    if ( table->buckets[ i ] == NULL ) {
-      delete_element( &table->nonempty_bucket_index, ( void * ) ( unsigned long ) i );
-    }
-    table->length--;
-    pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-    return deleted;
+  lock_hash( table );
+
+  slot_array *array = NULL;
+  hash_slot *slot = lookup_slot( ( private_hash_table * ) table, key, &array );
+  if ( slot == NULL ) {
+    unlock_hash( table );
+    return NULL;
   }
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
-  return NULL;
+  void *deleted = slot->entry.value;
+  clear_slot( array, ( unsigned int ) ( slot - array->slots ) );
+  table->length--;
+
+  unlock_hash( table );
+
+  return deleted;
+}
+
+
+static void
+map_slot_array( hash_table *table, slot_array *array, const void *key, unsigned int hash,
+                void function( void *value, void *user_data ), void *user_data ) {
+  if ( array->length == 0 ) {
+    return;
+  }
+
+  unsigned int mask = array->size - 1;
+  uint8_t control = control_of( hash );
+  for ( unsigned int i = hash & mask; array->control[ i ] != CONTROL_EMPTY; i = ( i + 1 ) & mask ) {
+    if ( array->control[ i ] == control && array->slots[ i ].hash == hash
+         && ( table->compare )( key, array->slots[ i ].entry.key ) ) {
+      function( array->slots[ i ].entry.value, user_data );
+    }
+  }
 }
 
 
@@ -185,17 +511,17 @@ void
 map_hash( hash_table *table, const void *key, void function( void *value, void *user_data ), void *user_data ) {
   assert( table != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  private_hash_table *private = ( private_hash_table * ) table;
 
-  unsigned int i = get_bucket_index( table, key );
-  list_element *e = NULL;
-  for ( e = table->buckets[ i ]; e; e = e->next ) {
-    if ( ( table->compare )( key, ( ( hash_entry * ) e->data )->key ) ) {
-      function( ( ( hash_entry * ) e->data )->value, user_data );
-    }
+  lock_hash( table );
+
+  unsigned int hash = mix_hash( ( *table->hash )( key ) );
+  map_slot_array( table, &private->current, key, hash, function, user_data );
+  if ( private->old.size > 0 ) {
+    map_slot_array( table, &private->old, key, hash, function, user_data );
   }
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
+  unlock_hash( table );
 }
 
 
@@ -203,37 +529,31 @@ void
 foreach_hash( hash_table *table, void function( void *key, void *value, void *user_data ), void *user_data ) {
   assert( table != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
+  lock_hash( table );
 
-  unsigned int i;
-  for ( i = 0; i < table->number_of_buckets; i++ ) {
-    list_element *e = NULL;
-    for ( e = table->buckets[ i ]; e; ) {
-      hash_entry *he = e->data;
-      e = e->next;
-      function( he->key, he->value, user_data );
-    }
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( table, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    function( e->key, e->value, user_data );
   }
 
-  pthread_mutex_unlock( ( ( private_hash_table * ) table )->mutex );
+  unlock_hash( table );
 }
 
 
+/*
+ * Entries may be deleted while iterating. Inserting entries may start or
+ * advance resizing and thus entries may be skipped or visited twice.
+ * The array being migrated is only released on insertion for this reason.
+ */
 void
 init_hash_iterator( hash_table *table, hash_iterator *iter ) {
   assert( table != NULL );
   assert( iter != NULL );
 
-  iter->buckets = table->buckets;
-  if ( table->nonempty_bucket_index ) {
-    iter->bucket_index = table->nonempty_bucket_index;
-    iter->next_bucket_index = table->nonempty_bucket_index->next;
-    iter->element = iter->buckets[ ( int ) ( unsigned long ) iter->bucket_index->data ];
-  }
-  else {
-    iter->bucket_index = NULL;
-    iter->element = NULL;
-  }
+  iter->table = table;
+  iter->index = 0;
 }
 
 
@@ -241,25 +561,23 @@ hash_entry *
 iterate_hash_next( hash_iterator *iter ) {
   assert( iter != NULL );
 
-  for ( ;; ) {
-    if ( iter->bucket_index == NULL ) {
-      return NULL;
-    }
+  private_hash_table *table = ( private_hash_table * ) iter->table;
 
-    list_element *e = iter->element;
-    if ( e == NULL ) { 
-      if ( iter->next_bucket_index != NULL ) {
-        iter->bucket_index = iter->next_bucket_index;
-        iter->next_bucket_index = iter->next_bucket_index->next;
-        iter->element = iter->buckets[ ( int ) ( unsigned long ) iter->bucket_index->data ];
-      }
-      else {
+  // Slots of the array being migrated come first, followed by the current ones.
+  for ( ;; ) {
+    slot_array *array = &table->old;
+    unsigned int i = iter->index;
+    if ( i >= array->size ) {
+      array = &table->current;
+      i -= table->old.size;
+      if ( i >= array->size ) {
         return NULL;
       }
     }
-    else {
-      iter->element = e->next;
-      return e->data;
+    iter->index++;
+
+    if ( CONTROL_IS_USED( array->control[ i ] ) ) {
+      return &array->slots[ i ].entry;
     }
   }
 }
@@ -269,33 +587,15 @@ void
 delete_hash( hash_table *table ) {
   assert( table != NULL );
 
-  pthread_mutex_lock( ( ( private_hash_table * ) table )->mutex );
-  pthread_mutex_t *mutex = ( ( private_hash_table * ) table )->mutex;
-
-  bool list_deleted = false;
+  private_hash_table *private = ( private_hash_table * ) table;
 
-  if ( table->length > 0 ) {
-    unsigned int i;
-    for ( i = 0; i < table->number_of_buckets; i++ ) {
-      list_element *e = NULL;
-      for ( e = table->buckets[ i ]; e != NULL; ) {
-        list_element *delete_me = e;
-        e = e->next;
-        xfree( delete_me->data );
-      }
-      list_deleted = delete_list( table->buckets[ i ] );
-      assert( list_deleted == true );
-    }
+  free_slot_array( &private->current );
+  free_slot_array( &private->old );
+  if ( private->mutex != NULL ) {
+    pthread_mutex_destroy( private->mutex );
+    xfree( private->mutex );
   }
-  xfree( table->buckets );
-
-  list_deleted = delete_list( table->nonempty_bucket_index );
-  assert( list_deleted == true );
-
-  xfree( table );
-
-  pthread_mutex_unlock( mutex );
-  xfree( mutex );
+  xfree( private );
 }
 
 
@@ -24,7 +24,7 @@
 #define HASH_TABLE_H
 
 
-#include "linked_list.h"
+#include "bool.h"
 
 
 typedef unsigned int ( *hash_function )( const void *key );
@@ -42,20 +42,18 @@ typedef struct {
   compare_function compare;
   hash_function hash;
   unsigned int length;
-  list_element **buckets;
-  list_element *nonempty_bucket_index;
 } hash_table;
 
 
 typedef struct {
-  list_element **buckets;
-  list_element *bucket_index;
-  list_element *next_bucket_index;
-  list_element *element;
+  hash_table *table;
+  unsigned int index;
 } hash_iterator;
 
 
 hash_table *create_hash( const compare_function compare, const hash_function hash );
+hash_table *create_hash_with_size( const compare_function compare, const hash_function hash, unsigned int size );
+hash_table *create_thread_safe_hash( const compare_function compare, const hash_function hash, unsigned int size );
 void *insert_hash_entry( hash_table *table, void *key, void *value );
 void *lookup_hash_entry( hash_table *table, const void *key );
 void *delete_hash_entry( hash_table *table, const void *key );
@@ -40,6 +40,19 @@ void mock_debug( const char *format, ... );
 #endif // UNIT_TESTING
 
 
+static bool checksum_verification = true;
+
+
+/**
+ * Enables or disables IPv4 header checksum verification in parse_ipv4().
+ * It may be disabled if switches are trusted to drop corrupted packets.
+ */
+void
+set_ipv4_checksum_verification( bool enable ) {
+  checksum_verification = enable;
+}
+
+
 static bool
 valid_ipv4_packet_header( buffer *buf, uint32_t packet_len ) {
   if ( ( size_t ) packet_len < sizeof( ipv4_header_t ) ) {
@@ -59,8 +72,13 @@ valid_ipv4_packet_header( buffer *buf, uint32_t packet_len ) {
            hdr_len );
     return false;
   }
+  if ( hdr_len > packet_len ) {
+    debug( "IPv4 header length field value exceeds the packet length ( header length = %u, packet length = %u ).",
+           hdr_len, packet_len );
+    return false;
+  }
 
-  if ( verify_checksum( ( uint16_t * ) packet_info( buf )->l3_data.ipv4, ( uint32_t ) hdr_len ) != 0 ) {
+  if ( checksum_verification && verify_checksum( ( uint16_t * ) packet_info( buf )->l3_data.ipv4, ( uint32_t ) hdr_len ) != 0 ) {
     debug( "Corrupted IPv4 header ( checksum verification error )." );
     return false;
   }
@@ -20,9 +20,13 @@
 
 #include <assert.h>
 #include "linked_list.h"
+#include "object_pool.h"
 #include "wrapper.h"
 
 
+static object_pool list_element_pool = OBJECT_POOL_INITIALIZER( "list_element", sizeof( list_element ) );
+
+
 bool
 create_list( list_element **list ) {
   assert( list != NULL );
@@ -37,7 +41,7 @@ insert_in_front( list_element **head, void *data ) {
   assert( head != NULL );
 
   list_element *old_head = *head;
-  list_element *new_head = xmalloc( sizeof( list_element ) );
+  list_element *new_head = allocate_object( &list_element_pool );
 
   new_head->data = data;
   *head = new_head;
@@ -55,7 +59,7 @@ insert_before( list_element **head, const void *sibling, void *data ) {
 
   for ( e = *head; e->next != NULL; e = e->next ) {
     if ( e->next->data == sibling ) {
-      new_element = xmalloc( sizeof( list_element ) );
+      new_element = allocate_object( &list_element_pool );
       new_element->next = e->next;
       new_element->data = data;
       e->next = new_element;
@@ -72,7 +76,7 @@ append_to_tail( list_element **head, void *data ) {
   assert( head != NULL );
 
   list_element *e;
-  list_element *new_tail = xmalloc( sizeof( list_element ) );
+  list_element *new_tail = allocate_object( &list_element_pool );
 
   new_tail->data = data;
   new_tail->next = NULL;
@@ -108,7 +112,7 @@ delete_element( list_element **head, const void *data ) {
 
   if ( e->data == data ) {
     *head = e->next;
-    xfree( e );
+    free_object( &list_element_pool, e );
     return true;
   }
 
@@ -116,7 +120,7 @@ delete_element( list_element **head, const void *data ) {
     if ( e->next->data == data ) {
       delete_me = e->next;
       e->next = e->next->next;
-      xfree( delete_me );
+      free_object( &list_element_pool, delete_me );
       return true;
     }
   }
@@ -133,7 +137,7 @@ delete_list( list_element *head ) {
   for ( e = head; e != NULL; ) {
     delete_me = e;
     e = e->next;
-    xfree( delete_me );
+    free_object( &list_element_pool, delete_me );
   }
   return true;
 }
@@ -19,7 +19,9 @@
 
 
 #include <assert.h>
+#include <inttypes.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -69,10 +71,15 @@ extern int mock_printf( const char *format, ... );
 #endif // UNIT_TESTING
 
 
+// The functions below are the targets of the info() and debug() macros.
+#undef info
+#undef debug
+
+
 static void log_stdout( int priority, const char *format, va_list ap );
 
 
-static int level = LOG_INFO;
+int _logging_level = LOG_INFO;
 static const int level_min = LOG_CRIT;
 static const int level_max = LOG_DEBUG;
 static pthread_mutex_t mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
@@ -123,6 +130,44 @@ static priority priority_list[] = {
 static void ( *do_log )( int priority, const char *format, va_list ap ) = NULL;
 
 
+#define ASYNC_LOG_LINE_LENGTH 1024
+#define ASYNC_LOG_DEFAULT_LINES 1024
+
+
+#ifndef _DOXYGEN
+
+/*
+ * A bounded multi-producer, single-consumer ring of preformatted lines.
+ * A slot is free for the producer holding ticket n if its sequence is n,
+ * and holds a line for the writer if its sequence is n + 1.
+ */
+typedef struct async_log_slot {
+  volatile uint64_t sequence;
+  int priority;
+  char line[ ASYNC_LOG_LINE_LENGTH ];
+} async_log_slot;
+
+typedef struct async_log_ring {
+  async_log_slot *slots;
+  uint64_t mask;
+  volatile uint64_t head;
+  uint64_t tail;
+  volatile int writer_sleeping;
+  volatile bool writer_running;
+  volatile bool stopping;
+  pthread_t writer;
+  sem_t wakeup;
+} async_log_ring;
+
+#endif // _DOXYGEN
+
+
+static async_log_ring *async_ring = NULL;
+static volatile uint64_t async_log_written = 0;
+static volatile uint64_t async_log_dropped = 0;
+static uint64_t async_log_dropped_reported = 0;
+
+
 static int
 logging_level_from( const char *name ) {
   assert( name != NULL );
@@ -151,6 +196,9 @@ init_log( const char *ident, bool run_as_daemon ) {
   if ( level != NULL ) {
     set_logging_level( level );
   }
+  if ( getenv( "LOGGING_ASYNC" ) != NULL ) {
+    enable_async_logging( ASYNC_LOG_DEFAULT_LINES );
+  }
   pthread_mutex_unlock( &mutex );
 
   return true;
@@ -164,7 +212,7 @@ set_logging_level( const char *name ) {
     die( "Invalid logging level: %s", name );
   }
   pthread_mutex_lock( &mutex );
-  level = newLevel;
+  _logging_level = newLevel;
   pthread_mutex_unlock( &mutex );
 
   return true;
@@ -173,24 +221,295 @@ set_logging_level( const char *name ) {
 
 int
 get_logging_level( void ) {
-  return level;
+  return _logging_level;
+}
+
+
+static void
+write_log_line( int priority, const char *format, ... ) {
+  va_list args;
+  va_start( args, format );
+  pthread_mutex_lock( &mutex );
+  ( *do_log )( priority, format, args );
+  pthread_mutex_unlock( &mutex );
+  va_end( args );
+}
+
+
+static void
+wake_up_async_log_writer( async_log_ring *ring ) {
+  __sync_synchronize();
+  if ( ring->writer_sleeping && __sync_bool_compare_and_swap( &ring->writer_sleeping, 1, 0 ) ) {
+    sem_post( &ring->wakeup );
+  }
+}
+
+
+static bool
+async_log_is_ready( async_log_ring *ring ) {
+  return ring->slots[ ring->tail & ring->mask ].sequence == ring->tail + 1;
+}
+
+
+static bool
+write_async_log( async_log_ring *ring ) {
+  uint64_t dropped = async_log_dropped;
+  if ( dropped != async_log_dropped_reported ) {
+    write_log_line( LOG_WARNING, "%" PRIu64 " log messages were dropped.", dropped - async_log_dropped_reported );
+    async_log_dropped_reported = dropped;
+  }
+
+  if ( !async_log_is_ready( ring ) ) {
+    return false;
+  }
+  async_log_slot *slot = &ring->slots[ ring->tail & ring->mask ];
+  write_log_line( slot->priority, "%s", slot->line );
+  __sync_synchronize();
+  slot->sequence = ring->tail + ring->mask + 1;
+  ring->tail++;
+  __sync_fetch_and_add( &async_log_written, 1 );
+
+  return true;
+}
+
+
+static void *
+async_log_writer( void *data ) {
+  async_log_ring *ring = data;
+
+  while ( true ) {
+    if ( write_async_log( ring ) ) {
+      continue;
+    }
+    if ( ring->stopping ) {
+      break;
+    }
+    ring->writer_sleeping = 1;
+    __sync_synchronize();
+    if ( async_log_is_ready( ring ) && __sync_bool_compare_and_swap( &ring->writer_sleeping, 1, 0 ) ) {
+      continue;
+    }
+    while ( sem_wait( &ring->wakeup ) != 0 ) {
+      // Interrupted by a signal.
+    }
+  }
+
+  return NULL;
+}
+
+
+static bool
+start_async_log_writer( async_log_ring *ring ) {
+  ring->writer_sleeping = 0;
+  ring->stopping = false;
+  if ( pthread_create( &ring->writer, NULL, async_log_writer, ring ) != 0 ) {
+    return false;
+  }
+  ring->writer_running = true;
+
+  return true;
+}
+
+
+static void
+prepare_async_log_for_fork( void ) {
+  // Keep the writer and other loggers out of do_log() while forking.
+  pthread_mutex_lock( &mutex );
+}
+
+
+static void
+resume_async_log_in_parent( void ) {
+  pthread_mutex_unlock( &mutex );
+}
+
+
+static void
+restart_async_log_writer_in_child( void ) {
+  // Only the forking thread survives fork(). Lines still in the ring are
+  // written by the parent, and slots claimed by other threads would never
+  // be filled, so the child starts with an empty ring. The writer is
+  // started again on demand.
+  if ( async_ring != NULL ) {
+    uint64_t n_slots = async_ring->mask + 1;
+    for ( uint64_t i = 0; i < n_slots; i++ ) {
+      async_ring->slots[ i ].sequence = i;
+    }
+    async_ring->head = 0;
+    async_ring->tail = 0;
+    async_ring->writer_sleeping = 0;
+    async_ring->stopping = false;
+    async_ring->writer_running = false;
+    sem_init( &async_ring->wakeup, 0, 0 );
+  }
+  async_log_dropped_reported = async_log_dropped;
+
+  // The child's thread id differs from the parent's, so the lock taken in
+  // prepare_async_log_for_fork() cannot be released but only reinitialized.
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init( &attr );
+  pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE_NP );
+  pthread_mutex_init( &mutex, &attr );
+  pthread_mutexattr_destroy( &attr );
+}
+
+
+static void
+push_async_log( async_log_ring *ring, int priority, const char *format, va_list ap ) {
+  if ( !ring->writer_running ) {
+    pthread_mutex_lock( &mutex );
+    if ( !ring->writer_running ) {
+      start_async_log_writer( ring );
+    }
+    pthread_mutex_unlock( &mutex );
+  }
+
+  uint64_t head = ring->head;
+  async_log_slot *slot;
+  while ( true ) {
+    slot = &ring->slots[ head & ring->mask ];
+    uint64_t sequence = slot->sequence;
+    if ( sequence == head ) {
+      if ( __sync_bool_compare_and_swap( &ring->head, head, head + 1 ) ) {
+        break;
+      }
+    }
+    else if ( sequence < head ) {
+      // Never block the caller. The writer reports how many were lost.
+      __sync_fetch_and_add( &async_log_dropped, 1 );
+      wake_up_async_log_writer( ring );
+      return;
+    }
+    head = ring->head;
+  }
+
+  slot->priority = priority;
+  vsnprintf( slot->line, sizeof( slot->line ), format, ap );
+  __sync_synchronize();
+  slot->sequence = head + 1;
+
+  wake_up_async_log_writer( ring );
+}
+
+
+static void
+disable_async_logging_at_exit( void ) {
+  disable_async_logging();
+}
+
+
+/**
+ * Switches to asynchronous logging. Messages are formatted into a ring of
+ * `lines' slots ( rounded up to a power of two ) and written to syslog or
+ * stdout by a background thread, so that callers never block on output.
+ * Messages that do not fit into the ring are dropped and counted. Lines
+ * longer than ASYNC_LOG_LINE_LENGTH are truncated.
+ */
+bool
+enable_async_logging( size_t lines ) {
+  static bool handlers_registered = false;
+
+  pthread_mutex_lock( &mutex );
+
+  if ( async_ring != NULL ) {
+    pthread_mutex_unlock( &mutex );
+    return true;
+  }
+
+  uint64_t n_slots = 2;
+  while ( n_slots < lines ) {
+    n_slots <<= 1;
+  }
+  async_log_ring *ring = xmalloc( sizeof( async_log_ring ) );
+  memset( ring, 0, sizeof( async_log_ring ) );
+  ring->slots = xmalloc( sizeof( async_log_slot ) * n_slots );
+  for ( uint64_t i = 0; i < n_slots; i++ ) {
+    ring->slots[ i ].sequence = i;
+  }
+  ring->mask = n_slots - 1;
+  sem_init( &ring->wakeup, 0, 0 );
+  if ( !start_async_log_writer( ring ) ) {
+    sem_destroy( &ring->wakeup );
+    xfree( ring->slots );
+    xfree( ring );
+    pthread_mutex_unlock( &mutex );
+    return false;
+  }
+
+  if ( !handlers_registered ) {
+    pthread_atfork( prepare_async_log_for_fork, resume_async_log_in_parent, restart_async_log_writer_in_child );
+    atexit( disable_async_logging_at_exit );
+    handlers_registered = true;
+  }
+  async_ring = ring;
+
+  pthread_mutex_unlock( &mutex );
+
+  return true;
+}
+
+
+/**
+ * Writes out all pending messages and switches back to synchronous
+ * logging. Must not be called while other threads are logging.
+ */
+bool
+disable_async_logging( void ) {
+  pthread_mutex_lock( &mutex );
+  async_log_ring *ring = async_ring;
+  async_ring = NULL;
+  pthread_mutex_unlock( &mutex );
+
+  if ( ring == NULL ) {
+    return false;
+  }
+
+  if ( ring->writer_running ) {
+    ring->stopping = true;
+    sem_post( &ring->wakeup );
+    pthread_join( ring->writer, NULL );
+  }
+  while ( write_async_log( ring ) ) {
+    // Flush messages left by a writer that did not survive fork().
+  }
+  sem_destroy( &ring->wakeup );
+  xfree( ring->slots );
+  xfree( ring );
+
+  return true;
+}
+
+
+void
+get_async_logging_stats( uint64_t *written, uint64_t *dropped ) {
+  assert( written != NULL );
+  assert( dropped != NULL );
+
+  *written = async_log_written;
+  *dropped = async_log_dropped;
 }
 
 
 #ifndef _DOXYGEN
 
-#define DO_LOG( _priority, _format )                \
-  do {                                              \
-    assert( do_log != NULL );                       \
-    assert( _format != NULL );                      \
-    if ( level >= _priority ) {                     \
-      pthread_mutex_lock( &mutex );                 \
-      va_list _args;                                \
-      va_start( _args, _format );                   \
-      ( *do_log )( _priority, _format, _args );     \
-      va_end( _args );                              \
-      pthread_mutex_unlock( &mutex );               \
-    }                                               \
+#define DO_LOG( _priority, _format )                          \
+  do {                                                        \
+    assert( do_log != NULL );                                 \
+    assert( _format != NULL );                                \
+    if ( _logging_level >= _priority ) {                      \
+      va_list _args;                                          \
+      va_start( _args, _format );                             \
+      async_log_ring *_ring = async_ring;                     \
+      if ( _ring != NULL ) {                                  \
+        push_async_log( _ring, _priority, _format, _args );   \
+      }                                                       \
+      else {                                                  \
+        pthread_mutex_lock( &mutex );                         \
+        ( *do_log )( _priority, _format, _args );             \
+        pthread_mutex_unlock( &mutex );                       \
+      }                                                       \
+      va_end( _args );                                        \
+    }                                                         \
   } while ( 0 )
 
 #endif // _DOXYGEN
@@ -236,7 +555,7 @@ static void
 log_stdout( int priority, const char *format, va_list ap ) {
   UNUSED( priority );
 
-  char format_newline[ strlen( format ) + 1 ];
+  char format_newline[ strlen( format ) + 2 ];
   sprintf( format_newline, "%s\n", format );
   vprintf( format_newline, ap );
 }
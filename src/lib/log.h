@@ -27,13 +27,35 @@
 #define LOG_H
 
 
+#include <stddef.h>
+#include <stdint.h>
 #include <syslog.h>
 #include "bool.h"
 
 
+/*
+ * Messages less important than LOG_MAX_LEVEL are compiled out. Release
+ * builds ( -DNDEBUG ) drop debug messages unless LOG_MAX_LEVEL is given
+ * explicitly, e.g. -DLOG_MAX_LEVEL=LOG_DEBUG.
+ */
+#ifndef LOG_MAX_LEVEL
+#ifdef NDEBUG
+#define LOG_MAX_LEVEL LOG_INFO
+#else
+#define LOG_MAX_LEVEL LOG_DEBUG
+#endif
+#endif
+
+
+extern int _logging_level;
+
+
 bool init_log( const char *ident, bool run_as_daemon );
 bool set_logging_level( const char *level );
 int get_logging_level( void );
+bool enable_async_logging( size_t lines );
+bool disable_async_logging( void );
+void get_async_logging_stats( uint64_t *written, uint64_t *dropped );
 void critical( const char *format, ... );
 void error( const char *format, ... );
 void warn( const char *format, ... );
@@ -42,6 +64,28 @@ void info( const char *format, ... );
 void debug( const char *format, ... );
 
 
+#define logging_level_is_enabled( _priority )                          \
+  ( ( _priority ) <= LOG_MAX_LEVEL && ( _priority ) <= _logging_level )
+
+/*
+ * info() and debug() are called on hot paths with many arguments, so
+ * check the logging level before the arguments are evaluated.
+ */
+#define info( ... )                                 \
+  do {                                              \
+    if ( logging_level_is_enabled( LOG_INFO ) ) {   \
+      info( __VA_ARGS__ );                          \
+    }                                               \
+  } while ( 0 )
+
+#define debug( ... )                                \
+  do {                                              \
+    if ( logging_level_is_enabled( LOG_DEBUG ) ) {  \
+      debug( __VA_ARGS__ );                         \
+    }                                               \
+  } while ( 0 )
+
+
 #endif // LOG_H
 
 
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <openflow.h>
 #include "checks.h"
+#include "linked_list.h"
 #include "match_table.h"
 #include "match.h"
 #include "log.h"
@@ -35,12 +36,37 @@
 #endif // UNIT_TESTING
 
 
+/*
+ * Entries with wildcards are classified by tuple space search. Entries
+ * sharing the same wildcards form a tuple, in which they are hashed by the
+ * fields that are not wildcarded. Tuples are probed in the order of the
+ * highest priority of their entries, so that the search ends as soon as no
+ * better entry can be found.
+ */
 typedef struct match_table {
   hash_table *exact_table; // no wildcards are set
-  list_element *wildcard_table; // wildcard flags are set
+  list_element *wildcard_table; // tuples of entries with wildcards, highest priority first
   pthread_mutex_t *mutex;
+  uint64_t last_serial;
 } match_table;
 
+typedef struct private_match_entry {
+  match_entry public;
+  uint64_t serial; // the newest entry wins among entries of the same priority
+} private_match_entry;
+
+typedef struct wildcard_tuple {
+  uint32_t wildcards;
+  uint16_t max_priority; // upper bound of the priorities of the entries
+  unsigned int n_entries;
+  hash_table *buckets;
+} wildcard_tuple;
+
+typedef struct wildcard_bucket {
+  struct ofp_match key; // masked by the wildcards of the tuple
+  list_element *entries; // in lookup order
+} wildcard_bucket;
+
 
 static match_table match_table_head;
 
@@ -78,17 +104,61 @@ hash_match_entry( const void *key ) {
 }
 
 
+/*
+ * Clears the fields wildcarded by `wildcards'. The result has no wildcards
+ * set, so that it can be looked up in a hash table.
+ */
+static void
+mask_match( struct ofp_match *masked, const struct ofp_match *ofp_match, uint32_t wildcards ) {
+  memset( masked, 0, sizeof( struct ofp_match ) );
+
+  if ( !( wildcards & OFPFW_IN_PORT ) ) {
+    masked->in_port = ofp_match->in_port;
+  }
+  if ( !( wildcards & OFPFW_DL_SRC ) ) {
+    memcpy( masked->dl_src, ofp_match->dl_src, OFP_ETH_ALEN );
+  }
+  if ( !( wildcards & OFPFW_DL_DST ) ) {
+    memcpy( masked->dl_dst, ofp_match->dl_dst, OFP_ETH_ALEN );
+  }
+  if ( !( wildcards & OFPFW_DL_VLAN ) ) {
+    masked->dl_vlan = ofp_match->dl_vlan;
+  }
+  if ( !( wildcards & OFPFW_DL_VLAN_PCP ) ) {
+    masked->dl_vlan_pcp = ofp_match->dl_vlan_pcp;
+  }
+  if ( !( wildcards & OFPFW_DL_TYPE ) ) {
+    masked->dl_type = ofp_match->dl_type;
+  }
+  if ( !( wildcards & OFPFW_NW_TOS ) ) {
+    masked->nw_tos = ofp_match->nw_tos;
+  }
+  if ( !( wildcards & OFPFW_NW_PROTO ) ) {
+    masked->nw_proto = ofp_match->nw_proto;
+  }
+  masked->nw_src = ofp_match->nw_src & create_nw_src_mask( wildcards );
+  masked->nw_dst = ofp_match->nw_dst & create_nw_dst_mask( wildcards );
+  if ( !( wildcards & OFPFW_TP_SRC ) ) {
+    masked->tp_src = ofp_match->tp_src;
+  }
+  if ( !( wildcards & OFPFW_TP_DST ) ) {
+    masked->tp_dst = ofp_match->tp_dst;
+  }
+}
+
+
 static match_entry *
 allocate_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name, const char *entry_name ) {
-  match_entry *new_entry;
+  private_match_entry *new_entry;
 
-  new_entry = xmalloc( sizeof( match_entry ) );
-  new_entry->ofp_match = *ofp_match;
-  new_entry->priority = priority;
-  new_entry->service_name = xstrdup( service_name );
-  new_entry->entry_name = xstrdup( entry_name );
+  new_entry = xmalloc( sizeof( private_match_entry ) );
+  new_entry->public.ofp_match = *ofp_match;
+  new_entry->public.priority = priority;
+  new_entry->public.service_name = xstrdup( service_name );
+  new_entry->public.entry_name = xstrdup( entry_name );
+  new_entry->serial = ++match_table_head.last_serial;
 
-  return new_entry;
+  return ( match_entry * ) new_entry;
 }
 
 
@@ -112,10 +182,71 @@ free_match_table_walker( void *key, void *value, void *user_data ) {
 }
 
 
+static void
+free_wildcard_bucket_walker( void *key, void *value, void *user_data ) {
+  wildcard_bucket *bucket = value;
+  list_element *list;
+
+  UNUSED( key );
+  UNUSED( user_data );
+
+  for ( list = bucket->entries; list != NULL; list = list->next ) {
+    free_match_entry( list->data );
+  }
+  delete_list( bucket->entries );
+  xfree( bucket );
+}
+
+
+static void
+free_wildcard_tuple( wildcard_tuple *tuple ) {
+  delete_hash( tuple->buckets );
+  xfree( tuple );
+}
+
+
+static wildcard_tuple *
+lookup_wildcard_tuple( uint32_t wildcards ) {
+  list_element *list;
+
+  for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
+    wildcard_tuple *tuple = list->data;
+    if ( tuple->wildcards == wildcards ) {
+      return tuple;
+    }
+  }
+
+  return NULL;
+}
+
+
+static void
+insert_wildcard_tuple_in_order( wildcard_tuple *tuple ) {
+  list_element *list;
+
+  for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
+    wildcard_tuple *other = list->data;
+    if ( other->max_priority <= tuple->max_priority ) {
+      break;
+    }
+  }
+  if ( list == NULL ) {
+    append_to_tail( &match_table_head.wildcard_table, tuple );
+  }
+  else if ( list == match_table_head.wildcard_table ) {
+    insert_in_front( &match_table_head.wildcard_table, tuple );
+  }
+  else {
+    insert_before( &match_table_head.wildcard_table, list->data, tuple );
+  }
+}
+
+
 void
 init_match_table( void ) {
   match_table_head.exact_table = create_hash( compare_match_entry, hash_match_entry );
   create_list( &match_table_head.wildcard_table );
+  match_table_head.last_serial = 0;
 
   pthread_mutexattr_t attr;
   pthread_mutexattr_init( &attr );
@@ -136,7 +267,9 @@ finalize_match_table( void ) {
   match_table_head.exact_table = NULL;
 
   for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
-    free_match_entry( list->data );
+    wildcard_tuple *tuple = list->data;
+    foreach_hash( tuple->buckets, free_wildcard_bucket_walker, NULL );
+    free_wildcard_tuple( tuple );
   }
   delete_list( match_table_head.wildcard_table );
   match_table_head.wildcard_table = NULL;
@@ -148,10 +281,59 @@ finalize_match_table( void ) {
 }
 
 
+static void
+insert_wildcard_entry( match_entry *new_entry ) {
+  uint32_t wildcards = new_entry->ofp_match.wildcards & OFPFW_ALL;
+
+  wildcard_tuple *tuple = lookup_wildcard_tuple( wildcards );
+  if ( tuple == NULL ) {
+    tuple = xmalloc( sizeof( wildcard_tuple ) );
+    tuple->wildcards = wildcards;
+    tuple->max_priority = new_entry->priority;
+    tuple->n_entries = 0;
+    tuple->buckets = create_hash( compare_match_entry, hash_match_entry );
+    insert_wildcard_tuple_in_order( tuple );
+  }
+  else if ( tuple->max_priority < new_entry->priority ) {
+    tuple->max_priority = new_entry->priority;
+    delete_element( &match_table_head.wildcard_table, tuple );
+    insert_wildcard_tuple_in_order( tuple );
+  }
+
+  struct ofp_match key;
+  mask_match( &key, &new_entry->ofp_match, wildcards );
+  wildcard_bucket *bucket = lookup_hash_entry( tuple->buckets, &key );
+  if ( bucket == NULL ) {
+    bucket = xmalloc( sizeof( wildcard_bucket ) );
+    bucket->key = key;
+    create_list( &bucket->entries );
+    insert_hash_entry( tuple->buckets, &bucket->key, bucket );
+  }
+  tuple->n_entries++;
+
+  // The new entry goes before older entries of the same priority.
+  list_element *list;
+  for ( list = bucket->entries; list != NULL; list = list->next ) {
+    match_entry *entry = list->data;
+    if ( entry->priority <= new_entry->priority ) {
+      break;
+    }
+  }
+  if ( list == NULL ) {
+    append_to_tail( &bucket->entries, new_entry );
+  }
+  else if ( list == bucket->entries ) {
+    insert_in_front( &bucket->entries, new_entry );
+  }
+  else {
+    insert_before( &bucket->entries, list->data, new_entry );
+  }
+}
+
+
 void
 insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *service_name, const char *entry_name ) {
   match_entry *new_entry, *entry;
-  list_element *list;
 
   pthread_mutex_lock( match_table_head.mutex );
 
@@ -171,65 +353,74 @@ insert_match_entry( struct ofp_match *ofp_match, uint16_t priority, const char *
   }
 
   // wildcard flags are set
-  for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
-    entry = list->data;
-    if ( entry->priority <= new_entry->priority ) {
-      break;
-    }
+  insert_wildcard_entry( new_entry );
+  pthread_mutex_unlock( match_table_head.mutex );
+}
+
+
+static match_entry *
+delete_wildcard_entry( struct ofp_match *ofp_match ) {
+  uint32_t wildcards = ofp_match->wildcards & OFPFW_ALL;
+
+  wildcard_tuple *tuple = lookup_wildcard_tuple( wildcards );
+  if ( tuple == NULL ) {
+    return NULL;
   }
-  if ( list == NULL ) {
-    // wildcard_table is null or tail
-    append_to_tail( &match_table_head.wildcard_table, new_entry );
-    pthread_mutex_unlock( match_table_head.mutex );
-    return;
+
+  struct ofp_match key;
+  mask_match( &key, ofp_match, wildcards );
+  wildcard_bucket *bucket = lookup_hash_entry( tuple->buckets, &key );
+  if ( bucket == NULL ) {
+    return NULL;
   }
-  if ( list == match_table_head.wildcard_table ) {
-    // head
-    insert_in_front( &match_table_head.wildcard_table, new_entry );
-    pthread_mutex_unlock( match_table_head.mutex );
-    return;
+
+  match_entry *delete_entry = bucket->entries->data;
+  delete_element( &bucket->entries, delete_entry );
+  if ( bucket->entries == NULL ) {
+    delete_hash_entry( tuple->buckets, &bucket->key );
+    xfree( bucket );
+  }
+  if ( --tuple->n_entries == 0 ) {
+    delete_element( &match_table_head.wildcard_table, tuple );
+    free_wildcard_tuple( tuple );
   }
 
-  // insert brefore
-  insert_before( &match_table_head.wildcard_table, list->data, new_entry );
-  pthread_mutex_unlock( match_table_head.mutex );
+  return delete_entry;
 }
 
 
 void
 delete_match_entry( struct ofp_match *ofp_match ) {
   match_entry *delete_entry;
-  list_element *list;
 
   pthread_mutex_lock( match_table_head.mutex );
 
   assert( ofp_match != NULL );
   if ( !ofp_match->wildcards ) {
     delete_entry = delete_hash_entry( match_table_head.exact_table, ofp_match );
-    if ( delete_entry == NULL ) {
-      pthread_mutex_unlock( match_table_head.mutex );
-      return;
-    }
   }
   else {
-    for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
-      delete_entry = list->data;
-      if ( ( ( ( delete_entry->ofp_match.wildcards ^ ofp_match->wildcards ) & OFPFW_ALL ) == 0 )
-          && compare_match( &delete_entry->ofp_match, ofp_match ) ) {
-        break;
-      }
-    }
-    if ( list == NULL ) {
-      pthread_mutex_unlock( match_table_head.mutex );
-      return;
-    }
-    delete_element( &match_table_head.wildcard_table, delete_entry );
+    delete_entry = delete_wildcard_entry( ofp_match );
+  }
+  if ( delete_entry == NULL ) {
+    pthread_mutex_unlock( match_table_head.mutex );
+    return;
   }
   free_match_entry( delete_entry );
   pthread_mutex_unlock( match_table_head.mutex );
 }
 
 
+static bool
+precedes( const match_entry *x, const match_entry *y ) {
+  if ( x->priority != y->priority ) {
+    return x->priority > y->priority;
+  }
+
+  return ( ( const private_match_entry * ) x )->serial > ( ( const private_match_entry * ) y )->serial;
+}
+
+
 match_entry *
 lookup_match_entry( struct ofp_match *ofp_match ) {
   match_entry *entry;
@@ -244,16 +435,21 @@ lookup_match_entry( struct ofp_match *ofp_match ) {
   }
 
   for ( list = match_table_head.wildcard_table; list != NULL; list = list->next ) {
-    entry = list->data;
-    if ( compare_match( &entry->ofp_match, ofp_match ) ) {
-      pthread_mutex_unlock( match_table_head.mutex );
-      return entry;
+    wildcard_tuple *tuple = list->data;
+    if ( entry != NULL && tuple->max_priority < entry->priority ) {
+      break;
+    }
+    struct ofp_match key;
+    mask_match( &key, ofp_match, tuple->wildcards );
+    wildcard_bucket *bucket = lookup_hash_entry( tuple->buckets, &key );
+    if ( bucket != NULL && ( entry == NULL || precedes( bucket->entries->data, entry ) ) ) {
+      entry = bucket->entries->data;
     }
   }
 
   pthread_mutex_unlock( match_table_head.mutex );
 
-  return NULL;
+  return entry;
 }
 
 
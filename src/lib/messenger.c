@@ -21,17 +21,22 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <linux/limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include "doubly_linked_list.h"
+#include "event_handler.h"
 #include "hash_table.h"
 #include "log.h"
 #include "messenger.h"
+#include "shared_memory_ring.h"
 #include "timer.h"
 #include "wrapper.h"
 
@@ -71,12 +76,6 @@ extern int mock_close( int fd );
 #define connect mock_connect
 extern int mock_connect( int sockfd, const struct sockaddr *addr, socklen_t addrlen );
 
-#ifdef select
-#undef select
-#endif
-#define select mock_select
-extern int mock_select( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout );
-
 #ifdef accept
 #undef accept
 #endif
@@ -89,12 +88,24 @@ extern int mock_accept( int sockfd, struct sockaddr *addr, socklen_t *addrlen );
 #define recv mock_recv
 extern ssize_t mock_recv( int sockfd, void *buf, size_t len, int flags );
 
+#ifdef recvmsg
+#undef recvmsg
+#endif
+#define recvmsg mock_recvmsg
+extern ssize_t mock_recvmsg( int sockfd, struct msghdr *msg, int flags );
+
 #ifdef send
 #undef send
 #endif
 #define send mock_send
 extern ssize_t mock_send( int sockfd, const void *buf, size_t len, int flags );
 
+#ifdef sendmsg
+#undef sendmsg
+#endif
+#define sendmsg mock_sendmsg
+extern ssize_t mock_sendmsg( int sockfd, const struct msghdr *msg, int flags );
+
 #ifdef setsockopt
 #undef setsockopt
 #endif
@@ -137,6 +148,12 @@ extern bool mock_add_periodic_event_callback( const time_t seconds, void ( *call
 #define execute_timer_events mock_execute_timer_events
 extern void mock_execute_timer_events( void );
 
+#ifdef get_next_timer_event_timeout
+#undef get_next_timer_event_timeout
+#endif
+#define get_next_timer_event_timeout mock_get_next_timer_event_timeout
+extern bool mock_get_next_timer_event_timeout( struct timespec *timeout );
+
 #endif // UNIT_TESTING
 
 
@@ -144,6 +161,10 @@ enum {
   MESSAGE_TYPE_NOTIFY,
   MESSAGE_TYPE_REQUEST,
   MESSAGE_TYPE_REPLY,
+  // Internal messages for negotiating the shared memory transport.
+  MESSAGE_TYPE_RING_OFFER,
+  MESSAGE_TYPE_RING_ACCEPT,
+  MESSAGE_TYPE_RING_START,
 };
 
 typedef struct message_header {
@@ -163,6 +184,10 @@ typedef struct message_buffer {
 
 typedef struct messenger_socket {
   int fd;
+  shared_memory_ring *ring;
+  bool ring_started;
+  bool ring_dispatching;
+  struct receive_queue *rq;
 } messenger_socket;
 
 typedef struct messenger_context {
@@ -192,12 +217,29 @@ typedef struct send_queue {
   struct timespec reconnect_at;
   struct sockaddr_un server_addr;
   message_buffer *buffer;
+  shared_memory_ring *ring;
+  bool ring_active;
+  uint64_t send_syscalls;
+  uint64_t sent_messages;
 } send_queue;
 
 
 #define MESSENGER_RECV_BUFFER 100000
+#define MESSENGER_SEND_BATCH_SIZE MESSENGER_RECV_BUFFER
 static const uint32_t messenger_send_queue_length = 100000;
 static const uint32_t messenger_recv_queue_length = 200000;
+static const size_t messenger_ring_size = 1048576;
+static const size_t messenger_send_budget = 1048576;
+
+// Dump records are timestamped with a coarse clock, which is read from
+// memory updated by the kernel on every tick, without a system call.
+#ifdef CLOCK_REALTIME_COARSE
+#define MESSENGER_DUMP_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define MESSENGER_DUMP_CLOCK CLOCK_REALTIME
+#endif
+// The maximum number of pieces a message is gathered from
+#define MESSENGER_MAX_IOVEC 8
 
 char socket_directory[ PATH_MAX ];
 static bool running = false;
@@ -208,12 +250,23 @@ static hash_table *send_queues = NULL;
 static hash_table *context_db = NULL;
 static char *_dump_service_name = NULL;
 static char *_dump_app_name = NULL;
-static void ( *external_fd_set )( fd_set *read_set, fd_set *write_set ) = NULL;
-static void ( *external_check_fd_isset )( fd_set *read_set, fd_set *write_set ) = NULL;
+static size_t _dump_app_name_length = 0;
+static unsigned int dump_sampling_rate = 1;
+static unsigned int dump_sampling_count = 0;
 static uint32_t last_transaction_id = 0;
+static int dispatch_depth = 0;
+static bool shared_memory_enabled = false;
 static void ( *external_callback )( void ) = NULL;
 
 
+static void on_accept( int fd, void *data );
+static void on_recv( int fd, void *data );
+static void on_send_read( int fd, void *data );
+static void on_send_write( int fd, void *data );
+static void on_ring_readable( int fd, void *data );
+static void drain_client_ring( messenger_socket *client );
+
+
 static void
 _delete_context( void *key, void *value, void *user_data ) {
   assert( value != NULL );
@@ -272,10 +325,25 @@ init_messenger( const char *working_directory ) {
   strcpy( socket_directory, working_directory );
   debug( "Initializing messenger (working_directory = %s).", socket_directory );
 
+  if ( !init_event_handler() ) {
+    error( "Failed to initialize event handler." );
+    return false;
+  }
+
   receive_queues = create_hash( compare_string, hash_string );
   send_queues = create_hash( compare_string, hash_string );
   context_db = create_hash( compare_uint32, hash_uint32 );
 
+  // Local services exchange messages over shared memory rings if enabled.
+  const char *shared_memory = getenv( "TREMA_MESSENGER_SHARED_MEMORY" );
+  shared_memory_enabled = ( shared_memory != NULL && strcmp( shared_memory, "0" ) != 0 );
+
+  // Only one in every N sent or received messages is dumped if set.
+  const char *sampling = getenv( "TREMA_MESSENGER_DUMP_SAMPLING" );
+  if ( sampling != NULL && atoi( sampling ) > 1 ) {
+    dump_sampling_rate = ( unsigned int ) atoi( sampling );
+  }
+
   initialized = true;
   finalized = false;
 
@@ -310,16 +378,29 @@ get_message_buffer_head( message_buffer *buf ) {
 }
 
 
+static void
+release_send_queue_ring( send_queue *sq ) {
+  if ( sq->ring != NULL ) {
+    delete_shared_memory_ring( sq->ring );
+    sq->ring = NULL;
+  }
+  sq->ring_active = false;
+}
+
+
 static void
 delete_send_queue( send_queue *sq ) {
   assert( NULL != sq );
 
-  debug( "Deleting a send queue ( service_name = %s, fd = %d ).", sq->service_name, sq->server_socket );
+  debug( "Deleting a send queue ( service_name = %s, fd = %d, send_syscalls = %" PRIu64 ", sent_messages = %" PRIu64 " ).",
+         sq->service_name, sq->server_socket, sq->send_syscalls, sq->sent_messages );
 
   free_message_buffer( sq->buffer );
   if ( sq->server_socket != -1 ) {
+    delete_fd_handler( sq->server_socket );
     close( sq->server_socket );
   }
+  release_send_queue_ring( sq );
   if ( send_queues != NULL ) {
     delete_hash_entry( send_queues, sq->service_name );
   }
@@ -351,17 +432,17 @@ delete_all_send_queues() {
 }
 
 
-static void
-send_dump_message( uint16_t dump_type, const char *service_name, const void *data, uint32_t data_len ) {
-  assert( service_name != NULL );
+static bool push_iovec_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const struct iovec *data, int count );
 
-  debug( "Sending a dump message ( dump_type = %#x, service_name = %s, data = %p, data_len = %u ).",
-         dump_type, service_name, data, data_len );
 
-  size_t service_name_len, app_name_len;
-  char *dump_buf, *p;
-  message_dump_header *dump_hdr;
-  size_t dump_buf_len;
+/**
+ * sends a dump record of a message gathered from `count' pieces to the
+ * dump service. no memory is allocated and the pieces are copied only
+ * into the send queue ( or the shared memory ring ) of the dump service.
+ */
+static void
+send_dump_messagev( uint16_t dump_type, const char *service_name, const struct iovec *data, int count ) {
+  assert( service_name != NULL );
 
   if ( _dump_service_name == NULL ) {
     debug( "Dump service name is not set." );
@@ -371,43 +452,68 @@ send_dump_message( uint16_t dump_type, const char *service_name, const void *dat
     debug( "Source service name and destination service name are the same ( service name = %s ).", service_name );
     return;
   }
+  if ( dump_sampling_rate > 1 && ( dump_type == MESSENGER_DUMP_SENT || dump_type == MESSENGER_DUMP_RECEIVED ) ) {
+    if ( ++dump_sampling_count < dump_sampling_rate ) {
+      return;
+    }
+    dump_sampling_count = 0;
+  }
+  assert( count >= 0 && count <= MESSENGER_MAX_IOVEC - 4 );
 
   struct timespec now;
-  if ( clock_gettime( CLOCK_REALTIME, &now ) == -1 ) {
+  if ( clock_gettime( MESSENGER_DUMP_CLOCK, &now ) == -1 ) {
     error( "Failed to retrieve system-wide real-time clock ( %s [%d] ).", strerror( errno ), errno );
     return;
   }
 
-  service_name_len = strlen( service_name ) + 1;
-  app_name_len = strlen( _dump_app_name ) + 1;
-  dump_buf_len = sizeof( message_dump_header ) + app_name_len + service_name_len + data_len;
-  dump_buf = xmalloc( dump_buf_len );
-  dump_hdr = ( message_dump_header * ) dump_buf;
+  size_t service_name_len = strlen( service_name ) + 1;
+  uint32_t data_len = 0;
+  for ( int i = 0; i < count; i++ ) {
+    data_len += ( uint32_t ) data[ i ].iov_len;
+  }
 
-  // header
-  dump_hdr->sent_time.sec = htonl( ( uint32_t ) now.tv_sec );
-  dump_hdr->sent_time.nsec = htonl( ( uint32_t ) now.tv_nsec );
-  dump_hdr->app_name_length = htons( ( uint16_t ) app_name_len );
-  dump_hdr->service_name_length = htons( ( uint16_t ) service_name_len );
-  dump_hdr->data_length = htonl( data_len );
+  debug( "Sending a dump message ( dump_type = %#x, service_name = %s, data_len = %u ).",
+         dump_type, service_name, data_len );
 
-  // app name
-  p = dump_buf;
-  p += sizeof( message_dump_header );
-  memcpy( p, _dump_app_name, app_name_len );
+  message_dump_header dump_hdr;
+  dump_hdr.sent_time.sec = htonl( ( uint32_t ) now.tv_sec );
+  dump_hdr.sent_time.nsec = htonl( ( uint32_t ) now.tv_nsec );
+  dump_hdr.app_name_length = htons( ( uint16_t ) _dump_app_name_length );
+  dump_hdr.service_name_length = htons( ( uint16_t ) service_name_len );
+  dump_hdr.data_length = htonl( data_len );
 
-  // service name
-  p += app_name_len;
-  memcpy( p, service_name, service_name_len );
+  struct iovec iov[ MESSENGER_MAX_IOVEC - 1 ];
+  iov[ 0 ].iov_base = &dump_hdr;
+  iov[ 0 ].iov_len = sizeof( message_dump_header );
+  iov[ 1 ].iov_base = _dump_app_name;
+  iov[ 1 ].iov_len = _dump_app_name_length;
+  iov[ 2 ].iov_base = ( void * ) ( uintptr_t ) service_name;
+  iov[ 2 ].iov_len = service_name_len;
+  for ( int i = 0; i < count; i++ ) {
+    iov[ 3 + i ] = data[ i ];
+  }
+
+  push_iovec_to_send_queue( _dump_service_name, MESSAGE_TYPE_NOTIFY, dump_type, iov, 3 + count );
+}
+
+
+static void
+send_dump_message( uint16_t dump_type, const char *service_name, const void *data, uint32_t data_len ) {
+  struct iovec iov[ 1 ];
+  iov[ 0 ].iov_base = ( void * ) ( uintptr_t ) data;
+  iov[ 0 ].iov_len = data_len;
 
-  // data
-  p += service_name_len;
-  memcpy( p, data, data_len );
+  send_dump_messagev( dump_type, service_name, iov, ( data != NULL && data_len > 0 ) ? 1 : 0 );
+}
 
-  // send
-  send_message( _dump_service_name, dump_type, dump_buf, dump_buf_len );
 
-  xfree( dump_buf );
+static void
+release_client_ring( messenger_socket *client ) {
+  if ( client->ring != NULL ) {
+    delete_fd_handler( get_shared_memory_ring_event_fd( client->ring ) );
+    delete_shared_memory_ring( client->ring );
+    client->ring = NULL;
+  }
 }
 
 
@@ -436,12 +542,15 @@ delete_receive_queue( void *service_name, void *_rq, void *user_data ) {
 
     debug( "Closing a client socket ( fd = %d ).", client_socket->fd );
 
+    delete_fd_handler( client_socket->fd );
     close( client_socket->fd );
+    release_client_ring( client_socket );
     xfree( client_socket );
     send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
   }
   delete_dlist( rq->client_sockets );
 
+  delete_fd_handler( rq->listen_socket );
   close( rq->listen_socket );
   free_message_buffer( rq->buffer );
   unlink( rq->listen_addr.sun_path );
@@ -497,8 +606,7 @@ finalize_messenger() {
     delete_context_db();
   }
 
-  set_fd_set_callback( NULL );
-  set_check_fd_isset_callback( NULL );
+  finalize_event_handler();
 
   running = false;
   initialized = false;
@@ -585,6 +693,9 @@ create_receive_queue( const char *service_name ) {
   rq->client_sockets = create_dlist();
   rq->buffer = create_message_buffer( messenger_recv_queue_length );
 
+  set_fd_handler( rq->listen_socket, on_accept, rq, NULL, NULL );
+  set_readable( rq->listen_socket, true );
+
   insert_hash_entry( receive_queues, rq->service_name, rq );
 
   return rq;
@@ -774,6 +885,58 @@ message_buffer_remain_bytes( message_buffer *buf ) {
 }
 
 
+/**
+ * offers a shared memory ring to the peer. Messages keep going through the
+ * socket until the peer accepts it ( see on_send_read() ).
+ */
+static void
+offer_shared_memory_ring( send_queue *sq ) {
+  assert( sq != NULL );
+  assert( sq->ring == NULL );
+
+  if ( !shared_memory_enabled ) {
+    return;
+  }
+
+  sq->ring = create_shared_memory_ring( messenger_ring_size );
+  if ( sq->ring == NULL ) {
+    debug( "Shared memory is not available ( service_name = %s ).", sq->service_name );
+    return;
+  }
+
+  message_header header;
+  memset( &header, 0, sizeof( message_header ) );
+  header.message_type = MESSAGE_TYPE_RING_OFFER;
+  header.message_length = sizeof( message_header );
+
+  struct iovec iov;
+  iov.iov_base = &header;
+  iov.iov_len = sizeof( message_header );
+
+  int fds[ 2 ] = { get_shared_memory_ring_memory_fd( sq->ring ), get_shared_memory_ring_event_fd( sq->ring ) };
+  char control[ CMSG_SPACE( sizeof( fds ) ) ];
+  memset( control, 0, sizeof( control ) );
+
+  struct msghdr msg;
+  memset( &msg, 0, sizeof( struct msghdr ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN( sizeof( fds ) );
+  memcpy( CMSG_DATA( cmsg ), fds, sizeof( fds ) );
+
+  if ( sendmsg( sq->server_socket, &msg, MSG_DONTWAIT ) != ( ssize_t ) sizeof( message_header ) ) {
+    debug( "Failed to offer a shared memory ring ( service_name = %s, errno = %s [%d] ).",
+           sq->service_name, strerror( errno ), errno );
+    release_send_queue_ring( sq );
+  }
+}
+
+
 /**
  * connects send_queue to the service
  * return value: -1:error, 0:refused (retry), 1:connected
@@ -829,12 +992,65 @@ send_queue_connect( send_queue *sq ) {
   sq->reconnect_at.tv_sec = 0;
   sq->reconnect_at.tv_nsec = 0;
 
+  set_fd_handler( sq->server_socket, on_send_read, sq, on_send_write, sq );
+  set_readable( sq->server_socket, true );
+  if ( sq->buffer->data_length > 0 ) {
+    set_writable( sq->server_socket, true );
+  }
+  offer_shared_memory_ring( sq );
+
   send_dump_message( MESSENGER_DUMP_SEND_CONNECTED, sq->service_name, NULL, 0 );
 
   return 1;
 }
 
 
+/**
+ * reconnects send_queue unless it is waiting for the next retry.
+ * return value: -1:error, 0:refused or waiting (retry), 1:connected
+ */
+static int
+send_queue_reconnect( send_queue *sq ) {
+  assert( sq != NULL );
+  assert( sq->server_socket == -1 );
+
+  if ( sq->refused_count > 0 ) {
+    struct timespec now;
+
+    if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+      error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+      return -1;
+    }
+    if ( sq->reconnect_at.tv_sec > now.tv_sec ) {
+      return 0;
+    }
+  }
+
+  return send_queue_connect( sq );
+}
+
+
+static void
+reconnect_send_queues( void *user_data ) {
+  UNUSED( user_data );
+
+  hash_iterator iter;
+  hash_entry *e;
+
+  if ( send_queues == NULL ) {
+    return;
+  }
+
+  init_hash_iterator( send_queues, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    send_queue *sq = e->value;
+    if ( sq->server_socket == -1 ) {
+      send_queue_reconnect( sq );
+    }
+  }
+}
+
+
 /**
  * creates send_queue and connects to specified service name.
  */
@@ -868,15 +1084,19 @@ create_send_queue( const char *service_name ) {
   sq->refused_count = 0;
   sq->reconnect_at.tv_sec = 0;
   sq->reconnect_at.tv_nsec = 0;
+  sq->buffer = create_message_buffer( messenger_send_queue_length );
+  sq->ring = NULL;
+  sq->ring_active = false;
+  sq->send_syscalls = 0;
+  sq->sent_messages = 0;
 
   if ( send_queue_connect( sq ) == -1 ) {
+    free_message_buffer( sq->buffer );
     xfree( sq );
     error( "Failed to create a send queue for %s.", service_name );
     return NULL;
   }
 
-  sq->buffer = create_message_buffer( messenger_send_queue_length );
-
   insert_hash_entry( send_queues, sq->service_name, sq );
 
   return sq;
@@ -906,13 +1126,71 @@ write_message_buffer( message_buffer *buf, const void *data, size_t len ) {
 
 
 static bool
-push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
-  assert( service_name != NULL );
+write_message_to_ring( send_queue *sq, const struct iovec *iov, int iovcnt ) {
+  assert( sq != NULL );
+  assert( sq->ring != NULL );
+
+  if ( !writev_shared_memory_ring( sq->ring, iov, iovcnt ) ) {
+    warn( "Could not write a message to shared memory ring due to overflow ( service_name = %s ).", sq->service_name );
+    send_dump_message( MESSENGER_DUMP_SEND_OVERFLOW, sq->service_name, NULL, 0 );
+    return false;
+  }
+
+  if ( messenger_dump_enabled() ) {
+    send_dump_messagev( MESSENGER_DUMP_SENT, sq->service_name, iov, iovcnt );
+  }
+
+  return true;
+}
+
+
+/**
+ * sends a message straight from the caller's memory if nothing is queued
+ * ahead of it. returns false if the message has to be queued.
+ */
+static bool
+send_message_directly( send_queue *sq, const message_header *header, struct iovec *iov, int iovcnt ) {
+  assert( sq != NULL );
+  assert( header != NULL );
+
+  // Messages are queued and sent in batches while dumping, since every
+  // message is followed by its dump record.
+  if ( sq->server_socket == -1 || sq->buffer->data_length > 0 || messenger_dump_enabled() ) {
+    return false;
+  }
+
+  struct msghdr msg;
+  memset( &msg, 0, sizeof( struct msghdr ) );
+  msg.msg_iov = iov;
+  msg.msg_iovlen = ( size_t ) iovcnt;
+
+  ssize_t sent_len = sendmsg( sq->server_socket, &msg, MSG_DONTWAIT );
+  sq->send_syscalls++;
+  if ( sent_len != ( ssize_t ) header->message_length ) {
+    // Leave the error handling to on_send_write().
+    debug( "Failed to send a message directly ( fd = %d, service_name = %s, errno = %s [%d] ).",
+           sq->server_socket, sq->service_name, strerror( errno ), errno );
+    return false;
+  }
+  sq->sent_messages++;
+
+  return true;
+}
 
-  debug( "Pushing a message to send queue ( service_name = %s, message_type = %#x, tag = %#x, data = %p, len = %u ).",
-         service_name, message_type, tag, data, len );
+
+/**
+ * pushes a message gathered from `count' pieces to the send queue of
+ * `service_name'.
+ */
+static bool
+push_iovec_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const struct iovec *data, int count ) {
+  assert( service_name != NULL );
+  assert( count >= 0 && count < MESSENGER_MAX_IOVEC );
 
   message_header header;
+  struct iovec iov[ MESSENGER_MAX_IOVEC ];
+  int iovcnt = 1;
+  size_t len = 0;
 
   if ( send_queues == NULL ) {
     error( "All send queues are already deleted or not created yet." );
@@ -926,10 +1204,27 @@ push_message_to_send_queue( const char *service_name, const uint8_t message_type
     assert( sq != NULL );
   }
 
+  for ( int i = 0; i < count; i++ ) {
+    if ( data[ i ].iov_len > 0 ) {
+      iov[ iovcnt++ ] = data[ i ];
+      len += data[ i ].iov_len;
+    }
+  }
+
   header.version = 0;
   header.message_type = message_type;
   header.tag = tag;
   header.message_length = ( uint32_t ) ( sizeof( message_header ) + len );
+  iov[ 0 ].iov_base = &header;
+  iov[ 0 ].iov_len = sizeof( message_header );
+
+  if ( sq->ring_active ) {
+    return write_message_to_ring( sq, iov, iovcnt );
+  }
+
+  if ( send_message_directly( sq, &header, iov, iovcnt ) ) {
+    return true;
+  }
 
   if ( message_buffer_remain_bytes( sq->buffer ) < header.message_length ) {
     warn( "Could not write a message to send queue due to overflow ( service_name = %s ).", sq->service_name );
@@ -937,13 +1232,36 @@ push_message_to_send_queue( const char *service_name, const uint8_t message_type
     return false;
   }
 
-  write_message_buffer( sq->buffer, &header, sizeof( message_header ) );
-  write_message_buffer( sq->buffer, data, len );
+  for ( int i = 0; i < iovcnt; i++ ) {
+    write_message_buffer( sq->buffer, iov[ i ].iov_base, iov[ i ].iov_len );
+  }
+
+  if ( sq->server_socket == -1 ) {
+    send_queue_reconnect( sq );
+  }
+  else {
+    set_writable( sq->server_socket, true );
+  }
 
   return true;
 }
 
 
+static bool
+push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len ) {
+  assert( service_name != NULL );
+
+  debug( "Pushing a message to send queue ( service_name = %s, message_type = %#x, tag = %#x, data = %p, len = %u ).",
+         service_name, message_type, tag, data, len );
+
+  struct iovec iov[ 1 ];
+  iov[ 0 ].iov_base = ( void * ) ( uintptr_t ) data;
+  iov[ 0 ].iov_len = len;
+
+  return push_iovec_to_send_queue( service_name, message_type, tag, iov, ( data != NULL && len > 0 ) ? 1 : 0 );
+}
+
+
 bool
 send_message( const char *service_name, const uint16_t tag, const void *data, size_t len ) {
   assert( service_name != NULL );
@@ -1079,40 +1397,6 @@ number_of_send_queue( int *connected_count, int *sending_count, int *reconnectin
 }
 
 
-static void
-set_recv_queue_fd_set( fd_set *read_set ) {
-  assert( read_set != NULL );
-
-  debug( "Setting fds to a fd_set ( read_set = %p ).", read_set );
-
-  hash_iterator iter;
-  hash_entry *e;
-
-  assert( receive_queues != NULL );
-
-  init_hash_iterator( receive_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    receive_queue *rq = e->value;
-    dlist_element *element;
-    /*
-     * A hacky workaround to avoid the bug of glibc (#431)
-     * See also: http://www.linuxquestions.org/questions/programming-9/impossible-to-use-gcc-with-wconversion-and-standard-socket-macros-841935/
-     */
-    debug( "Setting a fd ( %d ) to fd_set ( read_set = %p ).", rq->listen_socket, read_set );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-    FD_SET( rq->listen_socket, read_set );
-#undef sizeof
-    for ( element = rq->client_sockets->next; element; element = element->next ) {
-      messenger_socket *socket_item = element->data;
-      debug( "Setting a fd ( %d ) to fd_set ( read_set = %p ).", socket_item->fd, read_set );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-      FD_SET( socket_item->fd, read_set );
-#undef sizeof
-    }
-  }
-}
-
-
 static void
 add_recv_queue_client_fd( receive_queue *rq, int fd ) {
   assert( rq != NULL );
@@ -1124,12 +1408,21 @@ add_recv_queue_client_fd( receive_queue *rq, int fd ) {
 
   socket = xmalloc( sizeof( messenger_socket ) );
   socket->fd = fd;
+  socket->ring = NULL;
+  socket->ring_started = false;
+  socket->ring_dispatching = false;
+  socket->rq = rq;
   insert_after_dlist( rq->client_sockets, socket );
+
+  set_fd_handler( fd, on_recv, rq, NULL, NULL );
+  set_readable( fd, true );
 }
 
 
 static void
-on_accept( int fd, receive_queue *rq ) {
+on_accept( int fd, void *data ) {
+  receive_queue *rq = data;
+
   assert( rq != NULL );
 
   int client_fd;
@@ -1161,7 +1454,13 @@ del_recv_queue_client_fd( receive_queue *rq, int fd ) {
     socket = element->data;
     if ( socket->fd == fd ) {
       debug( "Deleting fd ( %d ).", fd );
+      delete_fd_handler( fd );
       delete_dlist_element( element );
+      if ( socket->ring != NULL && socket->ring_started ) {
+        // Deliver messages written before the peer closed the connection.
+        drain_client_ring( socket );
+      }
+      release_client_ring( socket );
       xfree( socket );
       return 1;
     }
@@ -1195,11 +1494,12 @@ truncate_message_buffer( message_buffer *buf, size_t len ) {
 
 
 /**
- * pulls message data from recv_queue.
+ * pulls message data from recv_queue. The message is not copied; *data
+ * points into the receive buffer and is valid until the next call to on_recv().
  * returns 1 if succeeded, otherwise 0.
  */
 static int
-pull_from_recv_queue( receive_queue *rq, uint8_t *message_type, uint16_t *tag, void *data, size_t *len, size_t maxlen ) {
+pull_from_recv_queue( receive_queue *rq, uint8_t *message_type, uint16_t *tag, void **data, size_t *len ) {
   assert( rq != NULL );
   assert( message_type != NULL );
   assert( tag != NULL );
@@ -1228,11 +1528,11 @@ pull_from_recv_queue( receive_queue *rq, uint8_t *message_type, uint16_t *tag, v
   *message_type = header->message_type;
   *tag = header->tag;
   *len = header->message_length - sizeof( message_header );
-  memcpy( data, header->value, *len > maxlen ? maxlen : *len );
+  *data = header->value;
   truncate_message_buffer( rq->buffer, header->message_length );
 
   debug( "A message is retrieved from receive queue ( message_type = %#x, tag = %#x, len = %u, data = %p ).",
-         *message_type, *tag, *len, data );
+         *message_type, *tag, *len, *data );
 
   return 1;
 }
@@ -1327,121 +1627,211 @@ call_message_callbacks( receive_queue *rq, const uint8_t message_type, const uin
 }
 
 
-static void
-on_recv( int fd, receive_queue *rq ) {
-  assert( rq != NULL );
-  assert( fd >= 0 );
+static messenger_socket *
+lookup_client_socket( receive_queue *rq, int fd ) {
+  dlist_element *element;
+  for ( element = rq->client_sockets->next; element; element = element->next ) {
+    messenger_socket *client = element->data;
+    if ( client->fd == fd ) {
+      return client;
+    }
+  }
 
-  debug( "Receiving data from remote ( fd = %d, service_name = %s ).", fd, rq->service_name );
+  return NULL;
+}
 
-  uint8_t buf[ MESSENGER_RECV_BUFFER ];
-  ssize_t recv_len;
-  size_t buf_len;
-  uint8_t message_type;
-  uint16_t tag;
 
-  recv_len = recv( fd, buf, sizeof( buf ), 0 );
-  if ( recv_len == -1 ) {
-    error( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+static void
+drain_client_ring( messenger_socket *client ) {
+  assert( client != NULL );
+  assert( client->ring != NULL );
+
+  receive_queue *rq = client->rq;
+  void *record;
+  size_t length;
+
+  client->ring_dispatching = true;
+  while ( ( record = peek_shared_memory_ring( client->ring, &length ) ) != NULL ) {
+    message_header *header = record;
+    if ( length < sizeof( message_header ) || header->message_length != length ) {
+      error( "Invalid message in shared memory ring ( service_name = %s, length = %u ).", rq->service_name, length );
+    }
+    else {
+      send_dump_message( MESSENGER_DUMP_RECEIVED, rq->service_name, header, header->message_length );
+      call_message_callbacks( rq, header->message_type, header->tag, header->value, length - sizeof( message_header ) );
+    }
+    pop_shared_memory_ring( client->ring );
   }
-  else if ( recv_len == 0 ) {
-    debug( "Connection closed ( fd = %d, service_name = %s ).", fd, rq->service_name );
-    send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
-    del_recv_queue_client_fd( rq, fd );
-    close( fd );
+  client->ring_dispatching = false;
+}
+
+
+static void
+on_ring_readable( int fd, void *data ) {
+  messenger_socket *client = data;
+
+  assert( client != NULL );
+  assert( client->ring != NULL );
+
+  // The record being dispatched by an outer call must not be delivered twice.
+  if ( client->ring_dispatching ) {
+    return;
   }
-  else {
-    if ( !write_message_buffer( rq->buffer, buf, ( size_t ) recv_len ) ) {
-      warn( "Could not write a message to receive queue due to overflow ( service_name = %s ).", rq->service_name );
-      send_dump_message( MESSENGER_DUMP_RECV_OVERFLOW, rq->service_name, buf, ( uint32_t ) recv_len );
-      // FIXME: remove fragmented message from buffer and notify it
-    }
 
-    send_dump_message( MESSENGER_DUMP_RECEIVED, rq->service_name, buf, ( uint32_t ) recv_len );
-    while ( pull_from_recv_queue( rq, &message_type, &tag, buf, &buf_len, sizeof( buf ) ) == 1 ) {
-      call_message_callbacks( rq, message_type, tag, buf, buf_len );
-    }
+  debug( "Receiving data from shared memory ring ( fd = %d, service_name = %s ).", fd, client->rq->service_name );
+
+  clear_shared_memory_ring_event( client->ring );
+  if ( client->ring_started ) {
+    drain_client_ring( client );
   }
 }
 
 
 static void
-check_recv_queue_fd_isset( fd_set *read_set ) {
-  assert( read_set != NULL );
+start_client_ring( receive_queue *rq, int fd ) {
+  messenger_socket *client = lookup_client_socket( rq, fd );
+  if ( client == NULL || client->ring == NULL ) {
+    error( "No shared memory ring found ( fd = %d, service_name = %s ).", fd, rq->service_name );
+    return;
+  }
 
-  hash_iterator iter;
-  hash_entry *e;
+  debug( "Starting to receive from shared memory ring ( fd = %d, service_name = %s ).", fd, rq->service_name );
 
-  debug( "Checking a fd_set for receiving data from remotes ( read_set = %p ).", read_set );
+  client->ring_started = true;
+  drain_client_ring( client );
+}
 
-  assert( receive_queues != NULL );
 
-  init_hash_iterator( receive_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    receive_queue *rq = e->value;
-    if ( FD_ISSET( rq->listen_socket, read_set ) ) {
-      on_accept( rq->listen_socket, rq );
-    }
-    dlist_element *element = rq->client_sockets->next, *next_element;
-    while ( element != NULL ) {
-      next_element = element->next;
-      messenger_socket *socket_item = element->data;
-      if ( FD_ISSET( socket_item->fd, read_set ) ) {
-        on_recv( socket_item->fd, rq );
-      }
-      element = next_element;
+static void
+accept_shared_memory_ring( receive_queue *rq, int fd, struct msghdr *msg, size_t len ) {
+  int fds[ 2 ] = { -1, -1 };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR( msg );
+  if ( cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+       && cmsg->cmsg_len == CMSG_LEN( sizeof( fds ) ) ) {
+    memcpy( fds, CMSG_DATA( cmsg ), sizeof( fds ) );
+  }
+
+  message_header *header = msg->msg_iov->iov_base;
+  messenger_socket *client = lookup_client_socket( rq, fd );
+  if ( len != sizeof( message_header ) || header->message_type != MESSAGE_TYPE_RING_OFFER || fds[ 0 ] < 0
+       || client == NULL || client->ring != NULL ) {
+    error( "Unexpected file descriptors received ( fd = %d, service_name = %s ).", fd, rq->service_name );
+    if ( fds[ 0 ] >= 0 ) {
+      close( fds[ 0 ] );
+      close( fds[ 1 ] );
     }
+    return;
+  }
+
+  client->ring = attach_shared_memory_ring( fds[ 0 ], fds[ 1 ] );
+  if ( client->ring == NULL ) {
+    close( fds[ 0 ] );
+    close( fds[ 1 ] );
+    return;
+  }
+
+  message_header accept;
+  memset( &accept, 0, sizeof( message_header ) );
+  accept.message_type = MESSAGE_TYPE_RING_ACCEPT;
+  accept.message_length = sizeof( message_header );
+  if ( send( fd, &accept, sizeof( message_header ), MSG_DONTWAIT ) != ( ssize_t ) sizeof( message_header ) ) {
+    error( "Failed to accept a shared memory ring ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+    release_client_ring( client );
+    return;
   }
+
+  set_fd_handler( fds[ 1 ], on_ring_readable, client, NULL, NULL );
+  set_readable( fds[ 1 ], true );
+
+  debug( "Shared memory ring is accepted ( fd = %d, service_name = %s ).", fd, rq->service_name );
 }
 
 
 static void
-set_send_queue_fd_set( fd_set *read_set, fd_set *write_set ) {
-  hash_iterator iter;
-  hash_entry *e;
-
-  debug( "Setting fds to fd_sets ( read_set = %p, write_set = %p ).", read_set, write_set );
+on_recv( int fd, void *data ) {
+  receive_queue *rq = data;
 
-  assert( send_queues != NULL );
+  assert( rq != NULL );
+  assert( fd >= 0 );
 
-  init_hash_iterator( send_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    send_queue *sq = e->value;
-    int ret_val = 1;
-    struct timespec now;
+  debug( "Receiving data from remote ( fd = %d, service_name = %s ).", fd, rq->service_name );
 
-    assert( clock_gettime( CLOCK_MONOTONIC, &now ) == 0 );
+  message_buffer *buf = rq->buffer;
+  ssize_t recv_len;
+  void *message;
+  size_t message_len;
+  uint8_t message_type;
+  uint16_t tag;
 
-    if ( ( sq->refused_count > 0 ) && ( sq->reconnect_at.tv_sec > now.tv_sec ) ) {
-      continue;
+  // Receive straight into the queue. Messages being dispatched by an outer
+  // on_recv() ( e.g. via flush_messenger() ) must not be moved, so the queue
+  // is compacted only at the top level.
+  if ( dispatch_depth == 0 ) {
+    if ( buf->size - buf->head_offset - buf->data_length < MESSENGER_RECV_BUFFER ) {
+      memmove( buf->buffer, get_message_buffer_head( buf ), buf->data_length );
+      buf->head_offset = 0;
     }
-
-    if ( sq->server_socket == -1 ) {
-      ret_val = send_queue_connect( sq );
+    if ( buf->size - buf->data_length < MESSENGER_RECV_BUFFER ) {
+      warn( "Dropping %u bytes data in receive queue due to overflow ( service_name = %s ).",
+            buf->data_length, rq->service_name );
+      send_dump_message( MESSENGER_DUMP_RECV_OVERFLOW, rq->service_name, NULL, 0 );
+      truncate_message_buffer( buf, buf->data_length );
+      buf->head_offset = 0;
     }
-    switch ( ret_val == 1 ) {
-    case 0: // refused
-      break;
+  }
+  else if ( buf->size - buf->head_offset - buf->data_length < MESSENGER_RECV_BUFFER ) {
+    debug( "Deferring receive until the current dispatch completes ( fd = %d, service_name = %s ).", fd, rq->service_name );
+    return;
+  }
+  void *tail = ( char * ) get_message_buffer_head( buf ) + buf->data_length;
 
-    case 1: // connected
-      if ( sq->buffer->data_length > 0 ) {
-        debug( "Adding a fd ( %d ) to fd_sets.", sq->server_socket );
-#define sizeof( X ) ( ( int ) sizeof( X ) )
-        FD_SET( sq->server_socket, read_set );
-        FD_SET( sq->server_socket, write_set );
-#undef sizeof
-      }
-      break;
+  struct iovec iov;
+  iov.iov_base = tail;
+  iov.iov_len = MESSENGER_RECV_BUFFER;
+  char control[ CMSG_SPACE( sizeof( int ) * 2 ) ];
+  struct msghdr msg;
+  memset( &msg, 0, sizeof( struct msghdr ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
 
-    case -1: // error
+  recv_len = recvmsg( fd, &msg, 0 );
+  if ( recv_len == -1 ) {
+    error( "Failed to recv ( fd = %d, errno = %s [%d] ).", fd, strerror( errno ), errno );
+  }
+  else if ( recv_len == 0 ) {
+    debug( "Connection closed ( fd = %d, service_name = %s ).", fd, rq->service_name );
+    send_dump_message( MESSENGER_DUMP_RECV_CLOSED, rq->service_name, NULL, 0 );
+    del_recv_queue_client_fd( rq, fd );
+    close( fd );
+  }
+  else {
+    if ( msg.msg_controllen > 0 ) {
+      accept_shared_memory_ring( rq, fd, &msg, ( size_t ) recv_len );
       return;
     }
+
+    buf->data_length += ( size_t ) recv_len;
+    send_dump_message( MESSENGER_DUMP_RECEIVED, rq->service_name, tail, ( uint32_t ) recv_len );
+
+    dispatch_depth++;
+    while ( pull_from_recv_queue( rq, &message_type, &tag, &message, &message_len ) == 1 ) {
+      if ( message_type == MESSAGE_TYPE_RING_START ) {
+        start_client_ring( rq, fd );
+        continue;
+      }
+      call_message_callbacks( rq, message_type, tag, message, message_len );
+    }
+    dispatch_depth--;
   }
 }
 
 
 static void
-on_send( int fd, send_queue *sq ) {
+on_send_write( int fd, void *data ) {
+  send_queue *sq = data;
+
   assert( sq != NULL );
   assert( fd >= 0 );
 
@@ -1449,27 +1839,44 @@ on_send( int fd, send_queue *sq ) {
          fd, sq->service_name, get_message_buffer_head( sq->buffer ), sq->buffer->data_length );
 
   if ( sq->buffer->data_length < sizeof( message_header ) ) {
+    set_writable( fd, false );
     return;
   }
 
-  message_header *header;
-  size_t send_len;
-  ssize_t sent_len;
   size_t sent_total = 0;
-  int sent_count = 0;
 
-  while ( ( ( sq->buffer->data_length - sent_total ) >= sizeof( message_header ) ) && ( sent_count < 128 ) ) {
-    header = ( message_header * ) ( ( char * ) get_message_buffer_head( sq->buffer ) + sent_total );
-    send_len = ( size_t ) header->message_length;
-    sent_len = send( fd, header, send_len, MSG_DONTWAIT );
+  while ( ( sq->buffer->data_length - sent_total ) >= sizeof( message_header ) && sent_total < messenger_send_budget ) {
+    // Each send() carries as many whole messages as fit in a single record
+    // that the receiver takes in with one recv() ( see on_recv() ).
+    char *head = ( char * ) get_message_buffer_head( sq->buffer ) + sent_total;
+    size_t remaining = sq->buffer->data_length - sent_total;
+    size_t send_len = 0;
+    uint32_t message_count = 0;
+    while ( remaining - send_len >= sizeof( message_header ) ) {
+      message_header *header = ( message_header * ) ( head + send_len );
+      if ( header->message_length > remaining - send_len
+           || ( message_count > 0 && send_len + header->message_length > MESSENGER_SEND_BATCH_SIZE ) ) {
+        break;
+      }
+      send_len += header->message_length;
+      message_count++;
+    }
+    if ( send_len == 0 ) {
+      break;
+    }
+
+    ssize_t sent_len = send( fd, head, send_len, MSG_DONTWAIT );
+    sq->send_syscalls++;
     if ( sent_len == -1 ) {
       int err = errno;
       if ( err != EAGAIN && err != EWOULDBLOCK ) {
         error( "Failed to send ( fd = %d, errno = %s [%d] ).", fd, strerror( err ), err );
         send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
+        delete_fd_handler( sq->server_socket );
         close( sq->server_socket );
         sq->server_socket = -1;
         sq->refused_count = 0;
+        release_send_queue_ring( sq );
       }
       truncate_message_buffer( sq->buffer, sent_total );
       if ( err == EMSGSIZE || err == ENOBUFS || err == ENOMEM ) {
@@ -1478,51 +1885,91 @@ on_send( int fd, send_queue *sq ) {
       }
       return;
     }
-    send_dump_message( MESSENGER_DUMP_SENT, sq->service_name, header, ( uint32_t ) sent_len );
+
+    // A SOCK_SEQPACKET socket never sends a part of a record, but only
+    // whole messages are accounted in case it ever does.
+    size_t accounted = 0;
+    while ( accounted < ( size_t ) sent_len ) {
+      message_header *header = ( message_header * ) ( head + accounted );
+      if ( accounted + header->message_length > ( size_t ) sent_len ) {
+        break;
+      }
+      if ( messenger_dump_enabled() ) {
+        send_dump_message( MESSENGER_DUMP_SENT, sq->service_name, header, header->message_length );
+      }
+      accounted += header->message_length;
+      sq->sent_messages++;
+    }
     sent_total += ( size_t ) sent_len;
-    sent_count++;
+    if ( ( size_t ) sent_len < send_len ) {
+      error( "Partial send ( fd = %d, service_name = %s, sent_len = %d, send_len = %u ).",
+             fd, sq->service_name, sent_len, send_len );
+      break;
+    }
   }
   truncate_message_buffer( sq->buffer, sent_total );
+  if ( sq->buffer->data_length == 0 ) {
+    set_writable( fd, false );
+  }
 }
 
 
+/**
+ * detects that the peer closed the connection. No data is expected from it.
+ */
 static void
-check_send_queue_fd_isset( fd_set *read_set, fd_set *write_set ) {
-  hash_iterator iter;
-  hash_entry *e;
+on_send_read( int fd, void *data ) {
+  send_queue *sq = data;
 
-  debug( "Checking fd_sets for sending/receiving data to/from remotes ( read_set = %p, write_set = %p ).", read_set, write_set );
+  assert( sq != NULL );
+  assert( fd >= 0 );
 
-  assert( send_queues != NULL );
+  char buf[ 256 ];
+  ssize_t recv_len = recv( fd, buf, sizeof( buf ), MSG_DONTWAIT );
+  if ( recv_len == 0 || ( recv_len == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) ) {
+    debug( "Connection closed ( fd = %d, service_name = %s ).", fd, sq->service_name );
+    send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
+    delete_fd_handler( fd );
+    close( fd );
+    sq->server_socket = -1;
+    release_send_queue_ring( sq );
+    return;
+  }
 
-  init_hash_iterator( send_queues, &iter );
-  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
-    send_queue *sq = e->value;
-    if ( sq->server_socket == -1 ) {
-      continue;
-    }
-    if ( FD_ISSET( sq->server_socket, read_set ) ) {
-      char buf[ 256 ];
-      if ( recv( sq->server_socket, buf, sizeof( buf ), 0 ) <= 0 ) {
-        send_dump_message( MESSENGER_DUMP_SEND_CLOSED, sq->service_name, NULL, 0 );
-        close( sq->server_socket );
-        sq->server_socket = -1;
-        continue;
-      }
-    }
-    if ( FD_ISSET( sq->server_socket, write_set ) ) {
-      on_send( sq->server_socket, sq );
+  message_header *header = ( message_header * ) buf;
+  if ( recv_len >= ( ssize_t ) sizeof( message_header ) && header->message_type == MESSAGE_TYPE_RING_ACCEPT
+       && sq->ring != NULL && !sq->ring_active ) {
+    // Messages already queued go through the socket. The peer starts reading
+    // the ring when it receives RING_START, so that the order is preserved.
+    debug( "Switching to shared memory ring ( service_name = %s ).", sq->service_name );
+    if ( push_message_to_send_queue( sq->service_name, MESSAGE_TYPE_RING_START, 0, NULL, 0 ) ) {
+      sq->ring_active = true;
     }
   }
 }
 
 
+/**
+ * returns milliseconds until the next timer event expires ( rounded up ),
+ * or -1 if no timer event is registered.
+ */
+static int
+get_event_wait_timeout( void ) {
+  struct timespec timeout;
+
+  if ( !get_next_timer_event_timeout( &timeout ) ) {
+    return -1;
+  }
+  if ( timeout.tv_sec >= INT_MAX / 1000 - 1 ) {
+    return INT_MAX;
+  }
+
+  return ( int ) ( timeout.tv_sec * 1000 + ( timeout.tv_nsec + 999999 ) / 1000000 );
+}
+
+
 static bool
 run_once( void ) {
-  fd_set read_set, write_set;
-  struct timeval timeout;
-  int set_count;
-
   execute_timer_events();
 
   if ( external_callback != NULL ) {
@@ -1530,37 +1977,11 @@ run_once( void ) {
     external_callback = NULL;
   }
 
-  FD_ZERO( &read_set );
-  FD_ZERO( &write_set );
-  set_recv_queue_fd_set( &read_set );
-  set_send_queue_fd_set( &read_set, &write_set );
-  if ( external_fd_set ) {
-    external_fd_set( &read_set, &write_set );
-  }
-
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 100 * 1000;
-
-  set_count = select( FD_SETSIZE, &read_set, &write_set, NULL, &timeout );
-
-  if ( set_count == -1 ) {
-    if ( errno == EINTR ) {
-      return true;
-    }
-    error( "Failed to select ( errno = %s [%d] ).", strerror( errno ), errno );
+  if ( !run_event_handler_once( get_event_wait_timeout() ) ) {
+    error( "Failed to run event handler." );
     running = false;
     return false;
   }
-  else if ( set_count == 0 ) {
-    // timed out
-    return true;
-  }
-
-  check_recv_queue_fd_isset( &read_set );
-  check_send_queue_fd_isset( &read_set, &write_set );
-  if ( external_check_fd_isset ) {
-    external_check_fd_isset( &read_set, &write_set );
-  }
 
   return true;
 }
@@ -1587,6 +2008,7 @@ start_messenger() {
   debug( "Starting messenger." );
 
   add_periodic_event_callback( 10, age_context_db, NULL );
+  add_periodic_event_callback( 1, reconnect_send_queues, NULL );
 
   running = true;
   while ( running ) {
@@ -1625,6 +2047,7 @@ start_messenger_dump( const char *dump_app_name, const char *dump_service_name )
   }
   _dump_service_name = xstrdup( dump_service_name );
   _dump_app_name = xstrdup( dump_app_name );
+  _dump_app_name_length = strlen( _dump_app_name ) + 1;
 }
 
 
@@ -1647,6 +2070,7 @@ stop_messenger_dump( void ) {
 
   xfree( _dump_app_name );
   _dump_app_name = NULL;
+  _dump_app_name_length = 0;
 }
 
 
@@ -1660,22 +2084,6 @@ messenger_dump_enabled( void ) {
 }
 
 
-void
-set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
-  debug( "Setting an external FD_SET callback ( callback = %p ).", callback );
-
-  external_fd_set = callback;
-}
-
-
-void
-set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
-  debug( "Setting an external FD_ISSET callback ( callback = %p ).", callback );
-
-  external_check_fd_isset = callback;
-}
-
-
 bool
 set_external_callback( void ( *callback ) ( void ) ) {
   if ( external_callback != NULL ) {
@@ -0,0 +1,289 @@
+/*
+ * Fixed-size object pools.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include "object_pool.h"
+#include "wrapper.h"
+
+
+#ifdef UNIT_TESTING
+
+// Allow static functions and variables to be referred from unit tests.
+#define static
+
+// Test the pools themselves rather than the heap.
+#undef allocate_object
+#undef free_object
+#undef allocate_sized_object
+#undef free_sized_object
+#undef sized_object_capacity
+
+#endif // UNIT_TESTING
+
+
+// Objects and the slab header are aligned to this.
+#define OBJECT_ALIGNMENT 16
+#define SLAB_HEADER_SIZE OBJECT_ALIGNMENT
+
+
+typedef struct free_object_entry {
+  struct free_object_entry *next;
+} free_object_entry;
+
+
+static object_pool sized_object_pools[] = {
+  OBJECT_POOL_INITIALIZER( "16 bytes", 16 ),
+  OBJECT_POOL_INITIALIZER( "32 bytes", 32 ),
+  OBJECT_POOL_INITIALIZER( "64 bytes", 64 ),
+  OBJECT_POOL_INITIALIZER( "128 bytes", 128 ),
+  OBJECT_POOL_INITIALIZER( "256 bytes", 256 ),
+  OBJECT_POOL_INITIALIZER( "512 bytes", 512 ),
+  OBJECT_POOL_INITIALIZER( "1024 bytes", 1024 ),
+  OBJECT_POOL_INITIALIZER( "2048 bytes", 2048 ),
+};
+
+static object_pool *pools = NULL;
+static volatile int pools_lock = 0;
+
+
+static void
+spin_lock( volatile int *lock ) {
+  while ( __sync_lock_test_and_set( lock, 1 ) ) {
+    while ( *lock ) {
+      // Wait until the lock looks free before retrying the atomic operation.
+    }
+  }
+}
+
+
+static void
+spin_unlock( volatile int *lock ) {
+  __sync_lock_release( lock );
+}
+
+
+static size_t
+stride_of( const object_pool *pool ) {
+  size_t size = pool->object_size < sizeof( free_object_entry ) ? sizeof( free_object_entry ) : pool->object_size;
+
+  return ( size + OBJECT_ALIGNMENT - 1 ) & ~( size_t ) ( OBJECT_ALIGNMENT - 1 );
+}
+
+
+static void
+register_pool( object_pool *pool ) {
+  spin_lock( &pools_lock );
+  pool->next = pools;
+  pools = pool;
+  spin_unlock( &pools_lock );
+}
+
+
+static void
+unregister_pool( object_pool *pool ) {
+  spin_lock( &pools_lock );
+  for ( object_pool **p = &pools; *p != NULL; p = &( *p )->next ) {
+    if ( *p == pool ) {
+      *p = pool->next;
+      break;
+    }
+  }
+  pool->next = NULL;
+  spin_unlock( &pools_lock );
+}
+
+
+// Must be called with the pool locked.
+static void
+add_slab( object_pool *pool ) {
+  size_t stride = stride_of( pool );
+  size_t slab_size = OBJECT_POOL_SLAB_SIZE;
+  if ( slab_size < SLAB_HEADER_SIZE + stride ) {
+    slab_size = SLAB_HEADER_SIZE + stride;
+  }
+
+  char *slab = xmalloc( slab_size );
+  *( void ** ) slab = pool->slabs;
+  pool->slabs = slab;
+
+  size_t n_objects = ( slab_size - SLAB_HEADER_SIZE ) / stride;
+  for ( size_t i = n_objects; i > 0; i-- ) {
+    free_object_entry *entry = ( free_object_entry * ) ( void * ) ( slab + SLAB_HEADER_SIZE + stride * ( i - 1 ) );
+    entry->next = pool->free_objects;
+    pool->free_objects = entry;
+  }
+
+  if ( pool->n_slabs++ == 0 ) {
+    register_pool( pool );
+  }
+}
+
+
+/**
+ * Takes an object out of `pool'. The contents of the object are
+ * undefined, as with xmalloc().
+ */
+void *
+allocate_object( object_pool *pool ) {
+  assert( pool != NULL );
+  assert( pool->object_size > 0 );
+
+  spin_lock( &pool->lock );
+
+  if ( pool->free_objects == NULL ) {
+    add_slab( pool );
+  }
+  free_object_entry *entry = pool->free_objects;
+  pool->free_objects = entry->next;
+  pool->allocations++;
+  pool->n_objects_in_use++;
+
+  spin_unlock( &pool->lock );
+
+#ifndef NDEBUG
+  memset( entry, 0xA5, pool->object_size );
+#endif
+
+  return entry;
+}
+
+
+void
+free_object( object_pool *pool, void *object ) {
+  assert( pool != NULL );
+
+  if ( object == NULL ) {
+    return;
+  }
+
+  spin_lock( &pool->lock );
+
+  free_object_entry *entry = object;
+  entry->next = pool->free_objects;
+  pool->free_objects = entry;
+  pool->n_objects_in_use--;
+
+  spin_unlock( &pool->lock );
+}
+
+
+static object_pool *
+sized_object_pool_for( size_t size ) {
+  if ( size > OBJECT_POOL_MAX_SIZED_OBJECT ) {
+    return NULL;
+  }
+  unsigned int i = 0;
+  while ( sized_object_pools[ i ].object_size < size ) {
+    i++;
+  }
+  return &sized_object_pools[ i ];
+}
+
+
+/**
+ * Allocates `size' bytes from the smallest size class that fits. Objects
+ * larger than OBJECT_POOL_MAX_SIZED_OBJECT are taken from the heap. The
+ * same size must be passed to free_sized_object().
+ */
+void *
+allocate_sized_object( size_t size ) {
+  object_pool *pool = sized_object_pool_for( size );
+  if ( pool == NULL ) {
+    return xmalloc( size );
+  }
+  return allocate_object( pool );
+}
+
+
+void
+free_sized_object( void *object, size_t size ) {
+  object_pool *pool = sized_object_pool_for( size );
+  if ( pool == NULL ) {
+    xfree( object );
+    return;
+  }
+  free_object( pool, object );
+}
+
+
+/**
+ * Returns the number of bytes actually usable in an object allocated by
+ * allocate_sized_object( size ). Passing the capacity instead of `size'
+ * to allocate_sized_object() and free_sized_object() is also allowed.
+ */
+size_t
+sized_object_capacity( size_t size ) {
+  object_pool *pool = sized_object_pool_for( size );
+  if ( pool == NULL ) {
+    return size;
+  }
+  return pool->object_size;
+}
+
+
+/**
+ * Returns all slabs of `pool' to the heap. No object of the pool may be
+ * in use.
+ */
+void
+destroy_object_pool( object_pool *pool ) {
+  assert( pool != NULL );
+
+  spin_lock( &pool->lock );
+
+  if ( pool->n_slabs > 0 ) {
+    unregister_pool( pool );
+  }
+  void *slab = pool->slabs;
+  while ( slab != NULL ) {
+    void *next = *( void ** ) slab;
+    xfree( slab );
+    slab = next;
+  }
+  pool->slabs = NULL;
+  pool->free_objects = NULL;
+  pool->n_slabs = 0;
+  pool->n_objects_in_use = 0;
+
+  spin_unlock( &pool->lock );
+}
+
+
+void
+dump_object_pools( void dump_function( const char *format, ... ) ) {
+  assert( dump_function != NULL );
+
+  spin_lock( &pools_lock );
+  for ( object_pool *pool = pools; pool != NULL; pool = pool->next ) {
+    ( *dump_function )( "Object pool %s: %" PRIu64 " allocations, %" PRIu64 " slabs, %" PRIu64 " objects in use.",
+                        pool->name, pool->allocations, pool->n_slabs, pool->n_objects_in_use );
+  }
+  spin_unlock( &pools_lock );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,85 @@
+/*
+ * Fixed-size object pools.
+ *
+ * Objects of the same size are carved out of large slabs and recycled
+ * through a free list instead of going through malloc()/free() every
+ * time. Slabs are never returned to the heap while the process runs.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wrapper.h"
+
+
+#define OBJECT_POOL_SLAB_SIZE 65536
+#define OBJECT_POOL_MAX_SIZED_OBJECT 2048
+
+
+typedef struct object_pool {
+  const char *name;
+  size_t object_size;
+  volatile int lock;
+  void *free_objects;
+  void *slabs;
+  uint64_t allocations; // number of objects handed out so far
+  uint64_t n_slabs;
+  uint64_t n_objects_in_use;
+  struct object_pool *next; // all pools that have allocated a slab
+} object_pool;
+
+
+#define OBJECT_POOL_INITIALIZER( _name, _object_size ) \
+  { _name, _object_size, 0, NULL, NULL, 0, 0, 0, NULL }
+
+
+void *allocate_object( object_pool *pool );
+void free_object( object_pool *pool, void *object );
+void *allocate_sized_object( size_t size );
+void free_sized_object( void *object, size_t size );
+size_t sized_object_capacity( size_t size );
+void destroy_object_pool( object_pool *pool );
+void dump_object_pools( void dump_function( const char *format, ... ) );
+
+
+// Pooled objects are passed to the heap in unit tests so that cmockery
+// can check for memory leaks.
+#ifdef UNIT_TESTING
+
+#define allocate_object( _pool ) xmalloc( ( _pool )->object_size )
+#define free_object( _pool, _object ) ( ( void ) ( _pool ), xfree( _object ) )
+#define allocate_sized_object( _size ) xmalloc( _size )
+#define free_sized_object( _object, _size ) ( ( void ) ( _size ), xfree( _object ) )
+#define sized_object_capacity( _size ) ( _size )
+
+#endif // UNIT_TESTING
+
+
+#endif // OBJECT_POOL_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -30,6 +30,7 @@
 #include "openflow_message.h"
 #include "packet_info.h"
 #include "packet_parser.h"
+#include "shadow_flow_table.h"
 #include "wrapper.h"
 
 
@@ -81,6 +82,12 @@ pid_t mock_getpid( void );
 #define parse_packet mock_parse_packet
 bool mock_parse_packet( buffer *buf );
 
+#ifdef parse_packet_lazily
+#undef parse_packet_lazily
+#endif
+#define parse_packet_lazily mock_parse_packet_lazily
+bool mock_parse_packet_lazily( buffer *buf );
+
 #ifdef die
 #undef die
 #endif
@@ -133,6 +140,73 @@ enum {
 };
 
 
+#define OPENFLOW_MESSAGE_TYPES ( OFPT_QUEUE_GET_CONFIG_REPLY + 1 )
+#define SWITCH_EVENT_TYPES ( MESSENGER_OPENFLOW_DISCONNECTED + 1 )
+
+static const char *openflow_message_stat_names[ OPENFLOW_MESSAGE_TYPES ] = {
+  [ OFPT_HELLO ] = "hello",
+  [ OFPT_ERROR ] = "error",
+  [ OFPT_ECHO_REQUEST ] = "echo_request",
+  [ OFPT_ECHO_REPLY ] = "echo_reply",
+  [ OFPT_VENDOR ] = "vendor",
+  [ OFPT_FEATURES_REQUEST ] = "features_request",
+  [ OFPT_FEATURES_REPLY ] = "features_reply",
+  [ OFPT_GET_CONFIG_REQUEST ] = "get_config_request",
+  [ OFPT_GET_CONFIG_REPLY ] = "get_config_reply",
+  [ OFPT_SET_CONFIG ] = "set_config",
+  [ OFPT_PACKET_IN ] = "packet_in",
+  [ OFPT_FLOW_REMOVED ] = "flow_removed",
+  [ OFPT_PORT_STATUS ] = "port_status",
+  [ OFPT_PACKET_OUT ] = "packet_out",
+  [ OFPT_FLOW_MOD ] = "flow_mod",
+  [ OFPT_PORT_MOD ] = "port_mod",
+  [ OFPT_STATS_REQUEST ] = "stats_request",
+  [ OFPT_STATS_REPLY ] = "stats_reply",
+  [ OFPT_BARRIER_REQUEST ] = "barrier_request",
+  [ OFPT_BARRIER_REPLY ] = "barrier_reply",
+  [ OFPT_QUEUE_GET_CONFIG_REQUEST ] = "queue_get_config_request",
+  [ OFPT_QUEUE_GET_CONFIG_REPLY ] = "queue_get_config_reply",
+};
+
+static const char *switch_event_stat_names[ SWITCH_EVENT_TYPES ] = {
+  [ MESSENGER_OPENFLOW_CONNECTED ] = "switch_connected",
+  [ MESSENGER_OPENFLOW_READY ] = "switch_ready",
+  [ MESSENGER_OPENFLOW_DISCONNECTED ] = "switch_disconnected",
+};
+
+/*
+ * Statistic counters indexed by [ type ][ direction ][ result ]. They are
+ * registered on first use and cleared on initialization since
+ * init_stat() invalidates all counters. The last row is for undefined
+ * types.
+ */
+static stat_counter openflow_message_stats[ OPENFLOW_MESSAGE_TYPES + 1 ][ 2 ][ 2 ];
+static stat_counter switch_event_stats[ SWITCH_EVENT_TYPES + 1 ][ 2 ][ 2 ];
+static stat_counter packet_in_heap_allocations;
+
+
+static void
+clear_interface_stats() {
+  memset( openflow_message_stats, 0, sizeof( openflow_message_stats ) );
+  memset( switch_event_stats, 0, sizeof( switch_event_stats ) );
+  packet_in_heap_allocations = STAT_COUNTER_INVALID;
+}
+
+
+static void
+increment_interface_stat( stat_counter *counter, const char *name, int send_receive, bool result ) {
+  if ( *counter == STAT_COUNTER_INVALID ) {
+    char key[ STAT_KEY_LENGTH ];
+    snprintf( key, sizeof( key ), "openflow_application_interface.%s%s%s", name,
+              send_receive == OPENFLOW_MESSAGE_SEND ? "_send" : "_receive",
+              result ? "_succeeded" : "_failed" );
+    *counter = register_stat_counter( key );
+  }
+
+  increment_stat_counter( *counter );
+}
+
+
 bool
 openflow_application_interface_is_initialized() {
   return openflow_application_interface_initialized;
@@ -170,6 +244,7 @@ init_openflow_application_interface( const char *custom_service_name ) {
   memcpy( service_name, custom_service_name, sizeof( service_name ) );
 
   init_openflow_message();
+  clear_interface_stats();
 
   add_message_received_callback( service_name, handle_message );
 
@@ -186,6 +261,7 @@ finalize_openflow_application_interface() {
   assert( openflow_application_interface_initialized );
 
   delete_message_received_callback( service_name, handle_message );
+  finalize_shadow_flow_table();
 
   memset( &event_handlers, 0, sizeof( openflow_event_handlers_t ) );
   memset( service_name, '\0', sizeof( service_name ) );
@@ -329,7 +405,7 @@ set_get_config_reply_handler( get_config_reply_handler callback, void *user_data
 
 
 bool
-_set_packet_in_handler( bool simple_callback, void *callback, void *user_data ) {
+_set_packet_in_handler( bool simple_callback, void *callback, void *user_data, bool lazy_parsing ) {
   if ( callback == NULL ) {
     die( "Invalid callback function for packet_in event." );
   }
@@ -338,12 +414,13 @@ _set_packet_in_handler( bool simple_callback, void *callback, void *user_data )
   maybe_init_openflow_application_interface();
   assert( openflow_application_interface_initialized );
 
-  debug( "Setting a packet-in handler ( callback = %p, user_data = %p ).",
-         callback, user_data );
+  debug( "Setting a packet-in handler ( callback = %p, user_data = %p, lazy_parsing = %s ).",
+         callback, user_data, lazy_parsing ? "true" : "false" );
 
   event_handlers.simple_packet_in_callback = simple_callback;
   event_handlers.packet_in_callback = callback;
   event_handlers.packet_in_user_data = user_data;
+  event_handlers.lazy_packet_in_parsing = lazy_parsing;
 
   return true;
 }
@@ -467,6 +544,10 @@ handle_error( const uint64_t datapath_id, buffer *data ) {
   type = ntohs( error_msg->type );
   code = ntohs( error_msg->code );
 
+  if ( type == OFPET_FLOW_MOD_FAILED && shadow_flow_table_is_initialized() ) {
+    delete_shadow_flow_entries_by_transaction_id( datapath_id, transaction_id );
+  }
+
   body = duplicate_buffer( data );
   remove_front_buffer( body, offsetof( struct ofp_error_msg, data ) );
 
@@ -709,9 +790,17 @@ handle_packet_in( const uint64_t datapath_id, buffer *data ) {
 
   buffer *body = NULL;
   if ( body_length > 0 ) {
-    body = duplicate_buffer( data );
+    body = share_buffer( data );
     remove_front_buffer( body, offsetof( struct ofp_packet_in, data ) );
-    bool parse_ok = parse_packet( body );
+    // Unless the handler decodes L3 and L4 headers on demand, it may
+    // refer to any field of packet_info, so they are decoded here as well.
+    bool parse_ok;
+    if ( event_handlers.lazy_packet_in_parsing ) {
+      parse_ok = parse_packet_lazily( body );
+    }
+    else {
+      parse_ok = parse_packet( body );
+    }
     if ( !parse_ok ) {
       error( "Failed to parse a packet." );
       // ???: Is it OK to drop malformed packets?
@@ -798,6 +887,10 @@ handle_flow_removed( const uint64_t datapath_id, buffer *data ) {
          priority, reason, duration_sec, duration_nsec,
          idle_timeout, packet_count, byte_count );
 
+  if ( shadow_flow_table_is_initialized() ) {
+    delete_shadow_flow_entry( datapath_id, match, priority );
+  }
+
   if ( event_handlers.flow_removed_callback == NULL ) {
     debug( "Callback function for flow removed events is not set." );
     return;
@@ -888,6 +981,12 @@ handle_stats_reply( const uint64_t datapath_id, buffer *data ) {
          " ( transaction_id = %#x, type = %#x, flags = %#x, body length = %u ).",
          datapath_id, transaction_id, type, flags, body_length );
 
+  // Replies to the flow stats request sent by sync_flow_table() are not
+  // passed to the application.
+  if ( shadow_flow_table_is_initialized() && sync_shadow_flow_table( datapath_id, data ) ) {
+    return;
+  }
+
   if ( event_handlers.stats_reply_callback == NULL ) {
     debug( "Callback function for stats reply events is not set." );
     return;
@@ -1147,54 +1246,40 @@ handle_queue_get_config_reply( const uint64_t datapath_id, buffer *data ) {
 
 static void
 update_switch_event_stats( uint16_t type, int send_receive, bool result ) {
-  char key[ STAT_KEY_LENGTH ];
-  char suffix[ 16 ];
-  char direction[ 16 ];
-  const char *prefix = "openflow_application_interface.";
-
-  memset( suffix, '\0', sizeof( suffix ) );
-
-  if ( result ) {
-    sprintf( suffix, "_succeeded" );
-  }
-  else {
-    sprintf( suffix, "_failed" );
-  }
-
-  memset( direction, '\0', sizeof( direction ) );
-
-  switch ( send_receive ) {
-  case OPENFLOW_MESSAGE_SEND:
-    sprintf( direction, "_send" );
-    break;
-  case OPENFLOW_MESSAGE_RECEIVE:
-    sprintf( direction, "_receive" );
-    break;
-  default:
+  if ( send_receive != OPENFLOW_MESSAGE_SEND && send_receive != OPENFLOW_MESSAGE_RECEIVE ) {
     return;
   }
 
-  switch ( type ) {
-  case MESSENGER_OPENFLOW_CONNECTED:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "switch_connected", direction, suffix );
-    break;
-  case MESSENGER_OPENFLOW_READY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "switch_ready", direction, suffix );
-    break;
-  case MESSENGER_OPENFLOW_DISCONNECTED:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "switch_disconnected", direction, suffix );
-    break;
-  default:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "undefined_switch_event", direction, suffix );
-    break;
+  size_t index = SWITCH_EVENT_TYPES;
+  if ( type < SWITCH_EVENT_TYPES && switch_event_stat_names[ type ] != NULL ) {
+    index = type;
   }
+  increment_interface_stat( &switch_event_stats[ index ][ send_receive ][ result ],
+                            index < SWITCH_EVENT_TYPES ? switch_event_stat_names[ index ] : "undefined_switch_event",
+                            send_receive, result );
+}
 
-  increment_stat( key );
+
+static void
+sync_flow_table( uint64_t datapath_id ) {
+  struct ofp_match match;
+  memset( &match, 0, sizeof( match ) );
+  match.wildcards = OFPFW_ALL;
+
+  uint32_t transaction_id = get_transaction_id();
+  buffer *request = create_flow_stats_request( transaction_id, 0, match, 0xff, OFPP_NONE );
+  start_shadow_flow_table_sync( datapath_id, transaction_id );
+  send_openflow_message( datapath_id, request );
+  free_buffer( request );
 }
 
 
 static void
 handle_switch_ready( uint64_t datapath_id ) {
+  if ( shadow_flow_table_is_initialized() ) {
+    sync_flow_table( datapath_id );
+  }
+
   if ( event_handlers.switch_ready_callback == NULL ) {
     debug( "Callback function for switch_ready events is not set." );
     return;
@@ -1224,6 +1309,7 @@ handle_switch_events( uint16_t type, void *data, size_t length ) {
 
   assert( data != NULL );
   assert( length == sizeof( openflow_service_header_t ) );
+  UNUSED( length );
 
   debug( "A switch event is received from remote ( type = %u ).", type );
 
@@ -1238,6 +1324,9 @@ handle_switch_events( uint16_t type, void *data, size_t length ) {
     handle_switch_ready( datapath_id );
     break;
   case MESSENGER_OPENFLOW_DISCONNECTED:
+    if ( shadow_flow_table_is_initialized() ) {
+      delete_shadow_flow_table( datapath_id );
+    }
     if ( event_handlers.switch_disconnected_callback != NULL ) {
       debug( "Calling switch disconnected handler ( callback = %p, user_data = %p ).",
              event_handlers.switch_disconnected_callback, event_handlers.switch_disconnected_user_data );
@@ -1259,112 +1348,19 @@ handle_switch_events( uint16_t type, void *data, size_t length ) {
 
 static void
 update_openflow_stats( uint8_t type, int send_receive, bool result ) {
-  char key[ STAT_KEY_LENGTH ];
-  char suffix[ 16 ];
-  char direction[ 16 ];
-  const char *prefix = "openflow_application_interface.";
-
-  memset( suffix, '\0', sizeof( suffix ) );
-
-  if ( result ) {
-    sprintf( suffix, "_succeeded" );
-  }
-  else {
-    sprintf( suffix, "_failed" );
-  }
-
-  memset( direction, '\0', sizeof( direction ) );
-
-  switch ( send_receive ) {
-  case OPENFLOW_MESSAGE_SEND:
-    sprintf( direction, "_send" );
-    break;
-  case OPENFLOW_MESSAGE_RECEIVE:
-    sprintf( direction, "_receive" );
-    break;
-  default:
+  if ( send_receive != OPENFLOW_MESSAGE_SEND && send_receive != OPENFLOW_MESSAGE_RECEIVE ) {
     return;
   }
 
-  switch ( type ) {
-  case OFPT_HELLO:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "hello", direction, suffix );
-    break;
-  case OFPT_ERROR:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "error", direction, suffix );
-    break;
-  case OFPT_ECHO_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "echo_request", direction, suffix );
-    break;
-  case OFPT_ECHO_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "echo_reply", direction, suffix );
-    break;
-  case OFPT_VENDOR:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "vendor", direction, suffix );
-    break;
-  case OFPT_FEATURES_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "features_request", direction, suffix );
-    break;
-  case OFPT_FEATURES_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "features_reply", direction, suffix );
-    break;
-  case OFPT_GET_CONFIG_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "get_config_request", direction, suffix );
-    break;
-  case OFPT_GET_CONFIG_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "get_config_reply", direction, suffix );
-    break;
-  case OFPT_SET_CONFIG:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "set_config", direction, suffix );
-    break;
-  case OFPT_PACKET_IN:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "packet_in", direction, suffix );
-    break;
-  case OFPT_FLOW_REMOVED:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "flow_removed", direction, suffix );
-    break;
-  case OFPT_PORT_STATUS:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "port_status", direction, suffix );
-    break;
-  case OFPT_PACKET_OUT:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "packet_out", direction, suffix );
-    break;
-  case OFPT_FLOW_MOD:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "flow_mod", direction, suffix );
-    break;
-  case OFPT_PORT_MOD:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "port_mod", direction, suffix );
-    break;
-  case OFPT_STATS_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "stats_request", direction, suffix );
-    break;
-  case OFPT_STATS_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "stats_reply", direction, suffix );
-    break;
-  case OFPT_BARRIER_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "barrier_request", direction, suffix );
-    break;
-  case OFPT_BARRIER_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "barrier_reply", direction, suffix );
-    break;
-  case OFPT_QUEUE_GET_CONFIG_REQUEST:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "queue_get_config_request", direction, suffix );
-    break;
-  case OFPT_QUEUE_GET_CONFIG_REPLY:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "queue_get_config_reply", direction, suffix );
-    break;
-  default:
-    snprintf( key, STAT_KEY_LENGTH, "%s%s%s%s", prefix, "undefined_message_type", direction, suffix );
-    break;
-  }
-
-  increment_stat( key );
+  size_t index = type < OPENFLOW_MESSAGE_TYPES ? type : OPENFLOW_MESSAGE_TYPES;
+  increment_interface_stat( &openflow_message_stats[ index ][ send_receive ][ result ],
+                            index < OPENFLOW_MESSAGE_TYPES ? openflow_message_stat_names[ index ] : "undefined_message_type",
+                            send_receive, result );
 }
 
 
 static void
 handle_openflow_message( void *data, size_t length ) {
-  void *p;
   int ret;
   uint64_t datapath_id;
   buffer *buffer;
@@ -1376,16 +1372,22 @@ handle_openflow_message( void *data, size_t length ) {
 
   debug( "An OpenFlow message is received from remote." );
 
+#ifndef NDEBUG
+  // Heap allocations made while handling a packet_in are accounted
+  // to see how far the object pools keep them off the heap.
+  uint64_t heap_allocations = get_heap_allocation_count();
+#endif
+
   message = ( openflow_service_header_t * ) data;
 
   datapath_id = ntohll( message->datapath_id );
 
-  buffer = alloc_buffer_with_length( length );
+  // The message is valid until this function returns, so refer to it
+  // in place instead of copying.
+  buffer = wrap_buffer( data, length );
 
   assert( buffer != NULL );
 
-  p = append_back_buffer( buffer, length );
-  memcpy( p, data, length );
   remove_front_buffer( buffer, sizeof( openflow_service_header_t ) );
 
   ret = validate_openflow_message( buffer );
@@ -1437,6 +1439,16 @@ handle_openflow_message( void *data, size_t length ) {
 
   update_openflow_stats( header->type, OPENFLOW_MESSAGE_RECEIVE, true );
 
+#ifndef NDEBUG
+  heap_allocations = get_heap_allocation_count() - heap_allocations;
+  if ( header->type == OFPT_PACKET_IN && heap_allocations > 0 ) {
+    if ( packet_in_heap_allocations == STAT_COUNTER_INVALID ) {
+      packet_in_heap_allocations = register_stat_counter( "openflow_application_interface.packet_in_heap_allocations" );
+    }
+    add_stat_counter( packet_in_heap_allocations, heap_allocations );
+  }
+#endif
+
   free_buffer( buffer );
 }
 
@@ -1482,9 +1494,12 @@ send_openflow_message( const uint64_t datapath_id, buffer *message ) {
   }
 
   ofp = ( struct ofp_header * ) message->data;
-  buffer = duplicate_buffer( message );
 
-  assert( buffer != NULL );
+  bool shadowed = ofp->type == OFPT_FLOW_MOD && shadow_flow_table_is_initialized();
+  if ( shadowed && shadow_flow_mod_is_redundant( datapath_id, message ) ) {
+    debug( "Suppressing a flow modification that does not change the flow table of %#" PRIx64 ".", datapath_id );
+    return true;
+  }
 
   header_length = ( uint16_t ) ( sizeof( openflow_service_header_t )
                   + strlen( service_name ) + 1 );
@@ -1492,7 +1507,13 @@ send_openflow_message( const uint64_t datapath_id, buffer *message ) {
   header.datapath_id = htonll( datapath_id );
   header.service_name_length = htons( ( uint16_t ) ( strlen( service_name ) + 1 ) );
 
-  data = append_front_buffer( buffer, header_length );
+  // Copy the message behind the header at once instead of duplicating
+  // and then prepending the header to it.
+  buffer = alloc_buffer_with_length( header_length + message->length );
+  assert( buffer != NULL );
+  data = append_back_buffer( buffer, header_length + message->length );
+  memcpy( ( char * ) data + header_length, message->data, message->length );
+
   memset( data, '\0', header_length );
   memcpy( data, &header, sizeof( openflow_service_header_t ) );
   memcpy( ( char * ) data + sizeof( openflow_service_header_t ),
@@ -1513,6 +1534,11 @@ send_openflow_message( const uint64_t datapath_id, buffer *message ) {
 
   free_buffer( buffer );
 
+  // Record the flow modification only if it may reach the switch.
+  if ( shadowed && ret ) {
+    update_shadow_flow_table( datapath_id, message );
+  }
+
   update_openflow_stats( ofp->type, OPENFLOW_MESSAGE_SEND, ret );
 
   return ret;
@@ -201,6 +201,7 @@ typedef struct openflow_event_handlers {
   bool simple_packet_in_callback;
   void *packet_in_callback;
   void *packet_in_user_data;
+  bool lazy_packet_in_parsing;
 
   flow_removed_handler flow_removed_callback;
   void *flow_removed_user_data;
@@ -248,16 +249,31 @@ bool set_get_config_reply_handler( get_config_reply_handler callback, void *user
 #define set_packet_in_handler( callback, user_data )                                      \
   {                                                                                       \
     if ( __builtin_types_compatible_p( typeof( callback ), simple_packet_in_handler ) ) { \
-      _set_packet_in_handler( true, callback, user_data );                                \
+      _set_packet_in_handler( true, callback, user_data, false );                         \
     }                                                                                     \
     else if ( __builtin_types_compatible_p( typeof( callback ), packet_in_handler ) ) {   \
-      _set_packet_in_handler( false, callback, user_data );                               \
+      _set_packet_in_handler( false, callback, user_data, false );                        \
     }                                                                                     \
     else {                                                                                \
-      _set_packet_in_handler( false, NULL, NULL );                                        \
+      _set_packet_in_handler( false, NULL, NULL, false );                                 \
     }                                                                                     \
   }
-bool _set_packet_in_handler( bool simple_callback, void *callback, void *user_data );
+// Same as set_packet_in_handler() except that only the Ethernet header
+// and 802.1Q tags of a packet are decoded before calling the handler.
+// The handler calls parse_packet_l3() if it refers to L3 or L4 headers.
+#define set_lazy_packet_in_handler( callback, user_data )                                 \
+  {                                                                                       \
+    if ( __builtin_types_compatible_p( typeof( callback ), simple_packet_in_handler ) ) { \
+      _set_packet_in_handler( true, callback, user_data, true );                          \
+    }                                                                                     \
+    else if ( __builtin_types_compatible_p( typeof( callback ), packet_in_handler ) ) {   \
+      _set_packet_in_handler( false, callback, user_data, true );                         \
+    }                                                                                     \
+    else {                                                                                \
+      _set_packet_in_handler( false, NULL, NULL, true );                                  \
+    }                                                                                     \
+  }
+bool _set_packet_in_handler( bool simple_callback, void *callback, void *user_data, bool lazy_parsing );
 
 bool set_flow_removed_handler( flow_removed_handler callback, void *user_data );
 bool set_port_status_handler( port_status_handler callback, void *user_data );
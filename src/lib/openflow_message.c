@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "object_pool.h"
 #include "openflow_message.h"
 #include "packet_info.h"
 #include "packet_parser.h"
@@ -401,7 +402,7 @@ create_flow_removed( const uint32_t transaction_id, const struct ofp_match match
   struct ofp_flow_removed *flow_removed;
 
   // Because match_to_string() is costly, we check logging_level first.
-  if ( get_logging_level() >= LOG_DEBUG ) {
+  if ( logging_level_is_enabled( LOG_DEBUG ) ) {
     match_to_string( &m, match_str, sizeof( match_str ) );
     debug( "Creating a flow removed "
            "( xid = %#x, match = [%s], cookie = %#" PRIx64 ", priority = %u, "
@@ -578,7 +579,7 @@ create_flow_mod( const uint32_t transaction_id, const struct ofp_match match,
   list_element *action;
 
   // Because match_to_string() is costly, we check logging_level first.
-  if ( get_logging_level() >= LOG_DEBUG ) {
+  if ( logging_level_is_enabled( LOG_DEBUG ) ) {
     match_to_string( &m, match_str, sizeof( match_str ) );
     debug( "Creating a flow modification "
            "( xid = %#x, match = [%s], cookie = %#" PRIx64 ", command = %#x, "
@@ -626,6 +627,60 @@ create_flow_mod( const uint32_t transaction_id, const struct ofp_match match,
 }
 
 
+/**
+ * Encodes a flow modification whose command, timeouts, priority,
+ * out_port, flags and actions do not change between uses. Messages are
+ * made from the template by create_flow_mod_from_template(), which only
+ * fills in the transaction id, match, cookie and buffer id.
+ */
+flow_mod_template *
+create_flow_mod_template( const uint16_t command,
+                          const uint16_t idle_timeout, const uint16_t hard_timeout,
+                          const uint16_t priority, const uint16_t out_port,
+                          const uint16_t flags, const openflow_actions *actions ) {
+  struct ofp_match match;
+  memset( &match, 0, sizeof( match ) );
+
+  debug( "Creating a flow modification template." );
+
+  flow_mod_template *template = xmalloc( sizeof( flow_mod_template ) );
+  template->message = create_flow_mod( 0, match, 0, command, idle_timeout, hard_timeout,
+                                       priority, UINT32_MAX, out_port, flags, actions );
+
+  return template;
+}
+
+
+void
+delete_flow_mod_template( flow_mod_template *template ) {
+  assert( template != NULL );
+
+  free_buffer( template->message );
+  xfree( template );
+}
+
+
+buffer *
+create_flow_mod_from_template( const flow_mod_template *template, const uint32_t transaction_id,
+                               const struct ofp_match match, const uint64_t cookie,
+                               const uint32_t buffer_id ) {
+  assert( template != NULL );
+
+  size_t length = template->message->length;
+  buffer *buffer = alloc_buffer_with_length( length );
+  struct ofp_flow_mod *flow_mod = append_back_buffer( buffer, length );
+  memcpy( flow_mod, template->message->data, length );
+
+  struct ofp_match m = match;
+  flow_mod->header.xid = htonl( transaction_id );
+  hton_match( &flow_mod->match, &m );
+  flow_mod->cookie = htonll( cookie );
+  flow_mod->buffer_id = htonl( buffer_id );
+
+  return buffer;
+}
+
+
 buffer *
 create_port_mod( const uint32_t transaction_id, const const uint16_t port_no,
                  const uint8_t hw_addr[ OFP_ETH_ALEN ], const uint32_t config,
@@ -696,7 +751,7 @@ create_flow_stats_request( const uint32_t transaction_id, const uint16_t flags,
   struct ofp_flow_stats_request *flow_stats_request;
 
   // Because match_to_string() is costly, we check logging_level first.
-  if ( get_logging_level() >= LOG_DEBUG ) {
+  if ( logging_level_is_enabled( LOG_DEBUG ) ) {
     match_to_string( &m, match_str, sizeof( match_str ) );
     debug( "Creating a flow stats request ( xid = %#x, flags = %#x, match = [%s], table_id = %u, out_port = %u ).",
            transaction_id, flags, match_str, table_id, out_port );
@@ -729,7 +784,7 @@ create_aggregate_stats_request( const uint32_t transaction_id,
   struct ofp_aggregate_stats_request *aggregate_stats_request;
 
   // Because match_to_string() is costly, we check logging_level first.
-  if ( get_logging_level() >= LOG_DEBUG ) {
+  if ( logging_level_is_enabled( LOG_DEBUG ) ) {
     match_to_string( &m, match_str, sizeof( match_str ) );
     debug( "Creating an aggregate stats request ( xid = %#x, flags = %#x, match = [%s], table_id = %u, out_port = %u ).",
            transaction_id, flags, match_str, table_id, out_port );
@@ -1280,13 +1335,33 @@ get_cookie( void ) {
 }
 
 
+// Actions are small and fixed-size except for vendor actions, and are
+// created and deleted for most flow modifications and packet_outs.
+static object_pool openflow_actions_pool = OBJECT_POOL_INITIALIZER( "openflow_actions", sizeof( openflow_actions ) );
+
+
+static void *
+allocate_action( size_t length ) {
+  void *action = allocate_sized_object( length );
+  memset( action, 0, length );
+
+  return action;
+}
+
+
+static void
+free_action( void *action ) {
+  free_sized_object( action, ( ( struct ofp_action_header * ) action )->len );
+}
+
+
 openflow_actions *
 create_actions() {
   openflow_actions *actions;
 
   debug( "Creating an empty actions list." );
 
-  actions = ( openflow_actions * ) xmalloc( sizeof( openflow_actions ) );
+  actions = allocate_object( &openflow_actions_pool );
 
   if ( create_list( &actions->list ) == false ) {
     assert( 0 );
@@ -1310,12 +1385,12 @@ delete_actions( openflow_actions *actions ) {
 
   element = actions->list;
   while ( element != NULL ) {
-    xfree( element->data );
+    free_action( element->data );
     element = element->next;
   }
 
   delete_list( actions->list );
-  xfree( actions );
+  free_object( &openflow_actions_pool, actions );
 
   return true;
 }
@@ -1330,7 +1405,7 @@ append_action_output( openflow_actions *actions, const uint16_t port, const uint
 
   assert( actions != NULL );
 
-  action_output = ( struct ofp_action_output * ) xcalloc( 1, sizeof( struct ofp_action_output ) );
+  action_output = allocate_action( sizeof( struct ofp_action_output ) );
   action_output->type = OFPAT_OUTPUT;
   action_output->len = sizeof( struct ofp_action_output );
   action_output->port = port;
@@ -1355,7 +1430,7 @@ append_action_set_vlan_vid( openflow_actions *actions, const uint16_t vlan_vid )
   assert( actions != NULL );
   assert( ( vlan_vid & ~VLAN_VID_MASK ) == 0 );
 
-  action_vlan_vid = ( struct ofp_action_vlan_vid * ) xcalloc( 1, sizeof( struct ofp_action_vlan_vid ) );
+  action_vlan_vid = allocate_action( sizeof( struct ofp_action_vlan_vid ) );
   action_vlan_vid->type = OFPAT_SET_VLAN_VID;
   action_vlan_vid->len = sizeof( struct ofp_action_vlan_vid );
   action_vlan_vid->vlan_vid = vlan_vid;
@@ -1379,7 +1454,7 @@ append_action_set_vlan_pcp( openflow_actions *actions, const uint8_t vlan_pcp )
   assert( actions != NULL );
   assert( ( vlan_pcp & ~VLAN_PCP_MASK ) == 0 );
 
-  action_vlan_pcp = ( struct ofp_action_vlan_pcp * ) xcalloc( 1, sizeof( struct ofp_action_vlan_pcp ) );
+  action_vlan_pcp = allocate_action( sizeof( struct ofp_action_vlan_pcp ) );
   action_vlan_pcp->type = OFPAT_SET_VLAN_PCP;
   action_vlan_pcp->len = sizeof( struct ofp_action_vlan_pcp );
   action_vlan_pcp->vlan_pcp = vlan_pcp;
@@ -1402,7 +1477,7 @@ append_action_strip_vlan( openflow_actions *actions ) {
 
   assert( actions != NULL );
 
-  action_strip_vlan = ( struct ofp_action_header * ) xcalloc( 1, sizeof( struct ofp_action_header ) );
+  action_strip_vlan = allocate_action( sizeof( struct ofp_action_header ) );
   action_strip_vlan->type = OFPAT_STRIP_VLAN;
   action_strip_vlan->len = sizeof( struct ofp_action_header );
 
@@ -1426,7 +1501,7 @@ append_action_set_dl_addr( openflow_actions *actions, const uint16_t type,
 
   assert( actions != NULL );
 
-  action_dl_addr = ( struct ofp_action_dl_addr * ) xcalloc( 1, sizeof( struct ofp_action_dl_addr ) );
+  action_dl_addr = allocate_action( sizeof( struct ofp_action_dl_addr ) );
   action_dl_addr->type = type;
   action_dl_addr->len = sizeof( struct ofp_action_dl_addr );
   memcpy( action_dl_addr->dl_addr, hw_addr, OFP_ETH_ALEN );
@@ -1474,7 +1549,7 @@ append_action_set_nw_addr( openflow_actions *actions, const uint16_t type, const
 
   assert( actions != NULL );
 
-  action_nw_addr = ( struct ofp_action_nw_addr * ) xcalloc( 1, sizeof( struct ofp_action_nw_addr ) );
+  action_nw_addr = allocate_action( sizeof( struct ofp_action_nw_addr ) );
   action_nw_addr->type = type;
   action_nw_addr->len = sizeof( struct ofp_action_nw_addr );
   action_nw_addr->nw_addr = nw_addr;
@@ -1528,7 +1603,7 @@ append_action_set_nw_tos( openflow_actions *actions, const uint8_t nw_tos ) {
   assert( actions != NULL );
   assert( ( nw_tos & ~NW_TOS_MASK ) == 0 );
 
-  action_nw_tos = ( struct ofp_action_nw_tos * ) xcalloc( 1, sizeof( struct ofp_action_nw_tos ) );
+  action_nw_tos = allocate_action( sizeof( struct ofp_action_nw_tos ) );
   action_nw_tos->type = OFPAT_SET_NW_TOS;
   action_nw_tos->len = sizeof( struct ofp_action_nw_tos );
   action_nw_tos->nw_tos = nw_tos;
@@ -1551,7 +1626,7 @@ append_action_set_tp_port( openflow_actions *actions, const uint16_t type, const
 
   assert( actions != NULL );
 
-  action_tp_port = ( struct ofp_action_tp_port * ) xcalloc( 1, sizeof( struct ofp_action_tp_port ) );
+  action_tp_port = allocate_action( sizeof( struct ofp_action_tp_port ) );
   action_tp_port->type = type;
   action_tp_port->len = sizeof( struct ofp_action_tp_port );
   action_tp_port->tp_port = tp_port;
@@ -1592,7 +1667,7 @@ append_action_enqueue( openflow_actions *actions, const uint16_t port, const uin
 
   assert( actions != NULL );
 
-  action_enqueue = ( struct ofp_action_enqueue * ) xcalloc( 1, sizeof( struct ofp_action_enqueue ) );
+  action_enqueue = allocate_action( sizeof( struct ofp_action_enqueue ) );
   action_enqueue->type = OFPAT_ENQUEUE;
   action_enqueue->len = sizeof( struct ofp_action_enqueue );
   action_enqueue->port = port;
@@ -1621,8 +1696,7 @@ append_action_vendor( openflow_actions *actions, const uint32_t vendor, const bu
 
   assert( actions != NULL );
 
-  action_vendor = ( struct ofp_action_vendor_header * )
-                  xcalloc( 1, sizeof( struct ofp_action_vendor_header ) + body_length );
+  action_vendor = allocate_action( sizeof( struct ofp_action_vendor_header ) + body_length );
   action_vendor->type = OFPAT_VENDOR;
   action_vendor->len = ( uint16_t ) ( sizeof( struct ofp_action_vendor_header ) + body_length );
   action_vendor->vendor = vendor;
@@ -3938,6 +4012,14 @@ set_match_from_packet( struct ofp_match *match, const uint16_t in_port,
   if ( !( wildcards & OFPFW_DL_TYPE ) ) {
     match->dl_type = packet_info( packet )->ethtype;
   }
+  // L3 and L4 headers of a lazily parsed packet are decoded here. If they
+  // are malformed, L3 and L4 fields are wildcarded.
+  if ( ( match->dl_type == ETH_ETHTYPE_IPV4 || match->dl_type == ETH_ETHTYPE_ARP )
+       && !parse_packet_l3( ( buffer * ) ( uintptr_t ) packet ) ) {
+    match->wildcards |= OFPFW_NW_TOS | OFPFW_NW_PROTO | OFPFW_NW_SRC_MASK | OFPFW_NW_DST_MASK
+                        | OFPFW_TP_SRC | OFPFW_TP_DST;
+    return;
+  }
   if ( match->dl_type == ETH_ETHTYPE_IPV4 ) {
     if ( !( wildcards & OFPFW_NW_TOS ) ) {
       match->nw_tos = packet_info( packet )->l3_data.ipv4->tos;
@@ -39,6 +39,12 @@ typedef struct openflow_actions {
 } openflow_actions;
 
 
+// A flow modification encoded in advance except for per-message fields
+typedef struct flow_mod_template {
+  buffer *message;
+} flow_mod_template;
+
+
 // Initialization
 bool init_openflow_message( void );
 
@@ -79,6 +85,14 @@ buffer *create_flow_mod( const uint32_t transaction_id, const struct ofp_match m
                          const uint16_t priority, const uint32_t buffer_id,
                          const uint16_t out_port, const uint16_t flags,
                          const openflow_actions *actions );
+flow_mod_template *create_flow_mod_template( const uint16_t command,
+                                             const uint16_t idle_timeout, const uint16_t hard_timeout,
+                                             const uint16_t priority, const uint16_t out_port,
+                                             const uint16_t flags, const openflow_actions *actions );
+void delete_flow_mod_template( flow_mod_template *template );
+buffer *create_flow_mod_from_template( const flow_mod_template *template, const uint32_t transaction_id,
+                                       const struct ofp_match match, const uint64_t cookie,
+                                       const uint32_t buffer_id );
 buffer *create_port_mod( const uint32_t transaction_id, const const uint16_t port_no,
                          const uint8_t hw_addr[ OFP_ETH_ALEN ], const uint32_t config,
                          const uint32_t mask, const uint32_t advertise );
@@ -19,16 +19,20 @@
 
 
 #include <assert.h>
+#include "object_pool.h"
 #include "packet_info.h"
 #include "wrapper.h"
 
 
+static object_pool packet_header_info_pool = OBJECT_POOL_INITIALIZER( "packet_header_info", sizeof( packet_header_info ) );
+
+
 static void
 free_packet_header_info( buffer *buf ) {
   assert( buf != NULL );
   assert( buf->user_data != NULL );
 
-  xfree( buf->user_data );
+  free_object( &packet_header_info_pool, buf->user_data );
   buf->user_data = NULL;
 }
 
@@ -37,16 +41,18 @@ void
 alloc_packet( buffer *buf ) {
   assert( buf != NULL );
 
-  packet_header_info *header_info = xcalloc( 1, sizeof( packet_header_info ) );
+  packet_header_info *header_info = allocate_object( &packet_header_info_pool );
   assert( header_info != NULL );
 
   header_info->ethtype = 0;
   header_info->nvtags = 0;
   header_info->ipproto = 0;
+  header_info->nexthop = 0;
   header_info->l2_data.l2 = NULL;
   header_info->vtag = NULL;
   header_info->l3_data.l3 = NULL;
   header_info->l4_data.l4 = NULL;
+  header_info->l3_status = PACKET_L3_VALID;
   buf->user_data = header_info;
 }
 
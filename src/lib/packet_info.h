@@ -51,6 +51,13 @@
 #include "udp.h"
 
 
+// Whether L3 and L4 headers are decoded. Only packets parsed by
+// parse_packet_lazily() are left unparsed ( see parse_packet_l3() ).
+#define PACKET_L3_UNPARSED 0
+#define PACKET_L3_VALID 1
+#define PACKET_L3_INVALID 2
+
+
 typedef struct packet_header_info {
   uint16_t ethtype;
   uint8_t nvtags;
@@ -72,6 +79,7 @@ typedef struct packet_header_info {
     tcp_header_t *tcp;
     udp_header_t *udp;
   } l4_data;
+  uint8_t l3_status;
 } packet_header_info;
 
 
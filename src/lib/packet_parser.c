@@ -20,13 +20,21 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 #include "packet_info.h"
 #include "log.h"
 #include "wrapper.h"
 
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#endif
+
 
 #ifdef UNIT_TESTING
 
+// Allow static functions and variables to be referred from unit tests.
+#define static
+
 #ifdef warn
 #undef warn
 #endif
@@ -35,27 +43,211 @@
 #endif // UNIT_TESTING
 
 
-uint16_t
-get_checksum( uint16_t *pos, uint32_t size ) {
-  assert( pos != NULL );
+/*
+ * Ones' complement sums of 16-bit words are independent of byte order
+ * and can be accumulated in wider integers and folded at the end
+ * ( RFC 1071 ). The vectorized versions add 16-bit words into 32-bit
+ * lanes and flush the lanes before they can overflow.
+ */
+
+static uint64_t
+sum_words_scalar( const uint8_t *p, size_t size ) {
+  uint64_t sum = 0;
 
-  uint32_t csum = 0;
-  for (; 2 <= size; pos++, size -= 2 ) {
-    csum += *pos;
+  for (; size >= sizeof( uint32_t ); p += sizeof( uint32_t ), size -= sizeof( uint32_t ) ) {
+    uint32_t word;
+    memcpy( &word, p, sizeof( word ) );
+    sum += word;
+  }
+  if ( size >= sizeof( uint16_t ) ) {
+    uint16_t word;
+    memcpy( &word, p, sizeof( word ) );
+    sum += word;
+    p += sizeof( uint16_t );
+    size -= sizeof( uint16_t );
   }
   if ( size == 1 ) {
-    csum += *( unsigned char * ) pos;
+    uint16_t word = 0;
+    memcpy( &word, p, 1 );
+    sum += word;
   }
-  while ( csum & 0xffff0000 ) {
-    csum = ( csum & 0x0000ffff ) + ( csum >> 16 );
+
+  return sum;
+}
+
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+
+// Each iteration adds at most two 16-bit words to every 32-bit lane.
+#define LANE_FLUSH_INTERVAL 16384
+
+
+__attribute__( ( target( "sse2" ) ) ) static uint64_t
+sum_words_sse2( const uint8_t *p, size_t size ) {
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t sum = 0;
+
+  while ( size >= sizeof( __m128i ) ) {
+    __m128i lanes = _mm_setzero_si128();
+    for ( int i = 0; i < LANE_FLUSH_INTERVAL && size >= sizeof( __m128i ); i++ ) {
+      __m128i words = _mm_loadu_si128( ( const __m128i * ) ( const void * ) p );
+      lanes = _mm_add_epi32( lanes, _mm_unpacklo_epi16( words, zero ) );
+      lanes = _mm_add_epi32( lanes, _mm_unpackhi_epi16( words, zero ) );
+      p += sizeof( __m128i );
+      size -= sizeof( __m128i );
+    }
+    uint32_t values[ 4 ];
+    _mm_storeu_si128( ( __m128i * ) ( void * ) values, lanes );
+    sum += ( uint64_t ) values[ 0 ] + values[ 1 ] + values[ 2 ] + values[ 3 ];
+  }
+
+  return sum + sum_words_scalar( p, size );
+}
+
+
+__attribute__( ( target( "avx2" ) ) ) static uint64_t
+sum_words_avx2( const uint8_t *p, size_t size ) {
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t sum = 0;
+
+  while ( size >= sizeof( __m256i ) ) {
+    __m256i lanes = _mm256_setzero_si256();
+    for ( int i = 0; i < LANE_FLUSH_INTERVAL && size >= sizeof( __m256i ); i++ ) {
+      __m256i words = _mm256_loadu_si256( ( const __m256i * ) ( const void * ) p );
+      lanes = _mm256_add_epi32( lanes, _mm256_unpacklo_epi16( words, zero ) );
+      lanes = _mm256_add_epi32( lanes, _mm256_unpackhi_epi16( words, zero ) );
+      p += sizeof( __m256i );
+      size -= sizeof( __m256i );
+    }
+    uint32_t values[ 8 ];
+    _mm256_storeu_si256( ( __m256i * ) ( void * ) values, lanes );
+    for ( int i = 0; i < 8; i++ ) {
+      sum += values[ i ];
+    }
   }
 
-  return ( uint16_t ) ~csum;
+  return sum + sum_words_sse2( p, size );
+}
+
+#endif // __x86_64__ || __i386__
+
+
+static uint64_t ( *sum_words )( const uint8_t *p, size_t size ) = NULL;
+
+
+static void
+select_sum_words( void ) {
+  sum_words = sum_words_scalar;
+#if defined( __x86_64__ ) || defined( __i386__ )
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "avx2" ) ) {
+    sum_words = sum_words_avx2;
+  }
+  else if ( __builtin_cpu_supports( "sse2" ) ) {
+    sum_words = sum_words_sse2;
+  }
+#endif
+}
+
+
+static uint16_t
+fold_checksum( uint64_t sum ) {
+  while ( sum >> 16 ) {
+    sum = ( sum & 0xffff ) + ( sum >> 16 );
+  }
+  return ( uint16_t ) sum;
+}
+
+
+/**
+ * Returns the Internet checksum of `size' octets from `pos'. SSE2 or
+ * AVX2 is used if the CPU supports it.
+ */
+uint16_t
+get_checksum( uint16_t *pos, uint32_t size ) {
+  assert( pos != NULL );
+
+  if ( sum_words == NULL ) {
+    select_sum_words();
+  }
+
+  return ( uint16_t ) ~fold_checksum( sum_words( ( const uint8_t * ) pos, size ) );
+}
+
+
+/**
+ * Returns the checksum updated for a 16-bit field of the checksummed
+ * data that changed from `old_value' to `new_value' ( RFC 1624 ). All
+ * values are as stored in the packet, i.e. in network byte order.
+ */
+uint16_t
+update_checksum_16( uint16_t checksum, uint16_t old_value, uint16_t new_value ) {
+  uint64_t sum = ( uint16_t ) ~checksum;
+  sum += ( uint16_t ) ~old_value;
+  sum += new_value;
+
+  return ( uint16_t ) ~fold_checksum( sum );
+}
+
+
+/**
+ * Same as update_checksum_16() but for a 32-bit field such as an IPv4
+ * address.
+ */
+uint16_t
+update_checksum_32( uint16_t checksum, uint32_t old_value, uint32_t new_value ) {
+  uint64_t sum = ( uint16_t ) ~checksum;
+  sum += ( uint16_t ) ~( old_value >> 16 ) + ( uint16_t ) ~( old_value & 0xffff );
+  sum += ( new_value >> 16 ) + ( new_value & 0xffff );
+
+  return ( uint16_t ) ~fold_checksum( sum );
+}
+
+
+static bool
+parse_arp( buffer *buf ) {
+  return valid_arp_packet( buf );
 }
 
 
+/*
+ * L3 decoders by Ethernet type. Frames of the other types are
+ * passed without L3 decoding.
+ */
+static const struct {
+  uint16_t ethtype;
+  bool ( *parse )( buffer *buf );
+  const char *name;
+} l3_parsers[] = {
+  { ETH_ETHTYPE_IPV4, parse_ipv4, "IPv4" },
+  { ETH_ETHTYPE_ARP, parse_arp, "ARP" },
+};
+
+
+static bool
+parse_l3( buffer *buf ) {
+  for ( size_t i = 0; i < sizeof( l3_parsers ) / sizeof( l3_parsers[ 0 ] ); i++ ) {
+    if ( l3_parsers[ i ].ethtype == packet_info( buf )->ethtype ) {
+      if ( !l3_parsers[ i ].parse( buf ) ) {
+        warn( "Failed to parse %s header.", l3_parsers[ i ].name );
+        return false;
+      }
+      return true;
+    }
+  }
+  return true;
+}
+
+
+/**
+ * Decodes the Ethernet header and 802.1Q tags of `buf' only. L3 and L4
+ * headers are decoded by parse_packet_l3(), which has to be called before
+ * l3_data other than the start of L3 header, l4_data, or ipproto of the
+ * packet_info are referred. Packets passed to packet_in handlers set by
+ * set_lazy_packet_in_handler() are parsed with this.
+ */
 bool
-parse_packet( buffer *buf ) {
+parse_packet_lazily( buffer *buf ) {
   assert( buf != NULL );
   assert( buf->data != NULL );
 
@@ -66,27 +258,40 @@ parse_packet( buffer *buf ) {
     warn( "Failed to parse ethernet header." );
     return false;
   }
+  packet_info( buf )->l3_status = PACKET_L3_UNPARSED;
 
-  switch ( packet_info( buf )->ethtype ) {
-    case ETH_ETHTYPE_ARP:
-      if ( !valid_arp_packet( buf ) ) {
-        warn( "Failed to parse ARP header." );
-        return false;
-      }
-      break;
-    case ETH_ETHTYPE_IPV4:
-      if ( !parse_ipv4( buf ) ) {
-        warn( "Failed to parse IPv4 header." );
-        return false;
-      }
-      break;
-    default:
-      break;
-  }
   return true;
 }
 
 
+/**
+ * Decodes L3 and L4 headers of a packet parsed by parse_packet_lazily()
+ * if not yet. Returns false if they are malformed.
+ */
+bool
+parse_packet_l3( buffer *buf ) {
+  assert( buf != NULL );
+  assert( packet_info( buf ) != NULL );
+
+  if ( packet_info( buf )->l3_status == PACKET_L3_UNPARSED ) {
+    packet_info( buf )->l3_status = parse_l3( buf ) ? PACKET_L3_VALID : PACKET_L3_INVALID;
+  }
+  return packet_info( buf )->l3_status == PACKET_L3_VALID;
+}
+
+
+bool
+parse_packet( buffer *buf ) {
+  assert( buf != NULL );
+  assert( buf->data != NULL );
+
+  if ( !parse_packet_lazily( buf ) ) {
+    return false;
+  }
+  return parse_packet_l3( buf );
+}
+
+
 /*
  * Local variables:
  * c-basic-offset: 2
@@ -28,7 +28,12 @@
 
 
 uint16_t get_checksum( uint16_t *pos, uint32_t size );
+uint16_t update_checksum_16( uint16_t checksum, uint16_t old_value, uint16_t new_value );
+uint16_t update_checksum_32( uint16_t checksum, uint32_t old_value, uint32_t new_value );
 bool parse_packet( buffer *buf );
+bool parse_packet_lazily( buffer *buf );
+bool parse_packet_l3( buffer *buf );
+void set_ipv4_checksum_verification( bool enable );
 
 
 #endif // PACKET_PARSER_H
@@ -0,0 +1,886 @@
+/*
+ * Controller-side mirror of the flow tables of switches.
+ *
+ * Flow entries are recorded per datapath from outgoing flow
+ * modifications, flow removed messages and flow stats replies. Only
+ * entries whose removal the controller can observe are recorded, that
+ * is, permanent entries and entries with OFPFF_SEND_FLOW_REM.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include "byteorder.h"
+#include "hash_table.h"
+#include "linked_list.h"
+#include "log.h"
+#include "shadow_flow_table.h"
+#include "utility.h"
+#include "wrapper.h"
+
+
+#ifdef UNIT_TESTING
+
+// Allow static functions and variables to be referred from unit tests.
+#define static
+
+#ifdef debug
+#undef debug
+#endif
+#define debug( ... )
+
+#endif // UNIT_TESTING
+
+
+typedef struct {
+  uint64_t datapath_id;
+  hash_table *entries;
+  hash_table *mac_index;
+  hash_table *port_index;
+  bool synchronizing;
+  uint32_t sync_transaction_id;
+} datapath_flows;
+
+
+typedef struct {
+  uint8_t mac[ OFP_ETH_ALEN ];
+  list_element *entries;
+} mac_index_entry;
+
+
+typedef struct {
+  uint32_t port;
+  list_element *entries;
+} port_index_entry;
+
+
+static hash_table *datapaths = NULL;
+
+
+static bool
+compare_flow_key( const void *x, const void *y ) {
+  const shadow_flow_entry *ex = x;
+  const shadow_flow_entry *ey = y;
+
+  return ex->priority == ey->priority && memcmp( &ex->match, &ey->match, sizeof( struct ofp_match ) ) == 0;
+}
+
+
+static unsigned int
+hash_flow_key( const void *key ) {
+  const shadow_flow_entry *entry = key;
+  const uint8_t *p = ( const uint8_t * ) &entry->match;
+  unsigned int hash = 2166136261U;
+
+  for ( size_t i = 0; i < sizeof( struct ofp_match ); i++ ) {
+    hash = ( hash ^ p[ i ] ) * 16777619U;
+  }
+  return ( hash ^ entry->priority ) * 16777619U;
+}
+
+
+static uint32_t
+nw_addr_mask( uint32_t wildcards, uint32_t mask, int shift ) {
+  uint32_t bits = ( wildcards & mask ) >> shift;
+  return bits >= 32 ? 0 : ~( uint32_t ) 0 << bits;
+}
+
+
+// Copies the fields of `src' that are not wildcarded into a zero
+// cleared match so that equivalent matches compare equal bytewise.
+static void
+normalize_match( struct ofp_match *dst, const struct ofp_match *src ) {
+  uint32_t wildcards = src->wildcards;
+
+  memset( dst, 0, sizeof( struct ofp_match ) );
+  dst->wildcards = wildcards;
+  if ( !( wildcards & OFPFW_IN_PORT ) ) {
+    dst->in_port = src->in_port;
+  }
+  if ( !( wildcards & OFPFW_DL_SRC ) ) {
+    memcpy( dst->dl_src, src->dl_src, OFP_ETH_ALEN );
+  }
+  if ( !( wildcards & OFPFW_DL_DST ) ) {
+    memcpy( dst->dl_dst, src->dl_dst, OFP_ETH_ALEN );
+  }
+  if ( !( wildcards & OFPFW_DL_VLAN ) ) {
+    dst->dl_vlan = src->dl_vlan;
+  }
+  if ( !( wildcards & OFPFW_DL_VLAN_PCP ) ) {
+    dst->dl_vlan_pcp = src->dl_vlan_pcp;
+  }
+  if ( !( wildcards & OFPFW_DL_TYPE ) ) {
+    dst->dl_type = src->dl_type;
+  }
+  if ( !( wildcards & OFPFW_NW_TOS ) ) {
+    dst->nw_tos = src->nw_tos;
+  }
+  if ( !( wildcards & OFPFW_NW_PROTO ) ) {
+    dst->nw_proto = src->nw_proto;
+  }
+  dst->nw_src = src->nw_src & nw_addr_mask( wildcards, OFPFW_NW_SRC_MASK, OFPFW_NW_SRC_SHIFT );
+  dst->nw_dst = src->nw_dst & nw_addr_mask( wildcards, OFPFW_NW_DST_MASK, OFPFW_NW_DST_SHIFT );
+  if ( !( wildcards & OFPFW_TP_SRC ) ) {
+    dst->tp_src = src->tp_src;
+  }
+  if ( !( wildcards & OFPFW_TP_DST ) ) {
+    dst->tp_dst = src->tp_dst;
+  }
+}
+
+
+// Returns true if every packet matching `narrow' also matches `wide'.
+// Both matches must be normalized.
+static bool
+match_covers( const struct ofp_match *wide, const struct ofp_match *narrow ) {
+  static const struct {
+    uint32_t flag;
+    size_t offset;
+    size_t size;
+  } fields[] = {
+    { OFPFW_IN_PORT, offsetof( struct ofp_match, in_port ), sizeof( uint16_t ) },
+    { OFPFW_DL_SRC, offsetof( struct ofp_match, dl_src ), OFP_ETH_ALEN },
+    { OFPFW_DL_DST, offsetof( struct ofp_match, dl_dst ), OFP_ETH_ALEN },
+    { OFPFW_DL_VLAN, offsetof( struct ofp_match, dl_vlan ), sizeof( uint16_t ) },
+    { OFPFW_DL_VLAN_PCP, offsetof( struct ofp_match, dl_vlan_pcp ), sizeof( uint8_t ) },
+    { OFPFW_DL_TYPE, offsetof( struct ofp_match, dl_type ), sizeof( uint16_t ) },
+    { OFPFW_NW_TOS, offsetof( struct ofp_match, nw_tos ), sizeof( uint8_t ) },
+    { OFPFW_NW_PROTO, offsetof( struct ofp_match, nw_proto ), sizeof( uint8_t ) },
+    { OFPFW_TP_SRC, offsetof( struct ofp_match, tp_src ), sizeof( uint16_t ) },
+    { OFPFW_TP_DST, offsetof( struct ofp_match, tp_dst ), sizeof( uint16_t ) },
+  };
+
+  for ( size_t i = 0; i < sizeof( fields ) / sizeof( fields[ 0 ] ); i++ ) {
+    if ( wide->wildcards & fields[ i ].flag ) {
+      continue;
+    }
+    if ( ( narrow->wildcards & fields[ i ].flag )
+         || memcmp( ( const char * ) wide + fields[ i ].offset, ( const char * ) narrow + fields[ i ].offset, fields[ i ].size ) != 0 ) {
+      return false;
+    }
+  }
+
+  uint32_t wide_mask = nw_addr_mask( wide->wildcards, OFPFW_NW_SRC_MASK, OFPFW_NW_SRC_SHIFT );
+  uint32_t narrow_mask = nw_addr_mask( narrow->wildcards, OFPFW_NW_SRC_MASK, OFPFW_NW_SRC_SHIFT );
+  if ( ( wide_mask & narrow_mask ) != wide_mask || ( narrow->nw_src & wide_mask ) != wide->nw_src ) {
+    return false;
+  }
+  wide_mask = nw_addr_mask( wide->wildcards, OFPFW_NW_DST_MASK, OFPFW_NW_DST_SHIFT );
+  narrow_mask = nw_addr_mask( narrow->wildcards, OFPFW_NW_DST_MASK, OFPFW_NW_DST_SHIFT );
+  if ( ( wide_mask & narrow_mask ) != wide_mask || ( narrow->nw_dst & wide_mask ) != wide->nw_dst ) {
+    return false;
+  }
+
+  return true;
+}
+
+
+// Returns the port of the `n'th output or enqueue action, or OFPP_NONE.
+static uint16_t
+output_port_of( const shadow_flow_entry *entry, unsigned int n ) {
+  const char *p = entry->actions;
+  const char *end = p + entry->actions_length;
+
+  while ( p + sizeof( struct ofp_action_header ) <= end ) {
+    const struct ofp_action_header *action = ( const void * ) p;
+    uint16_t length = ntohs( action->len );
+    if ( length < sizeof( struct ofp_action_header ) || p + length > end ) {
+      break;
+    }
+    uint16_t type = ntohs( action->type );
+    if ( type == OFPAT_OUTPUT || type == OFPAT_ENQUEUE ) {
+      if ( n-- == 0 ) {
+        if ( type == OFPAT_OUTPUT ) {
+          return ntohs( ( ( const struct ofp_action_output * ) ( const void * ) action )->port );
+        }
+        return ntohs( ( ( const struct ofp_action_enqueue * ) ( const void * ) action )->port );
+      }
+    }
+    p += length;
+  }
+
+  return OFPP_NONE;
+}
+
+
+static bool
+has_output_to( const shadow_flow_entry *entry, uint16_t port ) {
+  uint16_t output;
+
+  for ( unsigned int i = 0; ( output = output_port_of( entry, i ) ) != OFPP_NONE; i++ ) {
+    if ( output == port ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static void
+index_by_mac( datapath_flows *flows, const uint8_t *mac, shadow_flow_entry *entry, bool add ) {
+  mac_index_entry *index = lookup_hash_entry( flows->mac_index, mac );
+  if ( add ) {
+    if ( index == NULL ) {
+      index = xmalloc( sizeof( mac_index_entry ) );
+      memcpy( index->mac, mac, OFP_ETH_ALEN );
+      create_list( &index->entries );
+      insert_hash_entry( flows->mac_index, index->mac, index );
+    }
+    insert_in_front( &index->entries, entry );
+    return;
+  }
+
+  if ( index != NULL ) {
+    delete_element( &index->entries, entry );
+    if ( index->entries == NULL ) {
+      delete_hash_entry( flows->mac_index, index->mac );
+      xfree( index );
+    }
+  }
+}
+
+
+static void
+index_by_port( datapath_flows *flows, uint16_t port, shadow_flow_entry *entry, bool add ) {
+  uint32_t key = port;
+  port_index_entry *index = lookup_hash_entry( flows->port_index, &key );
+  if ( add ) {
+    if ( index == NULL ) {
+      index = xmalloc( sizeof( port_index_entry ) );
+      index->port = port;
+      create_list( &index->entries );
+      insert_hash_entry( flows->port_index, &index->port, index );
+    }
+    insert_in_front( &index->entries, entry );
+    return;
+  }
+
+  if ( index != NULL ) {
+    delete_element( &index->entries, entry );
+    if ( index->entries == NULL ) {
+      delete_hash_entry( flows->port_index, &index->port );
+      xfree( index );
+    }
+  }
+}
+
+
+// Adds `entry' to or removes it from the MAC address and port indexes.
+// Each entry appears at most once in every index list.
+static void
+index_entry( datapath_flows *flows, shadow_flow_entry *entry, bool add ) {
+  const struct ofp_match *match = &entry->match;
+
+  if ( !( match->wildcards & OFPFW_DL_SRC ) ) {
+    index_by_mac( flows, match->dl_src, entry, add );
+  }
+  if ( !( match->wildcards & OFPFW_DL_DST )
+       && ( ( match->wildcards & OFPFW_DL_SRC ) || memcmp( match->dl_src, match->dl_dst, OFP_ETH_ALEN ) != 0 ) ) {
+    index_by_mac( flows, match->dl_dst, entry, add );
+  }
+
+  if ( !( match->wildcards & OFPFW_IN_PORT ) ) {
+    index_by_port( flows, match->in_port, entry, add );
+  }
+  uint16_t port;
+  for ( unsigned int i = 0; ( port = output_port_of( entry, i ) ) != OFPP_NONE; i++ ) {
+    bool indexed = !( match->wildcards & OFPFW_IN_PORT ) && match->in_port == port;
+    for ( unsigned int j = 0; j < i && !indexed; j++ ) {
+      indexed = output_port_of( entry, j ) == port;
+    }
+    if ( !indexed ) {
+      index_by_port( flows, port, entry, add );
+    }
+  }
+}
+
+
+static void
+set_actions( datapath_flows *flows, shadow_flow_entry *entry, const void *actions, uint16_t actions_length ) {
+  index_entry( flows, entry, false );
+
+  if ( entry->actions != NULL ) {
+    xfree( entry->actions );
+    entry->actions = NULL;
+  }
+  entry->actions_length = actions_length;
+  if ( actions_length > 0 ) {
+    entry->actions = xmalloc( actions_length );
+    memcpy( entry->actions, actions, actions_length );
+  }
+
+  index_entry( flows, entry, true );
+}
+
+
+static shadow_flow_entry *
+add_entry( datapath_flows *flows, const struct ofp_match *match, uint16_t priority ) {
+  shadow_flow_entry *entry = xmalloc( sizeof( shadow_flow_entry ) );
+  memset( entry, 0, sizeof( shadow_flow_entry ) );
+  entry->datapath_id = flows->datapath_id;
+  entry->match = *match;
+  entry->priority = priority;
+  entry->synchronized = true;
+
+  insert_hash_entry( flows->entries, entry, entry );
+  index_entry( flows, entry, true );
+
+  return entry;
+}
+
+
+static void
+remove_entry( datapath_flows *flows, shadow_flow_entry *entry ) {
+  index_entry( flows, entry, false );
+  delete_hash_entry( flows->entries, entry );
+  if ( entry->actions != NULL ) {
+    xfree( entry->actions );
+  }
+  xfree( entry );
+}
+
+
+static shadow_flow_entry *
+lookup_entry( datapath_flows *flows, const struct ofp_match *match, uint16_t priority ) {
+  shadow_flow_entry key;
+  key.match = *match;
+  key.priority = priority;
+
+  return lookup_hash_entry( flows->entries, &key );
+}
+
+
+static datapath_flows *
+lookup_datapath( uint64_t datapath_id, bool create ) {
+  assert( datapaths != NULL );
+
+  datapath_flows *flows = lookup_hash_entry( datapaths, &datapath_id );
+  if ( flows == NULL && create ) {
+    flows = xmalloc( sizeof( datapath_flows ) );
+    flows->datapath_id = datapath_id;
+    flows->entries = create_hash( compare_flow_key, hash_flow_key );
+    flows->mac_index = create_hash( compare_mac, hash_mac );
+    flows->port_index = create_hash( compare_uint32, hash_uint32 );
+    flows->synchronizing = false;
+    flows->sync_transaction_id = 0;
+    insert_hash_entry( datapaths, &flows->datapath_id, flows );
+  }
+
+  return flows;
+}
+
+
+// Returns a newly created list of the entries of `flows', which stays
+// valid while the entries are removed.
+static list_element *
+list_entries( datapath_flows *flows ) {
+  list_element *list;
+  create_list( &list );
+
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( flows->entries, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    insert_in_front( &list, e->value );
+  }
+
+  return list;
+}
+
+
+static void
+delete_datapath( datapath_flows *flows ) {
+  list_element *list = list_entries( flows );
+  for ( list_element *e = list; e != NULL; e = e->next ) {
+    remove_entry( flows, e->data );
+  }
+  delete_list( list );
+
+  delete_hash_entry( datapaths, &flows->datapath_id );
+  delete_hash( flows->entries );
+  delete_hash( flows->mac_index );
+  delete_hash( flows->port_index );
+  xfree( flows );
+}
+
+
+void
+init_shadow_flow_table( void ) {
+  if ( datapaths != NULL ) {
+    return;
+  }
+  datapaths = create_hash( compare_datapath_id, hash_datapath_id );
+}
+
+
+void
+finalize_shadow_flow_table( void ) {
+  if ( datapaths == NULL ) {
+    return;
+  }
+
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( datapaths, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    delete_datapath( e->value );
+    init_hash_iterator( datapaths, &iter );
+  }
+  delete_hash( datapaths );
+  datapaths = NULL;
+}
+
+
+bool
+shadow_flow_table_is_initialized( void ) {
+  return datapaths != NULL;
+}
+
+
+static bool
+trackable( uint16_t idle_timeout, uint16_t hard_timeout, uint16_t flags ) {
+  return ( idle_timeout == 0 && hard_timeout == 0 ) || ( flags & OFPFF_SEND_FLOW_REM );
+}
+
+
+static bool
+same_entry( const shadow_flow_entry *entry, uint64_t cookie, uint16_t idle_timeout, uint16_t hard_timeout,
+            uint16_t flags, const void *actions, uint16_t actions_length ) {
+  return entry->cookie == cookie && entry->idle_timeout == idle_timeout && entry->hard_timeout == hard_timeout
+    && entry->flags == flags && entry->actions_length == actions_length
+    && ( actions_length == 0 || memcmp( entry->actions, actions, actions_length ) == 0 );
+}
+
+
+// Returns true if `message' adds an entry identical to `entry' without
+// releasing a buffered packet.
+static bool
+redundant_flow_mod( const shadow_flow_entry *entry, const struct ofp_flow_mod *message, uint16_t actions_length ) {
+  uint16_t idle_timeout = ntohs( message->idle_timeout );
+  uint16_t hard_timeout = ntohs( message->hard_timeout );
+  uint16_t flags = ntohs( message->flags );
+
+  return ntohl( message->buffer_id ) == UINT32_MAX && trackable( idle_timeout, hard_timeout, flags )
+    && same_entry( entry, ntohll( message->cookie ), idle_timeout, hard_timeout, flags,
+                   message->actions, actions_length );
+}
+
+
+/**
+ * Returns true if a flow modification ( in network byte order ) to
+ * `datapath_id' would not change the flow table and need not be sent,
+ * that is, if it adds an entry identical to a recorded one without
+ * releasing a buffered packet. The table is left as is.
+ */
+bool
+shadow_flow_mod_is_redundant( uint64_t datapath_id, const buffer *flow_mod ) {
+  assert( flow_mod != NULL );
+  assert( flow_mod->length >= offsetof( struct ofp_flow_mod, actions ) );
+
+  const struct ofp_flow_mod *message = flow_mod->data;
+  if ( ntohs( message->command ) != OFPFC_ADD ) {
+    return false;
+  }
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows == NULL ) {
+    return false;
+  }
+
+  struct ofp_match match, original;
+  ntoh_match( &original, ( struct ofp_match * ) ( uintptr_t ) &message->match );
+  normalize_match( &match, &original );
+  shadow_flow_entry *entry = lookup_entry( flows, &match, ntohs( message->priority ) );
+  uint16_t actions_length = ( uint16_t ) ( flow_mod->length - offsetof( struct ofp_flow_mod, actions ) );
+
+  return entry != NULL && redundant_flow_mod( entry, message, actions_length );
+}
+
+
+/**
+ * Records the effect of a flow modification ( in network byte order )
+ * sent to `datapath_id'. It should be called once the flow modification
+ * has been sent successfully. Returns false, without changing the table,
+ * if the flow modification is redundant ( see
+ * shadow_flow_mod_is_redundant() ).
+ */
+bool
+update_shadow_flow_table( uint64_t datapath_id, const buffer *flow_mod ) {
+  assert( flow_mod != NULL );
+  assert( flow_mod->length >= offsetof( struct ofp_flow_mod, actions ) );
+
+  const struct ofp_flow_mod *message = flow_mod->data;
+  struct ofp_match match, original;
+  ntoh_match( &original, ( struct ofp_match * ) ( uintptr_t ) &message->match );
+  normalize_match( &match, &original );
+  uint32_t transaction_id = ntohl( message->header.xid );
+  uint64_t cookie = ntohll( message->cookie );
+  uint16_t command = ntohs( message->command );
+  uint16_t idle_timeout = ntohs( message->idle_timeout );
+  uint16_t hard_timeout = ntohs( message->hard_timeout );
+  uint16_t priority = ntohs( message->priority );
+  uint16_t out_port = ntohs( message->out_port );
+  uint16_t flags = ntohs( message->flags );
+  const void *actions = message->actions;
+  uint16_t actions_length = ( uint16_t ) ( flow_mod->length - offsetof( struct ofp_flow_mod, actions ) );
+
+  datapath_flows *flows = lookup_datapath( datapath_id, true );
+  list_element *affected;
+  create_list( &affected );
+
+  switch ( command ) {
+    case OFPFC_MODIFY:
+    case OFPFC_MODIFY_STRICT:
+    case OFPFC_DELETE:
+    case OFPFC_DELETE_STRICT:
+    {
+      bool strict = command == OFPFC_MODIFY_STRICT || command == OFPFC_DELETE_STRICT;
+      bool delete = command == OFPFC_DELETE || command == OFPFC_DELETE_STRICT;
+      if ( strict ) {
+        shadow_flow_entry *entry = lookup_entry( flows, &match, priority );
+        if ( entry != NULL ) {
+          insert_in_front( &affected, entry );
+        }
+      }
+      else {
+        list_element *list = list_entries( flows );
+        for ( list_element *e = list; e != NULL; e = e->next ) {
+          if ( match_covers( &match, &( ( shadow_flow_entry * ) e->data )->match ) ) {
+            insert_in_front( &affected, e->data );
+          }
+        }
+        delete_list( list );
+      }
+
+      if ( delete ) {
+        for ( list_element *e = affected; e != NULL; e = e->next ) {
+          if ( out_port == OFPP_NONE || has_output_to( e->data, out_port ) ) {
+            remove_entry( flows, e->data );
+          }
+        }
+        break;
+      }
+      if ( affected != NULL ) {
+        for ( list_element *e = affected; e != NULL; e = e->next ) {
+          set_actions( flows, e->data, actions, actions_length );
+          ( ( shadow_flow_entry * ) e->data )->transaction_id = transaction_id;
+        }
+        break;
+      }
+    }
+    // A modification that does not match any entry adds one.
+    // fall through
+    case OFPFC_ADD:
+    {
+      shadow_flow_entry *entry = lookup_entry( flows, &match, priority );
+      if ( entry != NULL ) {
+        if ( redundant_flow_mod( entry, message, actions_length ) ) {
+          debug( "Redundant flow modification ( datapath_id = %#" PRIx64 ", priority = %u ).", datapath_id, priority );
+          delete_list( affected );
+          return false;
+        }
+        remove_entry( flows, entry );
+      }
+      if ( trackable( idle_timeout, hard_timeout, flags ) ) {
+        entry = add_entry( flows, &match, priority );
+        entry->cookie = cookie;
+        entry->idle_timeout = idle_timeout;
+        entry->hard_timeout = hard_timeout;
+        entry->flags = flags;
+        entry->transaction_id = transaction_id;
+        set_actions( flows, entry, actions, actions_length );
+      }
+    }
+    break;
+
+    default:
+      break;
+  }
+
+  delete_list( affected );
+
+  return true;
+}
+
+
+/**
+ * Removes the entry that exactly matches `match' and `priority' ( in
+ * host byte order ), e.g. when a flow removed message is received.
+ */
+void
+delete_shadow_flow_entry( uint64_t datapath_id, const struct ofp_match match, uint16_t priority ) {
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows == NULL ) {
+    return;
+  }
+
+  struct ofp_match normalized;
+  normalize_match( &normalized, &match );
+  shadow_flow_entry *entry = lookup_entry( flows, &normalized, priority );
+  if ( entry != NULL ) {
+    remove_entry( flows, entry );
+  }
+}
+
+
+/**
+ * Removes the entries added or modified by the flow modification sent
+ * with `transaction_id', e.g. when the switch reports that it failed.
+ * Entries are never restored, since the table only needs to be a subset
+ * of the flow table of the switch.
+ */
+void
+delete_shadow_flow_entries_by_transaction_id( uint64_t datapath_id, uint32_t transaction_id ) {
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows == NULL ) {
+    return;
+  }
+
+  list_element *list = list_entries( flows );
+  for ( list_element *e = list; e != NULL; e = e->next ) {
+    if ( ( ( shadow_flow_entry * ) e->data )->transaction_id == transaction_id ) {
+      remove_entry( flows, e->data );
+    }
+  }
+  delete_list( list );
+}
+
+
+void
+delete_shadow_flow_table( uint64_t datapath_id ) {
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows != NULL ) {
+    delete_datapath( flows );
+  }
+}
+
+
+const shadow_flow_entry *
+lookup_shadow_flow_entry( uint64_t datapath_id, const struct ofp_match match, uint16_t priority ) {
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows == NULL ) {
+    return NULL;
+  }
+
+  struct ofp_match normalized;
+  normalize_match( &normalized, &match );
+  return lookup_entry( flows, &normalized, priority );
+}
+
+
+// Calls `function' for the entries in `list'. Entries removed by an
+// earlier call are skipped.
+static void
+call_entry_handler( datapath_flows *flows, const list_element *list, shadow_flow_entry_handler function, void *user_data ) {
+  unsigned int n_entries = list_length_of( list );
+  if ( n_entries == 0 ) {
+    return;
+  }
+
+  shadow_flow_entry *keys = xmalloc( sizeof( shadow_flow_entry ) * n_entries );
+  unsigned int i = 0;
+  for ( const list_element *e = list; e != NULL; e = e->next ) {
+    keys[ i++ ] = *( const shadow_flow_entry * ) e->data;
+  }
+
+  uint64_t datapath_id = flows->datapath_id;
+  for ( i = 0; i < n_entries; i++ ) {
+    flows = lookup_datapath( datapath_id, false );
+    if ( flows == NULL ) {
+      break;
+    }
+    shadow_flow_entry *entry = lookup_entry( flows, &keys[ i ].match, keys[ i ].priority );
+    if ( entry != NULL ) {
+      function( entry, user_data );
+    }
+  }
+
+  xfree( keys );
+}
+
+
+/**
+ * Calls `function' for each entry of `datapath_id'. The function may
+ * modify the table, e.g. by sending flow modifications.
+ */
+void
+foreach_shadow_flow_entry( uint64_t datapath_id, shadow_flow_entry_handler function, void *user_data ) {
+  assert( function != NULL );
+
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows == NULL ) {
+    return;
+  }
+
+  list_element *list = list_entries( flows );
+  call_entry_handler( flows, list, function, user_data );
+  delete_list( list );
+}
+
+
+/**
+ * Calls `function' for each entry that matches `mac' as its source or
+ * destination MAC address.
+ */
+void
+foreach_shadow_flow_entry_by_mac( uint64_t datapath_id, const uint8_t mac[ OFP_ETH_ALEN ],
+                                  shadow_flow_entry_handler function, void *user_data ) {
+  assert( mac != NULL );
+  assert( function != NULL );
+
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows == NULL ) {
+    return;
+  }
+
+  mac_index_entry *index = lookup_hash_entry( flows->mac_index, mac );
+  if ( index != NULL ) {
+    call_entry_handler( flows, index->entries, function, user_data );
+  }
+}
+
+
+/**
+ * Calls `function' for each entry that matches `port' as its input port
+ * or outputs packets to `port'.
+ */
+void
+foreach_shadow_flow_entry_by_port( uint64_t datapath_id, uint16_t port,
+                                   shadow_flow_entry_handler function, void *user_data ) {
+  assert( function != NULL );
+
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows == NULL ) {
+    return;
+  }
+
+  uint32_t key = port;
+  port_index_entry *index = lookup_hash_entry( flows->port_index, &key );
+  if ( index != NULL ) {
+    call_entry_handler( flows, index->entries, function, user_data );
+  }
+}
+
+
+/**
+ * Starts reconciling the entries of `datapath_id' with the flow stats
+ * request sent with `transaction_id'. Entries that do not appear in the
+ * replies are removed when the last reply is passed to
+ * sync_shadow_flow_table().
+ */
+void
+start_shadow_flow_table_sync( uint64_t datapath_id, uint32_t transaction_id ) {
+  datapath_flows *flows = lookup_datapath( datapath_id, true );
+
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( flows->entries, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    ( ( shadow_flow_entry * ) e->value )->synchronized = false;
+  }
+  flows->synchronizing = true;
+  flows->sync_transaction_id = transaction_id;
+}
+
+
+static void
+sync_flow_stats( datapath_flows *flows, const struct ofp_flow_stats *stats ) {
+  struct ofp_match match, original;
+  ntoh_match( &original, ( struct ofp_match * ) ( uintptr_t ) &stats->match );
+  normalize_match( &match, &original );
+  uint16_t priority = ntohs( stats->priority );
+  uint16_t idle_timeout = ntohs( stats->idle_timeout );
+  uint16_t hard_timeout = ntohs( stats->hard_timeout );
+  uint16_t actions_length = ( uint16_t ) ( ntohs( stats->length ) - offsetof( struct ofp_flow_stats, actions ) );
+
+  shadow_flow_entry *entry = lookup_entry( flows, &match, priority );
+  if ( entry == NULL ) {
+    // Whether the switch notifies us of the removal is unknown.
+    if ( !trackable( idle_timeout, hard_timeout, 0 ) ) {
+      return;
+    }
+    entry = add_entry( flows, &match, priority );
+  }
+  entry->cookie = ntohll( stats->cookie );
+  entry->idle_timeout = idle_timeout;
+  entry->hard_timeout = hard_timeout;
+  entry->synchronized = true;
+  set_actions( flows, entry, stats->actions, actions_length );
+}
+
+
+/**
+ * Applies a flow stats reply ( in network byte order ) to the entries
+ * of `datapath_id'. Returns false if the reply is not for the request
+ * passed to start_shadow_flow_table_sync().
+ */
+bool
+sync_shadow_flow_table( uint64_t datapath_id, const buffer *stats_reply ) {
+  assert( stats_reply != NULL );
+
+  datapath_flows *flows = lookup_datapath( datapath_id, false );
+  if ( flows == NULL || !flows->synchronizing ) {
+    return false;
+  }
+
+  const struct ofp_stats_reply *reply = stats_reply->data;
+  if ( stats_reply->length < offsetof( struct ofp_stats_reply, body )
+       || ntohl( reply->header.xid ) != flows->sync_transaction_id || ntohs( reply->type ) != OFPST_FLOW ) {
+    return false;
+  }
+
+  const char *p = ( const char * ) reply->body;
+  const char *end = ( const char * ) stats_reply->data + stats_reply->length;
+  while ( p + offsetof( struct ofp_flow_stats, actions ) <= end ) {
+    const struct ofp_flow_stats *stats = ( const void * ) p;
+    uint16_t length = ntohs( stats->length );
+    if ( length < offsetof( struct ofp_flow_stats, actions ) || p + length > end ) {
+      warn( "Malformed flow stats reply ( datapath_id = %#" PRIx64 ", length = %u ).", datapath_id, length );
+      break;
+    }
+    sync_flow_stats( flows, stats );
+    p += length;
+  }
+
+  if ( ntohs( reply->flags ) & OFPSF_REPLY_MORE ) {
+    return true;
+  }
+
+  list_element *list = list_entries( flows );
+  for ( list_element *e = list; e != NULL; e = e->next ) {
+    if ( !( ( shadow_flow_entry * ) e->data )->synchronized ) {
+      remove_entry( flows, e->data );
+    }
+  }
+  delete_list( list );
+  flows->synchronizing = false;
+
+  debug( "Flow table of %#" PRIx64 " is synchronized.", datapath_id );
+
+  return true;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,77 @@
+/*
+ * Controller-side mirror of the flow tables of switches.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SHADOW_FLOW_TABLE_H
+#define SHADOW_FLOW_TABLE_H
+
+
+#include <openflow.h>
+#include "bool.h"
+#include "buffer.h"
+
+
+typedef struct shadow_flow_entry {
+  uint64_t datapath_id;
+  struct ofp_match match; // host byte order. wildcarded fields are cleared
+  uint16_t priority;
+  uint64_t cookie;
+  uint16_t idle_timeout;
+  uint16_t hard_timeout;
+  uint16_t flags;
+  uint16_t actions_length;
+  void *actions; // network byte order
+  bool synchronized; // seen in the flow stats replies of the current synchronization
+  uint32_t transaction_id; // of the last flow modification applied to the entry
+} shadow_flow_entry;
+
+
+typedef void ( *shadow_flow_entry_handler )( const shadow_flow_entry *entry, void *user_data );
+
+
+void init_shadow_flow_table( void );
+void finalize_shadow_flow_table( void );
+bool shadow_flow_table_is_initialized( void );
+
+bool shadow_flow_mod_is_redundant( uint64_t datapath_id, const buffer *flow_mod );
+bool update_shadow_flow_table( uint64_t datapath_id, const buffer *flow_mod );
+void delete_shadow_flow_entries_by_transaction_id( uint64_t datapath_id, uint32_t transaction_id );
+void delete_shadow_flow_entry( uint64_t datapath_id, const struct ofp_match match, uint16_t priority );
+void delete_shadow_flow_table( uint64_t datapath_id );
+const shadow_flow_entry *lookup_shadow_flow_entry( uint64_t datapath_id, const struct ofp_match match, uint16_t priority );
+
+void foreach_shadow_flow_entry( uint64_t datapath_id, shadow_flow_entry_handler function, void *user_data );
+void foreach_shadow_flow_entry_by_mac( uint64_t datapath_id, const uint8_t mac[ OFP_ETH_ALEN ],
+                                       shadow_flow_entry_handler function, void *user_data );
+void foreach_shadow_flow_entry_by_port( uint64_t datapath_id, uint16_t port,
+                                        shadow_flow_entry_handler function, void *user_data );
+
+void start_shadow_flow_table_sync( uint64_t datapath_id, uint32_t transaction_id );
+bool sync_shadow_flow_table( uint64_t datapath_id, const buffer *stats_reply );
+
+
+#endif // SHADOW_FLOW_TABLE_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "log.h"
+#include "shared_memory_ring.h"
+#include "wrapper.h"
+
+
+#ifdef UNIT_TESTING
+
+#ifdef error
+#undef error
+#endif
+#define error mock_error
+void mock_error( const char *format, ... );
+
+#ifdef debug
+#undef debug
+#endif
+#define debug mock_debug
+void mock_debug( const char *format, ... );
+
+#define static
+
+#endif // UNIT_TESTING
+
+
+#define SHARED_MEMORY_RING_MAGIC 0x7472696e // "trin"
+#define CACHE_LINE_SIZE 64
+#define RECORD_ALIGNMENT 8
+#define RECORD_PADDING 0x1
+
+
+/*
+ * The control block sits at the top of the shared memory. head and tail
+ * are free running byte counters owned by the producer and the consumer
+ * respectively, and are kept on separate cache lines.
+ */
+typedef struct ring_control {
+  uint32_t magic;
+  uint32_t size;
+  uint8_t pad0[ CACHE_LINE_SIZE - sizeof( uint32_t ) * 2 ];
+  volatile uint64_t head;
+  uint8_t pad1[ CACHE_LINE_SIZE - sizeof( uint64_t ) ];
+  volatile uint64_t tail;
+  uint8_t pad2[ CACHE_LINE_SIZE - sizeof( uint64_t ) ];
+} ring_control;
+
+typedef struct ring_record {
+  uint32_t length;
+  uint32_t flags;
+  uint8_t value[ 0 ];
+} ring_record;
+
+struct shared_memory_ring {
+  ring_control *control;
+  char *data;
+  uint32_t size;
+  size_t mapped_size;
+  int memory_fd;
+  int event_fd;
+  size_t peeked_length;
+};
+
+
+static size_t
+record_length( size_t length ) {
+  return ( sizeof( ring_record ) + length + RECORD_ALIGNMENT - 1 ) & ~( size_t ) ( RECORD_ALIGNMENT - 1 );
+}
+
+
+static int
+create_memory_fd( void ) {
+  int fd = -1;
+
+#ifdef SYS_memfd_create
+  fd = ( int ) syscall( SYS_memfd_create, "trema.ring", 1 ); // MFD_CLOEXEC
+  if ( fd >= 0 ) {
+    return fd;
+  }
+#endif
+
+  // Fall back to an unlinked POSIX shared memory object.
+  static unsigned int serial = 0;
+  char name[ 64 ];
+  snprintf( name, sizeof( name ), "/trema.ring.%d.%u", getpid(), serial++ );
+  fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+  if ( fd >= 0 ) {
+    shm_unlink( name );
+  }
+
+  return fd;
+}
+
+
+static shared_memory_ring *
+map_shared_memory_ring( int memory_fd, int event_fd, size_t mapped_size ) {
+  void *top = mmap( NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0 );
+  if ( top == MAP_FAILED ) {
+    error( "Failed to map a shared memory ring ( fd = %d, size = %u, %s [%d] ).",
+           memory_fd, mapped_size, strerror( errno ), errno );
+    return NULL;
+  }
+
+  shared_memory_ring *ring = xmalloc( sizeof( shared_memory_ring ) );
+  ring->control = top;
+  ring->data = ( char * ) top + sizeof( ring_control );
+  ring->size = 0;
+  ring->mapped_size = mapped_size;
+  ring->memory_fd = memory_fd;
+  ring->event_fd = event_fd;
+  ring->peeked_length = 0;
+
+  return ring;
+}
+
+
+/**
+ * Creates a ring with a data area of `size' bytes ( rounded up to a power
+ * of two ), together with an eventfd to wake up the consumer. Returns NULL
+ * if shared memory or eventfd is not available.
+ */
+shared_memory_ring *
+create_shared_memory_ring( size_t size ) {
+  assert( size > 0 );
+
+  uint32_t ring_size = RECORD_ALIGNMENT * 2;
+  while ( ring_size < size ) {
+    ring_size <<= 1;
+  }
+
+  int memory_fd = create_memory_fd();
+  if ( memory_fd < 0 ) {
+    debug( "Failed to create shared memory ( %s [%d] ).", strerror( errno ), errno );
+    return NULL;
+  }
+  size_t mapped_size = sizeof( ring_control ) + ring_size;
+  if ( ftruncate( memory_fd, ( off_t ) mapped_size ) < 0 ) {
+    error( "Failed to resize shared memory ( fd = %d, size = %u, %s [%d] ).",
+           memory_fd, mapped_size, strerror( errno ), errno );
+    close( memory_fd );
+    return NULL;
+  }
+  int event_fd = eventfd( 0, EFD_NONBLOCK );
+  if ( event_fd < 0 ) {
+    debug( "Failed to create an eventfd ( %s [%d] ).", strerror( errno ), errno );
+    close( memory_fd );
+    return NULL;
+  }
+
+  shared_memory_ring *ring = map_shared_memory_ring( memory_fd, event_fd, mapped_size );
+  if ( ring == NULL ) {
+    close( event_fd );
+    close( memory_fd );
+    return NULL;
+  }
+  memset( ring->control, 0, sizeof( ring_control ) );
+  ring->control->magic = SHARED_MEMORY_RING_MAGIC;
+  ring->control->size = ring_size;
+  ring->size = ring_size;
+
+  debug( "A shared memory ring is created ( memory_fd = %d, event_fd = %d, size = %u ).", memory_fd, event_fd, ring_size );
+
+  return ring;
+}
+
+
+/**
+ * Maps a ring created by another process. The ring takes the ownership of
+ * both file descriptors on success.
+ */
+shared_memory_ring *
+attach_shared_memory_ring( int memory_fd, int event_fd ) {
+  struct stat st;
+  if ( fstat( memory_fd, &st ) < 0 || ( size_t ) st.st_size <= sizeof( ring_control ) ) {
+    error( "Invalid shared memory ( fd = %d ).", memory_fd );
+    return NULL;
+  }
+
+  shared_memory_ring *ring = map_shared_memory_ring( memory_fd, event_fd, ( size_t ) st.st_size );
+  if ( ring == NULL ) {
+    return NULL;
+  }
+  uint32_t size = ring->control->size;
+  if ( ring->control->magic != SHARED_MEMORY_RING_MAGIC || ( size & ( size - 1 ) ) != 0
+       || sizeof( ring_control ) + size != ring->mapped_size ) {
+    error( "Invalid shared memory ring ( fd = %d, magic = %#x, size = %u ).", memory_fd, ring->control->magic, size );
+    munmap( ring->control, ring->mapped_size );
+    xfree( ring );
+    return NULL;
+  }
+  ring->size = size;
+
+  debug( "A shared memory ring is attached ( memory_fd = %d, event_fd = %d, size = %u ).", memory_fd, event_fd, size );
+
+  return ring;
+}
+
+
+void
+delete_shared_memory_ring( shared_memory_ring *ring ) {
+  assert( ring != NULL );
+
+  debug( "Deleting a shared memory ring ( memory_fd = %d, event_fd = %d ).", ring->memory_fd, ring->event_fd );
+
+  munmap( ring->control, ring->mapped_size );
+  close( ring->memory_fd );
+  close( ring->event_fd );
+  xfree( ring );
+}
+
+
+int
+get_shared_memory_ring_memory_fd( const shared_memory_ring *ring ) {
+  assert( ring != NULL );
+
+  return ring->memory_fd;
+}
+
+
+int
+get_shared_memory_ring_event_fd( const shared_memory_ring *ring ) {
+  assert( ring != NULL );
+
+  return ring->event_fd;
+}
+
+
+/**
+ * Appends a record made of `header' and `data' to the ring. The consumer
+ * is woken up only if the ring was empty. Returns false if the ring is full.
+ */
+bool
+write_shared_memory_ring( shared_memory_ring *ring, const void *header, size_t header_length, const void *data, size_t length ) {
+  struct iovec iov[ 2 ];
+
+  iov[ 0 ].iov_base = ( void * ) ( uintptr_t ) header;
+  iov[ 0 ].iov_len = header_length;
+  iov[ 1 ].iov_base = ( void * ) ( uintptr_t ) data;
+  iov[ 1 ].iov_len = length;
+
+  return writev_shared_memory_ring( ring, iov, 2 );
+}
+
+
+/**
+ * Same as write_shared_memory_ring(), but the record is gathered from
+ * `iovcnt' pieces.
+ */
+bool
+writev_shared_memory_ring( shared_memory_ring *ring, const struct iovec *iov, int iovcnt ) {
+  assert( ring != NULL );
+  assert( iov != NULL );
+
+  size_t length = 0;
+  for ( int i = 0; i < iovcnt; i++ ) {
+    length += iov[ i ].iov_len;
+  }
+
+  size_t total_length = record_length( length );
+  if ( total_length > ring->size / 2 ) {
+    error( "Too large record for a shared memory ring ( length = %u, ring size = %u ).", total_length, ring->size );
+    return false;
+  }
+
+  uint64_t old_head = ring->control->head;
+  uint64_t head = old_head;
+  __sync_synchronize();
+  uint64_t tail = ring->control->tail;
+
+  size_t offset = ( size_t ) ( head & ( ring->size - 1 ) );
+  size_t room_to_end = ring->size - offset;
+  size_t required = total_length + ( room_to_end < total_length ? room_to_end : 0 );
+  if ( head + required - tail > ring->size ) {
+    return false;
+  }
+
+  if ( room_to_end < total_length ) {
+    ring_record *padding = ( ring_record * ) ( ring->data + offset );
+    padding->length = 0;
+    padding->flags = RECORD_PADDING;
+    head += room_to_end;
+    offset = 0;
+  }
+
+  ring_record *record = ( ring_record * ) ( ring->data + offset );
+  record->length = ( uint32_t ) length;
+  record->flags = 0;
+  uint8_t *p = record->value;
+  for ( int i = 0; i < iovcnt; i++ ) {
+    if ( iov[ i ].iov_len > 0 ) {
+      memcpy( p, iov[ i ].iov_base, iov[ i ].iov_len );
+      p += iov[ i ].iov_len;
+    }
+  }
+
+  __sync_synchronize();
+  ring->control->head = head + total_length;
+  __sync_synchronize();
+
+  if ( ring->control->tail == old_head ) {
+    uint64_t one = 1;
+    if ( write( ring->event_fd, &one, sizeof( one ) ) < 0 && errno != EAGAIN ) {
+      error( "Failed to wake up a consumer ( event_fd = %d, %s [%d] ).", ring->event_fd, strerror( errno ), errno );
+    }
+  }
+
+  return true;
+}
+
+
+/**
+ * Returns the oldest record in place, or NULL if the ring is empty. The
+ * record stays valid until pop_shared_memory_ring() is called.
+ */
+void *
+peek_shared_memory_ring( shared_memory_ring *ring, size_t *length ) {
+  assert( ring != NULL );
+  assert( length != NULL );
+
+  uint64_t tail = ring->control->tail;
+  uint64_t head = ring->control->head;
+  __sync_synchronize();
+
+  while ( tail != head ) {
+    size_t offset = ( size_t ) ( tail & ( ring->size - 1 ) );
+    ring_record *record = ( ring_record * ) ( ring->data + offset );
+    if ( record->flags & RECORD_PADDING ) {
+      tail += ring->size - offset;
+      ring->control->tail = tail;
+      __sync_synchronize();
+      continue;
+    }
+    if ( record_length( record->length ) > ring->size - offset || tail + record_length( record->length ) > head ) {
+      error( "Corrupted record in a shared memory ring ( length = %u, offset = %u ).", record->length, offset );
+      return NULL;
+    }
+    ring->peeked_length = record_length( record->length );
+    *length = record->length;
+    return record->value;
+  }
+
+  return NULL;
+}
+
+
+void
+pop_shared_memory_ring( shared_memory_ring *ring ) {
+  assert( ring != NULL );
+  assert( ring->peeked_length > 0 );
+
+  uint64_t tail = ring->control->tail + ring->peeked_length;
+  ring->peeked_length = 0;
+  __sync_synchronize();
+  ring->control->tail = tail;
+  __sync_synchronize();
+}
+
+
+void
+clear_shared_memory_ring_event( shared_memory_ring *ring ) {
+  assert( ring != NULL );
+
+  uint64_t count;
+  if ( read( ring->event_fd, &count, sizeof( count ) ) < 0 && errno != EAGAIN ) {
+    error( "Failed to read an eventfd ( event_fd = %d, %s [%d] ).", ring->event_fd, strerror( errno ), errno );
+  }
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
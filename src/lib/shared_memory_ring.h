@@ -0,0 +1,55 @@
+/*
+ * Single-producer single-consumer message ring in shared memory.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef SHARED_MEMORY_RING_H
+#define SHARED_MEMORY_RING_H
+
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include "bool.h"
+
+
+typedef struct shared_memory_ring shared_memory_ring;
+
+
+shared_memory_ring *create_shared_memory_ring( size_t size );
+shared_memory_ring *attach_shared_memory_ring( int memory_fd, int event_fd );
+void delete_shared_memory_ring( shared_memory_ring *ring );
+
+int get_shared_memory_ring_memory_fd( const shared_memory_ring *ring );
+int get_shared_memory_ring_event_fd( const shared_memory_ring *ring );
+
+bool write_shared_memory_ring( shared_memory_ring *ring, const void *header, size_t header_length, const void *data, size_t length );
+bool writev_shared_memory_ring( shared_memory_ring *ring, const struct iovec *iov, int iovcnt );
+void *peek_shared_memory_ring( shared_memory_ring *ring, size_t *length );
+void pop_shared_memory_ring( shared_memory_ring *ring );
+void clear_shared_memory_ring_event( shared_memory_ring *ring );
+
+
+#endif // SHARED_MEMORY_RING_H
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
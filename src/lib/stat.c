@@ -21,9 +21,11 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <string.h>
 #include "bool.h"
 #include "hash_table.h"
 #include "log.h"
+#include "object_pool.h"
 #include "stat.h"
 #include "utility.h"
 #include "wrapper.h"
@@ -63,10 +65,19 @@ void mock_error( const char *format, ... );
 static hash_table *stats = NULL;
 static pthread_mutex_t stats_table_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
+/*
+ * Counter values live in a single array indexed by stat_counter so that
+ * incrementing a registered counter is a plain atomic add without any
+ * lookup or lock. The hash table only maps keys to counters. Counters
+ * start from one so that a zero-initialized stat_counter is invalid.
+ */
+static uint64_t stat_values[ STAT_MAX_COUNTERS + 1 ];
+static unsigned int n_stat_counters = 0;
+
 
 typedef struct {
   char key[ STAT_KEY_LENGTH ];
-  uint64_t value;
+  stat_counter counter;
 } stat_entry;
 
 
@@ -75,6 +86,8 @@ create_stats_table() {
   assert( stats == NULL );
   stats = create_hash( compare_string, hash_string );
   assert( stats != NULL );
+  memset( stat_values, 0, sizeof( stat_values ) );
+  n_stat_counters = 0;
 }
 
 
@@ -92,6 +105,7 @@ delete_stats_table() {
   }
   delete_hash( stats );
   stats = NULL;
+  n_stat_counters = 0;
 }
 
 
@@ -126,6 +140,24 @@ finalize_stat() {
 }
 
 
+static stat_entry *
+create_stat_entry( const char *key ) {
+  if ( n_stat_counters >= STAT_MAX_COUNTERS ) {
+    error( "Too many statistic entries ( key = %s, max = %u ).", key, STAT_MAX_COUNTERS );
+    return NULL;
+  }
+
+  stat_entry *entry = xmalloc( sizeof( stat_entry ) );
+  strncpy( entry->key, key, STAT_KEY_LENGTH );
+  entry->key[ STAT_KEY_LENGTH - 1 ] = '\0';
+  entry->counter = ++n_stat_counters;
+
+  insert_hash_entry( stats, entry->key, entry );
+
+  return entry;
+}
+
+
 bool
 add_stat_entry( const char *key ) {
   assert( key != NULL );
@@ -140,21 +172,22 @@ add_stat_entry( const char *key ) {
     return false;
   }
 
-  entry = xmalloc( sizeof( stat_entry ) );
-  entry->value = 0;
-  strncpy( entry->key, key, STAT_KEY_LENGTH );
-  entry->key[ STAT_KEY_LENGTH - 1 ] = '\0';
-
-  insert_hash_entry( stats, entry->key, entry );
+  entry = create_stat_entry( key );
 
   pthread_mutex_unlock( &stats_table_mutex );
 
-  return true;
+  return entry != NULL;
 }
 
 
-void
-increment_stat( const char *key ) {
+/**
+ * Returns the counter for `key', adding a statistic entry if it does not
+ * exist yet. Callers are expected to look a counter up once and keep it
+ * for increment_stat_counter(). Counters are valid until finalize_stat()
+ * is called. Returns STAT_COUNTER_INVALID if no more counters are left.
+ */
+stat_counter
+register_stat_counter( const char *key ) {
   assert( key != NULL );
   assert( stats != NULL );
 
@@ -162,18 +195,43 @@ increment_stat( const char *key ) {
 
   stat_entry *entry = lookup_hash_entry( stats, key );
   if ( entry == NULL ) {
-    if ( add_stat_entry( key ) == false ) {
-      pthread_mutex_unlock( &stats_table_mutex );
-      return;
-    }
-    entry = lookup_hash_entry( stats, key );
+    entry = create_stat_entry( key );
   }
+  stat_counter counter = entry != NULL ? entry->counter : STAT_COUNTER_INVALID;
 
-  assert( entry != NULL );
+  pthread_mutex_unlock( &stats_table_mutex );
 
-  ( entry->value )++;
+  return counter;
+}
 
-  pthread_mutex_unlock( &stats_table_mutex );
+
+void
+add_stat_counter( stat_counter counter, uint64_t value ) {
+  if ( counter == STAT_COUNTER_INVALID ) {
+    return;
+  }
+  assert( counter <= STAT_MAX_COUNTERS );
+
+#ifdef __ATOMIC_RELAXED
+  __atomic_fetch_add( &stat_values[ counter ], value, __ATOMIC_RELAXED );
+#else
+  __sync_fetch_and_add( &stat_values[ counter ], value );
+#endif
+}
+
+
+void
+increment_stat_counter( stat_counter counter ) {
+  add_stat_counter( counter, 1 );
+}
+
+
+void
+increment_stat( const char *key ) {
+  assert( key != NULL );
+  assert( stats != NULL );
+
+  increment_stat_counter( register_stat_counter( key ) );
 }
 
 
@@ -192,7 +250,12 @@ dump_stats() {
   init_hash_iterator( stats, &iter );
   while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
     stat_entry *st = e->value;
-    info( "%s: %" PRIu64, st->key, st->value );
+#ifdef __ATOMIC_RELAXED
+    uint64_t value = __atomic_load_n( &stat_values[ st->counter ], __ATOMIC_RELAXED );
+#else
+    uint64_t value = stat_values[ st->counter ];
+#endif
+    info( "%s: %" PRIu64, st->key, value );
     n_stats++;
   }
 
@@ -201,6 +264,8 @@ dump_stats() {
   }
 
   pthread_mutex_unlock( &stats_table_mutex );
+
+  dump_object_pools( info );
 }
 
 
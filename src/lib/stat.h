@@ -21,14 +21,27 @@
 
 
 #ifndef STAT_H
+#define STAT_H
+
+
+#include <stdint.h>
+#include "bool.h"
 
 
 #define STAT_KEY_LENGTH 256
+#define STAT_MAX_COUNTERS 4096
+#define STAT_COUNTER_INVALID 0
+
+
+typedef unsigned int stat_counter;
 
 
 bool init_stat( void );
 bool finalize_stat( void );
 bool add_stat_entry( const char *key );
+stat_counter register_stat_counter( const char *key );
+void increment_stat_counter( stat_counter counter );
+void add_stat_counter( stat_counter counter, uint64_t value );
 void increment_stat( const char *key );
 void dump_stats();
 
@@ -20,7 +20,6 @@
 
 #include <assert.h>
 #include <errno.h>
-#include "doubly_linked_list.h"
 #include "log.h"
 #include "timer.h"
 #include "wrapper.h"
@@ -56,31 +55,50 @@ typedef struct timer_callback {
   struct timespec expires_at;
   struct timespec interval;
   void *user_data;
+  size_t index;
 } timer_callback;
 
 
-static dlist_element *timer_callbacks = NULL;
+#define TIMER_HEAP_INITIAL_SIZE 64
+
+
+/*
+ * Timer callbacks are kept in a binary min-heap ordered by expiry time,
+ * so that the earliest one is always at timer_heap[ 0 ].
+ */
+static timer_callback **timer_heap = NULL;
+static size_t timer_heap_size = 0;
+static size_t timer_heap_capacity = 0;
+
+static timer_callback *running_timer = NULL;
+static bool running_timer_deleted = false;
 
 
 bool
 init_timer() {
-  timer_callbacks = create_dlist();
+  timer_heap_capacity = TIMER_HEAP_INITIAL_SIZE;
+  timer_heap_size = 0;
+  timer_heap = xmalloc( sizeof( timer_callback * ) * timer_heap_capacity );
+  running_timer = NULL;
+  running_timer_deleted = false;
   return true;
 }
 
 
 bool
 finalize_timer() {
-  dlist_element *e;
+  size_t i;
 
-  debug( "Deleting timer callbacks ( timer_callbacks = %p ).", timer_callbacks );
+  debug( "Deleting timer callbacks ( timer_heap = %p, timer_heap_size = %u ).", timer_heap, timer_heap_size );
 
-  if ( timer_callbacks != NULL ) {
-    for ( e = timer_callbacks->next; e; e = e->next ) {
-      xfree( e->data );
+  if ( timer_heap != NULL ) {
+    for ( i = 0; i < timer_heap_size; i++ ) {
+      xfree( timer_heap[ i ] );
     }
-    delete_dlist( timer_callbacks );
-    timer_callbacks = NULL;
+    xfree( timer_heap );
+    timer_heap = NULL;
+    timer_heap_size = 0;
+    timer_heap_capacity = 0;
   }
   else {
     error( "All timer callbacks are already deleted or not created yet." );
@@ -103,9 +121,117 @@ finalize_timer() {
   }                                                           \
   while ( 0 )
 
+#define SUB_TIMESPEC( _a, _b, _return )                       \
+  do {                                                        \
+    ( _return )->tv_sec = ( _a )->tv_sec - ( _b )->tv_sec;    \
+    ( _return )->tv_nsec = ( _a )->tv_nsec - ( _b )->tv_nsec; \
+    if ( ( _return )->tv_nsec < 0 ) {                         \
+      ( _return )->tv_sec--;                                  \
+      ( _return )->tv_nsec += 1000000000;                     \
+    }                                                         \
+  }                                                           \
+  while ( 0 )
+
+#define TIMESPEC_LESS_THAN_OR_EQUAL( _a, _b )                                   \
+  ( ( ( _a )->tv_sec < ( _b )->tv_sec )                                         \
+    || ( ( ( _a )->tv_sec == ( _b )->tv_sec ) && ( ( _a )->tv_nsec <= ( _b )->tv_nsec ) ) )
+
+
+static bool
+expires_earlier( const timer_callback *a, const timer_callback *b ) {
+  if ( a->expires_at.tv_sec != b->expires_at.tv_sec ) {
+    return a->expires_at.tv_sec < b->expires_at.tv_sec;
+  }
+  return a->expires_at.tv_nsec < b->expires_at.tv_nsec;
+}
+
 
 static void
-on_timer( timer_callback *callback ) {
+set_timer_heap_entry( size_t index, timer_callback *callback ) {
+  timer_heap[ index ] = callback;
+  callback->index = index;
+}
+
+
+static void
+sift_up_timer_heap( size_t index ) {
+  timer_callback *callback = timer_heap[ index ];
+
+  while ( index > 0 ) {
+    size_t parent = ( index - 1 ) / 2;
+    if ( !expires_earlier( callback, timer_heap[ parent ] ) ) {
+      break;
+    }
+    set_timer_heap_entry( index, timer_heap[ parent ] );
+    index = parent;
+  }
+  set_timer_heap_entry( index, callback );
+}
+
+
+static void
+sift_down_timer_heap( size_t index ) {
+  timer_callback *callback = timer_heap[ index ];
+
+  while ( true ) {
+    size_t child = index * 2 + 1;
+    if ( child >= timer_heap_size ) {
+      break;
+    }
+    if ( child + 1 < timer_heap_size && expires_earlier( timer_heap[ child + 1 ], timer_heap[ child ] ) ) {
+      child++;
+    }
+    if ( !expires_earlier( timer_heap[ child ], callback ) ) {
+      break;
+    }
+    set_timer_heap_entry( index, timer_heap[ child ] );
+    index = child;
+  }
+  set_timer_heap_entry( index, callback );
+}
+
+
+static void
+push_timer_heap( timer_callback *callback ) {
+  assert( timer_heap != NULL );
+
+  if ( timer_heap_size == timer_heap_capacity ) {
+    size_t new_capacity = timer_heap_capacity * 2;
+    timer_callback **new_heap = xmalloc( sizeof( timer_callback * ) * new_capacity );
+    memcpy( new_heap, timer_heap, sizeof( timer_callback * ) * timer_heap_size );
+    xfree( timer_heap );
+    timer_heap = new_heap;
+    timer_heap_capacity = new_capacity;
+  }
+
+  set_timer_heap_entry( timer_heap_size++, callback );
+  sift_up_timer_heap( callback->index );
+}
+
+
+static void
+remove_timer_heap( timer_callback *callback ) {
+  size_t index = callback->index;
+
+  assert( index < timer_heap_size );
+  assert( timer_heap[ index ] == callback );
+
+  timer_heap_size--;
+  if ( index == timer_heap_size ) {
+    return;
+  }
+  set_timer_heap_entry( index, timer_heap[ timer_heap_size ] );
+  if ( index > 0 && expires_earlier( timer_heap[ index ], timer_heap[ ( index - 1 ) / 2 ] ) ) {
+    sift_up_timer_heap( index );
+  }
+  else {
+    sift_down_timer_heap( index );
+  }
+}
+
+
+static void
+on_timer( timer_callback *callback, const struct timespec *now ) {
   assert( callback != NULL );
   assert( callback->function != NULL );
 
@@ -113,20 +239,25 @@ on_timer( timer_callback *callback ) {
          callback->function, callback->expires_at.tv_sec, callback->expires_at.tv_nsec,
          callback->interval.tv_sec, callback->interval.tv_nsec, callback->user_data );
 
-  if ( VALID_TIMESPEC( &callback->expires_at ) ) {
-    callback->function( callback->user_data );
-    if ( VALID_TIMESPEC( &callback->interval ) ) {
-      ADD_TIMESPEC( &callback->expires_at, &callback->interval, &callback->expires_at );
-    }
-    else {
-      callback->expires_at.tv_sec = 0;
-      callback->expires_at.tv_nsec = 0;
-    }
-    debug( "Set expires_at value to %u.%09u.", callback->expires_at.tv_sec, callback->expires_at.tv_nsec );
+  running_timer = callback;
+  running_timer_deleted = false;
+  callback->function( callback->user_data );
+  running_timer = NULL;
+
+  if ( running_timer_deleted || !VALID_TIMESPEC( &callback->interval ) ) {
+    xfree( callback );
+    return;
   }
-  else {
-    error( "Invalid expires_at value." );
+
+  ADD_TIMESPEC( &callback->expires_at, &callback->interval, &callback->expires_at );
+  if ( TIMESPEC_LESS_THAN_OR_EQUAL( &callback->expires_at, now ) ) {
+    // Missed ticks are not caught up. Otherwise a slow periodic callback
+    // would run over and over again within a single call.
+    ADD_TIMESPEC( now, &callback->interval, &callback->expires_at );
   }
+  debug( "Set expires_at value to %u.%09u.", callback->expires_at.tv_sec, callback->expires_at.tv_nsec );
+
+  push_timer_heap( callback );
 }
 
 
@@ -134,31 +265,63 @@ void
 execute_timer_events() {
   struct timespec now;
   timer_callback *callback;
-  dlist_element *element;
 
-  debug( "Executing timer events ( timer_callbacks = %p ).", timer_callbacks );
+  assert( timer_heap != NULL );
 
-  assert( clock_gettime( CLOCK_MONOTONIC, &now ) == 0 );
-  assert( timer_callbacks != NULL );
+  if ( timer_heap_size == 0 ) {
+    return;
+  }
 
-  // TODO: timer_callbacks should be a list which is sorted by expiry time
-  for ( element = timer_callbacks->next; element; element = element->next ) {
-    callback = element->data;
-    if ( ( callback->expires_at.tv_sec < now.tv_sec )
-      || ( ( callback->expires_at.tv_sec == now.tv_sec )
-          && ( callback->expires_at.tv_nsec <= now.tv_nsec ) ) ) {
-      on_timer( callback );
+  if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+    error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+    return;
+  }
+
+  while ( timer_heap_size > 0 ) {
+    callback = timer_heap[ 0 ];
+    if ( !TIMESPEC_LESS_THAN_OR_EQUAL( &callback->expires_at, &now ) ) {
+      break;
     }
+    remove_timer_heap( callback );
+    on_timer( callback, &now );
   }
 }
 
 
 bool
-add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data ) {
+get_next_timer_event_timeout( struct timespec *timeout ) {
+  assert( timeout != NULL );
+
+  struct timespec now;
+
+  if ( timer_heap == NULL || timer_heap_size == 0 ) {
+    return false;
+  }
+
+  if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
+    error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
+    return false;
+  }
+
+  timer_callback *callback = timer_heap[ 0 ];
+  if ( TIMESPEC_LESS_THAN_OR_EQUAL( &callback->expires_at, &now ) ) {
+    timeout->tv_sec = 0;
+    timeout->tv_nsec = 0;
+  }
+  else {
+    SUB_TIMESPEC( &callback->expires_at, &now, timeout );
+  }
+
+  return true;
+}
+
+
+timer_event_handle
+add_timer_event( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data ) {
   assert( interval != NULL );
   assert( callback != NULL );
 
-  debug( "Adding a timer event callback ( interval = %u.%09u, initial expiration = %u.%09u, callback = %p, user_data = %p ).",
+  debug( "Adding a timer event ( interval = %u.%09u, initial expiration = %u.%09u, callback = %p, user_data = %p ).",
          interval->it_interval.tv_sec, interval->it_interval.tv_nsec,
          interval->it_value.tv_sec, interval->it_value.tv_nsec, callback, user_data );
 
@@ -173,7 +336,7 @@ add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void
   if ( clock_gettime( CLOCK_MONOTONIC, &now ) != 0 ) {
     error( "Failed to retrieve monotonic time ( %s [%d] ).", strerror( errno ), errno );
     xfree( cb );
-    return false;
+    return NULL;
   }
 
   cb->interval = interval->it_interval;
@@ -187,38 +350,70 @@ add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void
   else {
     error( "Timer must not be zero when a timer event is added." );
     xfree( cb );
-    return false;
+    return NULL;
   }
 
   debug( "Set an initial expiration time to %u.%09u.", now.tv_sec, now.tv_nsec );
 
-  assert( timer_callbacks != NULL );
-  insert_after_dlist( timer_callbacks, cb );
+  push_timer_heap( cb );
+
+  return cb;
+}
+
+
+bool
+delete_timer_event( timer_event_handle handle ) {
+  assert( handle != NULL );
+
+  debug( "Deleting a timer event ( handle = %p ).", handle );
+
+  timer_callback *cb = handle;
+
+  if ( timer_heap == NULL ) {
+    error( "All timer callbacks are already deleted or not created yet." );
+    return false;
+  }
+
+  if ( cb == running_timer ) {
+    // Released by on_timer() once the callback returns.
+    running_timer_deleted = true;
+    return true;
+  }
+
+  remove_timer_heap( cb );
+  xfree( cb );
 
   return true;
 }
 
 
+bool
+add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data ) {
+  return add_timer_event( interval, callback, user_data ) != NULL;
+}
+
+
 bool
 delete_timer_event_callback( void ( *callback )( void *user_data ) ) {
   assert( callback != NULL );
 
   debug( "Deleting a timer event callback ( callback = %p ).", callback );
 
-  dlist_element *e;
+  size_t i;
 
-  if ( timer_callbacks == NULL ) {
+  if ( timer_heap == NULL ) {
     error( "All timer callbacks are already deleted or not created yet." );
     return false;
   }
 
-  for ( e = timer_callbacks->next; e; e = e->next ) {
-    timer_callback *cb = e->data;
-    if ( cb->function == callback ) {
+  if ( running_timer != NULL && !running_timer_deleted && running_timer->function == callback ) {
+    return delete_timer_event( running_timer );
+  }
+
+  for ( i = 0; i < timer_heap_size; i++ ) {
+    if ( timer_heap[ i ]->function == callback ) {
       debug( "Deleting a callback ( callback = %p ).", callback );
-      xfree( cb );
-      delete_dlist_element( e );
-      return true;
+      return delete_timer_event( timer_heap[ i ] );
     }
   }
 
@@ -28,9 +28,22 @@
 #include <time.h>
 
 
+/*
+ * A handle returned by add_timer_event() is valid until it is passed to
+ * delete_timer_event(), or until the callback of a one-shot timer event
+ * returns. A one-shot timer event is released once it fires, so callers
+ * that keep its handle must forget it in the callback. The callback may
+ * still delete its own timer event.
+ */
+typedef void *timer_event_handle;
+
+
 bool init_timer( void );
 bool finalize_timer( void );
 
+timer_event_handle add_timer_event( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data );
+bool delete_timer_event( timer_event_handle handle );
+
 bool add_timer_event_callback( struct itimerspec *interval, void ( *callback )( void *user_data ), void *user_data );
 bool delete_timer_event_callback( void ( *callback )( void *user_data ) );
 
@@ -38,6 +51,7 @@ bool add_periodic_event_callback( const time_t seconds, void ( *callback )( void
 bool delete_periodic_event_callback( void ( *callback )( void *user_data ) );
 
 void execute_timer_events( void );
+bool get_next_timer_event_timeout( struct timespec *timeout );
 
 
 #endif // TIMER_H
@@ -29,17 +29,21 @@
 #include "byteorder.h"
 #include "checks.h"
 #include "doubly_linked_list.h"
+#include "event_handler.h"
 #include "hash_table.h"
 #include "linked_list.h"
 #include "log.h"
 #include "match.h"
 #include "match_table.h"
 #include "messenger.h"
+#include "object_pool.h"
 #include "openflow_application_interface.h"
 #include "openflow_message.h"
 #include "packet_info.h"
 #include "packet_parser.h"
+#include "shadow_flow_table.h"
 #include "stat.h"
+#include "timer.h"
 #include "utility.h"
 #include "wrapper.h"
 
@@ -18,6 +18,7 @@
  */
 
 
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include "wrapper.h"
@@ -39,6 +40,21 @@ extern void _test_free( void *const ptr, const char *file, const int line );
 #include "utility.h"
 
 
+static uint64_t heap_allocations = 0;
+
+
+static void
+count_heap_allocation( void ) {
+#ifndef NDEBUG
+#ifdef __ATOMIC_RELAXED
+  __atomic_fetch_add( &heap_allocations, 1, __ATOMIC_RELAXED );
+#else
+  __sync_fetch_and_add( &heap_allocations, 1 );
+#endif
+#endif
+}
+
+
 void *
 xmalloc( size_t size ) {
   void *ret = malloc( size );
@@ -46,7 +62,11 @@ xmalloc( size_t size ) {
   if ( !ret ) {
     die( "Out of memory, malloc failed" );
   }
+  count_heap_allocation();
+#ifndef NDEBUG
+  // Poison the area to catch reads of uninitialized memory.
   memset( ret, 0xA5, size );
+#endif
   return ret;
 }
 
@@ -58,9 +78,24 @@ xcalloc( size_t nmemb, size_t size ) {
   if ( !ret ) {
     die( "Out of memory, calloc failed" );
   }
+  count_heap_allocation();
   return ret;
 }
 
+
+/**
+ * Returns the number of xmalloc() and xcalloc() calls made so far. They
+ * are not counted if built with NDEBUG.
+ */
+uint64_t
+get_heap_allocation_count( void ) {
+#ifdef __ATOMIC_RELAXED
+  return __atomic_load_n( &heap_allocations, __ATOMIC_RELAXED );
+#else
+  return heap_allocations;
+#endif
+}
+
 #endif // UNIT_TESTING
 
 
@@ -25,6 +25,7 @@
 
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include "utility.h"
 
@@ -67,6 +68,9 @@ extern void *_test_calloc( const size_t number_of_elements, const size_t size, c
   mock_assert( ( int ) ( expression ), #expression, __FILE__, __LINE__ );
 extern void mock_assert( const int result, const char *const expression, const char *const file, const int line );
 
+// Heap allocations are not counted in unit tests.
+#define get_heap_allocation_count() ( ( uint64_t ) 0 )
+
 #else // UNIT_TESTING
 
 #ifdef xmalloc
@@ -79,6 +83,8 @@ void *xmalloc( size_t size );
 #endif // xcalloc
 void *xcalloc( size_t nmemb, size_t size );
 
+uint64_t get_heap_allocation_count( void );
+
 #endif // UNIT_TESTING
 
 
@@ -21,6 +21,7 @@
 
 
 #include <getopt.h>
+#include <inttypes.h>
 #include <openflow.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -52,13 +53,23 @@ void mock_error( const char *format, ... );
 void mock_set_match_from_packet( struct ofp_match *match, const uint16_t in_port,
                                  const uint32_t wildcards, const buffer *packet );
 
-#ifdef create_packet_in
-#undef create_packet_in
+#ifdef warn
+#undef warn
 #endif
-#define create_packet_in mock_create_packet_in
-buffer *mock_create_packet_in( const uint32_t transaction_id, const uint32_t buffer_id,
-                               const uint16_t total_len, uint16_t in_port,
-                               const uint8_t reason, const buffer *data );
+#define warn( fmt, args... ) mock_warn( fmt, ##args )
+void mock_warn( const char *format, ... );
+
+#ifdef parse_packet
+#undef parse_packet
+#endif
+#define parse_packet mock_parse_packet
+bool mock_parse_packet( buffer *buf );
+
+#ifdef free_packet
+#undef free_packet
+#endif
+#define free_packet mock_free_packet
+void mock_free_packet( buffer *buf );
 
 #ifdef insert_match_entry
 #undef insert_match_entry
@@ -86,11 +97,18 @@ bool mock_send_message( const char *service_name, const uint16_t tag, const void
 #define init_trema mock_init_trema
 void mock_init_trema( int *argc, char ***argv );
 
-#ifdef set_packet_in_handler
-#undef set_packet_in_handler
+#ifdef add_message_received_callback
+#undef add_message_received_callback
 #endif
-#define set_packet_in_handler mock_set_packet_in_handler
-bool mock_set_packet_in_handler( packet_in_handler callback, void *user_data );
+#define add_message_received_callback mock_add_message_received_callback
+bool mock_add_message_received_callback( const char *service_name,
+                                         void ( *callback )( uint16_t tag, void *data, size_t len ) );
+
+#ifdef get_trema_name
+#undef get_trema_name
+#endif
+#define get_trema_name mock_get_trema_name
+const char *mock_get_trema_name( void );
 
 #ifdef start_trema
 #undef start_trema
@@ -131,18 +149,38 @@ usage() {
 }
 
 
+/*
+ * Forwards packet_in messages received from switch daemons as is. Only the
+ * frame is parsed ( in place ) for matching; the message itself is neither
+ * decoded nor re-encoded.
+ */
 static void
-handle_packet_in( uint64_t datapath_id, uint32_t transaction_id,
-                  uint32_t buffer_id, uint16_t total_len,
-                  uint16_t in_port, uint8_t reason, const buffer *data,
-                  void *user_data ) {
-  UNUSED( user_data );
+handle_packet_in( void *data, size_t length ) {
+  openflow_service_header_t *message = data;
+  size_t header_length = sizeof( openflow_service_header_t ) + ntohs( message->service_name_length );
+  if ( length < header_length + offsetof( struct ofp_packet_in, data ) ) {
+    error( "Too short packet_in message ( length = %u ).", length );
+    return;
+  }
 
-  char match_str[ 1024 ];
-  struct ofp_match ofp_match;   // host order
+  struct ofp_packet_in *packet_in = ( struct ofp_packet_in * ) ( ( char * ) data + header_length );
+  size_t frame_length = length - header_length - offsetof( struct ofp_packet_in, data );
+  if ( frame_length == 0 ) {
+    warn( "Dropping a packet_in message without frame ( datapath_id = %#" PRIx64 " ).",
+          ntohll( message->datapath_id ) );
+    return;
+  }
 
-  set_match_from_packet( &ofp_match, in_port, 0, data );
-  match_to_string( &ofp_match, match_str, sizeof( match_str ) );
+  buffer *frame = wrap_buffer( packet_in->data, frame_length );
+  if ( !parse_packet( frame ) ) {
+    error( "Failed to parse a packet." );
+    free_packet( frame );
+    return;
+  }
+
+  struct ofp_match ofp_match;   // host order
+  set_match_from_packet( &ofp_match, ntohs( packet_in->in_port ), 0, frame );
+  free_packet( frame );
 
   match_entry *match_entry = lookup_match_entry( &ofp_match );
   if ( match_entry == NULL ) {
@@ -150,25 +188,43 @@ handle_packet_in( uint64_t datapath_id, uint32_t transaction_id,
     return;
   }
 
-  buffer *buf = create_packet_in( transaction_id, buffer_id, total_len, in_port,
-                                  reason, data );
-
-  openflow_service_header_t *message;
-  message = append_front_buffer( buf, sizeof( openflow_service_header_t ) );
-  message->datapath_id = htonll( datapath_id );
-  message->service_name_length = htons( 0 );
-  if ( !send_message( match_entry->service_name, MESSENGER_OPENFLOW_MESSAGE,
-                      buf->data, buf->length ) ) {
+  char match_str[ 1024 ];
+  if ( !send_message( match_entry->service_name, MESSENGER_OPENFLOW_MESSAGE, data, length ) ) {
+    match_to_string( &ofp_match, match_str, sizeof( match_str ) );
     error( "Failed to send a message to %s ( entry_name = %s, match = %s ).",
            match_entry->service_name, match_entry->entry_name, match_str );
-    free_buffer( buf );
     return;
   }
 
-  debug( "Sending a message to %s ( entry_name = %s, match = %s ).",
-         match_entry->service_name, match_entry->entry_name, match_str );
+  // Because match_to_string() is costly, we check logging_level first.
+  if ( logging_level_is_enabled( LOG_DEBUG ) ) {
+    match_to_string( &ofp_match, match_str, sizeof( match_str ) );
+    debug( "Sending a message to %s ( entry_name = %s, match = %s ).",
+           match_entry->service_name, match_entry->entry_name, match_str );
+  }
+}
+
+
+static void
+handle_message( uint16_t tag, void *data, size_t length ) {
+  if ( tag != MESSENGER_OPENFLOW_MESSAGE ) {
+    debug( "Unhandled message ( tag = %u ).", tag );
+    return;
+  }
+  if ( length < sizeof( openflow_service_header_t ) + sizeof( struct ofp_header ) ) {
+    error( "Too short openflow application message ( length = %u ).", length );
+    return;
+  }
+
+  openflow_service_header_t *message = data;
+  struct ofp_header *header = ( struct ofp_header * ) ( ( char * ) data + sizeof( openflow_service_header_t )
+                                                       + ntohs( message->service_name_length ) );
+  if ( ( char * ) header + sizeof( struct ofp_header ) > ( char * ) data + length || header->type != OFPT_PACKET_IN ) {
+    debug( "Unhandled OpenFlow message." );
+    return;
+  }
 
-  free_buffer( buf );
+  handle_packet_in( data, length );
 }
 
 
@@ -246,7 +302,7 @@ main( int argc, char *argv[] ) {
     exit( EXIT_FAILURE );
   }
 
-  set_packet_in_handler( handle_packet_in, NULL );
+  add_message_received_callback( get_trema_name(), handle_message );
 
   start_trema();
 
@@ -74,7 +74,7 @@ compare_application( const void *x, const void *y ) {
 
 
 static cookie_entry_t *
-allocate_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags ) {
+allocate_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags, uint64_t datapath_id ) {
   cookie_entry_t *new_entry;
 
   new_entry = xmalloc( sizeof ( cookie_entry_t ) );
@@ -82,6 +82,7 @@ allocate_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t f
 
   new_entry->cookie = generate_cookie();
   new_entry->application.cookie = *original_cookie;
+  new_entry->application.datapath_id = datapath_id;
 
   if ( strlen( service_name ) + 1 > MESSENGER_SERVICE_NAME_LENGTH ) {
     warn( "Too long service name ( service_name = %s ).", service_name );
@@ -132,13 +133,13 @@ finalize_cookie_table( void ) {
 
 
 uint64_t *
-insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags ) {
+insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags, uint64_t datapath_id ) {
   cookie_entry_t *new_entry, *conflict_entry;
 
-  debug( "Inserting cookie entry ( original_cookie = %#" PRIx64 ", service_name = %s, flags = %#x ).",
-         original_cookie, service_name, flags );
+  debug( "Inserting cookie entry ( original_cookie = %#" PRIx64 ", service_name = %s, flags = %#x, datapath_id = %#" PRIx64 " ).",
+         original_cookie, service_name, flags, datapath_id );
 
-  new_entry = lookup_cookie_entry_by_application( original_cookie, service_name );
+  new_entry = lookup_cookie_entry_by_application( original_cookie, service_name, datapath_id );
   if ( new_entry != NULL ) {
     new_entry->reference_count++;
     new_entry->expire_at = time( NULL ) + COOKIE_ENTRY_LIFETIME;
@@ -147,7 +148,7 @@ insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t fla
     return &new_entry->cookie;
   }
 
-  new_entry = allocate_cookie_entry( original_cookie, service_name, flags );
+  new_entry = allocate_cookie_entry( original_cookie, service_name, flags, datapath_id );
   conflict_entry = insert_hash_entry( cookie_table.global, &new_entry->cookie, new_entry );
   if ( conflict_entry != NULL ) {
     warn( "Conflicted cookie ( cookie = %#" PRIx64 " ).", new_entry->cookie );
@@ -204,6 +205,27 @@ delete_cookie_entry( cookie_entry_t *entry ) {
 }
 
 
+/*
+ * Forgets the flow entries installed on a switch which is disconnected,
+ * regardless of their reference counts.
+ */
+void
+delete_cookie_entries_by_datapath_id( uint64_t datapath_id ) {
+  hash_iterator iter;
+  hash_entry *e;
+
+  init_hash_iterator( cookie_table.global, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    cookie_entry_t *entry = e->value;
+    if ( entry->application.datapath_id == datapath_id ) {
+      delete_hash_entry( cookie_table.global, &entry->cookie );
+      delete_hash_entry( cookie_table.application, &entry->application );
+      free_cookie_entry( entry );
+    }
+  }
+}
+
+
 cookie_entry_t *
 lookup_cookie_entry_by_cookie( uint64_t *cookie ) {
   return lookup_hash_entry( cookie_table.global, cookie );
@@ -211,12 +233,13 @@ lookup_cookie_entry_by_cookie( uint64_t *cookie ) {
 
 
 cookie_entry_t *
-lookup_cookie_entry_by_application( uint64_t *cookie, char *service_name ) {
+lookup_cookie_entry_by_application( uint64_t *cookie, char *service_name, uint64_t datapath_id ) {
   cookie_entry_t key;
   cookie_entry_t *entry;
 
   memset( &key, 0, sizeof( cookie_entry_t ) );
   key.application.cookie = *cookie;
+  key.application.datapath_id = datapath_id;
   strncpy( key.application.service_name, service_name, MESSENGER_SERVICE_NAME_LENGTH );
   key.application.service_name[ MESSENGER_SERVICE_NAME_LENGTH - 1 ] = '\0';
 
@@ -34,6 +34,7 @@
 
 typedef struct application_entry {
   uint64_t cookie;
+  uint64_t datapath_id;
   char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
   uint16_t flags;
 } application_entry_t;
@@ -53,10 +54,11 @@ typedef struct cookie_table {
 
 void init_cookie_table( void );
 void finalize_cookie_table( void );
-uint64_t *insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags );
+uint64_t *insert_cookie_entry( uint64_t *original_cookie, char *service_name, uint16_t flags, uint64_t datapath_id );
 void delete_cookie_entry( cookie_entry_t *entry );
+void delete_cookie_entries_by_datapath_id( uint64_t datapath_id );
 cookie_entry_t *lookup_cookie_entry_by_cookie( uint64_t *cookie );
-cookie_entry_t *lookup_cookie_entry_by_application( uint64_t *cookie, char *service_name );
+cookie_entry_t *lookup_cookie_entry_by_application( uint64_t *cookie, char *service_name, uint64_t datapath_id );
 void age_cookie_table( void *user_data );
 void dump_cookie_table( void );
 
@@ -22,6 +22,9 @@
 #include "message_queue.h"
 
 
+static object_pool message_queue_element_pool = OBJECT_POOL_INITIALIZER( "message_queue_element", sizeof( list_element ) );
+
+
 message_queue *
 create_message_queue( void ) {
   message_queue *queue = xmalloc( sizeof( message_queue ) );
@@ -39,10 +42,11 @@ delete_message_queue( message_queue *queue ) {
 
   list_element *element = queue->head;
   while( element != NULL ) {
+    list_element *delete_me = element;
     free_buffer( element->data );
     element = element->next;
+    free_object( &message_queue_element_pool, delete_me );
   }
-  delete_list( queue->head );
   xfree( queue );
 
   return true;
@@ -55,7 +59,7 @@ enqueue_message( message_queue *queue, buffer *message ) {
   assert( message != NULL );
   assert( message->length > 0 );
 
-  list_element *new_tail = xmalloc( sizeof( list_element ) );
+  list_element *new_tail = allocate_object( &message_queue_element_pool );
   new_tail->data = message;
   new_tail->next = NULL;
 
@@ -86,7 +90,7 @@ dequeue_message( message_queue *queue ) {
   list_element *delete_me = queue->head;
   buffer *message = delete_me->data;
   queue->head = queue->head->next;
-  xfree( delete_me );
+  free_object( &message_queue_element_pool, delete_me );
 
   if ( queue->head == NULL ) {
     queue->tail = NULL;
@@ -344,10 +344,11 @@ ofpmsg_recv_statsreply( struct switch_info *sw_info, buffer *buf ) {
     return -1;
   }
   stats_reply->header.xid = htonl( xid_entry->original_xid );
+  uint16_t flags = ntohs( stats_reply->flags );
   service_send_to_reply( xid_entry->service_name, MESSENGER_OPENFLOW_MESSAGE,
                          &sw_info->datapath_id, buf );
 
-  if ( ( ntohs( stats_reply->flags ) & OFPSF_REPLY_MORE ) == 0 ) {
+  if ( ( flags & OFPSF_REPLY_MORE ) == 0 ) {
     delete_xid_entry( xid_entry );
   }
   free_buffer( buf );
@@ -118,7 +118,7 @@ ofpmsg_send_error_msg( struct switch_info *sw_info, uint16_t type, uint16_t code
 
 
 static int
-update_flowmod_cookie( buffer *buf, char *service_name ) {
+update_flowmod_cookie( buffer *buf, char *service_name, uint64_t datapath_id ) {
   struct ofp_flow_mod *flow_mod = buf->data;
   uint16_t command = ntohs( flow_mod->command );
   uint16_t flags = ntohs( flow_mod->flags );
@@ -127,7 +127,7 @@ update_flowmod_cookie( buffer *buf, char *service_name ) {
   switch ( command ) {
   case OFPFC_ADD:
   {
-    uint64_t *new_cookie = insert_cookie_entry( &cookie, service_name, flags );
+    uint64_t *new_cookie = insert_cookie_entry( &cookie, service_name, flags, datapath_id );
     if ( new_cookie == NULL ) {
       return -1;
     }
@@ -141,7 +141,7 @@ update_flowmod_cookie( buffer *buf, char *service_name ) {
   case OFPFC_DELETE:
   case OFPFC_DELETE_STRICT:
   {
-    cookie_entry_t *entry = lookup_cookie_entry_by_application( &cookie, service_name );
+    cookie_entry_t *entry = lookup_cookie_entry_by_application( &cookie, service_name, datapath_id );
     if ( entry != NULL ) {
       flow_mod->cookie = htonll( entry->cookie );
     }
@@ -168,11 +168,11 @@ ofpmsg_send( struct switch_info *sw_info, buffer *buf, char *service_name ) {
 
   ofp_header = buf->data;
 
-  new_xid = insert_xid_entry( ntohl( ofp_header->xid ), service_name );
+  new_xid = insert_xid_entry( ntohl( ofp_header->xid ), service_name, sw_info->datapath_id );
   ofp_header->xid = htonl( new_xid );
 
   if ( ofp_header->type == OFPT_FLOW_MOD ) {
-    ret = update_flowmod_cookie( buf, service_name );
+    ret = update_flowmod_cookie( buf, service_name, sw_info->datapath_id );
     if ( ret < 0 ) {
       error( "Failed to update cookie value ( ret = %d ).", ret );
       free_buffer( buf );
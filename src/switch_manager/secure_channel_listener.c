@@ -168,23 +168,95 @@ secure_channel_listen_start( struct listener_info *listener_info ) {
 static const int ACCEPT_FD = 3;
 
 
-void
-secure_channel_accept( struct listener_info *listener_info ) {
-  struct sockaddr_in addr;
-  socklen_t addr_len;
-  int accept_fd;
-  int pid;
+/*
+ * Replaces the current process with a switch daemon named `name' which
+ * gets `fd' with `fd_option'.
+ */
+static void
+exec_switch( struct listener_info *listener_info, const char *name, const char *fd_option, int fd ) {
   uint command_name_len;
   char *command_name;
   uint service_name_len;
   char *service_name;
-  uint socket_opt_len;
-  char *socket_opt;
+  uint fd_opt_len;
+  char *fd_opt;
   char *daemonize_opt;
   int argc;
   char **argv;
   int i, j;
 
+  if ( fd < ACCEPT_FD ) {
+    dup2( fd, ACCEPT_FD );
+    close( fd );
+    fd = ACCEPT_FD;
+  }
+
+  argc = SWITCH_MANAGER_DEFAULT_ARGC + listener_info->switch_manager_argc + 1;
+  argv = xcalloc( ( size_t ) argc, sizeof( char * ) );
+
+  command_name_len = SWITCH_MANAGER_COMMAND_PREFIX_STR_LEN + ( uint ) strlen( name );
+  command_name = xmalloc( command_name_len );
+  snprintf( command_name, command_name_len, "%s%s", SWITCH_MANAGER_COMMAND_PREFIX, name );
+
+  service_name_len = SWITCH_MANAGER_NAME_OPTION_STR_LEN
+                     + SWITCH_MANAGER_PREFIX_STR_LEN
+                     + ( uint ) strlen( name );
+  service_name = xmalloc( service_name_len );
+  snprintf( service_name, service_name_len, "%s%s%s",
+            SWITCH_MANAGER_NAME_OPTION, SWITCH_MANAGER_PREFIX, name );
+
+  fd_opt_len = ( uint ) strlen( fd_option ) + SWITCH_MANAGER_SOCKET_STR_LEN;
+  fd_opt = xmalloc( fd_opt_len );
+  snprintf( fd_opt, fd_opt_len, "%s%d", fd_option, fd );
+
+  daemonize_opt = xstrdup( SWITCH_MANAGER_DAEMONIZE_OPTION );
+
+  i = 0;
+  argv[ i++ ] = command_name;
+  argv[ i++ ] = service_name;
+  argv[ i++ ] = fd_opt;
+  argv[ i++ ] = daemonize_opt;
+  for ( j = 0; j < listener_info->switch_manager_argc; i++, j++ ) {
+    argv[ i ] = listener_info->switch_manager_argv[ j ];
+  }
+
+  int in_fd = open( "/dev/null", O_RDONLY );
+  if ( in_fd != 0 ) {
+    dup2( in_fd, 0 );
+    close( in_fd );
+  }
+  int out_fd = open( "/dev/null", O_WRONLY );
+  if ( out_fd != 1 ) {
+    dup2( out_fd, 1 );
+    close( out_fd );
+  }
+  int err_fd = open( "/dev/null", O_WRONLY );
+  if ( err_fd != 2 ) {
+    dup2( err_fd, 2 );
+    close( err_fd );
+  }
+
+  execvp( listener_info->switch_manager, argv );
+  error( "Failed to execvp: %s(%s) %s %s. %s.",
+    argv[ 0 ], listener_info->switch_manager,
+    argv[ 1 ], argv[ 2 ], strerror( errno ) );
+
+  xfree( service_name );
+  xfree( command_name );
+  xfree( fd_opt );
+  xfree( daemonize_opt );
+  xfree( argv );
+}
+
+
+void
+secure_channel_accept( struct listener_info *listener_info ) {
+  struct sockaddr_in addr;
+  socklen_t addr_len;
+  int accept_fd;
+  int pid;
+  char name[ SWITCH_MANAGER_ADDR_STR_LEN ];
+
   addr_len = sizeof( struct sockaddr_in );
   accept_fd = accept( listener_info->listen_fd, ( struct sockaddr * ) &addr, &addr_len );
   if ( accept_fd < 0 ) {
@@ -199,74 +271,8 @@ secure_channel_accept( struct listener_info *listener_info ) {
     return;
   }
   if ( pid == 0 ) {
-    if ( accept_fd < ACCEPT_FD ) {
-      dup2( accept_fd, ACCEPT_FD );
-      close( accept_fd );
-      accept_fd = ACCEPT_FD;
-    }
-
-    argc = SWITCH_MANAGER_DEFAULT_ARGC + listener_info->switch_manager_argc + 1;
-    argv = xcalloc( ( size_t ) argc, sizeof( char * ) );
-
-    command_name_len = SWITCH_MANAGER_COMMAND_PREFIX_STR_LEN
-                       + SWITCH_MANAGER_ADDR_STR_LEN;
-    command_name = xmalloc( command_name_len );
-    snprintf( command_name, command_name_len, "%s%s:%u",
-      SWITCH_MANAGER_COMMAND_PREFIX,
-      inet_ntoa( addr.sin_addr ), ntohs( addr.sin_port ) );
-
-    service_name_len = SWITCH_MANAGER_NAME_OPTION_STR_LEN
-                       + SWITCH_MANAGER_PREFIX_STR_LEN
-                       + SWITCH_MANAGER_ADDR_STR_LEN;
-    service_name = xmalloc( service_name_len );
-    snprintf( service_name, service_name_len, "%s%s%s:%u",
-              SWITCH_MANAGER_NAME_OPTION,
-              SWITCH_MANAGER_PREFIX,
-              inet_ntoa( addr.sin_addr ), ntohs( addr.sin_port ) );
-
-    socket_opt_len = SWITCH_MANAGER_SOCKET_OPTION_STR_LEN
-                     + SWITCH_MANAGER_SOCKET_STR_LEN;
-    socket_opt = xmalloc( socket_opt_len );
-    snprintf( socket_opt, socket_opt_len, "%s%d",
-              SWITCH_MANAGER_SOCKET_OPTION, accept_fd );
-
-    daemonize_opt = xstrdup( SWITCH_MANAGER_DAEMONIZE_OPTION );
-
-    i = 0;
-    argv[ i++ ] = command_name;
-    argv[ i++ ] = service_name;
-    argv[ i++ ] = socket_opt;
-    argv[ i++ ] = daemonize_opt;
-    for ( j = 0; j < listener_info->switch_manager_argc; i++, j++ ) {
-      argv[ i ] = listener_info->switch_manager_argv[ j ];
-    }
-
-    int in_fd = open( "/dev/null", O_RDONLY );
-    if ( in_fd != 0 ) {
-      dup2( in_fd, 0 );
-      close( in_fd );
-    }
-    int out_fd = open( "/dev/null", O_WRONLY );
-    if ( out_fd != 1 ) {
-      dup2( out_fd, 1 );
-      close( out_fd );
-    }
-    int err_fd = open( "/dev/null", O_WRONLY );
-    if ( err_fd != 2 ) {
-      dup2( err_fd, 2 );
-      close( err_fd );
-    }
-
-    execvp( listener_info->switch_manager, argv );
-    error( "Failed to execvp: %s(%s) %s %s. %s.",
-      argv[ 0 ], listener_info->switch_manager,
-      argv[ 1 ], argv[ 2 ], strerror( errno ) );
-
-    xfree( service_name );
-    xfree( command_name );
-    xfree( socket_opt );
-    xfree( daemonize_opt );
-    xfree( argv );
+    snprintf( name, sizeof( name ), "%s:%u", inet_ntoa( addr.sin_addr ), ntohs( addr.sin_port ) );
+    exec_switch( listener_info, name, SWITCH_MANAGER_SOCKET_OPTION, accept_fd );
 
     UNREACHABLE();
   }
@@ -277,6 +283,30 @@ secure_channel_accept( struct listener_info *listener_info ) {
 }
 
 
+/*
+ * Starts a switch daemon which accepts connections on the listening
+ * socket and serves all switches by itself, instead of a daemon per
+ * switch. Returns the pid of the process which daemonizes it, or -1.
+ */
+pid_t
+secure_channel_start_switch_daemon( struct listener_info *listener_info ) {
+  pid_t pid;
+
+  pid = fork();
+  if ( pid < 0 ) {
+    error( "Failed to fork. %s.", strerror( errno ) );
+    return -1;
+  }
+  if ( pid == 0 ) {
+    exec_switch( listener_info, SWITCH_MANAGER_DAEMON_NAME, SWITCH_MANAGER_LISTEN_OPTION, listener_info->listen_fd );
+
+    UNREACHABLE();
+  }
+
+  return pid;
+}
+
+
 /*
  * Local variables:
  * c-basic-offset: 2
@@ -29,6 +29,7 @@
 
 bool secure_channel_listen_start( struct listener_info *listener_info );
 void secure_channel_accept( struct listener_info *listener_info );
+pid_t secure_channel_start_switch_daemon( struct listener_info *listener_info );
 
 
 #endif // SECURE_CANNEL_LISTENER_H
@@ -22,71 +22,62 @@
 #include <errno.h>
 #include <openflow.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include "trema.h"
-#include "message_queue.h"
 #include "ofpmsg_recv.h"
 #include "ofpmsg_send.h"
 #include "secure_channel_receiver.h"
 
 
-int
-recv_from_secure_channel( struct switch_info *sw_info ) {
-  assert( sw_info != NULL );
-  assert( sw_info->recv_queue != NULL );
+#define RECV_BUFFER_SIZE 262144
+#define RECV_BUFFER_HEADROOM sizeof( openflow_service_header_t )
+#define RECV_BUDGET 1048576
 
-  // all queued messages should be processed before receiving new messages from remote
-  if ( sw_info->recv_queue->length > 0 ) {
-    return 0;
-  }
 
-  if ( sw_info->fragment_buf == NULL ) {
-    sw_info->fragment_buf = alloc_buffer_with_length( UINT16_MAX );
+/*
+ * Hands a message out as a slice of the receive buffer. The bytes in front
+ * of it belong to messages already handled, so they are lent to the slice
+ * as headroom for the header prepended by service_send_to_application().
+ */
+static int
+handle_message( struct switch_info *sw_info, size_t message_length ) {
+  char *message = sw_info->recv_buf + sw_info->recv_head;
+  buffer *slice = wrap_buffer_with_headroom( message, sw_info->recv_head, message_length );
+  sw_info->recv_head += message_length;
+
+  int ret = ofpmsg_recv( sw_info, slice );
+  if ( ret < 0 ) {
+    error( "Failed to handle message to application." );
   }
 
-  size_t remaining_length = UINT16_MAX - sw_info->fragment_buf->length;
-  char *recv_buf = ( char * ) sw_info->fragment_buf->data + sw_info->fragment_buf->length;
-  ssize_t recv_length = read( sw_info->secure_channel_fd, recv_buf, remaining_length );
-  if ( recv_length < 0 ) {
-    if ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ) {
-      return 0;
-    }
-    error( "Receive error:%s(%d)", strerror( errno ), errno );
-    return -1;
-  }
-  if ( recv_length == 0 ) {
-    debug( "Connection closed by peer." );
-    return -1;
-  }
-  sw_info->fragment_buf->length += ( size_t ) recv_length;
+  return ret;
+}
 
-  size_t read_total = 0;
-  while ( sw_info->fragment_buf->length >= sizeof( struct ofp_header ) ) {
-    struct ofp_header *header = sw_info->fragment_buf->data;
+
+/*
+ * Handles all complete messages in the receive buffer in place.
+ */
+static int
+handle_received_messages( struct switch_info *sw_info ) {
+  while ( sw_info->recv_tail - sw_info->recv_head >= sizeof( struct ofp_header ) ) {
+    struct ofp_header *header = ( struct ofp_header * ) ( sw_info->recv_buf + sw_info->recv_head );
     if ( header->version != OFP_VERSION ) {
       error( "Receive error: invalid version (version %d)", header->version );
-      ofpmsg_send_error_msg( sw_info,
-                             OFPET_BAD_REQUEST, OFPBRC_BAD_VERSION, sw_info->fragment_buf );
+      buffer *data = wrap_buffer( header, sw_info->recv_tail - sw_info->recv_head );
+      ofpmsg_send_error_msg( sw_info, OFPET_BAD_REQUEST, OFPBRC_BAD_VERSION, data );
+      free_buffer( data );
       return -1;
     }
     uint16_t message_length = ntohs( header->length );
-    if ( message_length > sw_info->fragment_buf->length ) {
+    if ( message_length < sizeof( struct ofp_header ) ) {
+      error( "Receive error: too short message (length %u)", message_length );
+      return -1;
+    }
+    if ( message_length > sw_info->recv_tail - sw_info->recv_head ) {
       break;
     }
-    buffer *message = alloc_buffer_with_length( message_length );
-    char *p = append_back_buffer( message, message_length );
-    memcpy( p, sw_info->fragment_buf->data, message_length );
-    remove_front_buffer( sw_info->fragment_buf, message_length ); 
-    enqueue_message( sw_info->recv_queue, message );
-    read_total += message_length;
-  }
-
-  // remove headroom manually for next call
-  if ( read_total > 0 ) {
-    memmove( ( char * ) sw_info->fragment_buf->data - read_total,
-             sw_info->fragment_buf->data,
-             sw_info->fragment_buf->length );
-    sw_info->fragment_buf->data = ( char * ) sw_info->fragment_buf->data - read_total;
+    handle_message( sw_info, message_length );
   }
 
   return 0;
@@ -94,25 +85,54 @@ recv_from_secure_channel( struct switch_info *sw_info ) {
 
 
 int
-handle_messages_from_secure_channel( struct switch_info *sw_info ) {
+recv_from_secure_channel( struct switch_info *sw_info ) {
   assert( sw_info != NULL );
-  assert( sw_info->recv_queue != NULL );
-
-  int ret;
-  int errors = 0;
-  int received = 0;
-  buffer *message;
-
-  while ( ( message = dequeue_message( sw_info->recv_queue ) ) != NULL && received < 64 ) { // FIXME: magic number
-    ret = ofpmsg_recv( sw_info, message );
-    if ( ret < 0 ) {
-      error( "Failed to handle message to application." );
-      errors++;
+
+  if ( sw_info->recv_buf == NULL ) {
+    sw_info->recv_buf = xmalloc( RECV_BUFFER_SIZE );
+    sw_info->recv_head = RECV_BUFFER_HEADROOM;
+    sw_info->recv_tail = RECV_BUFFER_HEADROOM;
+  }
+
+  // Keep reading until the socket is drained, so that a burst is not
+  // left behind in the kernel while the messages are handled.
+  size_t received_total = 0;
+  while ( received_total < RECV_BUDGET ) {
+    // Move a partial message to the top only if the room for the rest of
+    // the largest possible message runs out.
+    if ( sw_info->recv_head == sw_info->recv_tail ) {
+      sw_info->recv_head = RECV_BUFFER_HEADROOM;
+      sw_info->recv_tail = RECV_BUFFER_HEADROOM;
+    }
+    else if ( RECV_BUFFER_SIZE - sw_info->recv_head < UINT16_MAX ) {
+      size_t remaining = sw_info->recv_tail - sw_info->recv_head;
+      memmove( sw_info->recv_buf + RECV_BUFFER_HEADROOM, sw_info->recv_buf + sw_info->recv_head, remaining );
+      sw_info->recv_head = RECV_BUFFER_HEADROOM;
+      sw_info->recv_tail = RECV_BUFFER_HEADROOM + remaining;
+    }
+
+    ssize_t recv_length = recv( sw_info->secure_channel_fd, sw_info->recv_buf + sw_info->recv_tail,
+                                RECV_BUFFER_SIZE - sw_info->recv_tail, MSG_DONTWAIT );
+    if ( recv_length < 0 ) {
+      if ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ) {
+        return 0;
+      }
+      error( "Receive error:%s(%d)", strerror( errno ), errno );
+      return -1;
+    }
+    if ( recv_length == 0 ) {
+      debug( "Connection closed by peer." );
+      return -1;
+    }
+    sw_info->recv_tail += ( size_t ) recv_length;
+    received_total += ( size_t ) recv_length;
+
+    if ( handle_received_messages( sw_info ) < 0 ) {
+      return -1;
     }
-    received++;
   }
 
-  return errors == 0 ? 0 : -1;
+  return 0;
 }
 
 
@@ -20,8 +20,13 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <openflow.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "message_queue.h"
 #include "ofpmsg_send.h"
@@ -39,38 +44,91 @@ send_to_secure_channel( struct switch_info *sw_info, buffer *buf ) {
     return -1;
   }
 
-  return ( enqueue_message( sw_info->send_queue, buf ) == true ) ? 0 : -1;
+  if ( !enqueue_message( sw_info->send_queue, buf ) ) {
+    return -1;
+  }
+  set_writable( sw_info->secure_channel_fd, true );
+
+  return 0;
+}
+
+
+static void
+set_cork( struct switch_info *sw_info, bool cork ) {
+  int value = cork ? 1 : 0;
+  if ( setsockopt( sw_info->secure_channel_fd, IPPROTO_TCP, TCP_CORK, &value, sizeof( value ) ) < 0 ) {
+    // Not a TCP socket. Give up corking.
+    debug( "Failed to set TCP_CORK ( fd = %d, errno = %s [%d] ).",
+           sw_info->secure_channel_fd, strerror( errno ), errno );
+    sw_info->cork = false;
+  }
 }
 
 
+/*
+ * Writes queued messages with writev(), up to IOV_MAX buffers at a time.
+ * If corking is enabled, a backlog longer than a single writev() is sent
+ * in full-sized segments and the remainder is pushed out once drained.
+ */
 int
 flush_secure_channel( struct switch_info *sw_info ) {
   assert( sw_info != NULL );
   assert( sw_info->send_queue != NULL );
   assert( sw_info->secure_channel_fd >= 0 );
 
-  buffer *buf;
-  ssize_t write_length;
+  struct iovec iov[ IOV_MAX ];
+  bool corked = false;
+  int ret = 0;
 
-  while ( ( buf = peek_message( sw_info->send_queue ) ) != NULL ) {
-    write_length = write( sw_info->secure_channel_fd, buf->data, buf->length );
+  while ( sw_info->send_queue->head != NULL ) {
+    list_element *element = sw_info->send_queue->head;
+    size_t total_length = 0;
+    int iovcnt = 0;
+    for ( ; element != NULL && iovcnt < IOV_MAX; element = element->next ) {
+      buffer *buf = element->data;
+      iov[ iovcnt ].iov_base = buf->data;
+      iov[ iovcnt ].iov_len = buf->length;
+      total_length += buf->length;
+      iovcnt++;
+    }
+    if ( element != NULL && sw_info->cork && !corked ) {
+      set_cork( sw_info, true );
+      corked = sw_info->cork;
+    }
+
+    ssize_t write_length = writev( sw_info->secure_channel_fd, iov, iovcnt );
+    sw_info->send_syscalls++;
     if ( write_length < 0 ) {
-      if ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ) {
-        return 0;
+      if ( errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK ) {
+        error( "Failed to send a message to secure channel ( errno = %s [%d] ).",
+               strerror( errno ), errno );
+        ret = -1;
       }
-      error( "Failed to send a message to secure channel ( errno = %s [%d] ).",
-             strerror( errno ), errno );
-      return -1;
+      break;
     }
-    if ( ( size_t ) write_length < buf->length ) {
-      remove_front_buffer( buf, ( size_t ) write_length );
-      return 0;
+    sw_info->send_bytes += ( uint64_t ) write_length;
+
+    size_t remaining = ( size_t ) write_length;
+    while ( remaining > 0 ) {
+      buffer *buf = peek_message( sw_info->send_queue );
+      if ( remaining < buf->length ) {
+        remove_front_buffer( buf, remaining );
+        break;
+      }
+      remaining -= buf->length;
+      free_buffer( dequeue_message( sw_info->send_queue ) );
+    }
+    if ( ( size_t ) write_length < total_length ) {
+      // The socket buffer is full.
+      break;
     }
-    buf = dequeue_message( sw_info->send_queue );
-    free_buffer( buf );
   }
 
-  return 0;
+  if ( corked ) {
+    set_cork( sw_info, false );
+  }
+
+  return ret;
 }
 
 
@@ -25,31 +25,46 @@
 #include "trema.h"
 
 
-static buffer *
-create_openflow_application_message( uint64_t *datapath_id, buffer *data ) {
-  openflow_service_header_t *message;
-  buffer *buf;
-  void *append;
-  size_t append_len = 0;
-
-  if ( data != NULL ) {
-     append_len = data->length;
-  }
-  buf = alloc_buffer_with_length( sizeof( openflow_service_header_t ) + append_len );
-  message = append_back_buffer( buf, sizeof( openflow_service_header_t ) );
-  if (datapath_id == NULL) {
+static void
+set_openflow_service_header( openflow_service_header_t *message, uint64_t *datapath_id ) {
+  if ( datapath_id == NULL ) {
     message->datapath_id = ~0U; // FIXME: defined invalid datapath_id
   } else {
     message->datapath_id = htonll( *datapath_id );
   }
   message->service_name_length = htons( 0 );
   // TODO: append ipaddress and port
-  if ( append_len > 0 ) {
-    append = append_back_buffer( buf, append_len );
-    memcpy( append, data->data, append_len );
+}
+
+
+/*
+ * Prepends an openflow service header to `data' in place. Messages from
+ * switches are received with headroom for the header ( see
+ * secure_channel_receiver.c ), so that the payload is never copied here.
+ * The header has to be removed with remove_openflow_application_header().
+ */
+static buffer *
+prepend_openflow_application_header( uint64_t *datapath_id, buffer *data ) {
+  if ( data == NULL ) {
+    buffer *buf = alloc_buffer_with_length( sizeof( openflow_service_header_t ) );
+    set_openflow_service_header( append_back_buffer( buf, sizeof( openflow_service_header_t ) ), datapath_id );
+    return buf;
+  }
+
+  set_openflow_service_header( append_front_buffer( data, sizeof( openflow_service_header_t ) ), datapath_id );
+
+  return data;
+}
+
+
+static void
+remove_openflow_application_header( buffer *buf, buffer *data ) {
+  if ( data == NULL ) {
+    free_buffer( buf );
+    return;
   }
 
-  return buf;
+  remove_front_buffer( data, sizeof( openflow_service_header_t ) );
 }
 
 
@@ -61,11 +76,11 @@ service_send_to_reply( char *service_name, uint16_t message_type, uint64_t *data
     return;
   }
 
-  buf = create_openflow_application_message( datapath_id, data );
+  buf = prepend_openflow_application_header( datapath_id, data );
   if ( !send_message( service_name, message_type, buf->data, buf->length ) ) {
     error( "Failed to send message." );
   }
-  free_buffer( buf );
+  remove_openflow_application_header( buf, data );
 }
 
 
@@ -79,7 +94,7 @@ service_send_to_application( list_element *service_name_list, uint16_t message_t
     return;
   }
 
-  buf = create_openflow_application_message( datapath_id, data );
+  buf = prepend_openflow_application_header( datapath_id, data );
 
   for ( list = service_name_list; list != NULL; list = list->next ) {
     service_name = list->data;
@@ -88,7 +103,7 @@ service_send_to_application( list_element *service_name_list, uint16_t message_t
       error( "Failed to send message." );
     }
   }
-  free_buffer( buf );
+  remove_openflow_application_header( buf, data );
 }
 
 
@@ -18,6 +18,8 @@
  */
 
 
+#include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
@@ -27,6 +29,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include "trema.h"
 #include "cookie_table.h"
@@ -44,13 +47,21 @@
 
 static struct option long_options[] = {
   { "socket", 1, NULL, 's' },
+  { "listen", 1, NULL, 'L' },
+  { "cork", 0, NULL, 'c' },
+  { "keep-flows", 0, NULL, 'k' },
   { NULL, 0, NULL, 0  },
 };
 
-static char short_options[] = "s:";
+static char short_options[] = "s:L:ck";
 
 struct switch_info switch_info;
 
+// Listening socket of the secure channel. If given, all switches are
+// served in this process and `switch_info' only holds the common settings.
+static int listen_fd = -1;
+static hash_table *switches = NULL; // switch_info of ready switches keyed by datapath_id
+
 static const time_t COOKIE_TABLE_AGING_INTERVAL = 3600;
 
 static bool age_cookie_table_enabled = false;
@@ -63,6 +74,9 @@ usage() {
          "Usage: %s [OPTION]... [DESTINATION-RULE]...\n"
          "\n"
          "  -s, --socket=fd             secure channnel socket\n"
+         "  -L, --listen=fd             accept secure channels and serve all switches\n"
+         "  -c, --cork                  cork secure channel while flushing a backlog\n"
+         "  -k, --keep-flows            do not delete flow entries on connection\n"
          "  -n, --name=SERVICE_NAME     service name\n"
          "  -l, --logging_level=LEVEL   set logging level\n"
          "  -h, --help                  display this help and exit\n"
@@ -107,6 +121,18 @@ option_parser( int argc, char *argv[] ) {
         switch_info.secure_channel_fd = strtofd( optarg );
         break;
 
+      case 'L':
+        listen_fd = strtofd( optarg );
+        break;
+
+      case 'c':
+        switch_info.cork = true;
+        break;
+
+      case 'k':
+        switch_info.keep_flows = true;
+        break;
+
       default:
         usage();
         exit( EXIT_SUCCESS );
@@ -136,91 +162,100 @@ service_send_state( struct switch_info *sw_info, uint64_t *dpid, uint16_t tag )
 }
 
 
-static void
-secure_channel_fd_set( fd_set *read_set, fd_set *write_set ) {
-  if ( switch_info.secure_channel_fd < 0 ) {
-    return;
+static bool
+serving_all_switches( void ) {
+  return listen_fd >= 0;
+}
+
+
+static struct switch_info *
+lookup_switch( uint64_t datapath_id ) {
+  if ( !serving_all_switches() ) {
+    return ( datapath_id == switch_info.datapath_id ) ? &switch_info : NULL;
   }
-  FD_SET( switch_info.secure_channel_fd, read_set );
-  if ( switch_info.send_queue != NULL && switch_info.send_queue->length > 0 ) {
-    FD_SET( switch_info.secure_channel_fd, write_set );
+
+  return lookup_hash_entry( switches, &datapath_id );
+}
+
+
+static void
+secure_channel_read( int fd, void *data ) {
+  struct switch_info *sw_info = data;
+
+  UNUSED( fd );
+
+  if ( recv_from_secure_channel( sw_info ) < 0 ) {
+    switch_event_disconnected( sw_info );
   }
 }
 
 
 static void
-secure_channel_fd_isset( fd_set *read_set, fd_set *write_set ) {
-  if ( switch_info.secure_channel_fd < 0 ) {
+secure_channel_write( int fd, void *data ) {
+  struct switch_info *sw_info = data;
+
+  if ( flush_secure_channel( sw_info ) < 0 ) {
+    switch_event_disconnected( sw_info );
     return;
   }
-  if ( FD_ISSET( switch_info.secure_channel_fd, read_set ) ) {
-    if ( recv_from_secure_channel( &switch_info ) < 0 ) {
-      switch_event_disconnected( &switch_info );
-      return;
-    }
-  }
-  if ( FD_ISSET( switch_info.secure_channel_fd, write_set ) ) {
-    if ( flush_secure_channel( &switch_info ) < 0 ) {
-      switch_event_disconnected( &switch_info );
-      return;
-    }
-  }
-
-  if ( switch_info.recv_queue->length > 0 ) {
-    handle_messages_from_secure_channel( &switch_info );
+  if ( sw_info->send_queue->length == 0 ) {
+    set_writable( fd, false );
   }
 }
 
 
 static void
-switch_set_timeout( long sec, void ( *callback )( void *user_data ), void *user_data ) {
+switch_set_timeout( struct switch_info *sw_info, long sec, void ( *callback )( void *user_data ) ) {
   struct itimerspec interval;
 
-  UNUSED( user_data );
-
   interval.it_value.tv_sec = sec;
   interval.it_value.tv_nsec = 0;
   interval.it_interval.tv_sec = 0;
   interval.it_interval.tv_nsec = 0;
-  add_timer_event_callback( &interval, callback, NULL );
+  sw_info->state_timer = add_timer_event( &interval, callback, sw_info );
 }
 
 
 static void
-switch_unset_timeout( void ( *callback )( void *user_data ) ) {
-  delete_timer_event_callback( callback );
+switch_unset_timeout( struct switch_info *sw_info ) {
+  if ( sw_info->state_timer != NULL ) {
+    delete_timer_event( sw_info->state_timer );
+    sw_info->state_timer = NULL;
+  }
 }
 
 
 static void
 switch_event_timeout_hello( void *user_data ) {
-  UNUSED( user_data );
+  struct switch_info *sw_info = user_data;
+
+  // The one-shot timer is released once this returns.
+  sw_info->state_timer = NULL;
 
-  if ( switch_info.state != SWITCH_STATE_WAIT_HELLO ) {
+  if ( sw_info->state != SWITCH_STATE_WAIT_HELLO ) {
     return;
   }
-  // delete to hello_wait-timeout timer
-  switch_unset_timeout( switch_event_timeout_hello );
 
   error( "Hello timeout. state:%d, dpid:%#" PRIx64 ", fd:%d.",
-         switch_info.state, switch_info.datapath_id, switch_info.secure_channel_fd );
-  switch_event_disconnected( &switch_info );
+         sw_info->state, sw_info->datapath_id, sw_info->secure_channel_fd );
+  switch_event_disconnected( sw_info );
 }
 
 
 static void
 switch_event_timeout_features_reply( void *user_data ) {
-  UNUSED( user_data );
+  struct switch_info *sw_info = user_data;
 
-  if ( switch_info.state != SWITCH_STATE_WAIT_FEATURES_REPLY ) {
+  // The one-shot timer is released once this returns.
+  sw_info->state_timer = NULL;
+
+  if ( sw_info->state != SWITCH_STATE_WAIT_FEATURES_REPLY ) {
     return;
   }
-  // delete to features_reply_wait-timeout timer
-  switch_unset_timeout( switch_event_timeout_features_reply );
 
   error( "Features Reply timeout. state:%d, dpid:%#" PRIx64 ", fd:%d.",
-         switch_info.state, switch_info.datapath_id, switch_info.secure_channel_fd );
-  switch_event_disconnected( &switch_info );
+         sw_info->state, sw_info->datapath_id, sw_info->secure_channel_fd );
+  switch_event_disconnected( sw_info );
 }
 
 
@@ -237,7 +272,7 @@ switch_event_connected( struct switch_info *sw_info ) {
   }
   sw_info->state = SWITCH_STATE_WAIT_HELLO;
 
-  switch_set_timeout( SWITCH_STATE_TIMEOUT_HELLO, switch_event_timeout_hello, NULL );
+  switch_set_timeout( sw_info, SWITCH_STATE_TIMEOUT_HELLO, switch_event_timeout_hello );
 
   return 0;
 }
@@ -249,7 +284,7 @@ switch_event_recv_hello( struct switch_info *sw_info ) {
 
   if ( sw_info->state == SWITCH_STATE_WAIT_HELLO ) {
     // cancel to hello_wait-timeout timer
-    switch_unset_timeout( switch_event_timeout_hello );
+    switch_unset_timeout( sw_info );
 
     ret = ofpmsg_send_featuresrequest( sw_info );
     if ( ret < 0 ) {
@@ -257,14 +292,60 @@ switch_event_recv_hello( struct switch_info *sw_info ) {
     }
     sw_info->state = SWITCH_STATE_WAIT_FEATURES_REPLY;
 
-    switch_set_timeout( SWITCH_STATE_TIMEOUT_FEATURES_REPLY,
-                        switch_event_timeout_features_reply, NULL );
+    switch_set_timeout( sw_info, SWITCH_STATE_TIMEOUT_FEATURES_REPLY,
+                        switch_event_timeout_features_reply );
   }
 
   return 0;
 }
 
 
+// Makes the switch reachable by applications through its own service name.
+static void
+register_switch( struct switch_info *sw_info, char *service_name ) {
+  sw_info->dpid_service_name = service_name;
+
+  if ( !serving_all_switches() ) {
+    // rename service_name of messenger
+    rename_message_received_callback( get_trema_name(), service_name );
+    debug( "Rename service name to %s from %s.", service_name, get_trema_name() );
+
+    if ( messenger_dump_enabled() ) {
+      stop_messenger_dump();
+      start_messenger_dump( service_name, DEFAULT_DUMP_SERVICE_NAME );
+    }
+    return;
+  }
+
+  struct switch_info *old = lookup_hash_entry( switches, &sw_info->datapath_id );
+  if ( old != NULL ) {
+    notice( "Switch ( dpid = %#" PRIx64 ", fd = %d ) reconnected. Closing the previous connection ( fd = %d ).",
+            sw_info->datapath_id, sw_info->secure_channel_fd, old->secure_channel_fd );
+    switch_event_disconnected( old );
+  }
+  insert_hash_entry( switches, &sw_info->datapath_id, sw_info );
+  add_message_received_callback( service_name, service_recv );
+  debug( "Add service name %s.", service_name );
+}
+
+
+static void
+unregister_switch( struct switch_info *sw_info ) {
+  if ( sw_info->dpid_service_name == NULL ) {
+    return;
+  }
+
+  if ( serving_all_switches() ) {
+    if ( lookup_hash_entry( switches, &sw_info->datapath_id ) == sw_info ) {
+      delete_hash_entry( switches, &sw_info->datapath_id );
+    }
+    delete_message_received_callback( sw_info->dpid_service_name, service_recv );
+  }
+  xfree( sw_info->dpid_service_name );
+  sw_info->dpid_service_name = NULL;
+}
+
+
 int
 switch_event_recv_featuresreply( struct switch_info *sw_info, uint64_t *dpid ) {
   int ret;
@@ -278,7 +359,7 @@ switch_event_recv_featuresreply( struct switch_info *sw_info, uint64_t *dpid ) {
     sw_info->state = SWITCH_STATE_COMPLETED;
 
     // cancel to features_reply_wait-timeout timer
-    switch_unset_timeout( switch_event_timeout_features_reply );
+    switch_unset_timeout( sw_info );
 
     // TODO: change process name
     // TODO: set keepalive-timeout
@@ -287,14 +368,7 @@ switch_event_recv_featuresreply( struct switch_info *sw_info, uint64_t *dpid ) {
     new_service_name = xmalloc( new_service_name_len );
     snprintf( new_service_name, new_service_name_len, "%s%" PRIx64, SWITCH_MANAGER_PREFIX, sw_info->datapath_id );
 
-    // rename service_name of messenger
-    rename_message_received_callback( get_trema_name(), new_service_name );
-    debug( "Rename service name to %s from %s.", new_service_name, get_trema_name() );
-
-    if ( messenger_dump_enabled() ) {
-      stop_messenger_dump();
-      start_messenger_dump( new_service_name, DEFAULT_DUMP_SERVICE_NAME );
-    }
+    register_switch( sw_info, new_service_name );
 
     // notify state and datapath_id
     service_send_state( sw_info, &sw_info->datapath_id, MESSENGER_OPENFLOW_READY );
@@ -304,9 +378,13 @@ switch_event_recv_featuresreply( struct switch_info *sw_info, uint64_t *dpid ) {
     if ( ret < 0 ) {
       return ret;
     }
-    ret = ofpmsg_send_delete_all_flows( sw_info );
-    if ( ret < 0 ) {
-      return ret;
+    // Applications with a shadow flow table reconcile it with the
+    // flow entries left on the switch.
+    if ( !sw_info->keep_flows ) {
+      ret = ofpmsg_send_delete_all_flows( sw_info );
+      if ( ret < 0 ) {
+        return ret;
+      }
     }
     break;
 
@@ -329,9 +407,14 @@ int
 switch_event_disconnected( struct switch_info *sw_info ) {
   sw_info->state = SWITCH_STATE_DISCONNECTED;
 
-  if ( sw_info->fragment_buf != NULL ) {
-    free_buffer( sw_info->fragment_buf );
-    sw_info->fragment_buf = NULL;
+  info( "Secure channel statistics ( datapath_id = %#" PRIx64 ", send_bytes = %" PRIu64 ", send_syscalls = %" PRIu64 " ).",
+        sw_info->datapath_id, sw_info->send_bytes, sw_info->send_syscalls );
+
+  switch_unset_timeout( sw_info );
+
+  if ( sw_info->recv_buf != NULL ) {
+    xfree( sw_info->recv_buf );
+    sw_info->recv_buf = NULL;
   }
 
   if ( sw_info->send_queue != NULL ) {
@@ -339,18 +422,28 @@ switch_event_disconnected( struct switch_info *sw_info ) {
     sw_info->send_queue = NULL;
   }
 
-  if ( sw_info->recv_queue != NULL ) {
-    delete_message_queue( sw_info->recv_queue );
-    sw_info->recv_queue = NULL;
-  }
-
   if ( sw_info->secure_channel_fd >= 0 ) {
+    delete_fd_handler( sw_info->secure_channel_fd );
     close( sw_info->secure_channel_fd );
     sw_info->secure_channel_fd = -1;
   }
 
   // send secure channle disconnect state to application
   service_send_state( sw_info, &sw_info->datapath_id, MESSENGER_OPENFLOW_DISCONNECTED );
+
+  if ( serving_all_switches() ) {
+    debug( "send disconnected state" );
+    if ( sw_info->dpid_service_name != NULL ) {
+      // The tables are shared by all switches and outlive this one.
+      delete_xid_entries_by_datapath_id( sw_info->datapath_id );
+      delete_cookie_entries_by_datapath_id( sw_info->datapath_id );
+    }
+    unregister_switch( sw_info );
+    xfree( sw_info );
+
+    return 0;
+  }
+
   flush_messenger();
   debug( "send disconnected state" );
 
@@ -362,15 +455,16 @@ switch_event_disconnected( struct switch_info *sw_info ) {
 
 int
 switch_event_recv_openflow_message_from_application( uint64_t *datapath_id, char *application_service_name, buffer *buf ) {
+  struct switch_info *sw_info = lookup_switch( *datapath_id );
 
-  if ( *datapath_id != switch_info.datapath_id ) {
-    error( "Invalid datapath id %#" PRIx64 ".", datapath_id );
+  if ( sw_info == NULL ) {
+    error( "Invalid datapath id %#" PRIx64 ".", *datapath_id );
     free_buffer( buf );
 
     return -1;
   }
 
-  return ofpmsg_send( &switch_info, buf, application_service_name );
+  return ofpmsg_send( sw_info, buf, application_service_name );
 }
 
 
@@ -415,6 +509,55 @@ management_recv( uint16_t tag, void *data, size_t data_len ) {
 }
 
 
+static void
+start_secure_channel( struct switch_info *sw_info ) {
+  fcntl( sw_info->secure_channel_fd, F_SETFL, O_NONBLOCK );
+  // default switch configuration
+  sw_info->config_flags = OFPC_FRAG_NORMAL;
+  sw_info->miss_send_len = UINT16_MAX;
+
+  sw_info->recv_buf = NULL;
+  sw_info->send_queue = create_message_queue();
+
+  set_fd_handler( sw_info->secure_channel_fd, secure_channel_read, sw_info, secure_channel_write, sw_info );
+  set_readable( sw_info->secure_channel_fd, true );
+}
+
+
+/*
+ * Starts serving a new switch with the state of its own. Options and
+ * destination rules are shared with `switch_info', as well as the xid
+ * and cookie tables and the connections to applications.
+ */
+static void
+accept_secure_channel( int fd, void *data ) {
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof( struct sockaddr_in );
+
+  UNUSED( data );
+
+  int accept_fd = accept( fd, ( struct sockaddr * ) &addr, &addr_len );
+  if ( accept_fd < 0 ) {
+    if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+      error( "Failed to accept from switch ( errno = %s [%d] ).", strerror( errno ), errno );
+    }
+    return;
+  }
+  debug( "Accepted a secure channel from %s:%u ( fd = %d ).",
+         inet_ntoa( addr.sin_addr ), ntohs( addr.sin_port ), accept_fd );
+
+  struct switch_info *sw_info = xmalloc( sizeof( struct switch_info ) );
+  memcpy( sw_info, &switch_info, sizeof( struct switch_info ) );
+  sw_info->secure_channel_fd = accept_fd;
+  start_secure_channel( sw_info );
+
+  if ( switch_event_connected( sw_info ) < 0 ) {
+    error( "Failed to set connected state ( fd = %d ).", accept_fd );
+    switch_event_disconnected( sw_info );
+  }
+}
+
+
 int
 main( int argc, char *argv[] ) {
   int ret;
@@ -454,35 +597,39 @@ main( int argc, char *argv[] ) {
     }
   }
 
-  fcntl( switch_info.secure_channel_fd, F_SETFL, O_NONBLOCK );
-  // default switch configuration
-  switch_info.config_flags = OFPC_FRAG_NORMAL;
-  switch_info.miss_send_len = UINT16_MAX;
-
-  switch_info.fragment_buf = NULL;
-  switch_info.send_queue = create_message_queue();
-  switch_info.recv_queue = create_message_queue();
-
   init_xid_table();
   init_cookie_table();
 
-  set_fd_set_callback( secure_channel_fd_set );
-  set_check_fd_isset_callback( secure_channel_fd_isset );
-  add_message_received_callback( get_trema_name(), service_recv );
+  if ( serving_all_switches() ) {
+    switches = create_hash( compare_datapath_id, hash_datapath_id );
+    fcntl( listen_fd, F_SETFL, O_NONBLOCK );
+    set_fd_handler( listen_fd, accept_secure_channel, NULL, NULL, NULL );
+    set_readable( listen_fd, true );
+  }
+  else {
+    start_secure_channel( &switch_info );
+    add_message_received_callback( get_trema_name(), service_recv );
+  }
 
   snprintf( management_service_name , MESSENGER_SERVICE_NAME_LENGTH,
             "%s.m", get_trema_name() );
   management_service_name[ MESSENGER_SERVICE_NAME_LENGTH - 1 ] = '\0';
   add_message_received_callback( management_service_name, management_recv );
 
-  ret = switch_event_connected( &switch_info );
-  if ( ret < 0 ) {
-    error( "Failed to set connected state." );
-    return -1;
+  if ( !serving_all_switches() ) {
+    ret = switch_event_connected( &switch_info );
+    if ( ret < 0 ) {
+      error( "Failed to set connected state." );
+      return -1;
+    }
   }
 
   start_trema();
 
+  if ( switches != NULL ) {
+    delete_hash( switches );
+    switches = NULL;
+  }
   finalize_xid_table();
   finalize_cookie_table();
 
@@ -27,6 +27,7 @@
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/prctl.h>
 #include <sys/wait.h>
 #include <openflow.h>
 #include "trema.h"
@@ -90,17 +91,17 @@ char *mock_get_current_dir_name( void );
 #define init_trema mock_init_trema
 void mock_init_trema( int *argc, char ***argv );
 
-#ifdef set_fd_set_callback
-#undef set_fd_set_callback
+#ifdef set_fd_handler
+#undef set_fd_handler
 #endif
-#define set_fd_set_callback mock_set_fd_set_callback
-void mock_set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) );
+#define set_fd_handler mock_set_fd_handler
+bool mock_set_fd_handler( int fd, event_fd_callback read_callback, void *read_data, event_fd_callback write_callback, void *write_data );
 
-#ifdef set_check_fd_isset_callback
-#undef set_check_fd_isset_callback
+#ifdef set_readable
+#undef set_readable
 #endif
-#define set_check_fd_isset_callback mock_set_check_fd_isset_callback
-void mock_set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) );
+#define set_readable mock_set_readable
+bool mock_set_readable( int fd, bool state );
 
 #ifdef secure_channel_accept
 #undef secure_channel_accept
@@ -143,14 +144,18 @@ void mock_set_external_callback( void ( *callback ) ( void ) );
 
 struct listener_info listener_info;
 
+static const time_t SWITCH_DAEMON_RESTART_INTERVAL = 1;
+static pid_t switch_daemon_starter = -1; // the process which daemonizes the multiplexed switch daemon
+
 
 static struct option long_options[] = {
   { "port", 1, NULL, 'p' },
   { "switch", 1, NULL, 's' },
+  { "multiplex", 0, NULL, 'm' },
   { NULL, 0, NULL, 0  },
 };
 
-static char short_options[] = "p:s:";
+static char short_options[] = "p:s:m";
 
 
 void
@@ -160,6 +165,7 @@ usage() {
 	 "Usage: %s [OPTION]... [-- SWITCH_MANAGER_OPTION]...\n"
 	 "\n"
 	 "  -s, --switch=PATH           the command path of switch\n"
+	 "  -m, --multiplex             serve all switches by a single switch daemon\n"
 	 "  -n, --name=SERVICE_NAME     service name\n"
          "  -p, --port=PORT             server listen port (default %u)\n"
 	 "  -d, --daemonize             run in the background\n"
@@ -170,6 +176,26 @@ usage() {
 }
 
 
+static void restart_switch_daemon_later( void );
+
+
+/*
+ * The process started by secure_channel_start_switch_daemon() exits
+ * successfully once the switch daemon is daemonized. Any other child
+ * reaped in multiplex mode is the switch daemon itself, since
+ * switch_manager is its subreaper.
+ */
+static bool
+switch_daemon_exited( pid_t pid, int status ) {
+  if ( pid != switch_daemon_starter ) {
+    return true;
+  }
+  switch_daemon_starter = -1;
+
+  return !WIFEXITED( status ) || WEXITSTATUS( status ) != EXIT_SUCCESS;
+}
+
+
 static void
 wait_child( void ) {
   int status;
@@ -191,40 +217,61 @@ wait_child( void ) {
         debug( "Child process is terminated. pid:%d, signal:%d", pid, WTERMSIG( status ) );
       }
     }
+    if ( listener_info.multiplex && switch_daemon_exited( pid, status ) ) {
+      notice( "Switch daemon is exited ( pid = %d ). Restarting it.", pid );
+      restart_switch_daemon_later();
+    }
   }
 }
 
 
 static void
-handle_sigchld( int signum ) {
-  UNUSED( signum );
+start_switch_daemon( void ) {
+  // Orphaned descendants, i.e. the daemonized switch daemon, are
+  // reparented to us so that we get SIGCHLD when it exits.
+  prctl( PR_SET_CHILD_SUBREAPER, 1 );
+
+  switch_daemon_starter = secure_channel_start_switch_daemon( &listener_info );
+  if ( switch_daemon_starter < 0 ) {
+    restart_switch_daemon_later();
+  }
+}
 
-  // because wait_child() is not signal safe, we call it later.
-  set_external_callback( wait_child );
+
+static void
+restart_switch_daemon( void *user_data ) {
+  UNUSED( user_data );
+
+  start_switch_daemon();
 }
 
 
 static void
-secure_channel_fd_set( fd_set *read_set, fd_set *write_set ) {
-  UNUSED( write_set );
+restart_switch_daemon_later( void ) {
+  struct itimerspec interval;
+
+  interval.it_value.tv_sec = SWITCH_DAEMON_RESTART_INTERVAL;
+  interval.it_value.tv_nsec = 0;
+  interval.it_interval.tv_sec = 0;
+  interval.it_interval.tv_nsec = 0;
+  add_timer_event_callback( &interval, restart_switch_daemon, NULL );
+}
 
-  if ( listener_info.listen_fd < 0 ) {
-    return;
-  }
-  FD_SET( listener_info.listen_fd, read_set );
+
+static void
+handle_sigchld( int signum ) {
+  UNUSED( signum );
+
+  // because wait_child() is not signal safe, we call it later.
+  set_external_callback( wait_child );
 }
 
 
 static void
-secure_channel_fd_isset( fd_set *read_set, fd_set *write_set ) {
-  UNUSED( write_set );
+secure_channel_read( int fd, void *data ) {
+  UNUSED( fd );
 
-  if ( listener_info.listen_fd < 0 ) {
-    return;
-  }
-  if ( FD_ISSET( listener_info.listen_fd, read_set ) ) {
-    secure_channel_accept( &listener_info );
-  }
+  secure_channel_accept( data );
 }
 
 
@@ -321,6 +368,9 @@ parse_argument( struct listener_info *listener_info, int argc, char *argv[] ) {
         xfree( (void *)( uintptr_t )listener_info->switch_manager );
         listener_info->switch_manager = xstrdup( optarg );
         break;
+      case 'm':
+        listener_info->multiplex = true;
+        break;
       default:
         usage();
         exit( EXIT_SUCCESS );
@@ -437,8 +487,6 @@ main( int argc, char *argv[] ) {
   free( startup_dir );
 
   catch_sigchild();
-  set_fd_set_callback( secure_channel_fd_set );
-  set_check_fd_isset_callback( secure_channel_fd_isset );
 
   // listener start (listen socket binding and listen)
   ret = secure_channel_listen_start( &listener_info );
@@ -447,6 +495,17 @@ main( int argc, char *argv[] ) {
     exit( EXIT_FAILURE );
   }
 
+  if ( listener_info.multiplex ) {
+    // the switch daemon accepts connections by itself. It is started
+    // from the main loop, i.e. after we are daemonized, so that we can
+    // restart it when it exits.
+    set_external_callback( start_switch_daemon );
+  }
+  else {
+    set_fd_handler( listener_info.listen_fd, secure_channel_read, &listener_info, NULL, NULL );
+    set_readable( listener_info.listen_fd, true );
+  }
+
   start_trema();
 
   finalize_listener_info( &listener_info );
@@ -25,12 +25,14 @@
 
 
 #include <sys/types.h>
+#include "bool.h"
 
 
 static const char SWITCH_MANAGER_NAME_OPTION[] = "--name=";
 static const uint SWITCH_MANAGER_NAME_OPTION_STR_LEN = sizeof( SWITCH_MANAGER_NAME_OPTION );
 static const char SWITCH_MANAGER_SOCKET_OPTION[] = "--socket=";
 static const uint SWITCH_MANAGER_SOCKET_OPTION_STR_LEN = sizeof( SWITCH_MANAGER_SOCKET_OPTION );
+static const char SWITCH_MANAGER_LISTEN_OPTION[] = "--listen=";
 static const char SWITCH_MANAGER_DAEMONIZE_OPTION[] = "--daemonize";
 static const uint SWITCH_MANAGER_SOCKET_STR_LEN = sizeof( "2147483647" );
 static const char SWITCH_MANAGER_COMMAND_PREFIX[] = "switch.";
@@ -38,6 +40,7 @@ static const uint SWITCH_MANAGER_COMMAND_PREFIX_STR_LEN = sizeof( SWITCH_MANAGER
 static const char SWITCH_MANAGER_PREFIX[] = "switch.";
 static const uint SWITCH_MANAGER_PREFIX_STR_LEN = sizeof( SWITCH_MANAGER_PREFIX );
 static const uint SWITCH_MANAGER_ADDR_STR_LEN = sizeof( "255.255.255.255:65535" );
+static const char SWITCH_MANAGER_DAEMON_NAME[] = "daemon";
 
 static const char SWITCH_MANAGER_PATH[] = "objects/switch_manager/switch";
 
@@ -48,6 +51,7 @@ struct listener_info {
   char **switch_manager_argv;
   uint16_t listen_port;
   int listen_fd;
+  bool multiplex; // serve all switches by a single switch daemon
 };
 
 
@@ -44,17 +44,24 @@ struct switch_info {
   int secure_channel_fd;        // socket file descriptor of secure channel
 
   int state;                    // state of switch secure channel
+  timer_event_handle state_timer; // timeout of the current state
   uint64_t datapath_id;
 
   uint16_t config_flags;        // OFPC_* flags
   uint16_t miss_send_len;       /* Max bytes of new flow that datapath should
                                    send to the controller. */
 
-  buffer *fragment_buf;         /* openflow message fragmentation buffer of
-                                   secure channel receiver */
+  char *recv_buf;               /* receive buffer of secure channel. openflow
+                                   messages are handled in place */
+  size_t recv_head;             // offset of the first unhandled byte
+  size_t recv_tail;             // offset of the end of received data
 
   message_queue *send_queue;
-  message_queue *recv_queue;
+
+  bool cork;                    // cork the secure channel while flushing a backlog
+  bool keep_flows;              // do not delete flow entries on connection
+  uint64_t send_bytes;          // bytes written to the secure channel
+  uint64_t send_syscalls;       // writev() calls on the secure channel
 };
 
 
@@ -19,6 +19,7 @@
 
 
 #include <assert.h>
+#include <inttypes.h>
 #include <openflow.h>
 #include <string.h>
 #include "trema.h"
@@ -61,13 +62,14 @@ generate_xid( void ) {
 
 
 static xid_entry_t *
-allocate_xid_entry( uint32_t original_xid, char *service_name, int index ) {
+allocate_xid_entry( uint32_t original_xid, char *service_name, uint64_t datapath_id, int index ) {
   xid_entry_t *new_entry;
 
   new_entry = xmalloc( sizeof ( xid_entry_t ) );
   new_entry->xid = generate_xid();
   new_entry->original_xid = original_xid;
   new_entry->service_name = xstrdup( service_name );
+  new_entry->datapath_id = datapath_id;
   new_entry->index = index;
 
   return new_entry;
@@ -116,11 +118,11 @@ finalize_xid_table( void ) {
 
 
 uint32_t
-insert_xid_entry( uint32_t original_xid, char *service_name ) {
+insert_xid_entry( uint32_t original_xid, char *service_name, uint64_t datapath_id ) {
   xid_entry_t *new_entry;
 
-  debug( "Inserting xid entry ( original_xid = %#lx, service_name = %s ).",
-         original_xid, service_name );
+  debug( "Inserting xid entry ( original_xid = %#lx, service_name = %s, datapath_id = %#" PRIx64 " ).",
+         original_xid, service_name, datapath_id );
 
   if ( xid_table.next_index >= XID_MAX_ENTRIES ) {
     xid_table.next_index = 0;
@@ -130,7 +132,7 @@ insert_xid_entry( uint32_t original_xid, char *service_name ) {
     delete_xid_entry( xid_table.entries[ xid_table.next_index ] );
   }
 
-  new_entry = allocate_xid_entry( original_xid, service_name, xid_table.next_index );
+  new_entry = allocate_xid_entry( original_xid, service_name, datapath_id, xid_table.next_index );
   insert_hash_entry( xid_table.hash, &new_entry->xid, new_entry );
   xid_table.entries[ xid_table.next_index ] = new_entry;
   xid_table.next_index++;
@@ -157,6 +159,21 @@ delete_xid_entry( xid_entry_t *delete_entry ) {
 }
 
 
+/*
+ * Forgets the transactions sent to a switch which is disconnected, so
+ * that the switch daemon serving all switches does not keep them until
+ * they are overwritten.
+ */
+void
+delete_xid_entries_by_datapath_id( uint64_t datapath_id ) {
+  for ( int i = 0; i < XID_MAX_ENTRIES; i++ ) {
+    if ( xid_table.entries[ i ] != NULL && xid_table.entries[ i ]->datapath_id == datapath_id ) {
+      delete_xid_entry( xid_table.entries[ i ] );
+    }
+  }
+}
+
+
 xid_entry_t *
 lookup_xid_entry( uint32_t xid ) {
   return lookup_hash_entry( xid_table.hash, &xid );
@@ -165,8 +182,8 @@ lookup_xid_entry( uint32_t xid ) {
 
 static void
 dump_xid_entry( xid_entry_t *entry ) {
-  info( "xid = %#lx, original_xid = %#lx, service_name = %s, index = %d",
-        entry->xid, entry->original_xid, entry->service_name, entry->index );
+  info( "xid = %#lx, original_xid = %#lx, service_name = %s, datapath_id = %#" PRIx64 ", index = %d",
+        entry->xid, entry->original_xid, entry->service_name, entry->datapath_id, entry->index );
 }
 
 
@@ -31,6 +31,7 @@ typedef struct xid_entry {
   uint32_t xid;
   uint32_t original_xid;
   char *service_name;
+  uint64_t datapath_id;
   int index;
 } xid_entry_t;
 
@@ -38,8 +39,9 @@ typedef struct xid_entry {
 uint32_t generate_xid( void );
 void init_xid_table( void );
 void finalize_xid_table( void );
-uint32_t insert_xid_entry( uint32_t original_xid, char *service_name );
+uint32_t insert_xid_entry( uint32_t original_xid, char *service_name, uint64_t datapath_id );
 void delete_xid_entry( xid_entry_t *entry );
+void delete_xid_entries_by_datapath_id( uint64_t datapath_id );
 xid_entry_t *lookup_xid_entry( uint32_t xid );
 void dump_xid_table( void );
 
@@ -20,128 +20,129 @@
  */
 
 
-#include <stdio.h>
 #include <assert.h>
-#include "linked_list.h"
+#include <string.h>
+#include <sys/uio.h>
 #include "pcap_queue.h"
 #include "wrapper.h"
 
 
-#define QUEUE_LIMIT 4096
-
-
-static list_element *packet_queue = NULL;
-static uint16_t amount_of_packet = 0;
+// Pcap records are queued back to back in a ring of bytes, so that any
+// number of them are written at once with a single writev().
+static char *ring = NULL;
+static size_t ring_size = 0;
+static size_t head = 0;   // offset of the first byte to write
+static size_t length = 0; // number of bytes queued
 
 
 void
-create_queue() {
-  assert( packet_queue == NULL );
-  assert( amount_of_packet == 0 );
-
-  create_list( &packet_queue );
-  return;
+create_queue( size_t size ) {
+  assert( ring == NULL );
+  assert( size > 0 );
+
+  ring = xmalloc( size );
+  ring_size = size;
+  head = 0;
+  length = 0;
 }
 
 
 bool
 delete_queue() {
-  buffer *p;
-
-  while ( amount_of_packet > 0 ) {
-    pop_pcap_packet( &p );
-    delete_pcap_packet( p );
+  if ( ring != NULL ) {
+    xfree( ring );
   }
-
-  delete_list( packet_queue );
-  packet_queue = NULL;
-  amount_of_packet = 0;
+  ring = NULL;
+  ring_size = 0;
+  head = 0;
+  length = 0;
 
   return true;
 }
 
 
-buffer*
-create_pcap_packet( void* pcap_header, size_t pcap_len,
-               void* dump_header, size_t dump_len,
-               void* data, size_t data_len ) {
-  size_t length = pcap_len + dump_len + data_len;
-  assert( length != 0 );
-  assert( pcap_header != NULL && dump_header != NULL );
-
-  buffer *buf = alloc_buffer_with_length( length );
-  assert( buf != NULL );
-
-  if ( pcap_header != NULL && pcap_len > 0 ) {
-    void *d = append_back_buffer( buf, pcap_len );
-    assert( d != NULL );
-    memcpy( d, pcap_header, pcap_len );
-  }
-
-  if ( dump_header != NULL && dump_len > 0 ) {
-    void *d = append_back_buffer( buf, dump_len );
-    assert( d != NULL );
-    memcpy( d, dump_header, dump_len );
+static void
+copy_to_ring( size_t offset, const void *data, size_t data_len ) {
+  size_t first = ring_size - offset;
+  if ( first > data_len ) {
+    first = data_len;
   }
-
-  if ( data != NULL && data_len > 0 ) {
-    void *d = append_back_buffer( buf, data_len );
-    assert( d != NULL );
-    memcpy( d, data, data_len );
-  }
-
-  return buf;
-}
-
-
-bool
-delete_pcap_packet( buffer *packet ) {
-  assert( packet != NULL );
-  
-  free_buffer( packet );
-  return true;
+  memcpy( ring + offset, data, first );
+  memcpy( ring, ( const char * ) data + first, data_len - first );
 }
 
 
+/**
+ *  Queues a pcap record made of `iovcnt' pieces. The record is queued
+ *  as a whole or not at all.
+ */
 queue_return
-push_pcap_packet( buffer *packet ) {
-  if ( amount_of_packet >= QUEUE_LIMIT ) {
+push_pcap_packet( const struct iovec *iov, int iovcnt ) {
+  assert( ring != NULL );
+  assert( iov != NULL && iovcnt > 0 );
+
+  size_t packet_len = 0;
+  for ( int i = 0; i < iovcnt; i++ ) {
+    packet_len += iov[ i ].iov_len;
+  }
+  if ( packet_len > ring_size - length ) {
     return QUEUE_FULL;
   }
 
-  append_to_tail( &packet_queue, packet );
-  amount_of_packet++;
+  size_t tail = ( head + length ) % ring_size;
+  for ( int i = 0; i < iovcnt; i++ ) {
+    if ( iov[ i ].iov_len > 0 ) {
+      copy_to_ring( tail, iov[ i ].iov_base, iov[ i ].iov_len );
+      tail = ( tail + iov[ i ].iov_len ) % ring_size;
+    }
+  }
+  length += packet_len;
 
   return QUEUE_SUCCESS;
 }
 
 
-queue_return
-push_pcap_packet_in_front( buffer *packet ) {
-  if ( amount_of_packet >= QUEUE_LIMIT ) {
-    return QUEUE_FULL;
-  }
-
-  insert_in_front( &packet_queue, packet );
-  amount_of_packet++;
-  
-  return QUEUE_SUCCESS;
+size_t
+get_queue_length() {
+  return length;
 }
 
 
-queue_return
-pop_pcap_packet( buffer **packet ) {
-  assert( packet != NULL );
+/**
+ *  Writes queued pcap records to `fd' with a single writev(). Records
+ *  that could not be written ( entirely ) stay in the queue.
+ *  Returns the number of bytes written, or -1 with errno set.
+ */
+ssize_t
+write_pcap_packets( int fd ) {
+  struct iovec iov[ 2 ];
+  int iovcnt = 0;
+
+  if ( length == 0 ) {
+    return 0;
+  }
 
-  if ( packet_queue == NULL ) {
-    return QUEUE_EMPTY;
+  size_t first = ring_size - head;
+  if ( first > length ) {
+    first = length;
+  }
+  iov[ iovcnt ].iov_base = ring + head;
+  iov[ iovcnt++ ].iov_len = first;
+  if ( length > first ) {
+    iov[ iovcnt ].iov_base = ring;
+    iov[ iovcnt++ ].iov_len = length - first;
   }
 
-  *packet = packet_queue->data;
-  delete_element( &packet_queue, *packet );
-  amount_of_packet--;
+  ssize_t ret = writev( fd, iov, iovcnt );
+  if ( ret > 0 ) {
+    head = ( head + ( size_t ) ret ) % ring_size;
+    length -= ( size_t ) ret;
+    if ( length == 0 ) {
+      head = 0;
+    }
+  }
 
-  return QUEUE_SUCCESS;
+  return ret;
 }
 
 
@@ -25,7 +25,9 @@
 
 
 #include <stdint.h>
-#include "buffer.h"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "bool.h"
 
 typedef enum queue_return {
   QUEUE_SUCCESS = 0,
@@ -34,15 +36,11 @@ typedef enum queue_return {
 } queue_return;
 
 
-void create_queue();
+void create_queue( size_t size );
 bool delete_queue();
-buffer* create_pcap_packet( void* pcap_header, size_t pcap_len,
-                       void* dump_header, size_t dump_len,
-                       void* data, size_t data_len );
-bool delete_pcap_packet( buffer *packet );
-queue_return push_pcap_packet( buffer *packet );
-queue_return push_pcap_packet_in_front( buffer *packet );
-queue_return pop_pcap_packet( buffer **packet );
+queue_return push_pcap_packet( const struct iovec *iov, int iovcnt );
+size_t get_queue_length();
+ssize_t write_pcap_packets( int fd );
 
 
 #endif // TREMASHARK_QUEUE_H
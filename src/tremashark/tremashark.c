@@ -30,11 +30,13 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "trema.h"
 #include "buffer.h"
@@ -44,11 +46,10 @@
 #define FIFO_NAME "tremashark"
 #define WIRESHARK "wireshark"
 #define TSHARK "tshark"
-#define FLUSH_INTERVAL 100000  // nano seconds
-
-#define WRITE_SUCCESS 0
-#define WRITE_BUSY 1
-#define WRITE_ERROR -1
+#define FLUSH_INTERVAL 10000000  // nano seconds
+#define FLUSH_THRESHOLD 65536     // bytes
+#define QUEUE_SIZE ( 4 * 1024 * 1024 ) // bytes
+#define DEFAULT_ROTATE_COUNT 5
 
 
 static char fifo_pathname[ PATH_MAX ];
@@ -57,10 +58,24 @@ static bool output_to_pcap_file = false;
 static bool launch_wireshark = true;
 static bool launch_tshark = false;
 static int outfile_fd = -1;
+static off_t outfile_size = 0;
+static off_t rotate_size = 0; // bytes. 0 means no rotation
+static bool record_split = false; // a record is partially written to the output
+static int rotate_count = DEFAULT_ROTATE_COUNT;
 static uint64_t total = 0;
 static uint64_t lost = 0;
 
 
+// Record header in pcap files. Note that struct pcap_pkthdr has a
+// struct timeval and differs in size on 64-bit platforms.
+typedef struct pcap_record_header {
+  uint32_t ts_sec;
+  uint32_t ts_usec;
+  uint32_t caplen;
+  uint32_t len;
+} pcap_record_header;
+
+
 // Special purpose header for telling extra information to wireshark
 typedef struct message_pcap_dump_header {
   uint16_t dump_type;
@@ -92,32 +107,42 @@ init_fifo_pathname() {
 }
 
 
+static void rotate_pcap_file( void );
+
+
 /**
- *  Write message to file.
- *  If it failed in writing whole message, param "packet" might be updated for remained.
+ *  Writes queued messages to the output. Called on a timer, and whenever
+ *  more than FLUSH_THRESHOLD bytes are queued.
  */
-static int
-write_to_file( buffer *packet ) {
-  assert( packet != NULL && packet->data != NULL && packet->length != 0 );
+static void
+flush_pcap_packets() {
   assert( outfile_fd >= 0 );
 
-  ssize_t ret = write( outfile_fd, packet->data, packet->length );
-  if ( ret < 0 ) {
-    int err = errno;
-    if ( err == EAGAIN || err == EWOULDBLOCK ) {
-      return WRITE_BUSY;
+  while ( get_queue_length() > 0 ) {
+    // The queue holds whole records only, so the output is at a record
+    // boundary once the queue is drained.
+    if ( rotate_size > 0 && outfile_size >= rotate_size && !record_split ) {
+      rotate_pcap_file();
     }
-    
-    error( "write error. errno = %d\n", err );
-    return WRITE_ERROR;
-  }
-
-  if ( ret != ( ssize_t ) packet->length ) {
-    packet->data = ( char * ) packet->data + ret;
-    packet->length = packet->length - ( unsigned int ) ret;
-    return WRITE_BUSY;
+    size_t length = get_queue_length();
+    ssize_t ret = write_pcap_packets( outfile_fd );
+    if ( ret < 0 ) {
+      if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) {
+        error( "write error. errno = %d\n", errno );
+      }
+      return;
+    }
+    outfile_size += ret;
+    if ( ( size_t ) ret < length ) {
+      // Partially written. Retry on the next flush, without rotating
+      // until the rest of the record is written to the same file.
+      if ( ret > 0 ) {
+        record_split = true;
+      }
+      return;
+    }
+    record_split = false;
   }
-  return WRITE_SUCCESS;
 }
 
 
@@ -129,14 +154,14 @@ dump_message( uint16_t tag, void *data, size_t len ) {
   char *app_name, *service_name;
   const char *type_str[] = { "sent", "received", "recv-connected", "recv-overflow", "recv-closed",
                              "send-connected", "send-refused", "send-overflow", "send-closed" };
-  size_t pcap_dump_header_length;
-  struct pcap_pkthdr pcap_header;
+  message_pcap_dump_header pcap_dump_hdr;
+  pcap_record_header pcap_header;
+  struct iovec iov[ 4 ];
+  struct timeval now;
   message_dump_header *dump_hdr;
-  message_pcap_dump_header *pcap_dump_hdr;
   message_header *hdr;
-  buffer *packet;
-  queue_return ret;
 
+  UNUSED( len );
   assert( outfile_fd >= 0 );
 
   dump_hdr = data;
@@ -152,50 +177,45 @@ dump_message( uint16_t tag, void *data, size_t len ) {
     debug( "message type: %d, length: %u", tag, ntohl( dump_hdr->data_length ) );
   }
 
-  size_t dump_header_length = ( sizeof( message_dump_header ) +
-                                 ntohs( dump_hdr->app_name_length ) +
-                                 ntohs( dump_hdr->service_name_length ) );
-
-  pcap_dump_header_length = ( sizeof( message_pcap_dump_header ) +
-                              ntohs( dump_hdr->app_name_length ) +
-                              ntohs( dump_hdr->service_name_length ) );
-
-  pcap_dump_hdr = xmalloc( pcap_dump_header_length );
-
-  pcap_dump_hdr->dump_type = htons( tag );
-  pcap_dump_hdr->sent_time.sec = dump_hdr->sent_time.sec;
-  pcap_dump_hdr->sent_time.nsec = dump_hdr->sent_time.nsec;
-  pcap_dump_hdr->app_name_len = dump_hdr->app_name_length;
-  pcap_dump_hdr->service_name_len = dump_hdr->service_name_length;
-  pcap_dump_hdr->data_len = dump_hdr->data_length;
-
-  char *pcap_dump_app_name = ( char * ) ( pcap_dump_hdr + 1 );
-  char *pcap_dump_service_name = pcap_dump_app_name + ntohs( pcap_dump_hdr->app_name_len );
-  memcpy( pcap_dump_app_name, app_name, ntohs( pcap_dump_hdr->app_name_len ) );
-  memcpy( pcap_dump_service_name, service_name, ntohs( pcap_dump_hdr->service_name_len ) );
-
-  memset( &pcap_header, 0, sizeof( struct pcap_pkthdr ) );
-  gettimeofday( &pcap_header.ts, NULL );
-
-  len -= dump_header_length;
-
-  pcap_header.caplen = ( bpf_u_int32 ) ( pcap_dump_header_length + ntohl( pcap_dump_hdr->data_len ) );
-  pcap_header.len = ( bpf_u_int32 ) ( pcap_dump_header_length + ntohl( pcap_dump_hdr->data_len ) );
-
-  packet = create_pcap_packet( &pcap_header, sizeof( struct pcap_pkthdr ),
-                               pcap_dump_hdr, pcap_dump_header_length,
-                               hdr, ntohl( pcap_dump_hdr->data_len ) );
-  ret = push_pcap_packet( packet );
+  size_t names_length = ( size_t ) ( ntohs( dump_hdr->app_name_length ) + ntohs( dump_hdr->service_name_length ) );
+
+  pcap_dump_hdr.dump_type = htons( tag );
+  pcap_dump_hdr.sent_time.sec = dump_hdr->sent_time.sec;
+  pcap_dump_hdr.sent_time.nsec = dump_hdr->sent_time.nsec;
+  pcap_dump_hdr.app_name_len = dump_hdr->app_name_length;
+  pcap_dump_hdr.service_name_len = dump_hdr->service_name_length;
+  pcap_dump_hdr.data_len = dump_hdr->data_length;
+
+  gettimeofday( &now, NULL );
+  pcap_header.ts_sec = ( uint32_t ) now.tv_sec;
+  pcap_header.ts_usec = ( uint32_t ) now.tv_usec;
+  pcap_header.caplen = ( uint32_t ) ( sizeof( message_pcap_dump_header ) + names_length + ntohl( dump_hdr->data_length ) );
+  pcap_header.len = pcap_header.caplen;
+
+  // app_name and service_name are contiguous in both messages.
+  iov[ 0 ].iov_base = &pcap_header;
+  iov[ 0 ].iov_len = sizeof( pcap_record_header );
+  iov[ 1 ].iov_base = &pcap_dump_hdr;
+  iov[ 1 ].iov_len = sizeof( message_pcap_dump_header );
+  iov[ 2 ].iov_base = app_name;
+  iov[ 2 ].iov_len = names_length;
+  iov[ 3 ].iov_base = hdr;
+  iov[ 3 ].iov_len = ntohl( dump_hdr->data_length );
+
+  queue_return ret = push_pcap_packet( iov, 4 );
+  if ( ret == QUEUE_FULL ) {
+    flush_pcap_packets();
+    ret = push_pcap_packet( iov, 4 );
+  }
   if ( ret == QUEUE_FULL ) {
     error( "tremashark queue is full. packet is discarded.\n" );
-    delete_pcap_packet( packet );
     lost++;
   }
   total++;
 
-  fsync( outfile_fd );
-
-  xfree( pcap_dump_hdr );
+  if ( get_queue_length() >= FLUSH_THRESHOLD ) {
+    flush_pcap_packets();
+  }
 }
 
 
@@ -206,33 +226,7 @@ static void
 write_pcap_packet( void *user_data ) {
   UNUSED( user_data );
 
-  for ( ; ; ) {
-    buffer *packet;
-    queue_return q_ret = pop_pcap_packet( &packet );
-    if ( q_ret == QUEUE_EMPTY ) {
-      break;
-    }
-
-    int ret = write_to_file( packet );
-    switch ( ret ) {
-    case WRITE_SUCCESS:
-      delete_pcap_packet( packet );
-      break;
-
-    case WRITE_BUSY:
-      push_pcap_packet_in_front( packet );
-      return;
-
-    case WRITE_ERROR:
-      push_pcap_packet_in_front( packet );
-      return;
-
-    default:
-      assert( 0 );
-    }
-  }
-
-  return;
+  flush_pcap_packets();
 }
 
 
@@ -255,7 +249,7 @@ set_timer_event() {
 
 
 static void
-init_pcap() {
+write_pcap_file_header() {
   struct pcap_file_header header;
   memset( &header, 0, sizeof( struct pcap_file_header ) );
   header.magic = 0xa1b2c3d4;
@@ -266,42 +260,83 @@ init_pcap() {
   header.snaplen = UINT16_MAX; // FIXME
   header.linktype = DLT_USER0; // FIXME
 
+  ssize_t ret = write( outfile_fd, &header, sizeof( struct pcap_file_header ) );
+
+  if ( ret != sizeof( struct pcap_file_header ) ) {
+    critical( "Failed to write a pcap header." );
+    assert( 0 );
+  }
+  outfile_size = ( off_t ) ret;
+}
+
+
+static void
+open_pcap_file() {
   mode_t mode = ( S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
-  if ( output_to_pcap_file ) {
-    outfile_fd = open( pcap_file_pathname, O_RDWR | O_CREAT, mode );
-    if ( outfile_fd < 0 ) {
-      critical( "Failed to open a file (%s).", pcap_file_pathname );
-      assert( 0 );
-    }
+  outfile_fd = open( pcap_file_pathname, O_WRONLY | O_CREAT | O_TRUNC, mode );
+  if ( outfile_fd < 0 ) {
+    critical( "Failed to open a file (%s).", pcap_file_pathname );
+    assert( 0 );
   }
-  else {
-    int ret = mkfifo( fifo_pathname, mode );
-    if ( ret < 0 ) {
-      critical( "Failed to create a named pipe." );
-      assert( 0 );
-    }
+  write_pcap_file_header();
+}
 
-    outfile_fd = open( fifo_pathname, O_RDWR | O_APPEND | O_NONBLOCK );
-    if ( outfile_fd < 0 ) {
-      critical( "Failed to open a named pipe." );
-      assert( 0 );
-    }
+
+/**
+ *  Renames FILE to FILE.1, FILE.1 to FILE.2, ... and FILE.<rotate_count>
+ *  is removed. Then starts a new FILE.
+ */
+static void
+rotate_pcap_file() {
+  char from[ PATH_MAX + 16 ];
+  char to[ PATH_MAX + 16 ];
+
+  close( outfile_fd );
+  outfile_fd = -1;
+
+  for ( int i = rotate_count - 1; i > 0; i-- ) {
+    snprintf( from, sizeof( from ), "%s.%d", pcap_file_pathname, i );
+    snprintf( to, sizeof( to ), "%s.%d", pcap_file_pathname, i + 1 );
+    rename( from, to );
+  }
+  snprintf( to, sizeof( to ), "%s.1", pcap_file_pathname );
+  if ( rename( pcap_file_pathname, to ) < 0 ) {
+    error( "Failed to rotate a pcap file (%s). errno = %d", pcap_file_pathname, errno );
   }
 
-  ssize_t ret = write( outfile_fd, &header, sizeof( struct pcap_file_header ) );
+  open_pcap_file();
+  info( "Rotated a pcap file (%s).", pcap_file_pathname );
+}
 
-  if ( ret != sizeof( struct pcap_file_header ) ) {
-    critical( "Failed to write a pcap header." );
+
+static void
+init_pcap() {
+  if ( output_to_pcap_file ) {
+    open_pcap_file();
+    return;
+  }
+
+  mode_t mode = ( S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+  int ret = mkfifo( fifo_pathname, mode );
+  if ( ret < 0 ) {
+    critical( "Failed to create a named pipe." );
     assert( 0 );
   }
 
-  fsync( outfile_fd );
+  outfile_fd = open( fifo_pathname, O_RDWR | O_APPEND | O_NONBLOCK );
+  if ( outfile_fd < 0 ) {
+    critical( "Failed to open a named pipe." );
+    assert( 0 );
+  }
+
+  write_pcap_file_header();
 }
 
 
 static void
 finalize_pcap() {
   if ( outfile_fd >= 0 ) {
+    flush_pcap_packets();
     close( outfile_fd );
     outfile_fd = -1;
   }
@@ -337,11 +372,13 @@ start_wireshark() {
 
 static void
 print_usage_and_exit() {
-  fprintf( stderr, "Usage: tremashark [-p] [-t] [-w filename] [-s SERVICE_NAME]\n" );
+  fprintf( stderr, "Usage: tremashark [-p] [-t] [-w filename [-C size [-W count]]] [-s SERVICE_NAME]\n" );
   fprintf( stderr, "  Options:\n" );
   fprintf( stderr, "    -p: do not launch wireshark or tshark\n" );
   fprintf( stderr, "    -t: launch tshark instead of wireshark\n" );
   fprintf( stderr, "    -w: save messages to a pcap file\n" );
+  fprintf( stderr, "    -C: rotate the pcap file when it is larger than size megabytes\n" );
+  fprintf( stderr, "    -W: keep count rotated pcap files ( default: %d )\n", DEFAULT_ROTATE_COUNT );
   fprintf( stderr, "    -s: specify service name\n" );
   exit( -1 );
 }
@@ -358,7 +395,7 @@ main( int argc, char *argv[] ) {
   init_trema( &argc, &argv );
 
   while( 1 ) {
-    opt = getopt( argc, argv, "s:tw:p" );
+    opt = getopt( argc, argv, "s:tw:pC:W:" );
 
     if( opt < 0 ){
       break;
@@ -398,11 +435,29 @@ main( int argc, char *argv[] ) {
       }
       break;
 
+    case 'C':
+      if ( atoi( optarg ) <= 0 ) {
+        print_usage_and_exit();
+      }
+      rotate_size = ( off_t ) atoi( optarg ) * 1000000;
+      break;
+
+    case 'W':
+      rotate_count = atoi( optarg );
+      if ( rotate_count <= 0 ) {
+        print_usage_and_exit();
+      }
+      break;
+
     default:
       print_usage_and_exit();
     }
   }
 
+  if ( !output_to_pcap_file ) {
+    rotate_size = 0;
+  }
+
   // Set an event handler
   if ( service_name == NULL ) {
     add_message_received_callback( DEFAULT_DUMP_SERVICE_NAME, dump_message );
@@ -413,7 +468,7 @@ main( int argc, char *argv[] ) {
   }
 
   // create queue for storing pcap packet
-  create_queue();
+  create_queue( QUEUE_SIZE );
 
   // Initialize an interface to wireshark
   init_pcap();
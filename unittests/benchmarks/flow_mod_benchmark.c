@@ -0,0 +1,108 @@
+/*
+ * Micro benchmark for flow modification templates of openflow_message.[ch]
+ *
+ * Compares building a flow modification with create_actions() and
+ * create_flow_mod() for every message, as cbench_switch used to do,
+ * with create_flow_mod_from_template().
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "openflow_message.h"
+
+
+#define NUMBER_OF_MESSAGES 1000000
+
+
+static double
+elapsed_ns( const struct timespec *start, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - start->tv_sec ) * 1e9 + ( double ) ( end->tv_nsec - start->tv_nsec );
+}
+
+
+static void
+make_match( struct ofp_match *match, uint32_t i ) {
+  memset( match, 0, sizeof( struct ofp_match ) );
+  match->in_port = 1;
+  match->dl_type = 0x0800;
+  match->nw_proto = 17;
+  match->nw_src = 0x0a000000 | i;
+  match->nw_dst = 0xc0a80000 | ( i >> 8 );
+  match->tp_src = ( uint16_t ) i;
+  match->tp_dst = 53;
+}
+
+
+int
+main() {
+  struct timespec start, end;
+  struct ofp_match match;
+  size_t bytes = 0;
+
+  init_openflow_message();
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( uint32_t i = 0; i < NUMBER_OF_MESSAGES; i++ ) {
+    make_match( &match, i );
+    openflow_actions *actions = create_actions();
+    append_action_output( actions, 2, UINT16_MAX );
+    buffer *flow_mod = create_flow_mod( get_transaction_id(), match, get_cookie(),
+                                        OFPFC_ADD, 0, 0, UINT16_MAX, i,
+                                        OFPP_NONE, OFPFF_SEND_FLOW_REM, actions );
+    bytes += flow_mod->length;
+    free_buffer( flow_mod );
+    delete_actions( actions );
+  }
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  printf( "create_flow_mod                %7.1f ns/message ( %zu bytes )\n",
+          elapsed_ns( &start, &end ) / NUMBER_OF_MESSAGES, bytes );
+
+  openflow_actions *actions = create_actions();
+  append_action_output( actions, 2, UINT16_MAX );
+  flow_mod_template *template = create_flow_mod_template( OFPFC_ADD, 0, 0, UINT16_MAX,
+                                                          OFPP_NONE, OFPFF_SEND_FLOW_REM, actions );
+  delete_actions( actions );
+
+  bytes = 0;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( uint32_t i = 0; i < NUMBER_OF_MESSAGES; i++ ) {
+    make_match( &match, i );
+    buffer *flow_mod = create_flow_mod_from_template( template, get_transaction_id(), match,
+                                                      get_cookie(), i );
+    bytes += flow_mod->length;
+    free_buffer( flow_mod );
+  }
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  printf( "create_flow_mod_from_template  %7.1f ns/message ( %zu bytes )\n",
+          elapsed_ns( &start, &end ) / NUMBER_OF_MESSAGES, bytes );
+
+  delete_flow_mod_template( template );
+
+  return 0;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
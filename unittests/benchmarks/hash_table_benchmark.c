@@ -0,0 +1,123 @@
+/*
+ * Micro benchmark for hash_table.[ch]
+ *
+ * Inserts, looks up and deletes N integer keys in a hash table that
+ * starts with the default size, so that insertions include resizing.
+ *
+ * Usage: hash_table_benchmark [NUMBER_OF_KEYS]
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hash_table.h"
+#include "wrapper.h"
+
+
+#define DEFAULT_NUMBER_OF_KEYS 10000
+#define ROUNDS 10
+
+
+static double
+elapsed_ns( const struct timespec *start, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - start->tv_sec ) * 1e9 + ( double ) ( end->tv_nsec - start->tv_nsec );
+}
+
+
+static unsigned int
+hash_key( const void *key ) {
+  return *( const unsigned int * ) key;
+}
+
+
+static bool
+compare_key( const void *x, const void *y ) {
+  return *( const unsigned int * ) x == *( const unsigned int * ) y;
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  int n_keys = DEFAULT_NUMBER_OF_KEYS;
+  struct timespec start, end;
+  double insert_ns = 0, lookup_ns = 0, delete_ns = 0;
+  int errors = 0;
+
+  if ( argc > 1 ) {
+    n_keys = atoi( argv[ 1 ] );
+  }
+  if ( n_keys <= 0 ) {
+    fprintf( stderr, "Usage: %s [NUMBER_OF_KEYS]\n", argv[ 0 ] );
+    return 1;
+  }
+
+  unsigned int *keys = xmalloc( sizeof( unsigned int ) * ( size_t ) n_keys );
+  for ( int i = 0; i < n_keys; i++ ) {
+    keys[ i ] = ( unsigned int ) i * 7919;
+  }
+
+  for ( int r = 0; r < ROUNDS; r++ ) {
+    hash_table *table = create_hash( compare_key, hash_key );
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( int i = 0; i < n_keys; i++ ) {
+      insert_hash_entry( table, &keys[ i ], &keys[ i ] );
+    }
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    insert_ns += elapsed_ns( &start, &end );
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( int i = 0; i < n_keys; i++ ) {
+      if ( lookup_hash_entry( table, &keys[ i ] ) != &keys[ i ] ) {
+        errors++;
+      }
+    }
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    lookup_ns += elapsed_ns( &start, &end );
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for ( int i = 0; i < n_keys; i++ ) {
+      delete_hash_entry( table, &keys[ i ] );
+    }
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    delete_ns += elapsed_ns( &start, &end );
+
+    if ( table->length != 0 ) {
+      errors++;
+    }
+    delete_hash( table );
+  }
+
+  double operations = ( double ) ROUNDS * n_keys;
+  printf( "insert %d entries    %9.1f ns/op\n", n_keys, insert_ns / operations );
+  printf( "lookup %d entries    %9.1f ns/op\n", n_keys, lookup_ns / operations );
+  printf( "delete %d entries    %9.1f ns/op\n", n_keys, delete_ns / operations );
+
+  xfree( keys );
+
+  return errors == 0 ? 0 : 1;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
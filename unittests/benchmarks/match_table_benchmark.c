@@ -0,0 +1,220 @@
+/*
+ * Micro benchmark for wildcard lookups of match_table.[ch]
+ *
+ * Compares lookup_match_entry() with a linear scan over a priority
+ * ordered list, which is how match_table used to look up wildcard
+ * entries.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "match.h"
+#include "match_table.h"
+#include "wrapper.h"
+
+
+#define NUMBER_OF_LOOKUPS 100000
+#define LINEAR_SCAN_BUDGET 100000000
+
+
+typedef struct {
+  struct ofp_match ofp_match;
+  uint16_t priority;
+  unsigned int serial;
+} rule;
+
+
+static const size_t rule_counts[] = { 10, 1000, 100000 };
+
+
+static uint32_t
+random_value( void ) {
+  return ( ( uint32_t ) random() << 16 ) ^ ( uint32_t ) random();
+}
+
+
+static void
+make_rule( rule *r, unsigned int serial ) {
+  struct ofp_match *m = &r->ofp_match;
+
+  memset( m, 0, sizeof( struct ofp_match ) );
+  m->wildcards = OFPFW_ALL;
+  switch ( random() % 4 ) {
+    case 0: // IPv4 source prefix ( /24 )
+      m->wildcards &= ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_SRC_MASK );
+      m->wildcards |= 8 << OFPFW_NW_SRC_SHIFT;
+      m->dl_type = 0x0800;
+      m->nw_src = random_value() & 0xffffff00;
+      break;
+    case 1: // TCP destination port
+      m->wildcards &= ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_PROTO | OFPFW_TP_DST );
+      m->dl_type = 0x0800;
+      m->nw_proto = 6;
+      m->tp_dst = ( uint16_t ) random();
+      break;
+    case 2: // in_port and destination MAC address
+      m->wildcards &= ~( uint32_t ) ( OFPFW_IN_PORT | OFPFW_DL_DST );
+      m->in_port = ( uint16_t ) ( random() % 48 + 1 );
+      uint32_t mac = random_value();
+      memcpy( m->dl_dst + 2, &mac, sizeof( mac ) );
+      break;
+    default: // IPv4 destination prefix ( /16 )
+      m->wildcards &= ~( uint32_t ) ( OFPFW_DL_TYPE | OFPFW_NW_DST_MASK );
+      m->wildcards |= 16 << OFPFW_NW_DST_SHIFT;
+      m->dl_type = 0x0800;
+      m->nw_dst = random_value() & 0xffff0000;
+      break;
+  }
+  r->priority = ( uint16_t ) random();
+  r->serial = serial;
+}
+
+
+// Builds an exact match that hits `r' half of the time.
+static void
+make_packet( struct ofp_match *packet, const rule *r ) {
+  memset( packet, 0, sizeof( struct ofp_match ) );
+  packet->in_port = r->ofp_match.in_port;
+  memcpy( packet->dl_dst, r->ofp_match.dl_dst, OFP_ETH_ALEN );
+  packet->dl_type = r->ofp_match.dl_type;
+  packet->nw_proto = r->ofp_match.nw_proto;
+  packet->nw_src = r->ofp_match.nw_src | ( random_value() & 0xff );
+  packet->nw_dst = r->ofp_match.nw_dst | ( random_value() & 0xffff );
+  packet->tp_src = ( uint16_t ) random();
+  packet->tp_dst = r->ofp_match.tp_dst;
+  if ( random() % 2 ) {
+    packet->dl_type = 0x86dd;
+    packet->in_port = 0;
+  }
+}
+
+
+// Higher priority first, then newer first as insert_match_entry() does.
+static int
+compare_rule( const void *x, const void *y ) {
+  const rule *rx = *( const rule * const * ) x;
+  const rule *ry = *( const rule * const * ) y;
+
+  if ( rx->priority != ry->priority ) {
+    return rx->priority > ry->priority ? -1 : 1;
+  }
+  return rx->serial > ry->serial ? -1 : 1;
+}
+
+
+static const rule *
+scan_rules( rule **sorted, size_t n_rules, const struct ofp_match *packet ) {
+  for ( size_t i = 0; i < n_rules; i++ ) {
+    if ( compare_match( &sorted[ i ]->ofp_match, packet ) ) {
+      return sorted[ i ];
+    }
+  }
+  return NULL;
+}
+
+
+static double
+elapsed_ns( const struct timespec *start, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - start->tv_sec ) * 1e9 + ( double ) ( end->tv_nsec - start->tv_nsec );
+}
+
+
+static void
+run_benchmark( size_t n_rules ) {
+  rule *rules = xmalloc( sizeof( rule ) * n_rules );
+  rule **sorted = xmalloc( sizeof( rule * ) * n_rules );
+  struct ofp_match *packets = xmalloc( sizeof( struct ofp_match ) * NUMBER_OF_LOOKUPS );
+  char name[ 32 ];
+
+  init_match_table();
+  for ( size_t i = 0; i < n_rules; i++ ) {
+    make_rule( &rules[ i ], ( unsigned int ) i );
+    sorted[ i ] = &rules[ i ];
+    snprintf( name, sizeof( name ), "%zu", i );
+    insert_match_entry( &rules[ i ].ofp_match, rules[ i ].priority, "benchmark", name );
+  }
+  qsort( sorted, n_rules, sizeof( rule * ), compare_rule );
+  for ( size_t i = 0; i < NUMBER_OF_LOOKUPS; i++ ) {
+    make_packet( &packets[ i ], &rules[ ( size_t ) random() % n_rules ] );
+  }
+
+  size_t n_scans = LINEAR_SCAN_BUDGET / n_rules;
+  if ( n_scans > NUMBER_OF_LOOKUPS ) {
+    n_scans = NUMBER_OF_LOOKUPS;
+  }
+
+  struct timespec start, end;
+  size_t hits = 0;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( size_t i = 0; i < NUMBER_OF_LOOKUPS; i++ ) {
+    if ( lookup_match_entry( &packets[ i ] ) != NULL ) {
+      hits++;
+    }
+  }
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  double table_ns = elapsed_ns( &start, &end ) / NUMBER_OF_LOOKUPS;
+
+  size_t scan_hits = 0;
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( size_t i = 0; i < n_scans; i++ ) {
+    if ( scan_rules( sorted, n_rules, &packets[ i ] ) != NULL ) {
+      scan_hits++;
+    }
+  }
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  double list_ns = elapsed_ns( &start, &end ) / ( double ) n_scans;
+
+  size_t mismatches = 0;
+  for ( size_t i = 0; i < n_scans; i++ ) {
+    match_entry *entry = lookup_match_entry( &packets[ i ] );
+    const rule *expected = scan_rules( sorted, n_rules, &packets[ i ] );
+    if ( expected == NULL ? entry != NULL : ( entry == NULL || ( unsigned int ) atoi( entry->entry_name ) != expected->serial ) ) {
+      mismatches++;
+    }
+  }
+
+  printf( "%6zu rules: match_table %9.1f ns/lookup ( %zu/%d hits ), linked list %11.1f ns/lookup ( %zu/%zu hits ), mismatches %zu\n",
+          n_rules, table_ns, hits, NUMBER_OF_LOOKUPS, list_ns, scan_hits, n_scans, mismatches );
+
+  finalize_match_table();
+  xfree( packets );
+  xfree( sorted );
+  xfree( rules );
+}
+
+
+int
+main() {
+  srandom( 1 );
+  for ( size_t i = 0; i < sizeof( rule_counts ) / sizeof( rule_counts[ 0 ] ); i++ ) {
+    run_benchmark( rule_counts[ i ] );
+  }
+  return 0;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
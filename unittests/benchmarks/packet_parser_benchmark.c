@@ -0,0 +1,285 @@
+/*
+ * Micro benchmark for packet_parser.[ch]
+ *
+ * Compares parse_packet() with parse_packet_lazily(), which leaves L3
+ * and L4 headers undecoded until parse_packet_l3() is called. Frames are
+ * read from a pcap file given as the first argument, or generated as a
+ * mix of ARP, TCP, UDP, ICMP, 802.1Q tagged and non-IP frames.
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "buffer.h"
+#include "packet_info.h"
+#include "packet_parser.h"
+#include "wrapper.h"
+
+
+#define NUMBER_OF_FRAMES 100000
+#define NUMBER_OF_ROUNDS 10
+#define MAX_FRAME_LENGTH 1518
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_GLOBAL_HEADER_LENGTH 24
+#define PCAP_RECORD_HEADER_LENGTH 16
+
+
+typedef struct {
+  uint8_t data[ MAX_FRAME_LENGTH ];
+  size_t length;
+} frame;
+
+
+static frame *frames;
+static size_t n_frames;
+
+
+static void
+put16( uint8_t *p, uint16_t value ) {
+  value = htons( value );
+  memcpy( p, &value, sizeof( value ) );
+}
+
+
+static void
+put32( uint8_t *p, uint32_t value ) {
+  value = htonl( value );
+  memcpy( p, &value, sizeof( value ) );
+}
+
+
+// Writes Ethernet ( and 802.1Q ) headers and returns the length written.
+static size_t
+make_ether( uint8_t *p, uint16_t type, bool tagged ) {
+  static const uint8_t macda[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x02 };
+  static const uint8_t macsa[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 };
+  size_t length = 0;
+
+  memcpy( p, macda, sizeof( macda ) );
+  memcpy( p + 6, macsa, sizeof( macsa ) );
+  length = 12;
+  if ( tagged ) {
+    put16( p + length, ETH_ETHTYPE_TPID );
+    put16( p + length + 2, ( uint16_t ) ( random() % 4094 + 1 ) );
+    length += 4;
+  }
+  put16( p + length, type );
+
+  return length + 2;
+}
+
+
+static size_t
+make_arp( uint8_t *p ) {
+  put16( p, ARPHRD_ETHER );
+  put16( p + 2, ETH_ETHTYPE_IPV4 );
+  p[ 4 ] = ETH_ADDRLEN;
+  p[ 5 ] = IPV4_ADDRLEN;
+  put16( p + 6, ARPOP_REQUEST );
+  put32( p + 14, 0x0a000001 );
+  put32( p + 24, ( uint32_t ) ( 0x0a000000 | ( random() & 0xffff ) ) );
+
+  return sizeof( arp_header_t );
+}
+
+
+static size_t
+make_ipv4( uint8_t *p, uint8_t protocol, size_t payload_length ) {
+  uint16_t tot_len = ( uint16_t ) ( sizeof( ipv4_header_t ) + payload_length );
+
+  p[ 0 ] = 0x45;
+  put16( p + 2, tot_len );
+  p[ 8 ] = 64;
+  p[ 9 ] = protocol;
+  put32( p + 12, ( uint32_t ) ( 0x0a000000 | ( random() & 0xffff ) ) );
+  put32( p + 16, ( uint32_t ) ( 0xc0a80000 | ( random() & 0xffff ) ) );
+  uint16_t check = get_checksum( ( uint16_t * ) ( void * ) p, sizeof( ipv4_header_t ) );
+  memcpy( p + 10, &check, sizeof( check ) );
+
+  uint8_t *l4 = p + sizeof( ipv4_header_t );
+  put16( l4, ( uint16_t ) random() );
+  put16( l4 + 2, ( uint16_t ) random() );
+  if ( protocol == IPPROTO_TCP ) {
+    l4[ 12 ] = 0x50;
+  }
+
+  return tot_len;
+}
+
+
+static void
+generate_frames( void ) {
+  frames = xcalloc( NUMBER_OF_FRAMES, sizeof( frame ) );
+
+  for ( n_frames = 0; n_frames < NUMBER_OF_FRAMES; n_frames++ ) {
+    frame *f = &frames[ n_frames ];
+    size_t length;
+    switch ( n_frames % 8 ) {
+      case 0:
+        length = make_ether( f->data, ETH_ETHTYPE_ARP, false );
+        length += make_arp( f->data + length );
+        break;
+      case 1:
+      case 2:
+        length = make_ether( f->data, ETH_ETHTYPE_IPV4, false );
+        length += make_ipv4( f->data + length, IPPROTO_TCP, 20 + ( size_t ) ( random() % 1400 ) );
+        break;
+      case 3:
+      case 4:
+        length = make_ether( f->data, ETH_ETHTYPE_IPV4, false );
+        length += make_ipv4( f->data + length, IPPROTO_UDP, 8 + ( size_t ) ( random() % 512 ) );
+        break;
+      case 5:
+        length = make_ether( f->data, ETH_ETHTYPE_IPV4, false );
+        length += make_ipv4( f->data + length, IPPROTO_ICMP, 64 );
+        break;
+      case 6:
+        length = make_ether( f->data, ETH_ETHTYPE_IPV4, true );
+        length += make_ipv4( f->data + length, IPPROTO_UDP, 8 + ( size_t ) ( random() % 512 ) );
+        break;
+      default:
+        length = make_ether( f->data, ETH_ETHTYPE_LLDP, false ) + 46;
+        break;
+    }
+    f->length = length < ETH_MINIMUM_LENGTH - ETH_FCS_LENGTH ? ETH_MINIMUM_LENGTH - ETH_FCS_LENGTH : length;
+  }
+}
+
+
+static bool
+read_frames( const char *file ) {
+  FILE *fp = fopen( file, "r" );
+  if ( fp == NULL ) {
+    perror( file );
+    return false;
+  }
+
+  uint8_t header[ PCAP_GLOBAL_HEADER_LENGTH ];
+  uint32_t magic;
+  if ( fread( header, sizeof( header ), 1, fp ) != 1 || ( memcpy( &magic, header, sizeof( magic ) ), magic != PCAP_MAGIC ) ) {
+    fprintf( stderr, "%s is not a pcap file in the native byte order.\n", file );
+    fclose( fp );
+    return false;
+  }
+
+  frames = xcalloc( NUMBER_OF_FRAMES, sizeof( frame ) );
+  uint8_t record[ PCAP_RECORD_HEADER_LENGTH ];
+  for ( n_frames = 0; n_frames < NUMBER_OF_FRAMES && fread( record, sizeof( record ), 1, fp ) == 1; ) {
+    uint32_t caplen;
+    memcpy( &caplen, record + 8, sizeof( caplen ) );
+    frame *f = &frames[ n_frames ];
+    if ( caplen > MAX_FRAME_LENGTH ) {
+      fseek( fp, ( long ) caplen, SEEK_CUR );
+      continue;
+    }
+    if ( fread( f->data, caplen, 1, fp ) != 1 ) {
+      break;
+    }
+    f->length = caplen;
+    n_frames++;
+  }
+  fclose( fp );
+
+  return n_frames > 0;
+}
+
+
+static double
+elapsed_ns( const struct timespec *start, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - start->tv_sec ) * 1e9 + ( double ) ( end->tv_nsec - start->tv_nsec );
+}
+
+
+enum {
+  PARSE_EAGERLY,
+  PARSE_L2_ONLY,
+  PARSE_LAZILY_THEN_L3,
+};
+
+
+static void
+run_benchmark( const char *name, int mode ) {
+  struct timespec start, end;
+  size_t parsed = 0;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( int round = 0; round < NUMBER_OF_ROUNDS; round++ ) {
+    for ( size_t i = 0; i < n_frames; i++ ) {
+      buffer *buf = wrap_buffer( frames[ i ].data, frames[ i ].length );
+      bool ret;
+      switch ( mode ) {
+        case PARSE_EAGERLY:
+          ret = parse_packet( buf );
+          break;
+        case PARSE_L2_ONLY:
+          ret = parse_packet_lazily( buf );
+          break;
+        default:
+          ret = parse_packet_lazily( buf ) && parse_packet_l3( buf );
+          break;
+      }
+      if ( ret ) {
+        parsed++;
+      }
+      free_packet( buf );
+    }
+  }
+  clock_gettime( CLOCK_MONOTONIC, &end );
+
+  size_t total = n_frames * NUMBER_OF_ROUNDS;
+  printf( "%-40s %7.1f ns/frame ( %zu/%zu parsed )\n", name, elapsed_ns( &start, &end ) / ( double ) total, parsed, total );
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  srandom( 1 );
+  if ( argc > 1 ) {
+    if ( !read_frames( argv[ 1 ] ) ) {
+      return 1;
+    }
+  }
+  else {
+    generate_frames();
+  }
+  printf( "%zu frames\n", n_frames );
+
+  run_benchmark( "parse_packet", PARSE_EAGERLY );
+  run_benchmark( "parse_packet_lazily", PARSE_L2_ONLY );
+  run_benchmark( "parse_packet_lazily + parse_packet_l3", PARSE_LAZILY_THEN_L3 );
+  set_ipv4_checksum_verification( false );
+  run_benchmark( "parse_packet ( no IPv4 checksum )", PARSE_EAGERLY );
+  set_ipv4_checksum_verification( true );
+
+  xfree( frames );
+
+  return 0;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,387 @@
+/*
+ * Benchmark for switch daemons of switch_manager
+ *
+ * Connects emulated switches to a running switch_manager and measures
+ * the time until all of them are ready, and the processes, memory and
+ * sockets used by the switch daemons. Run it against "switch_manager"
+ * ( a switch daemon per switch ) and "switch_manager --multiplex"
+ * ( a single switch daemon for all switches ) to compare both.
+ *
+ * Usage: switch_daemon_benchmark [NUMBER_OF_SWITCHES [PORT]]
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <openflow.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "byteorder.h"
+#include "wrapper.h"
+
+
+#define DEFAULT_NUMBER_OF_SWITCHES 100
+#define RECEIVE_BUFFER_LENGTH 65536
+#define TIMEOUT_SEC 60
+
+
+typedef struct {
+  int fd;
+  uint64_t datapath_id;
+  uint8_t buf[ RECEIVE_BUFFER_LENGTH ];
+  size_t length;
+  bool ready;
+} emulated_switch;
+
+
+static double
+elapsed_ms( const struct timespec *start, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - start->tv_sec ) * 1e3 + ( double ) ( end->tv_nsec - start->tv_nsec ) / 1e6;
+}
+
+
+static bool
+send_all( int fd, const void *data, size_t length ) {
+  const uint8_t *p = data;
+
+  while ( length > 0 ) {
+    ssize_t ret = write( fd, p, length );
+    if ( ret < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      return false;
+    }
+    p += ret;
+    length -= ( size_t ) ret;
+  }
+
+  return true;
+}
+
+
+static bool
+send_header( emulated_switch *sw, uint8_t type, uint32_t xid ) {
+  struct ofp_header header;
+
+  header.version = OFP_VERSION;
+  header.type = type;
+  header.length = htons( sizeof( struct ofp_header ) );
+  header.xid = xid; // network byte order
+
+  return send_all( sw->fd, &header, sizeof( header ) );
+}
+
+
+static bool
+send_features_reply( emulated_switch *sw, uint32_t xid ) {
+  struct ofp_switch_features features;
+
+  memset( &features, 0, sizeof( features ) );
+  features.header.version = OFP_VERSION;
+  features.header.type = OFPT_FEATURES_REPLY;
+  features.header.length = htons( sizeof( features ) );
+  features.header.xid = xid;
+  features.datapath_id = htonll( sw->datapath_id );
+  features.n_buffers = htonl( 256 );
+  features.n_tables = 1;
+
+  return send_all( sw->fd, &features, sizeof( features ) );
+}
+
+
+static bool
+handle_message( emulated_switch *sw, const struct ofp_header *header ) {
+  switch ( header->type ) {
+    case OFPT_FEATURES_REQUEST:
+      return send_features_reply( sw, header->xid );
+    case OFPT_ECHO_REQUEST:
+      return send_header( sw, OFPT_ECHO_REPLY, header->xid );
+    case OFPT_SET_CONFIG:
+      // The switch daemon configures a switch once it is ready.
+      sw->ready = true;
+      return true;
+    default:
+      return true;
+  }
+}
+
+
+static bool
+receive_messages( emulated_switch *sw ) {
+  ssize_t ret = read( sw->fd, sw->buf + sw->length, sizeof( sw->buf ) - sw->length );
+  if ( ret <= 0 ) {
+    return ret < 0 && errno == EINTR;
+  }
+  sw->length += ( size_t ) ret;
+
+  size_t offset = 0;
+  while ( sw->length - offset >= sizeof( struct ofp_header ) ) {
+    struct ofp_header header;
+    memcpy( &header, sw->buf + offset, sizeof( header ) );
+    size_t message_length = ntohs( header.length );
+    if ( message_length < sizeof( struct ofp_header ) ) {
+      return false;
+    }
+    if ( sw->length - offset < message_length ) {
+      break;
+    }
+    if ( !handle_message( sw, &header ) ) {
+      return false;
+    }
+    offset += message_length;
+  }
+  memmove( sw->buf, sw->buf + offset, sw->length - offset );
+  sw->length -= offset;
+
+  return true;
+}
+
+
+static bool
+connect_switch( emulated_switch *sw, uint16_t port ) {
+  struct sockaddr_in addr;
+
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons( port );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  sw->fd = socket( PF_INET, SOCK_STREAM, 0 );
+  if ( sw->fd < 0 ) {
+    return false;
+  }
+  if ( connect( sw->fd, ( struct sockaddr * ) &addr, sizeof( addr ) ) < 0 ) {
+    close( sw->fd );
+    sw->fd = -1;
+    return false;
+  }
+
+  return send_header( sw, OFPT_HELLO, htonl( 1 ) );
+}
+
+
+static bool
+wait_until_ready( emulated_switch *switches, int n_switches ) {
+  struct pollfd *fds = xcalloc( ( size_t ) n_switches, sizeof( struct pollfd ) );
+  struct timespec start, now;
+  int n_ready = 0;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  while ( n_ready < n_switches ) {
+    for ( int i = 0; i < n_switches; i++ ) {
+      fds[ i ].fd = switches[ i ].fd;
+      fds[ i ].events = POLLIN;
+      fds[ i ].revents = 0;
+    }
+    if ( poll( fds, ( nfds_t ) n_switches, 1000 ) < 0 && errno != EINTR ) {
+      break;
+    }
+    for ( int i = 0; i < n_switches; i++ ) {
+      if ( fds[ i ].revents == 0 ) {
+        continue;
+      }
+      bool ready = switches[ i ].ready;
+      if ( !receive_messages( &switches[ i ] ) ) {
+        fprintf( stderr, "Switch %#" PRIx64 " is disconnected.\n", switches[ i ].datapath_id );
+        xfree( fds );
+        return false;
+      }
+      if ( !ready && switches[ i ].ready ) {
+        n_ready++;
+      }
+    }
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    if ( now.tv_sec - start.tv_sec > TIMEOUT_SEC ) {
+      fprintf( stderr, "Only %d of %d switches became ready.\n", n_ready, n_switches );
+      break;
+    }
+  }
+  xfree( fds );
+
+  return n_ready == n_switches;
+}
+
+
+typedef struct {
+  int processes;
+  long rss_kb;
+  int sockets;
+} daemon_usage;
+
+
+static long
+read_rss_kb( int pid ) {
+  char path[ 64 ];
+  char line[ 256 ];
+  long rss_kb = 0;
+
+  snprintf( path, sizeof( path ), "/proc/%d/status", pid );
+  FILE *fp = fopen( path, "r" );
+  if ( fp == NULL ) {
+    return 0;
+  }
+  while ( fgets( line, sizeof( line ), fp ) != NULL ) {
+    if ( sscanf( line, "VmRSS: %ld kB", &rss_kb ) == 1 ) {
+      break;
+    }
+  }
+  fclose( fp );
+
+  return rss_kb;
+}
+
+
+static int
+count_sockets( int pid ) {
+  char path[ 64 ];
+  char link[ 256 ];
+  int sockets = 0;
+
+  snprintf( path, sizeof( path ), "/proc/%d/fd", pid );
+  DIR *dir = opendir( path );
+  if ( dir == NULL ) {
+    return 0;
+  }
+  struct dirent *entry;
+  while ( ( entry = readdir( dir ) ) != NULL ) {
+    char fd_path[ sizeof( path ) + sizeof( entry->d_name ) ];
+    snprintf( fd_path, sizeof( fd_path ), "%s/%s", path, entry->d_name );
+    ssize_t length = readlink( fd_path, link, sizeof( link ) - 1 );
+    if ( length > 0 ) {
+      link[ length ] = '\0';
+      if ( strncmp( link, "socket:", strlen( "socket:" ) ) == 0 ) {
+        sockets++;
+      }
+    }
+  }
+  closedir( dir );
+
+  return sockets;
+}
+
+
+// Switch daemons are named "switch.<address>" or "switch.daemon".
+static void
+get_daemon_usage( daemon_usage *usage ) {
+  memset( usage, 0, sizeof( daemon_usage ) );
+
+  DIR *proc = opendir( "/proc" );
+  if ( proc == NULL ) {
+    return;
+  }
+  struct dirent *entry;
+  while ( ( entry = readdir( proc ) ) != NULL ) {
+    char path[ 64 ];
+    char argv0[ 256 ];
+    int pid = atoi( entry->d_name );
+    if ( pid <= 0 ) {
+      continue;
+    }
+    snprintf( path, sizeof( path ), "/proc/%d/cmdline", pid );
+    FILE *fp = fopen( path, "r" );
+    if ( fp == NULL ) {
+      continue;
+    }
+    size_t length = fread( argv0, 1, sizeof( argv0 ) - 1, fp );
+    fclose( fp );
+    argv0[ length ] = '\0';
+    if ( strncmp( argv0, "switch.", strlen( "switch." ) ) != 0 ) {
+      continue;
+    }
+    usage->processes++;
+    usage->rss_kb += read_rss_kb( pid );
+    usage->sockets += count_sockets( pid );
+  }
+  closedir( proc );
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  int n_switches = DEFAULT_NUMBER_OF_SWITCHES;
+  uint16_t port = OFP_TCP_PORT;
+  struct timespec start, end;
+  daemon_usage before, after;
+
+  if ( argc > 1 ) {
+    n_switches = atoi( argv[ 1 ] );
+  }
+  if ( argc > 2 ) {
+    port = ( uint16_t ) atoi( argv[ 2 ] );
+  }
+  if ( n_switches <= 0 ) {
+    fprintf( stderr, "Usage: %s [NUMBER_OF_SWITCHES [PORT]]\n", argv[ 0 ] );
+    return 1;
+  }
+
+  get_daemon_usage( &before );
+
+  emulated_switch *switches = xcalloc( ( size_t ) n_switches, sizeof( emulated_switch ) );
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for ( int i = 0; i < n_switches; i++ ) {
+    switches[ i ].datapath_id = ( uint64_t ) i + 1;
+    if ( !connect_switch( &switches[ i ], port ) ) {
+      if ( i == 0 ) {
+        printf( "No switch manager is listening on port %u. Skipped.\n", port );
+        xfree( switches );
+        return 0;
+      }
+      fprintf( stderr, "Failed to connect switch %d ( %s ).\n", i + 1, strerror( errno ) );
+      n_switches = i;
+      break;
+    }
+  }
+  bool ready = wait_until_ready( switches, n_switches );
+  clock_gettime( CLOCK_MONOTONIC, &end );
+
+  // Wait for applications to get the switches ready.
+  sleep( 1 );
+  get_daemon_usage( &after );
+
+  printf( "%d switches %s in %.1f ms ( %.3f ms/switch )\n", n_switches, ready ? "ready" : "NOT ready",
+          elapsed_ms( &start, &end ), elapsed_ms( &start, &end ) / n_switches );
+  printf( "switch daemons: %d processes ( +%d )\n", after.processes, after.processes - before.processes );
+  printf( "memory: %ld kB RSS ( %.1f kB/switch )\n", after.rss_kb,
+          ( double ) ( after.rss_kb - before.rss_kb ) / n_switches );
+  printf( "sockets: %d ( %d secure channels, %d to and from applications )\n",
+          after.sockets, n_switches, after.sockets - before.sockets - n_switches );
+
+  for ( int i = 0; i < n_switches; i++ ) {
+    close( switches[ i ].fd );
+  }
+  xfree( switches );
+
+  return ready ? 0 : 1;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
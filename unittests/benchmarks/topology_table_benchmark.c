@@ -0,0 +1,172 @@
+/*
+ * Micro benchmark for topology_table.[ch] of the topology example
+ *
+ * Simulates topology discovery on a fabric of N switches with 48 ports
+ * each: switches and their ports are added as features replies arrive,
+ * every port then receives an LLDP packet that looks up both ends of the
+ * link, and every port reports a port status.
+ *
+ * Usage: topology_table_benchmark [NUMBER_OF_SWITCHES]
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "topology_table.h"
+
+
+#define DEFAULT_NUMBER_OF_SWITCHES 500
+#define NUMBER_OF_PORTS 48
+
+
+static double
+elapsed_ms( const struct timespec *start, const struct timespec *end ) {
+  return ( double ) ( end->tv_sec - start->tv_sec ) * 1e3 + ( double ) ( end->tv_nsec - start->tv_nsec ) / 1e6;
+}
+
+
+static void
+port_name( char *name, size_t size, uint16_t port_no ) {
+  snprintf( name, size, "eth%u", port_no );
+}
+
+
+static void
+add_switches( int n_switches ) {
+  char name[ OFP_MAX_PORT_NAME_LEN ];
+
+  for ( int i = 0; i < n_switches; i++ ) {
+    uint64_t datapath_id = ( uint64_t ) i + 1;
+    sw_entry *sw = update_sw_entry( &datapath_id );
+    for ( uint16_t port_no = 1; port_no <= NUMBER_OF_PORTS; port_no++ ) {
+      port_name( name, sizeof( name ), port_no );
+      port_entry *port = update_port_entry( sw, port_no, name );
+      port->up = true;
+    }
+  }
+}
+
+
+// Links each port to the same port of the next switch in a ring.
+static int
+receive_lldp_packets( int n_switches ) {
+  int links = 0;
+
+  for ( int i = 0; i < n_switches; i++ ) {
+    uint64_t from_datapath_id = ( uint64_t ) i + 1;
+    uint64_t to_datapath_id = ( uint64_t ) ( ( i + 1 ) % n_switches ) + 1;
+    for ( uint16_t port_no = 1; port_no <= NUMBER_OF_PORTS; port_no++ ) {
+      sw_entry *from_sw = lookup_sw_entry( &from_datapath_id );
+      sw_entry *to_sw = lookup_sw_entry( &to_datapath_id );
+      if ( from_sw == NULL || to_sw == NULL ) {
+        continue;
+      }
+      port_entry *from_port = lookup_port_entry( from_sw, port_no, NULL );
+      port_entry *to_port = lookup_port_entry( to_sw, port_no, NULL );
+      if ( from_port == NULL || to_port == NULL ) {
+        continue;
+      }
+      update_link_to( from_port, &to_datapath_id, port_no, true );
+      links++;
+    }
+  }
+
+  return links;
+}
+
+
+static int
+receive_port_status( int n_switches ) {
+  char name[ OFP_MAX_PORT_NAME_LEN ];
+  int found = 0;
+
+  for ( int i = 0; i < n_switches; i++ ) {
+    uint64_t datapath_id = ( uint64_t ) i + 1;
+    for ( uint16_t port_no = 1; port_no <= NUMBER_OF_PORTS; port_no++ ) {
+      sw_entry *sw = lookup_sw_entry( &datapath_id );
+      port_name( name, sizeof( name ), port_no );
+      if ( sw != NULL && lookup_port_entry( sw, port_no, name ) != NULL ) {
+        found++;
+      }
+    }
+  }
+
+  return found;
+}
+
+
+static void
+count_port( port_entry *entry, void *user_data ) {
+  int *count = user_data;
+
+  if ( entry->link_to != NULL ) {
+    ( *count )++;
+  }
+}
+
+
+int
+main( int argc, char *argv[] ) {
+  int n_switches = DEFAULT_NUMBER_OF_SWITCHES;
+  struct timespec start, end;
+
+  if ( argc > 1 ) {
+    n_switches = atoi( argv[ 1 ] );
+  }
+  if ( n_switches <= 0 ) {
+    fprintf( stderr, "Usage: %s [NUMBER_OF_SWITCHES]\n", argv[ 0 ] );
+    return 1;
+  }
+  int n_ports = n_switches * NUMBER_OF_PORTS;
+
+  init_topology_table();
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  add_switches( n_switches );
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  printf( "add %d switches ( %d ports )    %9.1f ms ( %.1f ns/port )\n", n_switches, n_ports,
+          elapsed_ms( &start, &end ), elapsed_ms( &start, &end ) * 1e6 / n_ports );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  int links = receive_lldp_packets( n_switches );
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  printf( "receive %d LLDP packets     %9.1f ms ( %.1f ns/packet )\n", links,
+          elapsed_ms( &start, &end ), elapsed_ms( &start, &end ) * 1e6 / n_ports );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  int found = receive_port_status( n_switches );
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  printf( "receive %d port status     %9.1f ms ( %.1f ns/message )\n", found,
+          elapsed_ms( &start, &end ), elapsed_ms( &start, &end ) * 1e6 / n_ports );
+
+  int linked = 0;
+  foreach_port_entry( count_port, &linked );
+
+  finalize_topology_table();
+
+  return linked == n_ports && found == n_ports ? 0 : 1;
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
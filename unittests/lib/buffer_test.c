@@ -45,6 +45,8 @@ typedef struct private_buffer {
   size_t real_length;
   void *top;
   pthread_mutex_t *mutex;
+  int *refcount;
+  bool external;
 } private_buffer;
 
 
@@ -116,11 +118,8 @@ static void
 test_alloc_buffer_succeeds() {
   buffer *buf = alloc_buffer();
   assert_true( buf != NULL );
-  assert_true( mutex_initialized );
+  assert_false( mutex_initialized );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -129,11 +128,8 @@ static void
 test_alloc_buffer_with_length_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
-  assert_true( mutex_initialized );
+  assert_false( mutex_initialized );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -146,17 +142,55 @@ test_alloc_buffer_with_length_fails_if_length_is_0() {
 
 
 static void
-test_free_buffer_succeeds() {
-  buffer *buf = alloc_buffer();
+test_alloc_thread_safe_buffer_locks_buffer() {
+  buffer *buf = alloc_thread_safe_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
+  assert_true( mutex_initialized );
 
   pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+  assert_true( expected_mutex != NULL );
+  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
+  void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
+  assert_true( data_pointer != NULL );
+
+  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
+  free_buffer( buf );
+  assert_false( mutex_initialized );
+}
+
+
+static void
+test_share_buffer_of_thread_safe_buffer_is_thread_safe() {
+  buffer *buf = alloc_thread_safe_buffer();
+  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
+
+  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
+  buffer *shared = share_buffer( buf );
+  pthread_mutex_t *expected_shared_mutex = ( ( private_buffer * ) shared )->mutex;
+  assert_true( expected_shared_mutex != NULL );
+  assert_true( expected_shared_mutex != expected_mutex );
+
+  expect_value( mock_pthread_mutex_lock, mutex, expected_shared_mutex );
+  expect_value( mock_pthread_mutex_unlock, mutex, expected_shared_mutex );
+  free_buffer( shared );
   expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
 
+static void
+test_free_buffer_succeeds() {
+  buffer *buf = alloc_buffer();
+  assert_true( buf != NULL );
+
+  free_buffer( buf );
+}
+
+
 static void
 test_free_buffer_fails_if_buffer_pointer_is_NULL() {
   expect_assert_failure( free_buffer( NULL ) );
@@ -168,15 +202,10 @@ test_append_front_buffer_new_alloc_succeeds() {
   buffer *buf = alloc_buffer();
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -186,17 +215,12 @@ test_append_front_twice_suceeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) );
 
   memcpy( data_pointer, &CEYLON, sizeof( tea ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   data_pointer = append_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) * 2 );
@@ -204,8 +228,6 @@ test_append_front_twice_suceeds() {
   tea *tea_data = ( tea * ) ( ( char * ) data_pointer + sizeof( tea ) );
   assert_true( 0 == strcmp( tea_data->name, CEYLON.name ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -215,21 +237,14 @@ test_append_front_buffer_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   data_pointer = append_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) * 2 );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -239,15 +254,10 @@ test_append_front_buffer_resize_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) * 2 );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) * 2 );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -265,9 +275,6 @@ test_append_front_buffer_fails_if_length_is_0() {
 
   expect_assert_failure( append_front_buffer( buf, 0 ) );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -276,21 +283,14 @@ test_remove_front_buffer_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) * 2 );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) * 2 );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   data_pointer = remove_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -300,25 +300,18 @@ test_remove_front_buffer_text_insert_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) * 2 );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) * 2 );
 
   memcpy( ( char * ) data_pointer + sizeof( tea ), &CEYLON, sizeof( tea ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   data_pointer = remove_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) );
   tea *tea_data = ( tea * ) ( ( char * ) buf->data );
   assert_true( 0 == strcmp( tea_data->name, CEYLON.name ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -328,21 +321,14 @@ test_remove_front_buffer_all_removed() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( data_pointer == buf->data );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   data_pointer = remove_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == 0 );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -352,18 +338,12 @@ test_remove_front_buffer_fails_if_large_length_remove() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( data_pointer == buf->data );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_assert_failure( remove_front_buffer( buf, sizeof( tea ) * 2 ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -381,9 +361,6 @@ test_remove_front_buffer_fails_if_remove_size_is_0() {
 
   expect_assert_failure( remove_front_buffer( buf, 0 ) );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -393,15 +370,10 @@ test_append_back_buffer_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -411,17 +383,12 @@ test_append_back_twice_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 3 );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) );
 
   memcpy( data_pointer, &CEYLON, sizeof( tea ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   data_pointer = append_back_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) * 2 );
@@ -433,8 +400,6 @@ test_append_back_twice_succeeds() {
   tea_data = ( tea * ) ( ( char * ) buf->data + sizeof( tea ) );
   assert_true( 0 == strcmp( tea_data->name, DARJEELING.name ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -444,15 +409,10 @@ test_append_back_buffer_resize_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_back_buffer( buf, sizeof( tea ) * 2 );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) * 2 );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -462,15 +422,10 @@ test_append_back_buffer_succeeds_if_initialize_length_is_0() {
   buffer *buf = alloc_buffer();
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
   assert_true( data_pointer != NULL );
   assert_true( buf->length == sizeof( tea ) );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -488,9 +443,6 @@ test_append_back_buffer_fails_if_length_is_0() {
 
   expect_assert_failure( append_back_buffer( buf, 0 ) );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -500,20 +452,12 @@ test_duplicate_buffer_succeeds() {
   buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
   assert_true( buf != NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   buffer *duplicate = duplicate_buffer( buf );
   assert_true( duplicate != NULL );
   assert_true( duplicate->user_data == buf->user_data );
   assert_true( duplicate->length == buf->length );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
-  pthread_mutex_t *expected_duplicate_mutex = ( ( private_buffer * ) duplicate )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_duplicate_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_duplicate_mutex );
   free_buffer( duplicate );
 }
 
@@ -524,21 +468,13 @@ test_duplicate_buffer_succeeds_if_initialize_length_is_0() {
   assert_true( buf != NULL );
   assert_true( buf->data == NULL );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   buffer *duplicate = duplicate_buffer( buf );
   assert_true( duplicate != NULL );
   assert_true( duplicate->data == NULL );
   assert_true( duplicate->user_data == NULL );
   assert_true( duplicate->length == 0 );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
-  pthread_mutex_t *expected_duplicate_mutex = ( ( private_buffer * ) duplicate )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_duplicate_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_duplicate_mutex );
   free_buffer( duplicate );
 }
 
@@ -550,13 +486,145 @@ test_duplicate_buffer_fails_if_buffer_is_NULL() {
 
   expect_assert_failure( duplicate_buffer( NULL ) );
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
 
+static void
+test_alloc_buffer_with_headroom_succeeds() {
+  buffer *buf = alloc_buffer_with_headroom( sizeof( tea ), sizeof( tea ) );
+  assert_true( buf != NULL );
+  assert_true( buf->length == 0 );
+
+  void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
+  memcpy( data_pointer, &CEYLON, sizeof( tea ) );
+
+  void *header = append_front_buffer( buf, sizeof( tea ) );
+  assert_true( header == ( ( private_buffer * ) buf )->top );
+  assert_true( ( char * ) header + sizeof( tea ) == data_pointer );
+  assert_true( buf->length == sizeof( tea ) * 2 );
+  tea *tea_data = ( tea * ) ( ( char * ) buf->data + sizeof( tea ) );
+  assert_true( 0 == strcmp( tea_data->name, CEYLON.name ) );
+
+  free_buffer( buf );
+}
+
+
+static void
+test_append_front_buffer_after_remove_front_reuses_headroom() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) * 2 );
+
+  void *data_pointer = append_back_buffer( buf, sizeof( tea ) * 2 );
+
+  remove_front_buffer( buf, sizeof( tea ) );
+
+  assert_true( append_front_buffer( buf, sizeof( tea ) ) == data_pointer );
+  assert_true( buf->length == sizeof( tea ) * 2 );
+
+  free_buffer( buf );
+}
+
+
+static void
+test_wrap_buffer_does_not_copy_nor_free_data() {
+  tea data = CEYLON;
+
+  buffer *buf = wrap_buffer( &data, sizeof( tea ) );
+  assert_true( buf != NULL );
+  assert_true( buf->data == &data );
+  assert_true( buf->length == sizeof( tea ) );
+
+  free_buffer( buf );
+
+  assert_true( 0 == strcmp( data.name, CEYLON.name ) );
+}
+
+
+static void
+test_append_back_buffer_copies_wrapped_data() {
+  tea data = CEYLON;
+
+  buffer *buf = wrap_buffer( &data, sizeof( tea ) );
+
+  void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
+  memcpy( data_pointer, &DARJEELING, sizeof( tea ) );
+  assert_true( buf->data != &data );
+  assert_true( buf->length == sizeof( tea ) * 2 );
+  assert_true( 0 == strcmp( ( ( tea * ) buf->data )->name, CEYLON.name ) );
+
+  free_buffer( buf );
+}
+
+
+static void
+test_append_front_buffer_uses_headroom_lent_to_wrapped_buffer() {
+  tea data[ 2 ] = { DARJEELING, CEYLON };
+
+  buffer *buf = wrap_buffer_with_headroom( &data[ 1 ], sizeof( tea ), sizeof( tea ) );
+  assert_true( buf->data == &data[ 1 ] );
+
+  assert_true( append_front_buffer( buf, sizeof( tea ) ) == &data[ 0 ] );
+  assert_true( buf->length == sizeof( tea ) * 2 );
+
+  // No more headroom.
+  void *data_pointer = append_front_buffer( buf, sizeof( tea ) );
+  assert_true( data_pointer != &data[ 0 ] );
+  assert_true( buf->length == sizeof( tea ) * 3 );
+
+  free_buffer( buf );
+
+  assert_true( 0 == strcmp( data[ 1 ].name, CEYLON.name ) );
+}
+
+
+static void
+test_share_buffer_succeeds() {
+  buffer *buf = alloc_buffer_with_length( sizeof( tea ) );
+  void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
+  memcpy( data_pointer, &CEYLON, sizeof( tea ) );
+  buf->user_data = &DARJEELING;
+
+  buffer *shared = share_buffer( buf );
+  assert_true( shared != NULL );
+  assert_true( shared->data == buf->data );
+  assert_true( shared->length == buf->length );
+  assert_true( shared->user_data == buf->user_data );
+
+  // The data area must survive until the last reference is dropped.
+  free_buffer( buf );
+  assert_true( 0 == strcmp( ( ( tea * ) shared->data )->name, CEYLON.name ) );
+
+  free_buffer( shared );
+}
+
+
+static void
+test_append_front_buffer_copies_shared_data() {
+  buffer *buf = alloc_buffer_with_headroom( sizeof( tea ), sizeof( tea ) );
+  void *data_pointer = append_back_buffer( buf, sizeof( tea ) );
+  memcpy( data_pointer, &CEYLON, sizeof( tea ) );
+
+  buffer *shared = share_buffer( buf );
+
+  void *header = append_front_buffer( shared, sizeof( tea ) );
+  memcpy( header, &DARJEELING, sizeof( tea ) );
+  assert_true( shared->data != ( ( private_buffer * ) buf )->top );
+  assert_true( buf->data == data_pointer );
+  assert_true( 0 == strcmp( ( ( tea * ) buf->data )->name, CEYLON.name ) );
+  assert_true( 0 == strcmp( ( ( tea * ) shared->data )->name, DARJEELING.name ) );
+  assert_true( 0 == strcmp( ( ( tea * ) shared->data + 1 )->name, CEYLON.name ) );
+
+  free_buffer( buf );
+  free_buffer( shared );
+}
+
+
+static void
+test_share_buffer_fails_if_buffer_is_NULL() {
+  expect_assert_failure( share_buffer( NULL ) );
+}
+
+
 static void
 dump_function( const char *format, ... ) {
   char hex[ 1000 ];
@@ -574,20 +642,13 @@ static void
 test_dump_buffer() {
   buffer *buf = alloc_buffer();
 
-  pthread_mutex_t *expected_mutex = ( ( private_buffer * ) buf )->mutex;
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   void *datap = append_back_buffer( buf, ( size_t ) 1 );
   int data255 = 255;
   memcpy( datap, &data255, ( size_t ) 1 );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
   expect_string( dump_function, hex, "ff" );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   dump_buffer( buf, dump_function );
 
-  expect_value( mock_pthread_mutex_lock, mutex, expected_mutex );
-  expect_value( mock_pthread_mutex_unlock, mutex, expected_mutex );
   free_buffer( buf );
 }
 
@@ -603,6 +664,8 @@ main() {
     unit_test( test_alloc_buffer_with_length_succeeds ),
     unit_test( test_alloc_buffer_with_length_fails_if_length_is_0 ),
 
+    unit_test( test_alloc_thread_safe_buffer_locks_buffer ),
+    unit_test( test_share_buffer_of_thread_safe_buffer_is_thread_safe ),
     unit_test( test_free_buffer_succeeds ),
     unit_test( test_free_buffer_fails_if_buffer_pointer_is_NULL ),
 
@@ -631,6 +694,17 @@ main() {
     unit_test( test_duplicate_buffer_succeeds_if_initialize_length_is_0 ),
     unit_test( test_duplicate_buffer_fails_if_buffer_is_NULL ),
 
+    unit_test( test_alloc_buffer_with_headroom_succeeds ),
+    unit_test( test_append_front_buffer_after_remove_front_reuses_headroom ),
+
+    unit_test( test_wrap_buffer_does_not_copy_nor_free_data ),
+    unit_test( test_append_back_buffer_copies_wrapped_data ),
+    unit_test( test_append_front_buffer_uses_headroom_lent_to_wrapped_buffer ),
+
+    unit_test( test_share_buffer_succeeds ),
+    unit_test( test_append_front_buffer_copies_shared_data ),
+    unit_test( test_share_buffer_fails_if_buffer_is_NULL ),
+
     unit_test( test_dump_buffer ),
   };
   return run_tests( tests );
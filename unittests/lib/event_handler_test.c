@@ -0,0 +1,248 @@
+/*
+ * Unit tests for event_handler.[ch]
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "checks.h"
+#include "cmockery_trema.h"
+#include "event_handler.h"
+
+
+/********************************************************************************
+ * Mocks.
+ ********************************************************************************/
+
+void
+mock_error( const char *format, ... ) {
+  // Do nothing.
+  UNUSED( format );
+}
+
+
+void
+mock_debug( const char *format, ... ) {
+  // Do nothing.
+  UNUSED( format );
+}
+
+
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+static int fds[ 2 ];
+
+
+static void
+setup() {
+  assert_true( init_event_handler() );
+  assert_int_equal( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+}
+
+
+static void
+teardown() {
+  close( fds[ 0 ] );
+  close( fds[ 1 ] );
+  assert_true( finalize_event_handler() );
+}
+
+
+static void
+read_callback( int fd, void *data ) {
+  check_expected( fd );
+  check_expected( data );
+
+  char buf[ 16 ];
+  assert_true( read( fd, buf, sizeof( buf ) ) > 0 );
+}
+
+
+static void
+write_callback( int fd, void *data ) {
+  check_expected( fd );
+  check_expected( data );
+}
+
+
+static void
+wait_for_events( int fd, int timeout_msec ) {
+  assert_true( fd >= 0 );
+  check_expected( timeout_msec );
+}
+
+
+static void
+delete_self_callback( int fd, void *data ) {
+  UNUSED( data );
+
+  check_expected( fd );
+  assert_true( delete_fd_handler( fd ) );
+}
+
+
+/********************************************************************************
+ * Tests.
+ ********************************************************************************/
+
+static void
+test_read_callback_is_called_when_readable() {
+  char user_data[] = "read";
+
+  assert_true( set_fd_handler( fds[ 0 ], read_callback, user_data, NULL, NULL ) );
+  assert_true( set_readable( fds[ 0 ], true ) );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  expect_value( read_callback, fd, fds[ 0 ] );
+  expect_value( read_callback, data, user_data );
+  assert_true( run_event_handler_once( 100 ) );
+
+  assert_true( delete_fd_handler( fds[ 0 ] ) );
+}
+
+
+static void
+test_read_callback_is_not_called_unless_readable_is_set() {
+  char user_data[] = "read";
+
+  assert_true( set_fd_handler( fds[ 0 ], read_callback, user_data, NULL, NULL ) );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  assert_true( run_event_handler_once( 0 ) );
+
+  assert_true( set_readable( fds[ 0 ], true ) );
+  assert_true( set_readable( fds[ 0 ], false ) );
+  assert_true( run_event_handler_once( 0 ) );
+
+  assert_true( delete_fd_handler( fds[ 0 ] ) );
+}
+
+
+static void
+test_write_callback_is_called_when_writable() {
+  char user_data[] = "write";
+
+  assert_true( set_fd_handler( fds[ 0 ], NULL, NULL, write_callback, user_data ) );
+  assert_true( set_writable( fds[ 0 ], true ) );
+
+  expect_value( write_callback, fd, fds[ 0 ] );
+  expect_value( write_callback, data, user_data );
+  assert_true( run_event_handler_once( 100 ) );
+
+  assert_true( set_writable( fds[ 0 ], false ) );
+  assert_true( run_event_handler_once( 0 ) );
+
+  assert_true( delete_fd_handler( fds[ 0 ] ) );
+}
+
+
+static void
+test_callback_can_delete_its_own_handler() {
+  assert_true( set_fd_handler( fds[ 0 ], delete_self_callback, NULL, write_callback, NULL ) );
+  assert_true( set_readable( fds[ 0 ], true ) );
+  assert_true( set_writable( fds[ 0 ], true ) );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  // write_callback must not be called after the handler is deleted.
+  expect_value( delete_self_callback, fd, fds[ 0 ] );
+  assert_true( run_event_handler_once( 100 ) );
+  assert_true( run_event_handler_once( 0 ) );
+}
+
+
+static void
+test_wait_function_is_called_before_polling() {
+  char user_data[] = "read";
+
+  set_event_wait_function( wait_for_events );
+  assert_true( set_fd_handler( fds[ 0 ], read_callback, user_data, NULL, NULL ) );
+  assert_true( set_readable( fds[ 0 ], true ) );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  expect_value( wait_for_events, timeout_msec, 100 );
+  expect_value( read_callback, fd, fds[ 0 ] );
+  expect_value( read_callback, data, user_data );
+  assert_true( run_event_handler_once( 100 ) );
+
+  // Not called if the event handler does not block.
+  assert_true( run_event_handler_once( 0 ) );
+
+  set_event_wait_function( NULL );
+  assert_true( delete_fd_handler( fds[ 0 ] ) );
+}
+
+
+static void
+test_fd_beyond_initial_table_size() {
+  setup();
+
+  int high_fd = dup2( fds[ 0 ], 1000 );
+  assert_int_equal( high_fd, 1000 );
+  char user_data[] = "high";
+
+  assert_true( set_fd_handler( high_fd, read_callback, user_data, NULL, NULL ) );
+  assert_true( set_readable( high_fd, true ) );
+  assert_int_equal( write( fds[ 1 ], "x", 1 ), 1 );
+
+  expect_value( read_callback, fd, high_fd );
+  expect_value( read_callback, data, user_data );
+  assert_true( run_event_handler_once( 100 ) );
+
+  assert_true( delete_fd_handler( high_fd ) );
+  close( high_fd );
+
+  teardown();
+}
+
+
+static void
+test_set_readable_fails_without_handler() {
+  assert_false( set_readable( fds[ 0 ], true ) );
+  assert_false( set_writable( fds[ 0 ], true ) );
+  assert_false( delete_fd_handler( fds[ 0 ] ) );
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test_setup_teardown( test_read_callback_is_called_when_readable, setup, teardown ),
+    unit_test_setup_teardown( test_read_callback_is_not_called_unless_readable_is_set, setup, teardown ),
+    unit_test_setup_teardown( test_write_callback_is_called_when_writable, setup, teardown ),
+    unit_test_setup_teardown( test_callback_can_delete_its_own_handler, setup, teardown ),
+    unit_test_setup_teardown( test_wait_function_is_called_before_polling, setup, teardown ),
+    unit_test( test_fd_beyond_initial_table_size ),
+    unit_test_setup_teardown( test_set_readable_fails_without_handler, setup, teardown ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -20,6 +20,7 @@
  */
 
 
+#include <limits.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -285,12 +286,148 @@ test_iterate_empty_hash() {
 }
 
 
+#define NUMBER_OF_KEYS 10000
+
+static unsigned int keys[ NUMBER_OF_KEYS ];
+
+
+static unsigned int
+hash_key( const void *key ) {
+  return *( const unsigned int * ) key;
+}
+
+
+static bool
+compare_key( const void *x, const void *y ) {
+  return *( const unsigned int * ) x == *( const unsigned int * ) y;
+}
+
+
+static void
+test_create_hash_with_size_does_not_resize() {
+  table = create_hash_with_size( compare_atom, hash_atom, NUMBER_OF_KEYS );
+  unsigned int size = table->number_of_buckets;
+
+  for ( int i = 0; i < NUMBER_OF_KEYS; i++ ) {
+    insert_hash_entry( table, &keys[ i ], &keys[ i ] );
+  }
+  assert_int_equal( table->number_of_buckets, size );
+  assert_int_equal( table->length, NUMBER_OF_KEYS );
+
+  delete_hash( table );
+}
+
+
+static void
+test_grow_keeps_all_entries() {
+  table = create_hash_with_size( compare_atom, hash_atom, 1 );
+  unsigned int size = table->number_of_buckets;
+
+  for ( int i = 0; i < NUMBER_OF_KEYS; i++ ) {
+    assert_true( insert_hash_entry( table, &keys[ i ], &keys[ i ] ) == NULL );
+    // Entries inserted so far must be found while resizing is in progress.
+    assert_true( lookup_hash_entry( table, &keys[ i / 2 ] ) == &keys[ i / 2 ] );
+  }
+  assert_true( table->number_of_buckets > size );
+  assert_int_equal( table->length, NUMBER_OF_KEYS );
+
+  for ( int i = 0; i < NUMBER_OF_KEYS; i += 2 ) {
+    assert_true( delete_hash_entry( table, &keys[ i ] ) == &keys[ i ] );
+  }
+  for ( int i = 0; i < NUMBER_OF_KEYS; i++ ) {
+    assert_true( lookup_hash_entry( table, &keys[ i ] ) == ( i % 2 == 0 ? NULL : &keys[ i ] ) );
+  }
+  assert_int_equal( table->length, NUMBER_OF_KEYS / 2 );
+
+  delete_hash( table );
+}
+
+
+static void
+test_duplicated_keys_survive_resize() {
+  table = create_hash( compare_key, hash_key );
+
+  unsigned int key[] = { UINT_MAX };
+  insert_hash_entry( table, key, alpha );
+  for ( int i = 0; i < NUMBER_OF_KEYS / 2; i++ ) {
+    insert_hash_entry( table, &keys[ i ], &keys[ i ] );
+  }
+  insert_hash_entry( table, key, bravo );
+  for ( int i = NUMBER_OF_KEYS / 2; i < NUMBER_OF_KEYS; i++ ) {
+    insert_hash_entry( table, &keys[ i ], &keys[ i ] );
+  }
+  insert_hash_entry( table, key, charlie );
+
+  abc0[ 0 ] = abc0[ 1 ] = abc0[ 2 ] = NULL;
+  map_hash( table, key, append_back, NULL );
+  assert_string_equal( abc0[ 0 ], "charlie" );
+  assert_string_equal( abc0[ 1 ], "bravo" );
+  assert_string_equal( abc0[ 2 ], "alpha" );
+
+  assert_string_equal( delete_hash_entry( table, key ), "charlie" );
+  assert_string_equal( lookup_hash_entry( table, key ), "bravo" );
+
+  delete_hash( table );
+}
+
+
+static void
+test_delete_all_while_iterating_during_resize() {
+  table = create_hash_with_size( compare_key, hash_key, 1 );
+
+  // Stop right after resizing has started.
+  unsigned int size = table->number_of_buckets;
+  int n = 0;
+  while ( table->number_of_buckets == size ) {
+    insert_hash_entry( table, &keys[ n ], &keys[ n ] );
+    n++;
+  }
+
+  int count = 0;
+  hash_iterator iter;
+  hash_entry *e;
+  init_hash_iterator( table, &iter );
+  while ( ( e = iterate_hash_next( &iter ) ) != NULL ) {
+    delete_hash_entry( table, e->key );
+    count++;
+  }
+  assert_int_equal( count, n );
+  assert_int_equal( table->length, 0 );
+
+  delete_hash( table );
+}
+
+
+static void
+test_thread_safe_hash() {
+  table = create_thread_safe_hash( compare_string, hash_string, 3 );
+
+  insert_hash_entry( table, alpha, alpha );
+  insert_hash_entry( table, bravo, bravo );
+  assert_string_equal( lookup_hash_entry( table, alpha ), "alpha" );
+  assert_string_equal( delete_hash_entry( table, bravo ), "bravo" );
+  assert_true( lookup_hash_entry( table, bravo ) == NULL );
+
+  delete_hash( table );
+}
+
+
+static void
+setup_keys() {
+  for ( unsigned int i = 0; i < NUMBER_OF_KEYS; i++ ) {
+    keys[ i ] = i * 7919;
+  }
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
 
 int
 main() {
+  setup_keys();
+
   const UnitTest tests[] = {
     unit_test( test_lookup_empty_table_returns_NULL ),
     unit_test( test_insert_and_lookup ),
@@ -303,6 +440,11 @@ main() {
     unit_test( test_iterator ),
     unit_test( test_multiple_inserts_and_deletes_then_iterate ),
     unit_test( test_iterate_empty_hash ),
+    unit_test( test_create_hash_with_size_does_not_resize ),
+    unit_test( test_grow_keeps_all_entries ),
+    unit_test( test_duplicated_keys_survive_resize ),
+    unit_test( test_delete_all_while_iterating_during_resize ),
+    unit_test( test_thread_safe_hash ),
   };
   return run_tests( tests );
 }
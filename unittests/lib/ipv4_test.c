@@ -137,6 +137,17 @@ test_parse_ipv4_fails_if_checksum_has_incorrect_value() {
 }
 
 
+static void
+test_parse_ipv4_fails_if_ihl_exceeds_packet_size() {
+  buffer *buf = setup_dummy_ipv4_packet();
+  packet_info( buf )->l3_data.ipv4->ihl = 15;
+
+  assert_int_equal( parse_ipv4( buf ), false );
+
+  free_packet( buf );
+}
+
+
 static void
 test_parse_ipv4_fails_if_fragment_does_not_have_any_data() {
   buffer *buf = setup_dummy_ipv4_packet( );
@@ -283,6 +294,7 @@ main() {
     unit_test( test_parse_ipv4_fails_if_version_is_not_ipv4 ),
     unit_test( test_parse_ipv4_fails_if_ihl_is_too_small ),
     unit_test( test_parse_ipv4_fails_if_checksum_has_incorrect_value ),
+    unit_test( test_parse_ipv4_fails_if_ihl_exceeds_packet_size ),
     unit_test( test_parse_ipv4_fails_if_fragment_does_not_have_any_data ),
     unit_test( test_parse_ipv4_fails_if_packet_size_is_too_big ),
     unit_test( test_parse_ipv4_fails_if_tot_len_has_incorrect_value ),
@@ -20,15 +20,19 @@
  */
 
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/wait.h>
 #include <syslog.h>
+#include <unistd.h>
 #include "checks.h"
 #include "cmockery_trema.h"
 #include "log.h"
 
 
-extern int level;
+extern int _logging_level;
+extern pthread_mutex_t mutex;
 
 
 int logging_level_from( const char *name );
@@ -110,7 +114,7 @@ void
 test_init_log_reads_LOGING_LEVEL_environment_variable() {
   setenv( "LOGGING_LEVEL", "CRITICAL", 1 );
   assert_true( init_log( "tetris", true ) );
-  assert_int_equal( level, LOG_CRIT );
+  assert_int_equal( _logging_level, LOG_CRIT );
 }
 
 
@@ -120,14 +124,14 @@ test_init_log_reads_LOGING_LEVEL_environment_variable() {
 
 void
 test_default_logging_level_is_INFO() {
-  assert_int_equal( level, LOG_INFO );
+  assert_int_equal( _logging_level, LOG_INFO );
 }
 
 
 void
 test_set_logging_level_succeed() {
   set_logging_level( "critical" );
-  assert_int_equal( level, LOG_CRIT );
+  assert_int_equal( _logging_level, LOG_CRIT );
 }
 
 
@@ -371,6 +375,7 @@ test_info_logs_if_logging_level_is_DEBUG() {
 
 void
 test_info_fail_if_NULL() {
+  set_logging_level( "info" );
   expect_assert_failure( info( NULL ) );
 }
 
@@ -388,6 +393,24 @@ test_DEBUG_donothing_if_logging_level_is_INFO() {
 }
 
 
+static int
+count_evaluation( int *times ) {
+  return ++( *times );
+}
+
+
+void
+test_DEBUG_does_not_evaluate_arguments_if_logging_level_is_INFO() {
+  int times = 0;
+
+  set_logging_level( "info" );
+  debug( "This message should not be logged ( %d ).", count_evaluation( &times ) );
+
+  assert_int_equal( times, 0 );
+  assert_true( times_vsyslog_called == 0 );
+}
+
+
 void
 test_DEBUG_logs_if_logging_level_is_DEBUG() {
   expect_value( mock_vsyslog, priority, LOG_DEBUG );
@@ -400,10 +423,110 @@ test_DEBUG_logs_if_logging_level_is_DEBUG() {
 
 void
 test_debug_fail_if_NULL() {
+  set_logging_level( "debug" );
   expect_assert_failure( debug( NULL ) );
 }
 
 
+/********************************************************************************
+ * Asynchronous logging tests.
+ ********************************************************************************/
+
+void
+test_async_logging_writes_messages_in_background() {
+  uint64_t written, dropped, written_before, dropped_before;
+  get_async_logging_stats( &written_before, &dropped_before );
+
+  expect_value( mock_vsyslog, priority, LOG_INFO );
+  expect_string( mock_vsyslog, output, "INFO message 1." );
+  expect_value( mock_vsyslog, priority, LOG_ERR );
+  expect_string( mock_vsyslog, output, "ERROR message 2." );
+
+  init_log( "tetris", true );
+  set_logging_level( "info" );
+  assert_true( enable_async_logging( 16 ) );
+  info( "INFO message %d.", 1 );
+  debug( "This message should not be logged." );
+  error( "ERROR message %d.", 2 );
+  assert_true( disable_async_logging() );
+
+  assert_true( times_vsyslog_called == 2 );
+  get_async_logging_stats( &written, &dropped );
+  assert_true( written - written_before == 2 );
+  assert_true( dropped - dropped_before == 0 );
+}
+
+
+void
+test_async_logging_drops_messages_if_ring_is_full() {
+  uint64_t written, dropped, written_before, dropped_before;
+  get_async_logging_stats( &written_before, &dropped_before );
+
+  // Two messages and a report on the dropped one, in any order.
+  for ( int i = 0; i < 3; i++ ) {
+    expect_any( mock_vsyslog, priority );
+    expect_any( mock_vsyslog, output );
+  }
+
+  init_log( "tetris", true );
+  set_logging_level( "info" );
+  assert_true( enable_async_logging( 2 ) );
+
+  // Keep the writer from freeing any slot.
+  pthread_mutex_lock( &mutex );
+  info( "INFO message 1." );
+  info( "INFO message 2." );
+  info( "INFO message 3." );
+  pthread_mutex_unlock( &mutex );
+
+  assert_true( disable_async_logging() );
+
+  assert_true( times_vsyslog_called == 3 );
+  get_async_logging_stats( &written, &dropped );
+  assert_true( written - written_before == 2 );
+  assert_true( dropped - dropped_before == 1 );
+}
+
+
+void
+test_async_logging_leaves_pending_messages_to_parent_on_fork() {
+  expect_value( mock_vsyslog, priority, LOG_INFO );
+  expect_string( mock_vsyslog, output, "INFO message 1." );
+  expect_value( mock_vsyslog, priority, LOG_INFO );
+  expect_string( mock_vsyslog, output, "INFO message 2." );
+
+  init_log( "tetris", true );
+  set_logging_level( "info" );
+  assert_true( enable_async_logging( 16 ) );
+
+  // Keep both messages pending in the ring across fork().
+  pthread_mutex_lock( &mutex );
+  info( "INFO message 1." );
+  info( "INFO message 2." );
+  pid_t pid = fork();
+  if ( pid == 0 ) {
+    disable_async_logging();
+    _exit( times_vsyslog_called );
+  }
+  pthread_mutex_unlock( &mutex );
+  assert_true( pid > 0 );
+
+  int status;
+  assert_true( waitpid( pid, &status, 0 ) == pid );
+  assert_true( WIFEXITED( status ) );
+  assert_int_equal( WEXITSTATUS( status ), 0 );
+
+  assert_true( disable_async_logging() );
+  assert_true( times_vsyslog_called == 2 );
+}
+
+
+void
+test_disable_async_logging_fails_if_not_enabled() {
+  assert_false( disable_async_logging() );
+}
+
+
 /********************************************************************************
  * No daemon
  ********************************************************************************/
@@ -483,10 +606,20 @@ main() {
 
     unit_test_setup_teardown( test_DEBUG_donothing_if_logging_level_is_INFO,
         		      reset_times_syslog_called, reset_times_syslog_called ),
+    unit_test_setup_teardown( test_DEBUG_does_not_evaluate_arguments_if_logging_level_is_INFO,
+        		      reset_times_syslog_called, reset_times_syslog_called ),
     unit_test_setup_teardown( test_DEBUG_logs_if_logging_level_is_DEBUG,
         		      reset_times_syslog_called, reset_times_syslog_called ),
     unit_test( test_debug_fail_if_NULL ),
 
+    unit_test_setup_teardown( test_async_logging_writes_messages_in_background,
+        		      reset_times_syslog_called, reset_logging_level ),
+    unit_test_setup_teardown( test_async_logging_drops_messages_if_ring_is_full,
+        		      reset_times_syslog_called, reset_logging_level ),
+    unit_test_setup_teardown( test_async_logging_leaves_pending_messages_to_parent_on_fork,
+        		      reset_times_syslog_called, reset_logging_level ),
+    unit_test( test_disable_async_logging_fails_if_not_enabled ),
+
     unit_test( test_output_to_stdout ),
   };
   return run_tests( tests );
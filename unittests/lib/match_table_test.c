@@ -27,14 +27,16 @@
 #include "checks.h"
 #include "cmockery_trema.h"
 #include "ether.h"
+#include "linked_list.h"
 #include "log.h"
 #include "match_table.h"
 
 
 typedef struct match_table {
   hash_table *exact_table; // no wildcards are set
-  list_element *wildcard_table; // wildcard flags are set
+  list_element *wildcard_table; // tuples of entries with wildcards, highest priority first
   pthread_mutex_t *mutex;
+  uint64_t last_serial;
 } match_table;
 
 
@@ -452,6 +454,85 @@ test_insert_and_delete_of_wildcard_any_lldp_ipv4_entry() {
 }
 
 
+static void
+test_lookup_of_wildcard_entry_prefers_higher_priority_tuple() {
+  setup();
+
+  struct ofp_match match, lookup_match;
+  match_entry *match_entry;
+
+  init_match_table();
+
+  intsert_any_match_entry();
+  intsert_ipv4_match_entry();
+  set_ipv4_match_entry( &match );
+  match.wildcards = ( OFPFW_ALL & ~( OFPFW_DL_TYPE | OFPFW_NW_SRC_MASK ) ) | ( 8 << OFPFW_NW_SRC_SHIFT );
+  match.nw_src = 0x0a000100;
+  insert_match_entry( &match, IPV4_MATCH_PRIORITY + 1, "service-name-subnet", "entry-name-subnet" );
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETHERTYPE_IP;
+  lookup_match.nw_src = 0x0a000101;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, "entry-name-subnet" );
+
+  lookup_match.nw_src = 0x0a000201;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, IPV4_MATCH_ENTRY_NAME );
+
+  lookup_match.dl_type = ETH_ETHTYPE_LLDP;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, ANY_MATCH_ENTRY_NAME );
+
+  finalize_match_table();
+
+  teardown();
+}
+
+
+static void
+test_lookup_of_wildcard_entry_returns_newest_of_same_priority() {
+  setup();
+
+  struct ofp_match match, lookup_match;
+  match_entry *match_entry;
+
+  init_match_table();
+
+  set_any_match_entry( &match );
+  insert_match_entry( &match, LLDP_MATCH_PRIORITY, ANY_MATCH_SERVICE_NAME, "entry-name-any-1" );
+  intsert_lldp_match_entry();
+
+  memset( &lookup_match, 0, sizeof( struct ofp_match ) );
+  lookup_match.dl_type = ETH_ETHTYPE_LLDP;
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, LLDP_MATCH_ENTRY_NAME );
+
+  insert_match_entry( &match, LLDP_MATCH_PRIORITY, ANY_MATCH_SERVICE_NAME, "entry-name-any-2" );
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, "entry-name-any-2" );
+
+  delete_match_entry( &match );
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, LLDP_MATCH_ENTRY_NAME );
+
+  delete_lldp_match_entry();
+  match_entry = lookup_match_entry( &lookup_match );
+  assert_true( match_entry != NULL );
+  assert_string_equal( match_entry->entry_name, "entry-name-any-1" );
+
+  finalize_match_table();
+
+  teardown();
+}
+
+
 static void
 set_alice_match_entry( struct ofp_match *match ) {
   memset( match, 0, sizeof( struct ofp_match ) );
@@ -769,6 +850,8 @@ main() {
     unit_test( test_delete_of_wildcard_any_entry_failed ),
     unit_test( test_insert_and_delete_of_wildcard_any_entry ),
     unit_test( test_insert_and_delete_of_wildcard_any_lldp_ipv4_entry ),
+    unit_test( test_lookup_of_wildcard_entry_prefers_higher_priority_tuple ),
+    unit_test( test_lookup_of_wildcard_entry_returns_newest_of_same_priority ),
     unit_test( test_insert_and_lookup_of_exact_alice_entry ),
     unit_test( test_insert_and_lookup_of_exact_alice_entry_conflict ),
     unit_test( test_insert_and_lookup_of_exact_all_entry ),
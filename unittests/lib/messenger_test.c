@@ -35,6 +35,7 @@
 #include "doubly_linked_list.h"
 #include "hash_table.h"
 #include "messenger.h"
+#include "shared_memory_ring.h"
 #include "timer.h"
 #include "wrapper.h"
 
@@ -46,6 +47,9 @@ enum {
   MESSAGE_TYPE_NOTIFY,
   MESSAGE_TYPE_REQUEST,
   MESSAGE_TYPE_REPLY,
+  MESSAGE_TYPE_RING_OFFER,
+  MESSAGE_TYPE_RING_ACCEPT,
+  MESSAGE_TYPE_RING_START,
 };
 
 typedef struct message_header {
@@ -60,6 +64,7 @@ typedef struct message_buffer {
   void *buffer;
   size_t data_length;
   size_t size;
+  size_t head_offset;
 } message_buffer;
 
 typedef struct messenger_socket {
@@ -93,6 +98,10 @@ typedef struct send_queue {
   struct timespec reconnect_at;
   struct sockaddr_un server_addr;
   message_buffer *buffer;
+  shared_memory_ring *ring;
+  bool ring_active;
+  uint64_t send_syscalls;
+  uint64_t sent_messages;
 } send_queue;
 
 
@@ -100,28 +109,27 @@ static void send_dump_message( uint16_t dump_type, const char *service_name, con
 
 static bool run_once( void );
 
-static void on_accept( int fd, receive_queue *queue );
-static void on_recv( int fd, receive_queue *queue );
-static void on_send( int fd, send_queue *queue );
+static void on_accept( int fd, void *data );
+static void on_recv( int fd, void *data );
+static void on_send_read( int fd, void *data );
+static void on_send_write( int fd, void *data );
 
 static receive_queue *create_receive_queue( const char *service_name );
 static void delete_all_receive_queues( void );
 static void delete_receive_queue( void *service_name, void *queue, void *user_data );
-static int pull_from_recv_queue( receive_queue *queue, uint8_t *message_type, uint16_t *tag, void *data, size_t *len, size_t maxlen );
-static void set_recv_queue_fd_set( fd_set *read_set );
-static void check_recv_queue_fd_isset( fd_set *read_set );
+static int pull_from_recv_queue( receive_queue *queue, uint8_t *message_type, uint16_t *tag, void **data, size_t *len );
 static void add_recv_queue_client_fd( receive_queue *queue, int fd );
 static int del_recv_queue_client_fd( receive_queue *queue, int fd );
 static void call_message_callbacks( receive_queue *rq, const uint8_t message_type, const uint16_t tag, void *data, size_t len );
 
 static send_queue *create_send_queue( const char *service_name );
 static int send_queue_connect( send_queue *queue );
+static int send_queue_reconnect( send_queue *queue );
+static void reconnect_send_queues( void *user_data );
 static void delete_all_send_queues( void );
 static void delete_send_queue( send_queue *sq );
 static void number_of_send_queue( int *connected_count, int *sending_count, int *reconnecting_count, int *closed_count );
 static bool push_message_to_send_queue( const char *service_name, const uint8_t message_type, const uint16_t tag, const void *data, size_t len );
-static void set_send_queue_fd_set( fd_set *read_set, fd_set *write_set );
-static void check_send_queue_fd_isset( fd_set *read_set, fd_set *write_set );
 
 static message_buffer *create_message_buffer( size_t size );
 static bool write_message_buffer( message_buffer *buf, const void *data, size_t len );
@@ -129,8 +137,6 @@ static void truncate_message_buffer( message_buffer *buf, size_t len );
 static void free_message_buffer( message_buffer *buf );
 static size_t message_buffer_remain_bytes( message_buffer *buf );
 
-static void delete_timer_callbacks( void );
-static void execute_timer_events( void );
 
 static messenger_context* insert_context( void *user_data );
 static messenger_context* get_context( uint32_t transaction_id );
@@ -144,14 +150,14 @@ static char socket_directory[ PATH_MAX ];
 static bool running;
 static bool initialized;
 static bool finalized;
+static bool shared_memory_enabled;
 static hash_table *receive_queues;
 static hash_table *send_queues;
 static hash_table *context_db;
-static dlist_element *timer_callbacks;
 static char *_dump_service_name;
 static char *_dump_app_name;
-static void ( *external_fd_set )( fd_set *read_set, fd_set *write_set );
-static void ( *external_check_fd_isset )( fd_set *read_set, fd_set *write_set );
+static unsigned int dump_sampling_rate;
+static unsigned int dump_sampling_count;
 static uint32_t last_transaction_id;
 
 
@@ -181,6 +187,14 @@ mock_execute_timer_events() {
 }
 
 
+bool
+mock_get_next_timer_event_timeout( struct timespec *timeout ) {
+  timeout->tv_sec = 0;
+  timeout->tv_nsec = 100 * 1000 * 1000;
+  return true;
+}
+
+
 bool
 mock_add_periodic_event_callback( const time_t seconds, void ( *callback )( void *user_data ), void *user_data ) {
   UNUSED( seconds );
@@ -225,13 +239,6 @@ mock_connect( int sockfd, const struct sockaddr *addr, socklen_t addrlen ) {
 }
 
 
-static bool fail_mock_select = false;
-int
-mock_select( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout ) {
-  return fail_mock_select ? -1 : select( nfds, readfds, writefds, exceptfds, timeout );
-}
-
-
 static bool fail_mock_accept = false;
 int
 mock_accept( int sockfd, struct sockaddr *addr, socklen_t *addrlen ) {
@@ -246,13 +253,39 @@ mock_recv( int sockfd, void *buf, size_t len, int flags ) {
 }
 
 
+ssize_t
+mock_recvmsg( int sockfd, struct msghdr *msg, int flags ) {
+  return fail_mock_recv ? -1 : recvmsg( sockfd, msg, flags );
+}
+
+
 static bool fail_mock_send = false;
+static int fail_mock_send_fd = -1;
+static bool refuse_mock_ring_offer = false;
 ssize_t
 mock_send( int sockfd, const void *buf, size_t len, int flags ) {
+  if ( sockfd == fail_mock_send_fd ) {
+    errno = EAGAIN;
+    return -1;
+  }
+  const message_header *header = buf;
+  if ( refuse_mock_ring_offer && len >= sizeof( message_header ) && header->message_type == MESSAGE_TYPE_RING_ACCEPT ) {
+    return -1;
+  }
   return fail_mock_send ? -1 : send( sockfd, buf, len, flags );
 }
 
 
+ssize_t
+mock_sendmsg( int sockfd, const struct msghdr *msg, int flags ) {
+  if ( sockfd == fail_mock_send_fd ) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return fail_mock_send ? -1 : sendmsg( sockfd, msg, flags );
+}
+
+
 int
 mock_setsockopt( int s, int level, int optname, const void *optval, socklen_t optlen ) {
   UNUSED( s );
@@ -267,8 +300,9 @@ mock_setsockopt( int s, int level, int optname, const void *optval, socklen_t op
 int
 mock_clock_gettime( clockid_t clk_id, struct timespec *tp ) {
   UNUSED( clk_id );
-  UNUSED( tp );
 
+  tp->tv_sec = 0;
+  tp->tv_nsec = 0;
   return ( int ) mock();
 }
 
@@ -387,8 +421,6 @@ static void
 test_send_then_message_received_callback_is_called() {
   init_messenger( "/tmp" );
 
-  will_return_count( mock_clock_gettime, 0, -1 );
-
   const char service_name[] = "Say HELLO";
 
   expect_value( callback_hello, tag, 43556 );
@@ -406,6 +438,302 @@ test_send_then_message_received_callback_is_called() {
 }
 
 
+static void
+callback_count( uint16_t tag, void *data, size_t len ) {
+  check_expected( tag );
+  check_expected( data );
+  check_expected( len );
+
+  if ( tag == 2 ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_send_twice_then_messages_are_received_in_order() {
+  init_messenger( "/tmp" );
+
+  const char service_name[] = "Count";
+
+  expect_value( callback_count, tag, 1 );
+  expect_string( callback_count, data, "ONE" );
+  expect_value( callback_count, len, 4 );
+  expect_value( callback_count, tag, 2 );
+  expect_string( callback_count, data, "TWO" );
+  expect_value( callback_count, len, 4 );
+
+  add_message_received_callback( service_name, callback_count );
+  send_message( service_name, 1, "ONE", strlen( "ONE" ) + 1 );
+  send_message( service_name, 2, "TWO", strlen( "TWO" ) + 1 );
+  start_messenger();
+
+  delete_message_received_callback( service_name, callback_count );
+  delete_send_queue( lookup_hash_entry( send_queues, service_name ) );
+
+  finalize_messenger();
+}
+
+
+static void
+callback_batch( uint16_t tag, void *data, size_t len ) {
+  check_expected( tag );
+  UNUSED( data );
+  UNUSED( len );
+
+  if ( tag == 3 ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+test_queued_messages_are_sent_in_a_single_call() {
+  init_messenger( "/tmp" );
+
+  const char service_name[] = "Batch";
+
+  expect_value( callback_batch, tag, 1 );
+  expect_value( callback_batch, tag, 2 );
+  expect_value( callback_batch, tag, 3 );
+
+  add_message_received_callback( service_name, callback_batch );
+
+  // The first message cannot be sent directly, so that all are queued.
+  fail_mock_send = true;
+  send_message( service_name, 1, "ONE", strlen( "ONE" ) + 1 );
+  send_message( service_name, 2, "TWO", strlen( "TWO" ) + 1 );
+  send_message( service_name, 3, "THREE", strlen( "THREE" ) + 1 );
+  fail_mock_send = false;
+  start_messenger();
+
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  assert_true( sq->send_syscalls == 2 );
+  assert_true( sq->sent_messages == 3 );
+
+  delete_message_received_callback( service_name, callback_batch );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Message dump tests.
+ ********************************************************************************/
+
+static message_header *
+queued_message( send_queue *sq, size_t offset ) {
+  assert_true( offset < sq->buffer->data_length );
+  return ( message_header * ) ( ( char * ) sq->buffer->buffer + sq->buffer->head_offset + offset );
+}
+
+
+static void
+test_dump_message_is_queued_to_dump_service() {
+  init_messenger( "/tmp" );
+  start_messenger_dump( DUMP_APP_NAME, DUMP_SERVICE_NAME );
+
+  // Dump clock, connection refused and reconnection.
+  will_return_count( mock_clock_gettime, 0, 3 );
+  fail_mock_connect = true;
+  send_dump_message( MESSENGER_DUMP_RECEIVED, SERVICE_NAME1, MESSAGE1, strlen( MESSAGE1 ) + 1 );
+  fail_mock_connect = false;
+
+  send_queue *sq = lookup_hash_entry( send_queues, DUMP_SERVICE_NAME );
+  assert_true( sq != NULL );
+  size_t names_length = sizeof( DUMP_APP_NAME ) + sizeof( SERVICE_NAME1 );
+  message_header *header = queued_message( sq, 0 );
+  assert_int_equal( header->tag, MESSENGER_DUMP_RECEIVED );
+  assert_int_equal( header->message_length, sizeof( message_header ) + sizeof( message_dump_header ) + names_length + sizeof( MESSAGE1 ) );
+  assert_int_equal( sq->buffer->data_length, header->message_length );
+
+  message_dump_header *dump_header = ( message_dump_header * ) header->value;
+  assert_int_equal( ntohs( dump_header->app_name_length ), sizeof( DUMP_APP_NAME ) );
+  assert_int_equal( ntohs( dump_header->service_name_length ), sizeof( SERVICE_NAME1 ) );
+  assert_int_equal( ntohl( dump_header->data_length ), sizeof( MESSAGE1 ) );
+  char *app_name = ( char * ) ( dump_header + 1 );
+  assert_string_equal( app_name, DUMP_APP_NAME );
+  assert_string_equal( app_name + sizeof( DUMP_APP_NAME ), SERVICE_NAME1 );
+  assert_string_equal( app_name + names_length, MESSAGE1 );
+
+  stop_messenger_dump();
+  finalize_messenger();
+}
+
+
+static void
+test_sent_and_received_messages_are_sampled() {
+  init_messenger( "/tmp" );
+  start_messenger_dump( DUMP_APP_NAME, DUMP_SERVICE_NAME );
+  dump_sampling_rate = 3;
+
+  // Three dumps, a connection refused and three reconnections.
+  will_return_count( mock_clock_gettime, 0, 7 );
+  fail_mock_connect = true;
+  for ( int i = 0; i < 3; i++ ) {
+    send_dump_message( MESSENGER_DUMP_SENT, SERVICE_NAME1, MESSAGE1, strlen( MESSAGE1 ) + 1 );
+  }
+  send_dump_message( MESSENGER_DUMP_SEND_CLOSED, SERVICE_NAME1, NULL, 0 );
+  for ( int i = 0; i < 3; i++ ) {
+    send_dump_message( MESSENGER_DUMP_RECEIVED, SERVICE_NAME1, MESSAGE1, strlen( MESSAGE1 ) + 1 );
+  }
+  fail_mock_connect = false;
+
+  send_queue *sq = lookup_hash_entry( send_queues, DUMP_SERVICE_NAME );
+  size_t offset = 0;
+  message_header *header = queued_message( sq, offset );
+  assert_int_equal( header->tag, MESSENGER_DUMP_SENT );
+  offset += header->message_length;
+  header = queued_message( sq, offset );
+  assert_int_equal( header->tag, MESSENGER_DUMP_SEND_CLOSED );
+  offset += header->message_length;
+  header = queued_message( sq, offset );
+  assert_int_equal( header->tag, MESSENGER_DUMP_RECEIVED );
+  offset += header->message_length;
+  assert_int_equal( sq->buffer->data_length, offset );
+
+  dump_sampling_rate = 1;
+  dump_sampling_count = 0;
+  stop_messenger_dump();
+  finalize_messenger();
+}
+
+
+/********************************************************************************
+ * Shared memory ring tests.
+ ********************************************************************************/
+
+static uint16_t last_ring_tag = 0;
+
+
+static void
+callback_ring( uint16_t tag, void *data, size_t len ) {
+  check_expected( tag );
+  UNUSED( data );
+  UNUSED( len );
+
+  if ( tag == last_ring_tag ) {
+    stop_messenger();
+  }
+}
+
+
+static void
+run_until_ring_is_active( send_queue *sq ) {
+  for ( int i = 0; i < 100 && !sq->ring_active; i++ ) {
+    run_once();
+  }
+}
+
+
+static void
+test_messages_are_sent_through_ring_once_accepted() {
+  init_messenger( "/tmp" );
+  shared_memory_enabled = true;
+
+  const char service_name[] = "Ring";
+
+  expect_value( callback_ring, tag, 1 );
+  expect_value( callback_ring, tag, 2 );
+  last_ring_tag = 2;
+
+  add_message_received_callback( service_name, callback_ring );
+  send_message( service_name, 1, "ONE", strlen( "ONE" ) + 1 );
+
+  // The ring is offered on connect, but not used until the peer accepts it.
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  assert_true( sq->ring != NULL );
+  assert_false( sq->ring_active );
+
+  run_until_ring_is_active( sq );
+  assert_true( sq->ring_active );
+
+  uint64_t send_syscalls = sq->send_syscalls;
+  send_message( service_name, 2, "TWO", strlen( "TWO" ) + 1 );
+  assert_true( sq->send_syscalls == send_syscalls );
+  start_messenger();
+
+  delete_message_received_callback( service_name, callback_ring );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+  shared_memory_enabled = false;
+}
+
+
+static void
+test_messages_are_sent_through_socket_if_ring_is_refused() {
+  init_messenger( "/tmp" );
+  shared_memory_enabled = true;
+  refuse_mock_ring_offer = true;
+
+  const char service_name[] = "Refused ring";
+
+  expect_value( callback_ring, tag, 1 );
+  expect_value( callback_ring, tag, 2 );
+
+  add_message_received_callback( service_name, callback_ring );
+  send_message( service_name, 1, "ONE", strlen( "ONE" ) + 1 );
+  last_ring_tag = 1;
+  start_messenger();
+
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  assert_false( sq->ring_active );
+
+  send_message( service_name, 2, "TWO", strlen( "TWO" ) + 1 );
+  last_ring_tag = 2;
+  start_messenger();
+
+  assert_true( sq->sent_messages == 2 );
+
+  delete_message_received_callback( service_name, callback_ring );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+  refuse_mock_ring_offer = false;
+  shared_memory_enabled = false;
+}
+
+
+static void
+test_queued_messages_are_received_before_ring_messages() {
+  init_messenger( "/tmp" );
+  shared_memory_enabled = true;
+
+  const char service_name[] = "Ring order";
+
+  expect_value( callback_ring, tag, 1 );
+  expect_value( callback_ring, tag, 2 );
+  expect_value( callback_ring, tag, 3 );
+  expect_value( callback_ring, tag, 4 );
+  last_ring_tag = 4;
+
+  add_message_received_callback( service_name, callback_ring );
+  send_message( service_name, 1, "ONE", strlen( "ONE" ) + 1 );
+
+  // Messages queued before the ring is accepted are left in the send queue.
+  send_queue *sq = lookup_hash_entry( send_queues, service_name );
+  fail_mock_send_fd = sq->server_socket;
+  send_message( service_name, 2, "TWO", strlen( "TWO" ) + 1 );
+  send_message( service_name, 3, "THREE", strlen( "THREE" ) + 1 );
+
+  run_until_ring_is_active( sq );
+  assert_true( sq->ring_active );
+  assert_true( sq->buffer->data_length > 0 );
+
+  send_message( service_name, 4, "FOUR", strlen( "FOUR" ) + 1 );
+  fail_mock_send_fd = -1;
+  start_messenger();
+
+  delete_message_received_callback( service_name, callback_ring );
+  delete_send_queue( sq );
+
+  finalize_messenger();
+  shared_memory_enabled = false;
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -431,6 +759,31 @@ main() {
     unit_test_setup_teardown( test_send_then_message_received_callback_is_called,
                               reset_messenger,
                               reset_messenger ),
+    unit_test_setup_teardown( test_send_twice_then_messages_are_received_in_order,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_queued_messages_are_sent_in_a_single_call,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Message dump tests.
+    unit_test_setup_teardown( test_dump_message_is_queued_to_dump_service,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_sent_and_received_messages_are_sampled,
+                              reset_messenger,
+                              reset_messenger ),
+
+    // Shared memory ring tests.
+    unit_test_setup_teardown( test_messages_are_sent_through_ring_once_accepted,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_messages_are_sent_through_socket_if_ring_is_refused,
+                              reset_messenger,
+                              reset_messenger ),
+    unit_test_setup_teardown( test_queued_messages_are_received_before_ring_messages,
+                              reset_messenger,
+                              reset_messenger ),
   };
   return run_tests( tests );
 }
@@ -0,0 +1,185 @@
+/*
+ * Unit tests for object_pool.[ch]
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checks.h"
+#include "cmockery_trema.h"
+#include "object_pool.h"
+
+
+// Test the pools rather than the heap.
+#undef allocate_object
+#undef free_object
+#undef allocate_sized_object
+#undef free_sized_object
+#undef sized_object_capacity
+
+
+extern object_pool sized_object_pools[];
+
+
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+static char dump_output[ 256 ];
+
+
+static void
+dump_function( const char *format, ... ) {
+  va_list args;
+  va_start( args, format );
+  vsnprintf( dump_output, sizeof( dump_output ), format, args );
+  va_end( args );
+}
+
+
+/********************************************************************************
+ * Tests.
+ ********************************************************************************/
+
+static void
+test_freed_object_is_reused() {
+  object_pool pool = OBJECT_POOL_INITIALIZER( "test", 24 );
+
+  void *object = allocate_object( &pool );
+  assert_true( object != NULL );
+  free_object( &pool, object );
+
+  assert_true( allocate_object( &pool ) == object );
+  assert_int_equal( pool.allocations, 2 );
+  assert_int_equal( pool.n_slabs, 1 );
+  assert_int_equal( pool.n_objects_in_use, 1 );
+
+  destroy_object_pool( &pool );
+}
+
+
+static void
+test_objects_are_aligned_and_do_not_overlap() {
+  object_pool pool = OBJECT_POOL_INITIALIZER( "test", 24 );
+  char *objects[ 100 ];
+
+  for ( int i = 0; i < 100; i++ ) {
+    objects[ i ] = allocate_object( &pool );
+    assert_int_equal( ( uintptr_t ) objects[ i ] % 16, 0 );
+    memset( objects[ i ], i, 24 );
+  }
+  for ( int i = 0; i < 100; i++ ) {
+    for ( int j = 0; j < 24; j++ ) {
+      assert_int_equal( objects[ i ][ j ], i );
+    }
+  }
+
+  destroy_object_pool( &pool );
+}
+
+
+static void
+test_slab_is_added_if_no_free_object_is_left() {
+  object_pool pool = OBJECT_POOL_INITIALIZER( "test", OBJECT_POOL_SLAB_SIZE / 4 );
+
+  for ( int i = 0; i < 3; i++ ) {
+    allocate_object( &pool );
+  }
+  assert_int_equal( pool.n_slabs, 1 );
+  allocate_object( &pool );
+  assert_int_equal( pool.n_slabs, 2 );
+  assert_int_equal( pool.n_objects_in_use, 4 );
+
+  destroy_object_pool( &pool );
+}
+
+
+static void
+test_object_larger_than_slab_is_allocated() {
+  object_pool pool = OBJECT_POOL_INITIALIZER( "test", OBJECT_POOL_SLAB_SIZE * 2 );
+
+  char *object = allocate_object( &pool );
+  memset( object, 0, OBJECT_POOL_SLAB_SIZE * 2 );
+
+  destroy_object_pool( &pool );
+}
+
+
+static void
+test_sized_objects_are_taken_from_size_classes() {
+  void *object = allocate_sized_object( 100 );
+  free_sized_object( object, 100 );
+
+  // 100 and 128 bytes fall into the same size class.
+  assert_int_equal( sized_object_capacity( 100 ), 128 );
+  assert_true( allocate_sized_object( 128 ) == object );
+  free_sized_object( object, 128 );
+
+  destroy_object_pool( &sized_object_pools[ 3 ] );
+}
+
+
+static void
+test_large_sized_object_is_taken_from_heap() {
+  void *object = allocate_sized_object( OBJECT_POOL_MAX_SIZED_OBJECT + 1 );
+  assert_true( object != NULL );
+  assert_int_equal( sized_object_capacity( OBJECT_POOL_MAX_SIZED_OBJECT + 1 ), OBJECT_POOL_MAX_SIZED_OBJECT + 1 );
+  free_sized_object( object, OBJECT_POOL_MAX_SIZED_OBJECT + 1 );
+}
+
+
+static void
+test_dump_object_pools() {
+  object_pool pool = OBJECT_POOL_INITIALIZER( "dump_test", 8 );
+  allocate_object( &pool );
+
+  dump_object_pools( dump_function );
+  assert_string_equal( dump_output, "Object pool dump_test: 1 allocations, 1 slabs, 1 objects in use." );
+
+  destroy_object_pool( &pool );
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test( test_freed_object_is_reused ),
+    unit_test( test_objects_are_aligned_and_do_not_overlap ),
+    unit_test( test_slab_is_added_if_no_free_object_is_left ),
+    unit_test( test_object_larger_than_slab_is_allocated ),
+    unit_test( test_sized_objects_are_taken_from_size_classes ),
+    unit_test( test_large_sized_object_is_taken_from_heap ),
+    unit_test( test_dump_object_pools ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -32,6 +32,7 @@
 #include "messenger.h"
 #include "openflow_application_interface.h"
 #include "openflow_message.h"
+#include "shadow_flow_table.h"
 #include "stat.h"
 
 
@@ -41,7 +42,7 @@
 
 typedef struct {
   char key[ STAT_KEY_LENGTH ];
-  uint64_t value;
+  stat_counter counter;
 } stat_entry;
 
 
@@ -49,6 +50,7 @@ extern bool openflow_application_interface_initialized;
 extern openflow_event_handlers_t event_handlers;
 extern char service_name[ MESSENGER_SERVICE_NAME_LENGTH ];
 extern hash_table *stats;
+extern uint64_t stat_values[];
 
 extern void assert_if_not_initialized();
 extern void handle_error( const uint64_t datapath_id, buffer *data );
@@ -100,7 +102,7 @@ static openflow_event_handlers_t NULL_EVENT_HANDLERS = { false, ( void * ) 0, (
                                                          ( void * ) 0, ( void * ) 0,
                                                          ( void * ) 0, ( void * ) 0,
                                                          ( void * ) 0, ( void * ) 0,
-                                                         false, ( void * ) 0, ( void * ) 0,
+                                                         false, ( void * ) 0, ( void * ) 0, false,
                                                          ( void * ) 0, ( void * ) 0,
                                                          ( void * ) 0, ( void * ) 0,
                                                          ( void * ) 0, ( void * ) 0,
@@ -113,7 +115,7 @@ static openflow_event_handlers_t EVENT_HANDLERS = {
   VENDOR_HANDLER, VENDOR_USER_DATA,
   FEATURES_REPLY_HANDLER, FEATURES_REPLY_USER_DATA,
   GET_CONFIG_REPLY_HANDLER, GET_CONFIG_REPLY_USER_DATA,
-  false, PACKET_IN_HANDLER, PACKET_IN_USER_DATA,
+  false, PACKET_IN_HANDLER, PACKET_IN_USER_DATA, false,
   FLOW_REMOVED_HANDLER, FLOW_REMOVED_USER_DATA,
   PORT_STATUS_HANDLER, PORT_STATUS_USER_DATA,
   STATS_REPLY_HANDLER, STATS_REPLY_USER_DATA,
@@ -204,6 +206,13 @@ mock_parse_packet( buffer *buf ) {
 }
 
 
+bool
+mock_parse_packet_lazily( buffer *buf ) {
+  alloc_packet( buf );
+  return ( bool ) mock();
+}
+
+
 static void
 mock_switch_disconnected_handler( uint64_t datapath_id, void *user_data ) {
   check_expected( &datapath_id );
@@ -622,7 +631,7 @@ test_handle_switch_ready() {
   handle_message( MESSENGER_OPENFLOW_READY, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_ready_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( data );
   free( delete_hash_entry( stats, "openflow_application_interface.switch_ready_receive_succeeded" ) );
@@ -643,7 +652,7 @@ test_handle_switch_ready_with_simple_handler() {
   handle_message( MESSENGER_OPENFLOW_READY, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_ready_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( data );
   free( delete_hash_entry( stats, "openflow_application_interface.switch_ready_receive_succeeded" ) );
@@ -829,6 +838,18 @@ test_set_simple_packet_in_handler() {
 }
 
 
+static void
+test_set_lazy_packet_in_handler() {
+  set_lazy_packet_in_handler( mock_simple_packet_in_handler, PACKET_IN_USER_DATA );
+  assert_true( event_handlers.packet_in_callback == mock_simple_packet_in_handler );
+  assert_true( event_handlers.packet_in_user_data == PACKET_IN_USER_DATA );
+  assert_true( event_handlers.lazy_packet_in_parsing );
+
+  set_packet_in_handler( mock_simple_packet_in_handler, PACKET_IN_USER_DATA );
+  assert_false( event_handlers.lazy_packet_in_parsing );
+}
+
+
 static void
 test_set_packet_in_handler_should_die_if_handler_is_NULL() {
   expect_string( mock_die, format, "Invalid callback function for packet_in event." );
@@ -900,6 +921,37 @@ test_handle_packet_in_with_simple_handler() {
 }
 
 
+static void
+test_handle_packet_in_with_lazy_handler() {
+  uint8_t reason = OFPR_NO_MATCH;
+  uint16_t in_port = 1;
+  uint32_t buffer_id = 0x01020304;
+  buffer *data = alloc_buffer_with_length( 64 );
+  alloc_packet( data );
+  append_back_buffer( data, 64 );
+  memset( data->data, 0x01, 64 );
+  uint16_t total_len = ( uint16_t ) data->length;
+
+  will_return( mock_parse_packet_lazily, true );
+  expect_memory( mock_simple_packet_in_handler, &datapath_id, &DATAPATH_ID, sizeof( uint64_t ) );
+  expect_value( mock_simple_packet_in_handler, transaction_id, TRANSACTION_ID );
+  expect_value( mock_simple_packet_in_handler, buffer_id, buffer_id );
+  expect_value( mock_simple_packet_in_handler, total_len32, ( uint32_t ) total_len );
+  expect_value( mock_simple_packet_in_handler, in_port32, ( uint32_t ) in_port );
+  expect_value( mock_simple_packet_in_handler, reason32, ( uint32_t ) reason );
+  expect_value( mock_simple_packet_in_handler, data->length, data->length );
+  expect_memory( mock_simple_packet_in_handler, user_data, USER_DATA, USER_DATA_LEN );
+
+  set_lazy_packet_in_handler( mock_simple_packet_in_handler, USER_DATA );
+
+  buffer *buffer = create_packet_in( TRANSACTION_ID, buffer_id, total_len, in_port, reason, data );
+  handle_packet_in( DATAPATH_ID, buffer );
+
+  free_packet( data );
+  free_buffer( buffer );
+}
+
+
 static void
 test_handle_packet_in_with_malformed_packet() {
   uint8_t reason = OFPR_NO_MATCH;
@@ -1132,7 +1184,7 @@ test_send_openflow_message() {
   
   assert_true( ret );
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.hello_send_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( buffer );
   free( expected_data );
@@ -1140,6 +1192,58 @@ test_send_openflow_message() {
 }
 
 
+static buffer *
+create_shadowed_flow_mod( uint32_t transaction_id, struct ofp_match *match ) {
+  memset( match, 0, sizeof( struct ofp_match ) );
+  match->wildcards = OFPFW_ALL & ~( uint32_t ) OFPFW_IN_PORT;
+  match->in_port = 1;
+
+  openflow_actions *actions = create_actions();
+  append_action_output( actions, 2, UINT16_MAX );
+  buffer *flow_mod = create_flow_mod( transaction_id, *match, 0, OFPFC_ADD, 0, 0, UINT16_MAX,
+                                      UINT32_MAX, OFPP_NONE, 0, actions );
+  delete_actions( actions );
+
+  return flow_mod;
+}
+
+
+static void
+test_send_openflow_message_records_flow_mod_only_if_sent() {
+  struct ofp_match match;
+  buffer *flow_mod = create_shadowed_flow_mod( TRANSACTION_ID, &match );
+
+  init_shadow_flow_table();
+
+  expect_string( mock_send_message, service_name, REMOTE_SERVICE_NAME );
+  expect_value( mock_send_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
+  expect_any( mock_send_message, data );
+  expect_any( mock_send_message, len );
+  will_return( mock_send_message, false );
+
+  assert_false( send_openflow_message( DATAPATH_ID, flow_mod ) );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, UINT16_MAX ) == NULL );
+
+  // Retrying must not be suppressed.
+  expect_string( mock_send_message, service_name, REMOTE_SERVICE_NAME );
+  expect_value( mock_send_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
+  expect_any( mock_send_message, data );
+  expect_any( mock_send_message, len );
+  will_return( mock_send_message, true );
+
+  assert_true( send_openflow_message( DATAPATH_ID, flow_mod ) );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, UINT16_MAX ) != NULL );
+
+  // Now it is redundant and is not sent.
+  assert_true( send_openflow_message( DATAPATH_ID, flow_mod ) );
+
+  finalize_shadow_flow_table();
+  free_buffer( flow_mod );
+  free( delete_hash_entry( stats, "openflow_application_interface.flow_mod_send_failed" ) );
+  free( delete_hash_entry( stats, "openflow_application_interface.flow_mod_send_succeeded" ) );
+}
+
+
 static void
 test_send_openflow_message_if_message_is_NULL() {
   expect_assert_failure( send_openflow_message( DATAPATH_ID, NULL ) );
@@ -1190,6 +1294,29 @@ test_handle_error() {
 }
 
 
+static void
+test_handle_error_deletes_shadow_flow_entries_of_failed_flow_mod() {
+  struct ofp_match match;
+  buffer *flow_mod = create_shadowed_flow_mod( TRANSACTION_ID, &match );
+
+  init_shadow_flow_table();
+  assert_true( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+
+  buffer *buffer = create_error( TRANSACTION_ID + 1, OFPET_FLOW_MOD_FAILED, OFPFMFC_ALL_TABLES_FULL, flow_mod );
+  handle_error( DATAPATH_ID, buffer );
+  free_buffer( buffer );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, UINT16_MAX ) != NULL );
+
+  buffer = create_error( TRANSACTION_ID, OFPET_FLOW_MOD_FAILED, OFPFMFC_ALL_TABLES_FULL, flow_mod );
+  handle_error( DATAPATH_ID, buffer );
+  free_buffer( buffer );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, UINT16_MAX ) == NULL );
+
+  finalize_shadow_flow_table();
+  free_buffer( flow_mod );
+}
+
+
 static void
 test_handle_error_if_handler_is_not_registered() {
   buffer *buffer, *data;
@@ -2359,7 +2486,7 @@ test_handle_switch_events_if_type_is_MESSENGER_OPENFLOW_CONNECTED() {
   handle_switch_events( MESSENGER_OPENFLOW_CONNECTED, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_connected_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( data );
   free( delete_hash_entry( stats, "openflow_application_interface.switch_connected_receive_succeeded" ) );
@@ -2383,7 +2510,7 @@ test_handle_switch_events_if_type_is_MESSENGER_OPENFLOW_DISCONNECTED() {
   handle_switch_events( MESSENGER_OPENFLOW_DISCONNECTED, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_disconnected_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( data );
   free( delete_hash_entry( stats, "openflow_application_interface.switch_disconnected_receive_succeeded" ) );
@@ -2432,7 +2559,7 @@ test_handle_switch_events_if_unhandled_message_type() {
   handle_switch_events( MESSENGER_OPENFLOW_MESSAGE, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.undefined_switch_event_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( data );
   free( delete_hash_entry( stats, "openflow_application_interface.undefined_switch_event_receive_succeeded" ) );
@@ -2474,7 +2601,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.error_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free_buffer( data );
     free_buffer( buffer );
@@ -2504,7 +2631,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.vendor_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free_buffer( data );
     free_buffer( buffer );
@@ -2568,7 +2695,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.features_reply_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free( phy_port[0] );
     free( phy_port[1] );
@@ -2597,7 +2724,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.get_config_reply_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free_buffer( buffer );
     free( delete_hash_entry( stats, "openflow_application_interface.get_config_reply_receive_succeeded" ) );
@@ -2638,7 +2765,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.packet_in_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free_buffer( data );
     free_buffer( buffer );
@@ -2680,7 +2807,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.flow_removed_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free_buffer( buffer );
     free( delete_hash_entry( stats, "openflow_application_interface.flow_removed_receive_succeeded" ) );
@@ -2717,7 +2844,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.port_status_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free_buffer( buffer );
     free( delete_hash_entry( stats, "openflow_application_interface.port_status_receive_succeeded" ) );
@@ -2770,7 +2897,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.stats_reply_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free_buffer( buffer );
     free( delete_hash_entry( stats, "openflow_application_interface.stats_reply_receive_succeeded" ) );
@@ -2792,7 +2919,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.barrier_reply_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free_buffer( buffer );
     free( delete_hash_entry( stats, "openflow_application_interface.barrier_reply_receive_succeeded" ) );
@@ -2843,7 +2970,7 @@ test_handle_openflow_message() {
     handle_openflow_message( buffer->data, buffer->length );
 
     stat = lookup_hash_entry( stats, "openflow_application_interface.queue_get_config_reply_receive_succeeded" );
-    assert_int_equal( ( int ) stat->value, 1 );
+    assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
     free( queue[ 0 ] );
     free( queue[ 1 ] );
@@ -2950,7 +3077,7 @@ test_handle_message_if_type_is_MESSENGER_OPENFLOW_MESSAGE() {
   handle_message( MESSENGER_OPENFLOW_MESSAGE, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.barrier_reply_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
 
   free_buffer( data );
@@ -2969,7 +3096,7 @@ test_handle_message_if_type_is_MESSENGER_OPENFLOW_CONNECTED() {
   handle_message( MESSENGER_OPENFLOW_CONNECTED, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_connected_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( data );
   free( delete_hash_entry( stats, "openflow_application_interface.switch_connected_receive_succeeded" ) );
@@ -2993,7 +3120,7 @@ test_handle_message_if_type_is_MESSENGER_OPENFLOW_DISCONNECTED() {
   handle_message( MESSENGER_OPENFLOW_DISCONNECTED, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.switch_disconnected_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( data );
   free( delete_hash_entry( stats, "openflow_application_interface.switch_disconnected_receive_succeeded" ) );
@@ -3029,7 +3156,7 @@ test_handle_message_if_unhandled_message_type() {
   handle_message( MESSENGER_OPENFLOW_DISCONNECTED + 1, data->data, data->length );
 
   stat_entry *stat = lookup_hash_entry( stats, "openflow_application_interface.undefined_switch_event_receive_succeeded" );
-  assert_int_equal( ( int ) stat->value, 1 );
+  assert_int_equal( ( int ) stat_values[ stat->counter ], 1 );
 
   free_buffer( data );
   free( delete_hash_entry( stats, "openflow_application_interface.undefined_switch_event_receive_succeeded" ) );
@@ -3090,10 +3217,12 @@ main() {
     unit_test_setup_teardown( test_set_queue_get_config_reply_handler_if_handler_is_NULL, init, cleanup ),
 
     unit_test_setup_teardown( test_send_openflow_message, init, cleanup ),
+    unit_test_setup_teardown( test_send_openflow_message_records_flow_mod_only_if_sent, init, cleanup ),
     unit_test_setup_teardown( test_send_openflow_message_if_message_is_NULL, init, cleanup ),
     unit_test_setup_teardown( test_send_openflow_message_if_message_length_is_zero, init, cleanup ),
 
     unit_test_setup_teardown( test_handle_error, init, cleanup ),
+    unit_test_setup_teardown( test_handle_error_deletes_shadow_flow_entries_of_failed_flow_mod, init, cleanup ),
     unit_test_setup_teardown( test_handle_error_if_handler_is_not_registered, init, cleanup ),
     unit_test_setup_teardown( test_handle_error_if_message_is_NULL, init, cleanup ),
     unit_test_setup_teardown( test_handle_error_if_message_length_is_zero, init, cleanup ),
@@ -3118,9 +3247,11 @@ main() {
     // Packet in handler tests.
     unit_test_setup_teardown( test_set_packet_in_handler, init, cleanup ),
     unit_test_setup_teardown( test_set_simple_packet_in_handler, init, cleanup ),
+    unit_test_setup_teardown( test_set_lazy_packet_in_handler, init, cleanup ),
     unit_test_setup_teardown( test_set_packet_in_handler_should_die_if_handler_is_NULL, init, cleanup ),
     unit_test_setup_teardown( test_handle_packet_in, init, cleanup ),
     unit_test_setup_teardown( test_handle_packet_in_with_simple_handler, init, cleanup ),
+    unit_test_setup_teardown( test_handle_packet_in_with_lazy_handler, init, cleanup ),
     unit_test_setup_teardown( test_handle_packet_in_with_malformed_packet, init, cleanup ),
     unit_test_setup_teardown( test_handle_packet_in_without_data, init, cleanup ),
     unit_test_setup_teardown( test_handle_packet_in_without_handler, init, cleanup ),
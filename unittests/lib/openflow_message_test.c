@@ -31,6 +31,7 @@
 #include "checks.h"
 #include "cmockery_trema.h"
 #include "openflow_message.h"
+#include "packet_parser.h"
 #include "wrapper.h"
 
 
@@ -1450,6 +1451,42 @@ test_create_flow_mod() {
 }
 
 
+/********************************************************************************
+ * create_flow_mod_from_template() test.
+ ********************************************************************************/
+
+static void
+test_create_flow_mod_from_template() {
+  uint64_t cookie = 10;
+  uint16_t idle_timeout = 5;
+  uint16_t hard_timeout = 10;
+  uint32_t buffer_id = 10;
+  uint16_t flags = OFPFF_CHECK_OVERLAP | OFPFF_SEND_FLOW_REM;
+  openflow_actions *actions;
+
+  actions = create_actions();
+  append_action_output( actions, 1, 128 );
+  append_action_set_nw_src( actions, 0x0a000001 );
+
+  flow_mod_template *template = create_flow_mod_template( OFPFC_ADD, idle_timeout, hard_timeout,
+                                                          PRIORITY, OFPP_NONE, flags, actions );
+  assert_true( template != NULL );
+
+  buffer *expected = create_flow_mod( MY_TRANSACTION_ID, MATCH, cookie, OFPFC_ADD, idle_timeout,
+                                      hard_timeout, PRIORITY, buffer_id, OFPP_NONE, flags, actions );
+  buffer *buffer = create_flow_mod_from_template( template, MY_TRANSACTION_ID, MATCH, cookie, buffer_id );
+  assert_true( buffer != NULL );
+
+  assert_int_equal( ( int ) buffer->length, ( int ) expected->length );
+  assert_memory_equal( buffer->data, expected->data, expected->length );
+
+  free_buffer( buffer );
+  free_buffer( expected );
+  delete_flow_mod_template( template );
+  delete_actions( actions );
+}
+
+
 /********************************************************************************
  * create_stats_request() test.
  ********************************************************************************/
@@ -6813,6 +6850,40 @@ test_set_match_from_packet_fails_if_packet_is_not_parsed_yet() {
 }
 
 
+static void
+test_set_match_from_packet_wildcards_l3_fields_if_ipv4_header_is_truncated() {
+  size_t length = sizeof( ether_header_t ) - ETH_PREPADLEN + sizeof( ipv4_header_t );
+  buffer *buf = alloc_buffer_with_length( length );
+  char *frame = append_back_buffer( buf, length );
+  memset( frame, 0, length );
+  memcpy( frame, macda, ETH_ADDRLEN );
+  memcpy( frame + ETH_ADDRLEN, macsa, ETH_ADDRLEN );
+  uint16_t type = htons( ETH_ETHTYPE_IPV4 );
+  memcpy( frame + ETH_ADDRLEN * 2, &type, sizeof( type ) );
+  ipv4_header_t *ipv4 = ( ipv4_header_t * ) ( void * ) ( frame + sizeof( ether_header_t ) - ETH_PREPADLEN );
+  ipv4->version = IPVERSION;
+  ipv4->ihl = 15; // 60 octets, which are not in the frame
+  ipv4->protocol = IPPROTO_UDP;
+  ipv4->saddr = htonl( 0xC0A80067 );
+
+  assert_true( parse_packet_lazily( buf ) );
+
+  struct ofp_match match;
+  set_match_from_packet( &match, 1, 0, buf );
+
+  uint32_t l3_wildcards = OFPFW_NW_TOS | OFPFW_NW_PROTO | OFPFW_NW_SRC_MASK | OFPFW_NW_DST_MASK
+                          | OFPFW_TP_SRC | OFPFW_TP_DST;
+  assert_int_equal( ( int ) match.wildcards, ( int ) l3_wildcards );
+  assert_int_equal( match.in_port, 1 );
+  assert_memory_equal( match.dl_src, macsa, ETH_ADDRLEN );
+  assert_int_equal( match.dl_type, ETH_ETHTYPE_IPV4 );
+  assert_int_equal( match.nw_proto, 0 );
+  assert_int_equal( ( int ) match.nw_src, 0 );
+
+  free_packet( buf );
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -6876,6 +6947,7 @@ main() {
     unit_test_setup_teardown( test_create_packet_out, init, teardown ),
     unit_test_setup_teardown( test_create_packet_out_without_actions, init, teardown ),
     unit_test_setup_teardown( test_create_flow_mod, init, teardown ),
+    unit_test_setup_teardown( test_create_flow_mod_from_template, init, teardown ),
     unit_test_setup_teardown( test_create_flow_stats_request, init, teardown ),
     unit_test_setup_teardown( test_create_flow_stats_reply, init, teardown ),
 
@@ -7135,6 +7207,7 @@ main() {
     unit_test_setup_teardown( test_set_match_from_packet_succeeds_if_datatype_is_ieee8023_not_llc_and_wildcards_is_zero, init, teardown ),
     unit_test_setup_teardown( test_set_match_from_packet_fails_if_packet_data_is_NULL, init, teardown ),
     unit_test_setup_teardown( test_set_match_from_packet_fails_if_packet_is_not_parsed_yet, init, teardown ),
+    unit_test_setup_teardown( test_set_match_from_packet_wildcards_l3_fields_if_ipv4_header_is_truncated, init, teardown ),
   };
   return run_tests( tests );
 }
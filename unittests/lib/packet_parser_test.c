@@ -21,6 +21,7 @@
 
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include "checks.h"
 #include "cmockery_trema.h"
@@ -47,6 +48,14 @@ const unsigned int ipv4_padding_size = 46 - sizeof( ipv4_header_t );
 const unsigned int arp_padding_size = 46 - sizeof( arp_header_t );
 
 
+extern uint64_t ( *sum_words )( const uint8_t *p, size_t size );
+extern uint64_t sum_words_scalar( const uint8_t *p, size_t size );
+#if defined( __x86_64__ ) || defined( __i386__ )
+extern uint64_t sum_words_sse2( const uint8_t *p, size_t size );
+extern uint64_t sum_words_avx2( const uint8_t *p, size_t size );
+#endif
+
+
 /********************************************************************************
  * Mock functions.
  ********************************************************************************/
@@ -209,6 +218,53 @@ test_parse_packet_fails_if_buffer_is_NULL() {
 }
 
 
+/********************************************************************************
+ * Lazy parsing Tests.
+ ********************************************************************************/
+
+static void
+test_parse_packet_lazily_does_not_parse_l3_header() {
+  buffer *ipv4_buffer = setup_dummy_ether_ipv4_packet( );
+
+  assert_int_equal( parse_packet_lazily( ipv4_buffer ), true );
+  assert_int_equal( packet_info( ipv4_buffer )->l3_status, PACKET_L3_UNPARSED );
+  assert_int_equal( packet_info( ipv4_buffer )->ethtype, ETH_ETHTYPE_IPV4 );
+
+  assert_int_equal( parse_packet_l3( ipv4_buffer ), true );
+  assert_int_equal( packet_info( ipv4_buffer )->l3_status, PACKET_L3_VALID );
+  assert_int_equal( packet_info( ipv4_buffer )->ipproto, IPPROTO_UDP );
+
+  free_packet( ipv4_buffer );
+}
+
+
+static void
+test_parse_packet_l3_fails_if_version_is_no_ipv4() {
+  buffer *ip_version = setup_dummy_ether_ipv4_packet( );
+  ( ( ipv4_header_t * ) ( ( char * ) ( ip_version->data ) + sizeof( ether_header_t ) ) )->version = 6;
+
+  assert_int_equal( parse_packet_lazily( ip_version ), true );
+  assert_int_equal( parse_packet_l3( ip_version ), false );
+  assert_int_equal( packet_info( ip_version )->l3_status, PACKET_L3_INVALID );
+  assert_int_equal( parse_packet_l3( ip_version ), false );
+
+  free_packet( ip_version );
+}
+
+
+static void
+test_parse_packet_succeeds_if_checksum_verification_is_disabled() {
+  buffer *ipv4_buffer = setup_dummy_ether_ipv4_packet( );
+  ( ( ipv4_header_t * ) ( ( char * ) ( ipv4_buffer->data ) + sizeof( ether_header_t ) ) )->check = 0;
+
+  set_ipv4_checksum_verification( false );
+  assert_int_equal( parse_packet( ipv4_buffer ), true );
+  set_ipv4_checksum_verification( true );
+
+  free_packet( ipv4_buffer );
+}
+
+
 /********************************************************************************
  * get_checksum Tests.
  ********************************************************************************/
@@ -245,6 +301,116 @@ test_get_checksum_succeeds_if_size_odd_number() {
 }
 
 
+// The plain 16-bit loop that get_checksum() used to be.
+static uint16_t
+reference_checksum( const uint8_t *p, uint32_t size ) {
+  uint64_t csum = 0;
+  for (; 2 <= size; p += 2, size -= 2 ) {
+    uint16_t word;
+    memcpy( &word, p, sizeof( word ) );
+    csum += word;
+  }
+  if ( size == 1 ) {
+    csum += *p;
+  }
+  while ( csum & 0xffffffffffff0000ULL ) {
+    csum = ( csum & 0x0000ffff ) + ( csum >> 16 );
+  }
+
+  return ( uint16_t ) ~csum;
+}
+
+
+static void
+check_checksum_against_reference( uint64_t implementation( const uint8_t *p, size_t size ) ) {
+  uint8_t data[ 1024 + 3 ];
+  for ( size_t i = 0; i < sizeof( data ); i++ ) {
+    data[ i ] = ( uint8_t ) random();
+  }
+
+  sum_words = implementation;
+  for ( uint32_t offset = 0; offset < 4; offset++ ) {
+    for ( uint32_t size = 0; size <= 1024; size++ ) {
+      assert_int_equal( get_checksum( ( uint16_t * ) ( void * ) ( data + offset ), size ),
+                        reference_checksum( data + offset, size ) );
+    }
+  }
+
+  // Large enough to overflow 32-bit accumulators.
+  uint32_t size = 1024 * 1024;
+  uint8_t *ones = malloc( size );
+  memset( ones, 0xff, size );
+  assert_int_equal( get_checksum( ( uint16_t * ) ( void * ) ones, size ), reference_checksum( ones, size ) );
+  ones[ 12345 ] = 0;
+  assert_int_equal( get_checksum( ( uint16_t * ) ( void * ) ones, size ), reference_checksum( ones, size ) );
+  free( ones );
+
+  sum_words = NULL;
+}
+
+
+static void
+test_get_checksum_scalar_matches_reference() {
+  check_checksum_against_reference( sum_words_scalar );
+}
+
+
+static void
+test_get_checksum_sse2_matches_reference() {
+#if defined( __x86_64__ ) || defined( __i386__ )
+  if ( __builtin_cpu_supports( "sse2" ) ) {
+    check_checksum_against_reference( sum_words_sse2 );
+  }
+#endif
+}
+
+
+static void
+test_get_checksum_avx2_matches_reference() {
+#if defined( __x86_64__ ) || defined( __i386__ )
+  if ( __builtin_cpu_supports( "avx2" ) ) {
+    check_checksum_against_reference( sum_words_avx2 );
+  }
+#endif
+}
+
+
+/********************************************************************************
+ * update_checksum Tests.
+ ********************************************************************************/
+
+static void
+test_update_checksum_32_succeeds() {
+  buffer *ipv4_buffer = setup_dummy_ether_ipv4_packet( );
+  ipv4_header_t *ipv4 = ( ipv4_header_t * ) ( ( char * ) ( ipv4_buffer->data ) + sizeof( ether_header_t ) - ETH_PREPADLEN );
+
+  uint32_t old_saddr = ipv4->saddr;
+  ipv4->saddr = htonl( 0x0a0b0c0d );
+  ipv4->check = update_checksum_32( ipv4->check, old_saddr, ipv4->saddr );
+  assert_int_equal( get_checksum( ( uint16_t * ) ipv4, sizeof( ipv4_header_t ) ), 0 );
+
+  uint16_t check = ipv4->check;
+  ipv4->check = 0;
+  assert_int_equal( get_checksum( ( uint16_t * ) ipv4, sizeof( ipv4_header_t ) ), check );
+
+  free_buffer( ipv4_buffer );
+}
+
+
+static void
+test_update_checksum_16_succeeds() {
+  uint8_t udp[ 8 ] = { 0x04, 0xd2, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00 };
+  uint16_t check = get_checksum( ( uint16_t * ) ( void * ) udp, sizeof( udp ) );
+
+  uint16_t old_port, new_port = htons( 8080 );
+  memcpy( &old_port, udp, sizeof( old_port ) );
+  memcpy( udp, &new_port, sizeof( new_port ) );
+
+  assert_int_equal( update_checksum_16( check, old_port, new_port ),
+                    get_checksum( ( uint16_t * ) ( void * ) udp, sizeof( udp ) ) );
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -261,8 +427,18 @@ main() {
     unit_test( test_parse_packet_fails_if_data_is_NULL ),
     unit_test( test_parse_packet_fails_if_buffer_is_NULL ),
 
+    unit_test( test_parse_packet_lazily_does_not_parse_l3_header ),
+    unit_test( test_parse_packet_l3_fails_if_version_is_no_ipv4 ),
+    unit_test( test_parse_packet_succeeds_if_checksum_verification_is_disabled ),
+
     unit_test( test_get_checksum_succeeds_if_size_even_number ),
     unit_test( test_get_checksum_succeeds_if_size_odd_number ),
+    unit_test( test_get_checksum_scalar_matches_reference ),
+    unit_test( test_get_checksum_sse2_matches_reference ),
+    unit_test( test_get_checksum_avx2_matches_reference ),
+
+    unit_test( test_update_checksum_32_succeeds ),
+    unit_test( test_update_checksum_16_succeeds ),
   };
   return run_tests( tests );
 }
@@ -0,0 +1,495 @@
+/*
+ * Unit tests for shadow_flow_table.[ch]
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <arpa/inet.h>
+#include <openflow.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "byteorder.h"
+#include "checks.h"
+#include "cmockery_trema.h"
+#include "openflow_message.h"
+#include "shadow_flow_table.h"
+#include "wrapper.h"
+
+
+extern bool has_output_to( const shadow_flow_entry *entry, uint16_t port );
+
+
+static const uint64_t DATAPATH_ID = 0xabc;
+static const uint16_t PRIORITY = 100;
+static const uint32_t TRANSACTION_ID = 0x04030201;
+static const uint8_t MAC_SRC[ OFP_ETH_ALEN ] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t MAC_DST[ OFP_ETH_ALEN ] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x02 };
+
+
+/********************************************************************************
+ * Mock functions.
+ ********************************************************************************/
+
+pid_t
+mock_getpid() {
+  return 1234;
+}
+
+
+void
+mock_die( char *format, ... ) {
+  UNUSED( format );
+}
+
+
+void
+mock_debug( char *format, ... ) {
+  UNUSED( format );
+}
+
+
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+static struct ofp_match
+make_match( uint16_t in_port, const uint8_t *dl_dst ) {
+  struct ofp_match match;
+
+  memset( &match, 0, sizeof( match ) );
+  match.wildcards = OFPFW_ALL & ~( uint32_t ) ( OFPFW_IN_PORT | OFPFW_DL_SRC | OFPFW_DL_DST );
+  match.in_port = in_port;
+  memcpy( match.dl_src, MAC_SRC, OFP_ETH_ALEN );
+  memcpy( match.dl_dst, dl_dst, OFP_ETH_ALEN );
+  // Garbage in a wildcarded field must be ignored.
+  match.tp_dst = 80;
+
+  return match;
+}
+
+
+static buffer *
+make_flow_mod( uint16_t command, struct ofp_match match, uint16_t idle_timeout, uint16_t flags,
+               uint32_t buffer_id, uint16_t out_port, uint16_t output ) {
+  openflow_actions *actions = create_actions();
+  if ( output != OFPP_NONE ) {
+    append_action_output( actions, output, UINT16_MAX );
+  }
+  buffer *flow_mod = create_flow_mod( TRANSACTION_ID, match, 1, command, idle_timeout, 0,
+                                      PRIORITY, buffer_id, out_port, flags, actions );
+  delete_actions( actions );
+
+  return flow_mod;
+}
+
+
+static bool
+send_flow_mod( uint16_t command, struct ofp_match match, uint16_t output ) {
+  buffer *flow_mod = make_flow_mod( command, match, 0, 0, UINT32_MAX, OFPP_NONE, output );
+  bool ret = update_shadow_flow_table( DATAPATH_ID, flow_mod );
+  free_buffer( flow_mod );
+
+  return ret;
+}
+
+
+static void
+count_entry( const shadow_flow_entry *entry, void *user_data ) {
+  UNUSED( entry );
+  ( *( int * ) user_data )++;
+}
+
+
+static void
+delete_entry( const shadow_flow_entry *entry, void *user_data ) {
+  UNUSED( user_data );
+  send_flow_mod( OFPFC_DELETE_STRICT, entry->match, OFPP_NONE );
+}
+
+
+// Builds a flow stats reply with a permanent entry per match.
+static buffer *
+make_flow_stats_reply( uint32_t transaction_id, uint16_t flags, const struct ofp_match *matches, int n_matches ) {
+  uint16_t entry_length = ( uint16_t ) ( sizeof( struct ofp_flow_stats ) + sizeof( struct ofp_action_output ) );
+  size_t length = offsetof( struct ofp_stats_reply, body ) + ( size_t ) entry_length * ( size_t ) n_matches;
+  buffer *reply = alloc_buffer_with_length( length );
+  struct ofp_stats_reply *stats_reply = append_back_buffer( reply, length );
+  memset( stats_reply, 0, length );
+
+  stats_reply->header.version = OFP_VERSION;
+  stats_reply->header.type = OFPT_STATS_REPLY;
+  stats_reply->header.length = htons( ( uint16_t ) length );
+  stats_reply->header.xid = htonl( transaction_id );
+  stats_reply->type = htons( OFPST_FLOW );
+  stats_reply->flags = htons( flags );
+
+  struct ofp_flow_stats *stats = ( struct ofp_flow_stats * ) stats_reply->body;
+  for ( int i = 0; i < n_matches; i++ ) {
+    stats->length = htons( entry_length );
+    struct ofp_match match = matches[ i ];
+    hton_match( &stats->match, &match );
+    stats->priority = htons( PRIORITY );
+    struct ofp_action_output *output = ( struct ofp_action_output * ) stats->actions;
+    output->type = htons( OFPAT_OUTPUT );
+    output->len = htons( sizeof( struct ofp_action_output ) );
+    output->port = htons( 3 );
+    stats = ( struct ofp_flow_stats * ) ( ( char * ) stats + entry_length );
+  }
+
+  return reply;
+}
+
+
+/********************************************************************************
+ * Tests.
+ ********************************************************************************/
+
+static void
+test_added_entry_is_recorded() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+
+  assert_true( send_flow_mod( OFPFC_ADD, match, 2 ) );
+
+  const shadow_flow_entry *entry = lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY );
+  assert_true( entry != NULL );
+  assert_int_equal( entry->actions_length, sizeof( struct ofp_action_output ) );
+  assert_int_equal( entry->match.tp_dst, 0 );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY + 1 ) == NULL );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID + 1, match, PRIORITY ) == NULL );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_redundant_add_is_suppressed() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+
+  assert_true( send_flow_mod( OFPFC_ADD, match, 2 ) );
+  assert_false( send_flow_mod( OFPFC_ADD, match, 2 ) );
+  assert_true( send_flow_mod( OFPFC_ADD, match, 3 ) );
+  assert_false( send_flow_mod( OFPFC_ADD, match, 3 ) );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_shadow_flow_mod_is_redundant() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+  buffer *flow_mod = make_flow_mod( OFPFC_ADD, match, 0, 0, UINT32_MAX, OFPP_NONE, 2 );
+
+  assert_false( shadow_flow_mod_is_redundant( DATAPATH_ID, flow_mod ) );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY ) == NULL );
+  assert_true( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+  assert_true( shadow_flow_mod_is_redundant( DATAPATH_ID, flow_mod ) );
+  assert_false( shadow_flow_mod_is_redundant( DATAPATH_ID + 1, flow_mod ) );
+  free_buffer( flow_mod );
+
+  flow_mod = make_flow_mod( OFPFC_MODIFY_STRICT, match, 0, 0, UINT32_MAX, OFPP_NONE, 2 );
+  assert_false( shadow_flow_mod_is_redundant( DATAPATH_ID, flow_mod ) );
+  free_buffer( flow_mod );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_add_with_buffer_id_is_not_suppressed() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+  assert_true( send_flow_mod( OFPFC_ADD, match, 2 ) );
+
+  buffer *flow_mod = make_flow_mod( OFPFC_ADD, match, 0, 0, 1, OFPP_NONE, 2 );
+  assert_true( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+  free_buffer( flow_mod );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_entry_that_expires_silently_is_not_recorded() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+
+  buffer *flow_mod = make_flow_mod( OFPFC_ADD, match, 60, 0, UINT32_MAX, OFPP_NONE, 2 );
+  assert_true( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+  assert_true( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+  free_buffer( flow_mod );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY ) == NULL );
+
+  flow_mod = make_flow_mod( OFPFC_ADD, match, 60, OFPFF_SEND_FLOW_REM, UINT32_MAX, OFPP_NONE, 2 );
+  assert_true( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+  assert_false( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+  free_buffer( flow_mod );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_modify_replaces_actions() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+  assert_true( send_flow_mod( OFPFC_ADD, match, 2 ) );
+
+  struct ofp_match wide;
+  memset( &wide, 0, sizeof( wide ) );
+  wide.wildcards = OFPFW_ALL & ~( uint32_t ) OFPFW_IN_PORT;
+  wide.in_port = 1;
+  assert_true( send_flow_mod( OFPFC_MODIFY, wide, 5 ) );
+
+  int count = 0;
+  foreach_shadow_flow_entry_by_port( DATAPATH_ID, 5, count_entry, &count );
+  assert_int_equal( count, 1 );
+  count = 0;
+  foreach_shadow_flow_entry_by_port( DATAPATH_ID, 2, count_entry, &count );
+  assert_int_equal( count, 0 );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, wide, PRIORITY ) == NULL );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_modify_without_matching_entry_adds_entry() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+
+  assert_true( send_flow_mod( OFPFC_MODIFY_STRICT, match, 2 ) );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY ) != NULL );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_delete_removes_covered_entries() {
+  init_shadow_flow_table();
+
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 1, MAC_DST ), 2 ) );
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 2, MAC_DST ), 1 ) );
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 3, MAC_SRC ), 1 ) );
+
+  struct ofp_match wide;
+  memset( &wide, 0, sizeof( wide ) );
+  wide.wildcards = OFPFW_ALL & ~( uint32_t ) OFPFW_DL_DST;
+  memcpy( wide.dl_dst, MAC_DST, OFP_ETH_ALEN );
+  buffer *flow_mod = make_flow_mod( OFPFC_DELETE, wide, 0, 0, UINT32_MAX, 1, OFPP_NONE );
+  assert_true( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+  free_buffer( flow_mod );
+
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, make_match( 1, MAC_DST ), PRIORITY ) != NULL );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, make_match( 2, MAC_DST ), PRIORITY ) == NULL );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, make_match( 3, MAC_SRC ), PRIORITY ) != NULL );
+
+  wide.wildcards = OFPFW_ALL;
+  assert_true( send_flow_mod( OFPFC_DELETE, wide, OFPP_NONE ) );
+  int count = 0;
+  foreach_shadow_flow_entry( DATAPATH_ID, count_entry, &count );
+  assert_int_equal( count, 0 );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_delete_shadow_flow_entry() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+  assert_true( send_flow_mod( OFPFC_ADD, match, 2 ) );
+
+  delete_shadow_flow_entry( DATAPATH_ID, match, PRIORITY );
+
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY ) == NULL );
+  assert_true( send_flow_mod( OFPFC_ADD, match, 2 ) );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_delete_shadow_flow_entries_by_transaction_id() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+  struct ofp_match other = make_match( 2, MAC_DST );
+  assert_true( send_flow_mod( OFPFC_ADD, match, 2 ) );
+  buffer *flow_mod = make_flow_mod( OFPFC_ADD, other, 0, 0, UINT32_MAX, OFPP_NONE, 1 );
+  ( ( struct ofp_header * ) flow_mod->data )->xid = htonl( TRANSACTION_ID + 1 );
+  assert_true( update_shadow_flow_table( DATAPATH_ID, flow_mod ) );
+
+  delete_shadow_flow_entries_by_transaction_id( DATAPATH_ID, TRANSACTION_ID + 1 );
+
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY ) != NULL );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, other, PRIORITY ) == NULL );
+  assert_false( shadow_flow_mod_is_redundant( DATAPATH_ID, flow_mod ) );
+  free_buffer( flow_mod );
+
+  delete_shadow_flow_entries_by_transaction_id( DATAPATH_ID + 1, TRANSACTION_ID );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY ) != NULL );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_foreach_shadow_flow_entry_by_mac() {
+  init_shadow_flow_table();
+
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 1, MAC_DST ), 2 ) );
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 2, MAC_DST ), 1 ) );
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 3, MAC_SRC ), 1 ) );
+
+  int count = 0;
+  foreach_shadow_flow_entry_by_mac( DATAPATH_ID, MAC_DST, count_entry, &count );
+  assert_int_equal( count, 2 );
+  count = 0;
+  foreach_shadow_flow_entry_by_mac( DATAPATH_ID, MAC_SRC, count_entry, &count );
+  assert_int_equal( count, 3 );
+
+  foreach_shadow_flow_entry_by_mac( DATAPATH_ID, MAC_DST, delete_entry, NULL );
+  count = 0;
+  foreach_shadow_flow_entry_by_mac( DATAPATH_ID, MAC_SRC, count_entry, &count );
+  assert_int_equal( count, 1 );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_foreach_shadow_flow_entry_by_port() {
+  init_shadow_flow_table();
+
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 1, MAC_DST ), 2 ) );
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 2, MAC_DST ), 1 ) );
+  assert_true( send_flow_mod( OFPFC_ADD, make_match( 3, MAC_SRC ), 3 ) );
+
+  int count = 0;
+  foreach_shadow_flow_entry_by_port( DATAPATH_ID, 1, count_entry, &count );
+  assert_int_equal( count, 2 );
+  count = 0;
+  foreach_shadow_flow_entry_by_port( DATAPATH_ID, 3, count_entry, &count );
+  assert_int_equal( count, 1 );
+  count = 0;
+  foreach_shadow_flow_entry_by_port( DATAPATH_ID, 4, count_entry, &count );
+  assert_int_equal( count, 0 );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_sync_reconciles_with_flow_stats() {
+  init_shadow_flow_table();
+
+  struct ofp_match kept = make_match( 1, MAC_DST );
+  struct ofp_match lost = make_match( 2, MAC_DST );
+  struct ofp_match found = make_match( 3, MAC_DST );
+  assert_true( send_flow_mod( OFPFC_ADD, kept, 2 ) );
+  assert_true( send_flow_mod( OFPFC_ADD, lost, 2 ) );
+
+  start_shadow_flow_table_sync( DATAPATH_ID, TRANSACTION_ID );
+
+  buffer *reply = make_flow_stats_reply( TRANSACTION_ID + 1, 0, &kept, 1 );
+  assert_false( sync_shadow_flow_table( DATAPATH_ID, reply ) );
+  free_buffer( reply );
+
+  reply = make_flow_stats_reply( TRANSACTION_ID, OFPSF_REPLY_MORE, &kept, 1 );
+  assert_true( sync_shadow_flow_table( DATAPATH_ID, reply ) );
+  free_buffer( reply );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, lost, PRIORITY ) != NULL );
+
+  reply = make_flow_stats_reply( TRANSACTION_ID, 0, &found, 1 );
+  assert_true( sync_shadow_flow_table( DATAPATH_ID, reply ) );
+  free_buffer( reply );
+
+  const shadow_flow_entry *entry = lookup_shadow_flow_entry( DATAPATH_ID, kept, PRIORITY );
+  assert_true( entry != NULL );
+  assert_true( has_output_to( entry, 3 ) );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, lost, PRIORITY ) == NULL );
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, found, PRIORITY ) != NULL );
+
+  reply = make_flow_stats_reply( TRANSACTION_ID, 0, &found, 1 );
+  assert_false( sync_shadow_flow_table( DATAPATH_ID, reply ) );
+  free_buffer( reply );
+
+  finalize_shadow_flow_table();
+}
+
+
+static void
+test_delete_shadow_flow_table() {
+  init_shadow_flow_table();
+
+  struct ofp_match match = make_match( 1, MAC_DST );
+  assert_true( send_flow_mod( OFPFC_ADD, match, 2 ) );
+
+  delete_shadow_flow_table( DATAPATH_ID );
+
+  assert_true( lookup_shadow_flow_entry( DATAPATH_ID, match, PRIORITY ) == NULL );
+
+  finalize_shadow_flow_table();
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test( test_added_entry_is_recorded ),
+    unit_test( test_redundant_add_is_suppressed ),
+    unit_test( test_shadow_flow_mod_is_redundant ),
+    unit_test( test_add_with_buffer_id_is_not_suppressed ),
+    unit_test( test_entry_that_expires_silently_is_not_recorded ),
+    unit_test( test_modify_replaces_actions ),
+    unit_test( test_modify_without_matching_entry_adds_entry ),
+    unit_test( test_delete_removes_covered_entries ),
+    unit_test( test_delete_shadow_flow_entry ),
+    unit_test( test_delete_shadow_flow_entries_by_transaction_id ),
+    unit_test( test_foreach_shadow_flow_entry_by_mac ),
+    unit_test( test_foreach_shadow_flow_entry_by_port ),
+    unit_test( test_sync_reconciles_with_flow_stats ),
+    unit_test( test_delete_shadow_flow_table ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
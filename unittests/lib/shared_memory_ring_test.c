@@ -0,0 +1,238 @@
+/*
+ * Unit tests for shared_memory_ring.[ch]
+ *
+ * Copyright (C) 2008-2011 NEC Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License, version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "checks.h"
+#include "cmockery_trema.h"
+#include "shared_memory_ring.h"
+
+
+/********************************************************************************
+ * Mocks.
+ ********************************************************************************/
+
+void
+mock_error( const char *format, ... ) {
+  // Do nothing.
+  UNUSED( format );
+}
+
+
+void
+mock_debug( const char *format, ... ) {
+  // Do nothing.
+  UNUSED( format );
+}
+
+
+/********************************************************************************
+ * Helpers.
+ ********************************************************************************/
+
+static bool
+event_is_signaled( shared_memory_ring *ring ) {
+  uint64_t count = 0;
+  ssize_t ret = read( get_shared_memory_ring_event_fd( ring ), &count, sizeof( count ) );
+
+  return ret == sizeof( count ) && count > 0;
+}
+
+
+static void
+assert_record( shared_memory_ring *ring, const char *expected ) {
+  size_t length = 0;
+  char *record = peek_shared_memory_ring( ring, &length );
+  assert_true( record != NULL );
+  assert_int_equal( length, strlen( expected ) );
+  assert_memory_equal( record, expected, length );
+  pop_shared_memory_ring( ring );
+}
+
+
+/********************************************************************************
+ * Tests.
+ ********************************************************************************/
+
+static void
+test_write_then_peek_returns_records_in_order() {
+  shared_memory_ring *ring = create_shared_memory_ring( 256 );
+  assert_true( ring != NULL );
+
+  assert_true( write_shared_memory_ring( ring, "HEL", 3, "LO", 2 ) );
+  assert_true( write_shared_memory_ring( ring, "WORLD", 5, NULL, 0 ) );
+
+  assert_record( ring, "HELLO" );
+  assert_record( ring, "WORLD" );
+
+  size_t length;
+  assert_true( peek_shared_memory_ring( ring, &length ) == NULL );
+
+  delete_shared_memory_ring( ring );
+}
+
+
+static void
+test_writev_gathers_a_record_from_pieces() {
+  shared_memory_ring *ring = create_shared_memory_ring( 256 );
+
+  char first[] = "GAT";
+  char second[] = "HER";
+  struct iovec iov[ 3 ];
+  iov[ 0 ].iov_base = first;
+  iov[ 0 ].iov_len = 3;
+  iov[ 1 ].iov_base = NULL;
+  iov[ 1 ].iov_len = 0;
+  iov[ 2 ].iov_base = second;
+  iov[ 2 ].iov_len = 3;
+  assert_true( writev_shared_memory_ring( ring, iov, 3 ) );
+
+  assert_record( ring, "GATHER" );
+
+  delete_shared_memory_ring( ring );
+}
+
+
+static void
+test_consumer_is_woken_up_only_if_ring_was_empty() {
+  shared_memory_ring *ring = create_shared_memory_ring( 256 );
+
+  assert_true( write_shared_memory_ring( ring, "A", 1, NULL, 0 ) );
+  assert_true( event_is_signaled( ring ) );
+  assert_true( write_shared_memory_ring( ring, "B", 1, NULL, 0 ) );
+  assert_false( event_is_signaled( ring ) );
+
+  assert_record( ring, "A" );
+  assert_record( ring, "B" );
+
+  assert_true( write_shared_memory_ring( ring, "C", 1, NULL, 0 ) );
+  assert_true( event_is_signaled( ring ) );
+
+  delete_shared_memory_ring( ring );
+}
+
+
+static void
+test_write_fails_if_ring_is_full() {
+  shared_memory_ring *ring = create_shared_memory_ring( 64 );
+  char data[ 24 ];
+  memset( data, 'x', sizeof( data ) );
+
+  // Each record takes 32 bytes including its header.
+  assert_true( write_shared_memory_ring( ring, data, sizeof( data ), NULL, 0 ) );
+  assert_true( write_shared_memory_ring( ring, data, sizeof( data ), NULL, 0 ) );
+  assert_false( write_shared_memory_ring( ring, data, sizeof( data ), NULL, 0 ) );
+
+  size_t length;
+  assert_true( peek_shared_memory_ring( ring, &length ) != NULL );
+  pop_shared_memory_ring( ring );
+  assert_true( write_shared_memory_ring( ring, data, sizeof( data ), NULL, 0 ) );
+
+  delete_shared_memory_ring( ring );
+}
+
+
+static void
+test_write_fails_if_record_is_too_large() {
+  shared_memory_ring *ring = create_shared_memory_ring( 64 );
+  char data[ 64 ];
+  memset( data, 'x', sizeof( data ) );
+
+  assert_false( write_shared_memory_ring( ring, data, sizeof( data ), NULL, 0 ) );
+
+  delete_shared_memory_ring( ring );
+}
+
+
+static void
+test_records_wrap_around() {
+  shared_memory_ring *ring = create_shared_memory_ring( 64 );
+  char expected[ 16 ];
+  int i;
+
+  for ( i = 0; i < 20; i++ ) {
+    snprintf( expected, sizeof( expected ), "record %d", i );
+    assert_true( write_shared_memory_ring( ring, expected, strlen( expected ), NULL, 0 ) );
+    assert_record( ring, expected );
+  }
+
+  delete_shared_memory_ring( ring );
+}
+
+
+static void
+test_attached_ring_shares_records() {
+  shared_memory_ring *producer = create_shared_memory_ring( 4096 );
+  int memory_fd = dup( get_shared_memory_ring_memory_fd( producer ) );
+  int event_fd = dup( get_shared_memory_ring_event_fd( producer ) );
+
+  shared_memory_ring *consumer = attach_shared_memory_ring( memory_fd, event_fd );
+  assert_true( consumer != NULL );
+
+  assert_true( write_shared_memory_ring( producer, "PACKET", 6, "_IN", 3 ) );
+  assert_true( event_is_signaled( consumer ) );
+  assert_record( consumer, "PACKET_IN" );
+
+  delete_shared_memory_ring( consumer );
+  delete_shared_memory_ring( producer );
+}
+
+
+static void
+test_attach_fails_if_memory_is_not_a_ring() {
+  int fds[ 2 ];
+  assert_int_equal( pipe( fds ), 0 );
+
+  assert_true( attach_shared_memory_ring( fds[ 0 ], fds[ 1 ] ) == NULL );
+
+  close( fds[ 0 ] );
+  close( fds[ 1 ] );
+}
+
+
+/********************************************************************************
+ * Run tests.
+ ********************************************************************************/
+
+int
+main() {
+  const UnitTest tests[] = {
+    unit_test( test_write_then_peek_returns_records_in_order ),
+    unit_test( test_writev_gathers_a_record_from_pieces ),
+    unit_test( test_consumer_is_woken_up_only_if_ring_was_empty ),
+    unit_test( test_write_fails_if_ring_is_full ),
+    unit_test( test_write_fails_if_record_is_too_large ),
+    unit_test( test_records_wrap_around ),
+    unit_test( test_attached_ring_shares_records ),
+    unit_test( test_attach_fails_if_memory_is_not_a_ring ),
+  };
+  return run_tests( tests );
+}
+
+
+/*
+ * Local variables:
+ * c-basic-offset: 2
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -33,13 +33,14 @@
  ********************************************************************************/
 
 extern hash_table *stats;
+extern uint64_t stat_values[];
 
 void create_stats_table();
 void delete_stats_table();
 
 typedef struct {
   char key[ STAT_KEY_LENGTH ];
-  uint64_t value;  
+  stat_counter counter;
 } stat_entry;
 
 
@@ -140,7 +141,7 @@ test_add_stat_entry_succeeds() {
   stat_entry *entry = lookup_hash_entry( stats, key );
   assert_string_equal( entry->key, key );
   uint64_t expected_value = 0;
-  assert_memory_equal( &entry->value, &expected_value, sizeof( uint64_t ) );
+  assert_memory_equal( &stat_values[ entry->counter ], &expected_value, sizeof( uint64_t ) );
 
   assert_true( finalize_stat() );
 }
@@ -158,6 +159,92 @@ test_add_stat_entry_fails_with_duplicated_key() {
 }
 
 
+static void
+test_add_stat_entry_fails_if_too_many_entries() {
+  assert_true( init_stat() );
+
+  char key[ STAT_KEY_LENGTH ];
+  for ( int i = 0; i < STAT_MAX_COUNTERS; i++ ) {
+    snprintf( key, sizeof( key ), "key%d", i );
+    assert_true( add_stat_entry( key ) );
+  }
+  assert_false( add_stat_entry( "one too many" ) );
+  assert_int_equal( register_stat_counter( "one too many" ), STAT_COUNTER_INVALID );
+
+  assert_true( finalize_stat() );
+}
+
+
+/********************************************************************************
+ * register_stat_counter() tests.
+ ********************************************************************************/
+
+static void
+test_register_stat_counter_returns_same_counter_for_same_key() {
+  assert_true( init_stat() );
+
+  stat_counter counter = register_stat_counter( "key" );
+  assert_true( counter != STAT_COUNTER_INVALID );
+  assert_int_equal( register_stat_counter( "key" ), counter );
+  assert_true( register_stat_counter( "another key" ) != counter );
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_register_stat_counter_returns_counter_of_added_entry() {
+  assert_true( init_stat() );
+
+  assert_true( add_stat_entry( "key" ) );
+  stat_counter counter = register_stat_counter( "key" );
+
+  stat_entry *entry = lookup_hash_entry( stats, "key" );
+  assert_int_equal( counter, entry->counter );
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_register_stat_counter_fails_if_not_initialized() {
+  expect_assert_failure( register_stat_counter( "key" ) );
+}
+
+
+/********************************************************************************
+ * increment_stat_counter() tests.
+ ********************************************************************************/
+
+static void
+test_increment_stat_counter_succeeds() {
+  assert_true( init_stat() );
+
+  stat_counter counter = register_stat_counter( "key" );
+  increment_stat_counter( counter );
+  increment_stat_counter( counter );
+  increment_stat( "key" );
+
+  uint64_t expected_value = 3;
+  assert_memory_equal( &stat_values[ counter ], &expected_value, sizeof( uint64_t ) );
+
+  assert_true( finalize_stat() );
+}
+
+
+static void
+test_increment_stat_counter_ignores_invalid_counter() {
+  assert_true( init_stat() );
+
+  increment_stat_counter( STAT_COUNTER_INVALID );
+
+  uint64_t expected_value = 0;
+  assert_memory_equal( &stat_values[ STAT_COUNTER_INVALID ], &expected_value, sizeof( uint64_t ) );
+
+  assert_true( finalize_stat() );
+}
+
+
 /********************************************************************************
  * increment_stat() tests.
  ********************************************************************************/
@@ -173,7 +260,7 @@ test_increment_stat_succeeds_with_defined_key() {
   stat_entry *entry = lookup_hash_entry( stats, key );
   assert_string_equal( entry->key, key );
   uint64_t expected_value = 1;
-  assert_memory_equal( &entry->value, &expected_value, sizeof( uint64_t ) );
+  assert_memory_equal( &stat_values[ entry->counter ], &expected_value, sizeof( uint64_t ) );
 
   assert_true( finalize_stat() );
 }
@@ -189,7 +276,7 @@ test_increment_stat_succeeds_with_undefined_key() {
   stat_entry *entry = lookup_hash_entry( stats, key );
   assert_string_equal( entry->key, key );
   uint64_t expected_value = 1;
-  assert_memory_equal( &entry->value, &expected_value, sizeof( uint64_t ) );
+  assert_memory_equal( &stat_values[ entry->counter ], &expected_value, sizeof( uint64_t ) );
 
   assert_true( finalize_stat() );
 }
@@ -267,6 +354,16 @@ main() {
     // add_stat_entry() tests.
     unit_test_setup_teardown( test_add_stat_entry_succeeds, reset, reset ),
     unit_test_setup_teardown( test_add_stat_entry_fails_with_duplicated_key, reset, reset ),
+    unit_test_setup_teardown( test_add_stat_entry_fails_if_too_many_entries, reset, reset ),
+
+    // register_stat_counter() tests.
+    unit_test_setup_teardown( test_register_stat_counter_returns_same_counter_for_same_key, reset, reset ),
+    unit_test_setup_teardown( test_register_stat_counter_returns_counter_of_added_entry, reset, reset ),
+    unit_test_setup_teardown( test_register_stat_counter_fails_if_not_initialized, reset, reset ),
+
+    // increment_stat_counter() tests.
+    unit_test_setup_teardown( test_increment_stat_counter_succeeds, reset, reset ),
+    unit_test_setup_teardown( test_increment_stat_counter_ignores_invalid_counter, reset, reset ),
 
     // increment_stat() tests.
     unit_test_setup_teardown( test_increment_stat_succeeds_with_defined_key, reset, reset ),
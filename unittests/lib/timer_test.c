@@ -27,7 +27,6 @@
 #include <sys/stat.h>
 #include "checks.h"
 #include "cmockery_trema.h"
-#include "doubly_linked_list.h"
 #include "timer.h"
 
 
@@ -41,21 +40,26 @@ typedef struct timer_callback {
   struct timespec expires_at;
   struct timespec interval;
   void *user_data;
+  size_t index;
 } timer_callback;
 
 
-extern dlist_element *timer_callbacks;
+extern timer_callback **timer_heap;
+extern size_t timer_heap_size;
 
 
 /********************************************************************************
  * Mocks.
  ********************************************************************************/
 
+static struct timespec mock_now = { 1000, 0 };
+
+
 int
 mock_clock_gettime( clockid_t clk_id, struct timespec *tp ) {
   UNUSED( clk_id );
-  UNUSED( tp );
 
+  *tp = mock_now;
   return ( int ) mock();
 }
 
@@ -80,20 +84,26 @@ mock_debug( const char *format, ... ) {
 
 static timer_callback *
 find_timer_callback( void ( *callback )( void *user_data ) ) {
-  dlist_element *e;
-  timer_callback *cb;
-
-  cb = NULL;
-  for ( e = timer_callbacks->next; e; e = e->next ) {
-    cb = e->data;
-    if ( cb->function == callback ) {
-      return cb;
+  size_t i;
+
+  for ( i = 0; i < timer_heap_size; i++ ) {
+    if ( timer_heap[ i ]->function == callback ) {
+      return timer_heap[ i ];
     }
   }
   return NULL;
 }
 
 
+static void
+set_interval( struct itimerspec *interval, time_t value_sec, time_t interval_sec ) {
+  interval->it_value.tv_sec = value_sec;
+  interval->it_value.tv_nsec = 0;
+  interval->it_interval.tv_sec = interval_sec;
+  interval->it_interval.tv_nsec = 0;
+}
+
+
 /********************************************************************************
  * Tests
  ********************************************************************************/
@@ -190,6 +200,188 @@ test_clock_gettime_fail_einval() {
 }
 
 
+static void
+callback_record_order( void *user_data ) {
+  check_expected( user_data );
+}
+
+
+static void
+test_timer_events_are_executed_in_expiry_order() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  mock_now.tv_sec = 1000;
+
+  char first[] = "first", second[] = "second", third[] = "third";
+  struct itimerspec interval;
+  set_interval( &interval, 3, 0 );
+  assert_true( add_timer_event( &interval, callback_record_order, third ) != NULL );
+  set_interval( &interval, 1, 0 );
+  assert_true( add_timer_event( &interval, callback_record_order, first ) != NULL );
+  set_interval( &interval, 2, 0 );
+  assert_true( add_timer_event( &interval, callback_record_order, second ) != NULL );
+
+  mock_now.tv_sec = 1002;
+  expect_string( callback_record_order, user_data, "first" );
+  expect_string( callback_record_order, user_data, "second" );
+  execute_timer_events();
+  assert_int_equal( ( int ) timer_heap_size, 1 );
+
+  mock_now.tv_sec = 1010;
+  expect_string( callback_record_order, user_data, "third" );
+  execute_timer_events();
+  assert_int_equal( ( int ) timer_heap_size, 0 );
+
+  finalize_timer();
+}
+
+
+static void
+test_delete_timer_event_by_handle() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  mock_now.tv_sec = 1000;
+
+  struct itimerspec interval;
+  set_interval( &interval, 1, 1 );
+  timer_event_handle handle1 = add_timer_event( &interval, mock_timer_event_callback, NULL );
+  timer_event_handle handle2 = add_timer_event( &interval, mock_timer_event_callback, NULL );
+  assert_true( handle1 != NULL );
+  assert_true( handle2 != NULL );
+
+  assert_true( delete_timer_event( handle1 ) );
+  assert_int_equal( ( int ) timer_heap_size, 1 );
+  assert_true( timer_heap[ 0 ] == handle2 );
+
+  assert_true( delete_timer_event( handle2 ) );
+  assert_int_equal( ( int ) timer_heap_size, 0 );
+
+  finalize_timer();
+}
+
+
+static timer_event_handle one_shot_handle = NULL;
+
+
+static void
+callback_delete_own_handle( void *user_data ) {
+  UNUSED( user_data );
+
+  assert_true( delete_timer_event( one_shot_handle ) );
+  one_shot_handle = NULL;
+}
+
+
+static void
+test_one_shot_timer_event_is_released_once_fired() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  mock_now.tv_sec = 1000;
+
+  struct itimerspec interval;
+  set_interval( &interval, 1, 0 );
+  assert_true( add_timer_event( &interval, mock_timer_event_callback, NULL ) != NULL );
+  one_shot_handle = add_timer_event( &interval, callback_delete_own_handle, NULL );
+  assert_true( one_shot_handle != NULL );
+  assert_int_equal( ( int ) timer_heap_size, 2 );
+
+  mock_now.tv_sec = 1001;
+  execute_timer_events();
+  assert_int_equal( ( int ) timer_heap_size, 0 );
+  assert_true( one_shot_handle == NULL );
+
+  finalize_timer();
+}
+
+
+static void
+test_get_next_timer_event_timeout() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  mock_now.tv_sec = 1000;
+  mock_now.tv_nsec = 0;
+
+  struct timespec timeout;
+  assert_false( get_next_timer_event_timeout( &timeout ) );
+
+  struct itimerspec interval;
+  set_interval( &interval, 5, 0 );
+  assert_true( add_timer_event( &interval, mock_timer_event_callback, NULL ) != NULL );
+  set_interval( &interval, 2, 0 );
+  assert_true( add_timer_event( &interval, mock_timer_event_callback, NULL ) != NULL );
+
+  mock_now.tv_nsec = 500000000;
+  assert_true( get_next_timer_event_timeout( &timeout ) );
+  assert_int_equal( timeout.tv_sec, 1 );
+  assert_int_equal( timeout.tv_nsec, 500000000 );
+
+  mock_now.tv_sec = 1003;
+  assert_true( get_next_timer_event_timeout( &timeout ) );
+  assert_int_equal( timeout.tv_sec, 0 );
+  assert_int_equal( timeout.tv_nsec, 0 );
+
+  mock_now.tv_nsec = 0;
+  finalize_timer();
+}
+
+
+static void
+callback_delete_itself( void *user_data ) {
+  UNUSED( user_data );
+
+  assert_true( delete_timer_event_callback( callback_delete_itself ) );
+}
+
+
+static void
+test_periodic_event_callback_can_delete_itself() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  mock_now.tv_sec = 1000;
+
+  assert_true( add_periodic_event_callback( 1, callback_delete_itself, NULL ) );
+
+  mock_now.tv_sec = 1001;
+  execute_timer_events();
+  assert_true( find_timer_callback( callback_delete_itself ) == NULL );
+
+  finalize_timer();
+}
+
+
+static void
+test_periodic_event_is_rescheduled() {
+  init_timer();
+
+  will_return_count( mock_clock_gettime, 0, -1 );
+  mock_now.tv_sec = 1000;
+
+  char user_data[] = "tick";
+  assert_true( add_periodic_event_callback( 2, callback_record_order, user_data ) );
+
+  mock_now.tv_sec = 1002;
+  expect_string( callback_record_order, user_data, "tick" );
+  execute_timer_events();
+
+  timer_callback *callback = find_timer_callback( callback_record_order );
+  assert_true( callback != NULL );
+  assert_int_equal( callback->expires_at.tv_sec, 1004 );
+
+  // Missed ticks are skipped instead of being run in a burst.
+  mock_now.tv_sec = 1011;
+  expect_string( callback_record_order, user_data, "tick" );
+  execute_timer_events();
+  assert_int_equal( callback->expires_at.tv_sec, 1013 );
+
+  finalize_timer();
+}
+
+
 /********************************************************************************
  * Run tests.
  ********************************************************************************/
@@ -202,6 +394,12 @@ main() {
     unit_test( test_add_timer_event_callback_fail_with_invalid_timespec ),
     unit_test( test_nonexistent_timer_event_callback ),
     unit_test( test_clock_gettime_fail_einval ),
+    unit_test( test_timer_events_are_executed_in_expiry_order ),
+    unit_test( test_delete_timer_event_by_handle ),
+    unit_test( test_one_shot_timer_event_is_released_once_fired ),
+    unit_test( test_get_next_timer_event_timeout ),
+    unit_test( test_periodic_event_callback_can_delete_itself ),
+    unit_test( test_periodic_event_is_rescheduled ),
   };
   return run_tests( tests );
 }
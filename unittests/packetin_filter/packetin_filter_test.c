@@ -28,10 +28,7 @@
 #include "match_table.h"
 
 void usage();
-void handle_packet_in( uint64_t datapath_id, uint32_t transaction_id,
-  uint32_t buffer_id, uint16_t total_len,
-  uint16_t in_port, uint8_t reason, const buffer *data,
-  void *user_data );
+void handle_message( uint16_t tag, void *data, size_t length );
 void register_dl_type_filter( uint16_t dl_type, uint16_t priority,
   const char *service_name, const char *entry_name );
 void register_any_filter( uint16_t priority, const char *service_name,
@@ -105,22 +102,23 @@ mock_set_match_from_packet( struct ofp_match *match, const uint16_t in_port,
 }
 
 
-buffer *
-mock_create_packet_in( const uint32_t transaction_id, const uint32_t buffer_id,
-  const uint16_t total_len, uint16_t in_port,
-  const uint8_t reason, /* const */ buffer *data ) {
-  uint32_t total_len32 = total_len;
-  uint32_t in_port32 = in_port;
-  uint32_t reason32 = reason;
+void
+mock_warn( const char *format, ... ) {
+  UNUSED( format );
+}
 
-  check_expected( transaction_id );
-  check_expected( buffer_id );
-  check_expected( total_len32 );
-  check_expected( in_port32 );
-  check_expected( reason32 );
-  check_expected( data );
 
-  return ( buffer * ) mock();
+bool
+mock_parse_packet( buffer *buf ) {
+  check_expected( buf );
+
+  return ( bool ) mock();
+}
+
+
+void
+mock_free_packet( buffer *buf ) {
+  free_buffer( buf );
 }
 
 
@@ -171,14 +169,21 @@ mock_init_trema( int *argc, char ***argv ) {
 
 
 bool
-mock_set_packet_in_handler( packet_in_handler callback, void *user_data ) {
-  UNUSED( callback );
-  UNUSED( user_data );
+mock_add_message_received_callback( const char *service_name,
+  void ( *callback )( uint16_t tag, void *data, size_t len ) ) {
+  check_expected( service_name );
+  check_expected( callback );
 
   return ( bool ) mock();
 }
 
 
+const char *
+mock_get_trema_name( void ) {
+  return "packetin_filter";
+}
+
+
 void
 mock_start_trema( void ) {
   ( void ) mock();
@@ -191,6 +196,37 @@ mock_get_executable_name( void ) {
 }
 
 
+/*************************************************************************
+ * Helpers.
+ *************************************************************************/
+
+#define FRAME_LENGTH 64
+
+typedef struct {
+  openflow_service_header_t header;
+  uint8_t body[ offsetof( struct ofp_packet_in, data ) + FRAME_LENGTH ];
+} __attribute__( ( packed ) ) packet_in_message;
+
+
+static size_t
+build_packet_in_message( packet_in_message *message, uint8_t type, size_t frame_length ) {
+  memset( message, 0, sizeof( packet_in_message ) );
+  message->header.datapath_id = htonll( 0x101 );
+  message->header.service_name_length = htons( 0 );
+
+  struct ofp_packet_in *packet_in = ( struct ofp_packet_in * ) message->body;
+  size_t length = offsetof( struct ofp_packet_in, data ) + frame_length;
+  packet_in->header.version = OFP_VERSION;
+  packet_in->header.type = type;
+  packet_in->header.length = htons( ( uint16_t ) length );
+  packet_in->header.xid = htonl( 1234 );
+  packet_in->in_port = htons( 1 );
+  memset( packet_in->data, 0xff, frame_length );
+
+  return sizeof( openflow_service_header_t ) + length;
+}
+
+
 /*************************************************************************
  * Test functions.
  *************************************************************************/
@@ -208,26 +244,20 @@ test_usage() {
 
 
 static void
-test_handle_packet_in_successed() {
+test_handle_message_forwards_original_message() {
   setup();
 
-  uint64_t datapath_id = 0x101;
-  uint32_t transaction_id = 1234;
-  uint32_t buffer_id = 0;
-  uint32_t total_len32 = 0;
-  uint32_t in_port32 = 1;
-  uint32_t reason32 = 0;
-  buffer *data;
-  void *user_data = NULL;
-
+  packet_in_message message;
+  size_t length = build_packet_in_message( &message, OFPT_PACKET_IN, FRAME_LENGTH );
   match_entry match_entry;
-  buffer *buf;
 
-  data = alloc_buffer();
+  expect_not_value( mock_parse_packet, buf, NULL );
+  will_return( mock_parse_packet, true );
+
   expect_not_value( mock_set_match_from_packet, match, NULL );
-  expect_value( mock_set_match_from_packet, in_port32, in_port32 );
+  expect_value( mock_set_match_from_packet, in_port32, 1 );
   expect_value( mock_set_match_from_packet, wildcards, 0 );
-  expect_value( mock_set_match_from_packet, packet, data );
+  expect_not_value( mock_set_match_from_packet, packet, NULL );
   will_return_void( mock_set_match_from_packet );
 
   memset( &match_entry, 0, sizeof( match_entry ) );
@@ -236,84 +266,58 @@ test_handle_packet_in_successed() {
   expect_not_value( mock_lookup_match_entry, match, NULL );
   will_return( mock_lookup_match_entry, &match_entry );
 
-  buf = alloc_buffer();
-  expect_value( mock_create_packet_in, transaction_id, transaction_id );
-  expect_value( mock_create_packet_in, buffer_id, buffer_id );
-  expect_value( mock_create_packet_in, total_len32, total_len32 );
-  expect_value( mock_create_packet_in, in_port32, in_port32 );
-  expect_value( mock_create_packet_in, reason32, reason32 );
-  expect_value( mock_create_packet_in, data, data );
-  will_return( mock_create_packet_in, buf );
-
-  expect_value( mock_send_message, service_name, match_entry.service_name );
+  expect_string( mock_send_message, service_name, match_entry.service_name );
   expect_value( mock_send_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
-  expect_not_value( mock_send_message, data, NULL );
-  expect_not_value( mock_send_message, len, 0 );
+  expect_value( mock_send_message, data, &message );
+  expect_value( mock_send_message, len, length );
   will_return( mock_send_message, true );
 
-  handle_packet_in( datapath_id, transaction_id, buffer_id, ( uint16_t ) total_len32,
-    ( uint16_t ) in_port32, ( uint8_t ) reason32, data, user_data );
-
-  free_buffer( data );
+  handle_message( MESSENGER_OPENFLOW_MESSAGE, &message, length );
 
   teardown();
 }
 
 
 static void
-test_handle_packet_in_lookup_failed() {
+test_handle_message_lookup_failed() {
   setup();
 
-  uint64_t datapath_id = 0x101;
-  uint32_t transaction_id = 1234;
-  uint32_t buffer_id = 0;
-  uint16_t total_len = 0;
-  uint32_t in_port32 = 1;
-  uint8_t reason = 0;
-  buffer *data;
-  void *user_data = NULL;
+  packet_in_message message;
+  size_t length = build_packet_in_message( &message, OFPT_PACKET_IN, FRAME_LENGTH );
 
-  data = alloc_buffer();
+  expect_not_value( mock_parse_packet, buf, NULL );
+  will_return( mock_parse_packet, true );
 
   expect_not_value( mock_set_match_from_packet, match, NULL );
-  expect_value( mock_set_match_from_packet, in_port32, in_port32 );
+  expect_value( mock_set_match_from_packet, in_port32, 1 );
   expect_value( mock_set_match_from_packet, wildcards, 0 );
-  expect_value( mock_set_match_from_packet, packet, data );
+  expect_not_value( mock_set_match_from_packet, packet, NULL );
   will_return_void( mock_set_match_from_packet );
 
   expect_not_value( mock_lookup_match_entry, match, NULL );
   will_return( mock_lookup_match_entry, NULL );
 
-  handle_packet_in( datapath_id, transaction_id, buffer_id, total_len,
-    ( uint16_t ) in_port32, reason, data, user_data );
-
-  free_buffer( data );
+  handle_message( MESSENGER_OPENFLOW_MESSAGE, &message, length );
 
   teardown();
 }
 
 
 static void
-test_handle_packet_in_send_failed() {
+test_handle_message_send_failed() {
   setup();
 
-  uint64_t datapath_id = 0x101;
-  uint32_t transaction_id = 1234;
-  uint32_t buffer_id = 0;
-  uint32_t total_len32 = 0;
-  uint32_t in_port32 = 1;
-  uint32_t reason32 = 0;
-  buffer *data;
-  void *user_data = NULL;
-
+  packet_in_message message;
+  size_t length = build_packet_in_message( &message, OFPT_PACKET_IN, FRAME_LENGTH );
   match_entry match_entry;
-  buffer *buf;
 
-  data = alloc_buffer();
+  expect_not_value( mock_parse_packet, buf, NULL );
+  will_return( mock_parse_packet, true );
+
   expect_not_value( mock_set_match_from_packet, match, NULL );
-  expect_value( mock_set_match_from_packet, in_port32, in_port32 );
+  expect_value( mock_set_match_from_packet, in_port32, 1 );
   expect_value( mock_set_match_from_packet, wildcards, 0 );
-  expect_value( mock_set_match_from_packet, packet, data );
+  expect_not_value( mock_set_match_from_packet, packet, NULL );
   will_return_void( mock_set_match_from_packet );
 
   memset( &match_entry, 0, sizeof( match_entry ) );
@@ -322,28 +326,62 @@ test_handle_packet_in_send_failed() {
   expect_not_value( mock_lookup_match_entry, match, NULL );
   will_return( mock_lookup_match_entry, &match_entry );
 
-  buf = alloc_buffer();
-  expect_value( mock_create_packet_in, transaction_id, transaction_id );
-  expect_value( mock_create_packet_in, buffer_id, buffer_id );
-  expect_value( mock_create_packet_in, total_len32, total_len32 );
-  expect_value( mock_create_packet_in, in_port32, in_port32 );
-  expect_value( mock_create_packet_in, reason32, reason32 );
-  expect_value( mock_create_packet_in, data, data );
-  will_return( mock_create_packet_in, buf );
-
   expect_string( mock_send_message, service_name, match_entry.service_name );
   expect_value( mock_send_message, tag32, MESSENGER_OPENFLOW_MESSAGE );
-  expect_not_value( mock_send_message, data, NULL );
-  expect_not_value( mock_send_message, len, 0 );
+  expect_value( mock_send_message, data, &message );
+  expect_value( mock_send_message, len, length );
   will_return( mock_send_message, false );
 
   expect_string( mock_error, buffer, "Failed to send a message to service_name ( entry_name = entry_name, match = wildcards = 0, in_port = 1, dl_src = 00:00:00:00:00:00, dl_dst = 00:00:00:00:00:00, dl_vlan = 0, dl_vlan_pcp = 0, dl_type = 0, nw_tos = 0, nw_proto = 0, nw_src = 0.0.0.0, nw_dst = 0.0.0.0, tp_src = 0, tp_dst = 0 )." );
   will_return_void( mock_error );
 
-  handle_packet_in( datapath_id, transaction_id, buffer_id, ( uint16_t ) total_len32,
-                    ( uint16_t ) in_port32, ( uint8_t ) reason32, data, user_data );
+  handle_message( MESSENGER_OPENFLOW_MESSAGE, &message, length );
+
+  teardown();
+}
+
+
+static void
+test_handle_message_drops_packet_in_without_frame() {
+  setup();
+
+  packet_in_message message;
+  size_t length = build_packet_in_message( &message, OFPT_PACKET_IN, 0 );
+
+  handle_message( MESSENGER_OPENFLOW_MESSAGE, &message, length );
+
+  teardown();
+}
+
+
+static void
+test_handle_message_ignores_other_messages() {
+  setup();
+
+  packet_in_message message;
+  size_t length = build_packet_in_message( &message, OFPT_PORT_STATUS, FRAME_LENGTH );
+
+  handle_message( MESSENGER_OPENFLOW_MESSAGE, &message, length );
+  handle_message( MESSENGER_OPENFLOW_READY, &message, length );
+
+  teardown();
+}
+
+
+static void
+test_handle_message_parse_failed() {
+  setup();
+
+  packet_in_message message;
+  size_t length = build_packet_in_message( &message, OFPT_PACKET_IN, FRAME_LENGTH );
+
+  expect_not_value( mock_parse_packet, buf, NULL );
+  will_return( mock_parse_packet, false );
+
+  expect_string( mock_error, buffer, "Failed to parse a packet." );
+  will_return_void( mock_error );
 
-  free_buffer( data );
+  handle_message( MESSENGER_OPENFLOW_MESSAGE, &message, length );
 
   teardown();
 }
@@ -412,7 +450,9 @@ test_packetin_filter_main_successed() {
   will_return_void( mock_insert_match_entry );
 
   will_return_void( mock_init_trema );
-  will_return( mock_set_packet_in_handler, true );
+  expect_string( mock_add_message_received_callback, service_name, "packetin_filter" );
+  expect_value( mock_add_message_received_callback, callback, handle_message );
+  will_return( mock_add_message_received_callback, true );
   will_return_void( mock_start_trema );
 
   optind = 1;
@@ -456,9 +496,12 @@ int
 main() {
   const UnitTest tests[] = {
     unit_test( test_usage ),
-    unit_test( test_handle_packet_in_successed ),
-    unit_test( test_handle_packet_in_lookup_failed ),
-    unit_test( test_handle_packet_in_send_failed ),
+    unit_test( test_handle_message_forwards_original_message ),
+    unit_test( test_handle_message_lookup_failed ),
+    unit_test( test_handle_message_send_failed ),
+    unit_test( test_handle_message_drops_packet_in_without_frame ),
+    unit_test( test_handle_message_ignores_other_messages ),
+    unit_test( test_handle_message_parse_failed ),
     unit_test( test_register_dl_type_filter ),
     unit_test( test_register_any_filter ),
     unit_test( test_packetin_filter_main_successed ),
@@ -36,8 +36,7 @@ extern struct listener_info listener_info;
 
 void usage();
 void handle_sigchld( int signum );
-void secure_channel_fd_set( fd_set *read_set, fd_set *write_set );
-void secure_channel_fd_isset( fd_set *read_set, fd_set *write_set );
+void secure_channel_read( int fd, void *data );
 char *absolute_path( const char *dir, const char *file );
 int switch_manager_main( int argc, char *argv[] );
 void wait_child( void );
@@ -122,18 +121,23 @@ mock_init_trema( int *argc, char ***argv ) {
   ( void ) mock();
 }
 
-void
-mock_set_fd_set_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
-  UNUSED( callback );
+bool
+mock_set_fd_handler( int fd, event_fd_callback read_callback, void *read_data, event_fd_callback write_callback, void *write_data ) {
+  UNUSED( fd );
+  UNUSED( read_callback );
+  UNUSED( read_data );
+  UNUSED( write_callback );
+  UNUSED( write_data );
 
-  ( void ) mock();
+  return ( bool ) mock();
 }
 
-void
-mock_set_check_fd_isset_callback( void ( *callback )( fd_set *read_set, fd_set *write_set ) ) {
-  UNUSED( callback );
+bool
+mock_set_readable( int fd, bool state ) {
+  UNUSED( fd );
+  UNUSED( state );
 
-  ( void ) mock();
+  return ( bool ) mock();
 }
 
 bool
@@ -445,73 +449,14 @@ test_wait_child_wait3_signaled() {
 
 
 static void
-test_secure_channel_fd_set_succeeded() {
-  setup();
-
-  fd_set read_set, write_set;
-
-  listener_info.listen_fd = 1;
-  FD_ZERO( &read_set );
-  FD_ZERO( &write_set );
-  secure_channel_fd_set( &read_set, &write_set );
-
-  assert_true( FD_ISSET( listener_info.listen_fd, &read_set ) );
-  FD_CLR( listener_info.listen_fd, &read_set );
-  assert_true( FD_ISZERO( &read_set ) );
-  assert_true( FD_ISZERO( &write_set ) );
-
-  teardown();
-}
-
-
-static void
-test_secure_channel_fd_set_failed() {
-  setup();
-
-  fd_set read_set, write_set;
-
-  listener_info.listen_fd = -1;
-  FD_ZERO( &read_set );
-  FD_ZERO( &write_set );
-  secure_channel_fd_set( &read_set, &write_set );
-
-  assert_true( FD_ISZERO( &read_set ) );
-  assert_true( FD_ISZERO( &write_set ) );
-
-  teardown();
-}
-
-
-static void
-test_secure_channel_fd_isset_succeeded() {
+test_secure_channel_read_accepts() {
   setup();
 
-  fd_set read_set, write_set;
-
   expect_value( mock_secure_channel_accept, listener_info, &listener_info );
   will_return_void( mock_secure_channel_accept );
 
   listener_info.listen_fd = 1;
-  FD_ZERO( &read_set );
-  FD_ZERO( &write_set );
-  FD_SET( listener_info.listen_fd, &read_set );
-  secure_channel_fd_isset( &read_set, &write_set );
-
-  teardown();
-}
-
-
-static void
-test_secure_channel_fd_isset_failed() {
-  setup();
-
-  fd_set read_set, write_set;
-
-  listener_info.listen_fd = -1;
-  FD_ZERO( &read_set );
-  FD_ZERO( &write_set );
-  FD_SET( 1, &read_set );
-  secure_channel_fd_isset( &read_set, &write_set );
+  secure_channel_read( listener_info.listen_fd, &listener_info );
 
   teardown();
 }
@@ -598,10 +543,9 @@ test_switch_manager_main_succeeded() {
   will_return_void( mock_init_trema );
   will_return( mock_access, 0 );
 
-  will_return_void( mock_set_fd_set_callback );
-  will_return_void( mock_set_check_fd_isset_callback );
-
   will_return( mock_secure_channel_listen_start, true );
+  will_return( mock_set_fd_handler, true );
+  will_return( mock_set_readable, true );
   will_return( mock_get_trema_home, strdup( "/tmp" ) );
   will_return_void( mock_start_trema );
 
@@ -630,10 +574,9 @@ test_switch_manager_main_and_port_option_succeeded() {
   will_return_void( mock_init_trema );
   will_return( mock_access, 0 );
 
-  will_return_void( mock_set_fd_set_callback );
-  will_return_void( mock_set_check_fd_isset_callback );
-
   will_return( mock_secure_channel_listen_start, true );
+  will_return( mock_set_fd_handler, true );
+  will_return( mock_set_readable, true );
   will_return( mock_get_trema_home, strdup( "/tmp" ) );
   will_return_void( mock_start_trema );
 
@@ -737,9 +680,6 @@ test_switch_manager_main_secure_channel_listen_start_failed() {
   will_return( mock_get_trema_home, strdup( "/tmp" ) );
   will_return( mock_access, 0 );
 
-  will_return_void( mock_set_fd_set_callback );
-  will_return_void( mock_set_check_fd_isset_callback );
-
   will_return( mock_secure_channel_listen_start, false );
 
   optind = 1;
@@ -1141,10 +1081,7 @@ main() {
     unit_test( test_wait_child_wait3_exit ),
     unit_test( test_wait_child_wait3_coredump ),
     unit_test( test_wait_child_wait3_signaled ),
-    unit_test( test_secure_channel_fd_set_succeeded ),
-    unit_test( test_secure_channel_fd_set_failed ),
-    unit_test( test_secure_channel_fd_isset_succeeded ),
-    unit_test( test_secure_channel_fd_isset_failed ),
+    unit_test( test_secure_channel_read_accepts ),
     unit_test( test_absolute_path_absolute ),
     unit_test( test_absolute_path_access_failed ),
     unit_test( test_absolute_path_relative ),